@@ -0,0 +1,20 @@
+#ifndef ALLOCATION_COUNTER_H
+#define ALLOCATION_COUNTER_H
+
+#include <benchmark/benchmark.h>
+
+// Counts what goes through the replaceable global operator new while
+// Google Benchmark's memory run of a benchmark is in progress, from every
+// thread, including the engine's shared library. Results show up as
+// allocs_per_iter, max_bytes_used, total_allocated_bytes and
+// net_heap_growth. Over-aligned allocations are counted too.
+class AllocationCounter : public benchmark::MemoryManager {
+public:
+    void Start() override;
+    void Stop(Result& result) override;
+
+    // Older releases still declare this form pure virtual.
+    void Stop(Result* result);
+};
+
+#endif
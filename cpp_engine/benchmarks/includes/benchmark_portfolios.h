@@ -0,0 +1,152 @@
+#ifndef BENCHMARK_PORTFOLIOS_H
+#define BENCHMARK_PORTFOLIOS_H
+
+#include "Instrument.h"
+#include "MarketData.h"
+#include "Portfolio.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// Seeded generators of option books and market data for the benchmarks.
+// Uniforms are taken straight from std::mt19937, whose output the
+// standard fixes, rather than through the library's distributions, so
+// every platform benchmarks the same inputs.
+
+class SeededDraws {
+public:
+    explicit SeededDraws(uint32_t seed) : engine_(seed) {}
+
+    // In (0, 1).
+    double uniform() {
+        return (static_cast<double>(engine_()) + 0.5) / 4294967296.0;
+    }
+
+    double between(double lo, double hi) {
+        return lo + (hi - lo) * uniform();
+    }
+
+    size_t below(size_t n) {
+        return static_cast<size_t>(uniform() * static_cast<double>(n));
+    }
+
+private:
+    std::mt19937 engine_;
+};
+
+// Listed expiries from a week to two years, in years.
+inline const std::vector<double>& listedExpiries() {
+    static const std::vector<double> expiries = {
+        7.0 / 365.0, 30.0 / 365.0, 91.0 / 365.0, 182.0 / 365.0, 1.0, 2.0
+    };
+    return expiries;
+}
+
+// Strikes within two standard deviations of spot at a 35% vol, widening
+// with expiry as listed strikes do, on a whole-dollar grid so books drawn
+// on the same assets share contracts the way real ones do.
+inline double listedStrike(SeededDraws& draws, double spot, double expiry) {
+    const double moneyness = std::exp(0.35 * std::sqrt(expiry) * draws.between(-2.0, 2.0));
+    return std::max(1.0, std::round(spot * moneyness));
+}
+
+struct ContractSample {
+    double spot;
+    double strike;
+    double rate;
+    double expiry;
+    double volatility;
+    bool is_call;
+};
+
+inline std::vector<ContractSample> makeContracts(size_t count, uint32_t seed) {
+    SeededDraws draws(seed);
+    std::vector<ContractSample> contracts(count);
+    for (ContractSample& contract : contracts) {
+        contract.spot = draws.between(20.0, 500.0);
+        contract.expiry = listedExpiries()[draws.below(listedExpiries().size())];
+        contract.strike = listedStrike(draws, contract.spot, contract.expiry);
+        contract.rate = draws.between(0.01, 0.05);
+        contract.volatility = draws.between(0.15, 0.6);
+        contract.is_call = draws.uniform() < 0.5;
+    }
+    return contracts;
+}
+
+inline std::string benchmarkAssetId(size_t index) {
+    char id[32];
+    std::snprintf(id, sizeof(id), "SYM%04zu", index);
+    return id;
+}
+
+inline std::map<std::string, MarketData> makeMarket(size_t assets, uint32_t seed) {
+    SeededDraws draws(seed);
+    std::map<std::string, MarketData> market;
+    for (size_t a = 0; a < assets; ++a) {
+        MarketData md;
+        md.asset_id = benchmarkAssetId(a);
+        md.spot_price = draws.between(20.0, 500.0);
+        md.risk_free_rate = draws.between(0.01, 0.05);
+        md.volatility = draws.between(0.15, 0.6);
+        md.dividend_yield = draws.between(0.0, 0.03);
+        market[md.asset_id] = md;
+    }
+    return market;
+}
+
+struct BookSpec {
+    size_t lines = 100;
+    size_t assets = 10;
+    double american_share = 0.0;  // AmericanOption on a binomial lattice
+    double jump_share = 0.0;      // EuropeanOption under Merton jump diffusion
+    int binomial_steps = 100;
+    // When non-zero, every line is one of this many fixed contracts, the
+    // same whatever the seed, so books made from different seeds overlap
+    // like the sub-books of one desk. Otherwise each line is drawn afresh.
+    size_t universe = 0;
+    uint32_t seed = 1;
+};
+
+// Lines on the first spec.assets assets of market, which must hold them.
+inline Portfolio makeBook(const BookSpec& spec, const std::map<std::string, MarketData>& market) {
+    SeededDraws draws(spec.seed);
+    Portfolio book;
+    book.reserve(spec.lines);
+    for (size_t i = 0; i < spec.lines; ++i) {
+        int quantity = static_cast<int>(draws.below(100)) - 50;
+        if (quantity == 0) {
+            quantity = 1;
+        }
+        SeededDraws universe_draws(static_cast<uint32_t>(spec.universe ? draws.below(spec.universe) : 0) + 1);
+        SeededDraws& terms = spec.universe ? universe_draws : draws;
+
+        const std::string asset_id = benchmarkAssetId(terms.below(spec.assets));
+        const double spot = market.at(asset_id).spot_price;
+        const double expiry = listedExpiries()[terms.below(listedExpiries().size())];
+        const double strike = listedStrike(terms, spot, expiry);
+        const OptionType type = terms.uniform() < 0.5 ? OptionType::Call : OptionType::Put;
+        const double model = terms.uniform();
+        if (model < spec.american_share) {
+            book.addInstrument(
+                std::make_unique<AmericanOption>(type, strike, expiry, asset_id, spec.binomial_steps),
+                quantity);
+        } else if (model < spec.american_share + spec.jump_share) {
+            auto option = std::make_unique<EuropeanOption>(
+                type, strike, expiry, asset_id, PricingModel::MertonJumpDiffusion);
+            option->setJumpParameters(0.5, -0.05, 0.15);
+            book.addInstrument(std::move(option), quantity);
+        } else {
+            book.addInstrument(std::make_unique<EuropeanOption>(type, strike, expiry, asset_id), quantity);
+        }
+    }
+    return book;
+}
+
+#endif
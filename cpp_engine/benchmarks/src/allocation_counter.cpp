@@ -0,0 +1,173 @@
+#include "allocation_counter.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Every block carries its size in front of it, so frees can be counted
+// against the peak.
+constexpr size_t kHeader = alignof(std::max_align_t);
+
+std::atomic<bool> counting{false};
+std::atomic<int64_t> allocations{0};
+std::atomic<int64_t> allocated_bytes{0};
+std::atomic<int64_t> live_bytes{0};
+std::atomic<int64_t> peak_bytes{0};
+
+void count(size_t size) {
+    if (!counting.load(std::memory_order_relaxed)) {
+        return;
+    }
+    const int64_t bytes = static_cast<int64_t>(size);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    const int64_t live = live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    int64_t peak = peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+// Over-aligned blocks get a header as large as their alignment, so the
+// pointer handed out keeps it; the size sits just in front of it either way.
+size_t headerFor(size_t alignment) {
+    return std::max(kHeader, alignment);
+}
+
+void* allocate(size_t size, size_t alignment = kHeader) {
+    const size_t header = headerFor(alignment);
+    void* block = alignment <= kHeader
+        ? std::malloc(size + header)
+        : std::aligned_alloc(alignment, (size + header + alignment - 1) / alignment * alignment);
+    if (!block) {
+        return nullptr;
+    }
+    char* p = static_cast<char*>(block) + header;
+    reinterpret_cast<size_t*>(p)[-1] = size;
+    count(size);
+    return p;
+}
+
+void* allocateOrThrow(size_t size, size_t alignment = kHeader) {
+    void* p = allocate(size, alignment);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void release(void* p, size_t alignment = kHeader) {
+    if (!p) {
+        return;
+    }
+    if (counting.load(std::memory_order_relaxed)) {
+        live_bytes.fetch_sub(static_cast<int64_t>(reinterpret_cast<size_t*>(p)[-1]),
+                             std::memory_order_relaxed);
+    }
+    std::free(static_cast<char*>(p) - headerFor(alignment));
+}
+
+}
+
+void AllocationCounter::Start() {
+    allocations = 0;
+    allocated_bytes = 0;
+    live_bytes = 0;
+    peak_bytes = 0;
+    counting = true;
+}
+
+void AllocationCounter::Stop(Result& result) {
+    counting = false;
+    result.num_allocs = allocations;
+    result.max_bytes_used = peak_bytes;
+    result.total_allocated_bytes = allocated_bytes;
+    result.net_heap_growth = live_bytes;
+}
+
+void AllocationCounter::Stop(Result* result) {
+    Stop(*result);
+}
+
+void* operator new(size_t size) {
+    return allocateOrThrow(size);
+}
+
+void* operator new[](size_t size) {
+    return allocateOrThrow(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p) noexcept {
+    release(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    release(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    release(p);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return allocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* p, std::align_val_t alignment) noexcept {
+    release(p, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* p, std::align_val_t alignment) noexcept {
+    release(p, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept {
+    release(p, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept {
+    release(p, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    release(p, static_cast<size_t>(alignment));
+}
+
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    release(p, static_cast<size_t>(alignment));
+}
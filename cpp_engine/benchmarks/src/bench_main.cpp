@@ -0,0 +1,18 @@
+#include "allocation_counter.h"
+#include <benchmark/benchmark.h>
+
+// Same as benchmark_main, plus allocation counts for every benchmark.
+// Pass --benchmark_out=<file> --benchmark_out_format=json to keep the
+// results for comparison.
+int main(int argc, char** argv) {
+    AllocationCounter allocation_counter;
+    benchmark::RegisterMemoryManager(&allocation_counter);
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::RegisterMemoryManager(nullptr);
+    benchmark::Shutdown();
+    return 0;
+}
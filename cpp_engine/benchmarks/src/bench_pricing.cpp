@@ -0,0 +1,155 @@
+#include "benchmark_portfolios.h"
+#include "BinomialTree.h"
+#include "BlackScholes.h"
+#include "BlackScholesBatch.h"
+#include "ImpliedVolatilitySurface.h"
+#include "JumpDiffusion.h"
+#include <benchmark/benchmark.h>
+#include <vector>
+
+// Single-contract pricers over a fixed, seeded spread of contracts, so
+// the figures do not flatter one lucky set of inputs. options_per_second
+// is the throughput to compare across releases.
+
+namespace {
+
+void setOptionsRate(benchmark::State& state, size_t options_per_iteration) {
+    state.counters["options_per_second"] = benchmark::Counter(
+        static_cast<double>(state.iterations() * options_per_iteration), benchmark::Counter::kIsRate);
+}
+
+void BM_BlackScholesCallPrice(benchmark::State& state) {
+    const std::vector<ContractSample> contracts = makeContracts(1024, 11);
+    for (auto _ : state) {
+        for (const ContractSample& c : contracts) {
+            benchmark::DoNotOptimize(BlackScholes::callPrice(c.spot, c.strike, c.rate, c.expiry, c.volatility));
+        }
+    }
+    setOptionsRate(state, contracts.size());
+}
+BENCHMARK(BM_BlackScholesCallPrice);
+
+// The vectorized kernel behind the risk engine's European groups, for
+// comparison with the scalar pricer above. The second argument selects a
+// mixed call/put batch (0) or the all-calls kernel the engine runs on a
+// homogeneous group (1).
+void BM_BlackScholesBatchPrice(benchmark::State& state) {
+    const std::vector<ContractSample> contracts = makeContracts(static_cast<size_t>(state.range(0)), 11);
+    std::vector<double> spot, strike, rate, expiry, volatility, price(contracts.size());
+    std::vector<uint8_t> is_call;
+    for (const ContractSample& c : contracts) {
+        spot.push_back(c.spot);
+        strike.push_back(c.strike);
+        rate.push_back(c.rate);
+        expiry.push_back(c.expiry);
+        volatility.push_back(c.volatility);
+        is_call.push_back(c.is_call);
+    }
+    BlackScholes::BatchInputs inputs;
+    inputs.spot = spot.data();
+    inputs.strike = strike.data();
+    inputs.rate = rate.data();
+    inputs.expiry = expiry.data();
+    inputs.volatility = volatility.data();
+    inputs.is_call = is_call.data();
+    inputs.size = contracts.size();
+    if (state.range(1)) {
+        inputs.types = BlackScholes::BatchOptionTypes::Calls;
+    }
+    BlackScholes::BatchOutputs outputs;
+    outputs.price = price.data();
+
+    for (auto _ : state) {
+        BlackScholes::priceBatchUnchecked(inputs, outputs);
+        benchmark::DoNotOptimize(price.data());
+        benchmark::ClobberMemory();
+    }
+    setOptionsRate(state, contracts.size());
+}
+BENCHMARK(BM_BlackScholesBatchPrice)->ArgsProduct({{1024, 65536}, {0, 1}});
+
+void BM_BinomialAmericanPrice(benchmark::State& state) {
+    const int steps = static_cast<int>(state.range(0));
+    const LatticeScheme scheme = state.range(1) ? LatticeScheme::LeisenReimer : LatticeScheme::CoxRossRubinstein;
+    const std::vector<ContractSample> contracts = makeContracts(64, 12);
+    for (auto _ : state) {
+        for (const ContractSample& c : contracts) {
+            benchmark::DoNotOptimize(BinomialTree::americanOptionPrice(
+                c.spot, c.strike, c.rate, c.expiry, c.volatility,
+                c.is_call ? OptionType::Call : OptionType::Put, steps, scheme));
+        }
+    }
+    setOptionsRate(state, contracts.size());
+}
+BENCHMARK(BM_BinomialAmericanPrice)
+    ->ArgNames({"steps", "leisen_reimer"})
+    ->ArgsProduct({{25, 50, 100, 200, 500, 1000}, {0, 1}});
+
+void BM_MertonOptionPrice(benchmark::State& state) {
+    const int max_jumps = static_cast<int>(state.range(0));
+    const std::vector<ContractSample> contracts = makeContracts(256, 13);
+    for (auto _ : state) {
+        for (const ContractSample& c : contracts) {
+            benchmark::DoNotOptimize(JumpDiffusion::mertonOptionPrice(
+                c.spot, c.strike, c.rate, c.expiry, c.volatility,
+                c.is_call ? OptionType::Call : OptionType::Put, 0.5, -0.05, 0.15, max_jumps));
+        }
+    }
+    setOptionsRate(state, contracts.size());
+}
+BENCHMARK(BM_MertonOptionPrice)->ArgName("max_jumps")->Arg(10)->Arg(50);
+
+// A listed-style surface: every expiry slice quotes 25 strikes from 60%
+// to 140% of a 100 spot with a downward skew.
+VolatilitySurface::ImpliedVolSurface makeSurface() {
+    VolatilitySurface::ImpliedVolSurface surface;
+    std::vector<VolatilitySurface::VolPoint> points;
+    for (double expiry : {7.0 / 365.0, 30.0 / 365.0, 61.0 / 365.0, 91.0 / 365.0, 0.25, 0.5,
+                          0.75, 1.0, 1.5, 2.0, 3.0, 5.0}) {
+        for (int k = 0; k < 25; ++k) {
+            const double strike = 60.0 + 80.0 * k / 24.0;
+            points.push_back({strike, expiry, 0.2 + 0.15 * (100.0 - strike) / 100.0 + 0.02 / std::sqrt(expiry)});
+        }
+    }
+    surface.addPoints(points);
+    return surface;
+}
+
+void BM_VolSurfaceInterpolate(benchmark::State& state) {
+    const VolatilitySurface::ImpliedVolSurface surface = makeSurface();
+    SeededDraws draws(14);
+    std::vector<double> strikes(1024), expiries(1024);
+    for (size_t i = 0; i < strikes.size(); ++i) {
+        strikes[i] = draws.between(50.0, 150.0);
+        expiries[i] = draws.between(1.0 / 365.0, 6.0);
+    }
+    for (auto _ : state) {
+        for (size_t i = 0; i < strikes.size(); ++i) {
+            benchmark::DoNotOptimize(surface.interpolate(strikes[i], expiries[i]));
+        }
+    }
+    state.counters["lookups_per_second"] = benchmark::Counter(
+        static_cast<double>(state.iterations() * strikes.size()), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_VolSurfaceInterpolate);
+
+// Batched lookups grouped by expiry, as the risk engine makes them.
+void BM_VolSurfaceInterpolateBatch(benchmark::State& state) {
+    const VolatilitySurface::ImpliedVolSurface surface = makeSurface();
+    SeededDraws draws(14);
+    std::vector<double> strikes(1024), expiries(1024), vols(1024);
+    for (size_t i = 0; i < strikes.size(); ++i) {
+        strikes[i] = draws.between(50.0, 150.0);
+        expiries[i] = listedExpiries()[i * listedExpiries().size() / strikes.size()];
+    }
+    for (auto _ : state) {
+        surface.interpolate(strikes.data(), expiries.data(), vols.data(), strikes.size());
+        benchmark::DoNotOptimize(vols.data());
+        benchmark::ClobberMemory();
+    }
+    state.counters["lookups_per_second"] = benchmark::Counter(
+        static_cast<double>(state.iterations() * strikes.size()), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_VolSurfaceInterpolateBatch);
+
+}
@@ -0,0 +1,152 @@
+#include "benchmark_portfolios.h"
+#include "RiskEngine.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <vector>
+
+// End-to-end risk runs on seeded books. Every run uses a fixed seed, so
+// each iteration does exactly the same work. paths_per_second counts
+// scenarios, line_paths_per_second scenarios times portfolio lines, both
+// against wall-clock time since the runs are multithreaded.
+
+namespace {
+
+void setPathRates(benchmark::State& state, size_t paths, size_t lines) {
+    const double runs = static_cast<double>(state.iterations());
+    state.counters["paths_per_second"] = benchmark::Counter(
+        runs * static_cast<double>(paths), benchmark::Counter::kIsRate);
+    state.counters["line_paths_per_second"] = benchmark::Counter(
+        runs * static_cast<double>(paths * lines), benchmark::Counter::kIsRate);
+}
+
+RiskEngine makeEngine(int paths, int threads, VaRMethod method) {
+    RiskEngine engine(paths);
+    engine.setRandomSeed(42);
+    engine.setNumThreads(threads);
+    engine.setVaRMethod(method);
+    return engine;
+}
+
+// One asset for every ten lines, up to 50.
+size_t assetsFor(size_t lines) {
+    return std::min<size_t>(50, std::max<size_t>(1, lines / 10));
+}
+
+void runPortfolioRisk(benchmark::State& state, const BookSpec& spec, VaRMethod method) {
+    const int paths = static_cast<int>(state.range(1));
+    const int threads = static_cast<int>(state.range(2));
+    const auto market = makeMarket(spec.assets, 7);
+    const Portfolio book = makeBook(spec, market);
+    RiskEngine engine = makeEngine(paths, threads, method);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(engine.calculatePortfolioRisk(book, market));
+    }
+    setPathRates(state, static_cast<size_t>(paths), spec.lines);
+}
+
+// Black-Scholes Europeans, fully revalued.
+void BM_PortfolioRisk(benchmark::State& state) {
+    BookSpec spec;
+    spec.lines = static_cast<size_t>(state.range(0));
+    spec.assets = assetsFor(spec.lines);
+    runPortfolioRisk(state, spec, VaRMethod::FullRevaluation);
+}
+BENCHMARK(BM_PortfolioRisk)
+    ->ArgNames({"lines", "paths", "threads"})
+    ->ArgsProduct({{10, 100, 1000}, {1000, 10000}, {1}})
+    ->Args({1000, 10000, 4})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// A tenth of the lines American on 50-step lattices and a tenth under
+// Merton jump diffusion, fully revalued.
+void BM_PortfolioRiskMixed(benchmark::State& state) {
+    BookSpec spec;
+    spec.lines = static_cast<size_t>(state.range(0));
+    spec.assets = assetsFor(spec.lines);
+    spec.american_share = 0.1;
+    spec.jump_share = 0.1;
+    spec.binomial_steps = 50;
+    runPortfolioRisk(state, spec, VaRMethod::FullRevaluation);
+}
+BENCHMARK(BM_PortfolioRiskMixed)
+    ->ArgNames({"lines", "paths", "threads"})
+    ->ArgsProduct({{10, 100}, {1000}, {1}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// The same mixed book through the delta-gamma approximation.
+void BM_PortfolioRiskDeltaGamma(benchmark::State& state) {
+    BookSpec spec;
+    spec.lines = static_cast<size_t>(state.range(0));
+    spec.assets = assetsFor(spec.lines);
+    spec.american_share = 0.1;
+    spec.jump_share = 0.1;
+    spec.binomial_steps = 50;
+    runPortfolioRisk(state, spec, VaRMethod::DeltaGamma);
+}
+BENCHMARK(BM_PortfolioRiskDeltaGamma)
+    ->ArgNames({"lines", "paths", "threads"})
+    ->ArgsProduct({{100, 1000}, {10000, 100000}, {1}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Books of 50 lines out of the same 400 contracts on 20 assets, so they
+// overlap as the sub-books of one desk do: one batch run against a loop
+// of single-book runs.
+std::vector<Portfolio> makeBooks(size_t count, const std::map<std::string, MarketData>& market) {
+    std::vector<Portfolio> books;
+    for (size_t b = 0; b < count; ++b) {
+        BookSpec spec;
+        spec.lines = 50;
+        spec.assets = 20;
+        spec.universe = 400;
+        spec.seed = static_cast<uint32_t>(100 + b);
+        books.push_back(makeBook(spec, market));
+    }
+    return books;
+}
+
+void BM_BatchRisk(benchmark::State& state) {
+    const int paths = static_cast<int>(state.range(1));
+    const auto market = makeMarket(20, 7);
+    const std::vector<Portfolio> books = makeBooks(static_cast<size_t>(state.range(0)), market);
+    std::vector<const Portfolio*> book_ptrs;
+    for (const Portfolio& book : books) {
+        book_ptrs.push_back(&book);
+    }
+    RiskEngine engine = makeEngine(paths, 1, VaRMethod::FullRevaluation);
+    size_t distinct_lines = 0;
+    for (auto _ : state) {
+        const BatchRiskResult result = engine.calculateBatchRisk(book_ptrs, market);
+        distinct_lines = result.distinct_lines;
+        benchmark::DoNotOptimize(result.total.value_at_risk_99);
+    }
+    setPathRates(state, static_cast<size_t>(paths), books.size() * 50);
+    state.counters["distinct_lines"] = static_cast<double>(distinct_lines);
+}
+BENCHMARK(BM_BatchRisk)
+    ->ArgNames({"books", "paths"})
+    ->ArgsProduct({{10, 50}, {2000}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+void BM_BatchRiskLoop(benchmark::State& state) {
+    const int paths = static_cast<int>(state.range(1));
+    const auto market = makeMarket(20, 7);
+    const std::vector<Portfolio> books = makeBooks(static_cast<size_t>(state.range(0)), market);
+    RiskEngine engine = makeEngine(paths, 1, VaRMethod::FullRevaluation);
+    for (auto _ : state) {
+        for (const Portfolio& book : books) {
+            benchmark::DoNotOptimize(engine.calculatePortfolioRisk(book, market));
+        }
+    }
+    setPathRates(state, static_cast<size_t>(paths), books.size() * 50);
+}
+BENCHMARK(BM_BatchRiskLoop)
+    ->ArgNames({"books", "paths"})
+    ->ArgsProduct({{10, 50}, {2000}})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+}
@@ -1,20 +1,134 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
 #include <pybind11/stl.h>
 #include <pybind11/stl_bind.h>
 
+#include "BinomialTree.h"
+#include "BlackScholesBatch.h"
+#include "CorrelationModel.h"
+#include "PnLSink.h"
+#include "ReturnsStore.h"
+#include "ImpliedVolatilityBatch.h"
+#include "ImpliedVolatilitySurface.h"
 #include "Instrument.h"
 #include "Portfolio.h"
+#include "PortfolioRegistry.h"
+#include "PricingCache.h"
 #include "RiskEngine.h"
+#include "RiskJobQueue.h"
+#include "RunControl.h"
+#include "RunStats.h"
 #include "MarketData.h"
 
+#include <algorithm>
+#include <chrono>
 #include <memory>
+#include <stdexcept>
+#include <string>
 
 namespace py = pybind11;
 
+namespace {
+
+// Inputs are read in place when they already are C-contiguous arrays of
+// the right dtype, and converted once otherwise.
+template <typename T>
+using InputArray = py::array_t<T, py::array::c_style | py::array::forcecast>;
+
+template <typename T>
+const T* inputData(const InputArray<T> &array, size_t n, const char *name)
+{
+    if (static_cast<size_t>(array.size()) != n) {
+        throw std::invalid_argument(std::string(name) + " must have " + std::to_string(n) + " elements");
+    }
+    return array.data();
+}
+
+// Outputs are written in place, so they must already be writeable,
+// C-contiguous arrays of the right dtype and length. None skips the output.
+template <typename T>
+T* outputData(const py::object &out, size_t n, const char *name)
+{
+    if (out.is_none()) {
+        return nullptr;
+    }
+    if (!py::isinstance<py::array_t<T>>(out)) {
+        throw std::invalid_argument(std::string(name) + " must be a NumPy array of dtype " +
+                                    std::string(py::str(py::dtype::of<T>())));
+    }
+    auto array = py::reinterpret_borrow<py::array_t<T>>(out);
+    if (!(array.flags() & py::array::c_style)) {
+        throw std::invalid_argument(std::string(name) + " must be C-contiguous");
+    }
+    if (static_cast<size_t>(array.size()) != n) {
+        throw std::invalid_argument(std::string(name) + " must have " + std::to_string(n) + " elements");
+    }
+    return array.mutable_data();
+}
+
+BlackScholes::BatchInputs batchInputs(
+    const InputArray<double> &spot, const InputArray<double> &strike,
+    const InputArray<double> &rate, const InputArray<double> &expiry,
+    const InputArray<double> &volatility, const InputArray<uint8_t> &is_call)
+{
+    BlackScholes::BatchInputs inputs;
+    inputs.size = static_cast<size_t>(spot.size());
+    inputs.spot = spot.data();
+    inputs.strike = inputData(strike, inputs.size, "strike");
+    inputs.rate = inputData(rate, inputs.size, "rate");
+    inputs.expiry = inputData(expiry, inputs.size, "expiry");
+    inputs.volatility = inputData(volatility, inputs.size, "volatility");
+    inputs.is_call = inputData(is_call, inputs.size, "is_call");
+    return inputs;
+}
+
+// Row-major copy of a list of equal-length rows.
+std::vector<double> flattenRows(const std::vector<std::vector<double>> &rows, size_t columns,
+                                const char *name)
+{
+    std::vector<double> flat;
+    flat.reserve(rows.size() * columns);
+    for (const std::vector<double> &row : rows) {
+        if (row.size() != columns) {
+            throw std::invalid_argument(std::string(name) + " rows must all have " +
+                                        std::to_string(columns) + " entries");
+        }
+        flat.insert(flat.end(), row.begin(), row.end());
+    }
+    return flat;
+}
+
+OptionLineArrays optionLineArrays(
+    const InputArray<uint8_t> &is_call, const InputArray<double> &strike,
+    const InputArray<double> &expiry, const InputArray<int> &quantity,
+    const InputArray<uint32_t> &asset_index, const py::object &is_american,
+    InputArray<uint8_t> &american_storage)
+{
+    OptionLineArrays lines;
+    lines.size = static_cast<size_t>(is_call.size());
+    lines.is_call = is_call.data();
+    lines.strike = inputData(strike, lines.size, "strike");
+    lines.expiry = inputData(expiry, lines.size, "expiry");
+    lines.quantity = inputData(quantity, lines.size, "quantity");
+    lines.asset_index = inputData(asset_index, lines.size, "asset_index");
+    if (!is_american.is_none()) {
+        american_storage = InputArray<uint8_t>::ensure(is_american);
+        if (!american_storage) {
+            throw std::invalid_argument("is_american must be convertible to a uint8 array");
+        }
+        lines.is_american = inputData(american_storage, lines.size, "is_american");
+    }
+    return lines;
+}
+
+}
+
 PYBIND11_MODULE(quant_risk_engine, m)
 {
     m.doc() = "Python bindings for the Quant Enthusiasts Risk Engine";
 
+    py::register_exception<RiskRunCancelled>(m, "RiskRunCancelled", PyExc_RuntimeError);
+
     py::enum_<OptionType>(m, "OptionType")
         .value("Call", OptionType::Call)
         .value("Put", OptionType::Put)
@@ -26,6 +140,46 @@ PYBIND11_MODULE(quant_risk_engine, m)
         .value("MertonJumpDiffusion", PricingModel::MertonJumpDiffusion)
         .export_values();
 
+    py::enum_<LatticeScheme>(m, "LatticeScheme")
+        .value("CoxRossRubinstein", LatticeScheme::CoxRossRubinstein)
+        .value("LeisenReimer", LatticeScheme::LeisenReimer)
+        .export_values();
+
+    py::class_<VolatilitySurface::VolPoint>(m, "VolPoint")
+        .def(py::init<>())
+        .def(py::init([](double strike, double expiry, double implied_vol) {
+                 return VolatilitySurface::VolPoint{strike, expiry, implied_vol};
+             }),
+             py::arg("strike"), py::arg("expiry"), py::arg("implied_vol"))
+        .def_readwrite("strike", &VolatilitySurface::VolPoint::strike)
+        .def_readwrite("expiry", &VolatilitySurface::VolPoint::expiry)
+        .def_readwrite("implied_vol", &VolatilitySurface::VolPoint::implied_vol);
+
+    py::class_<VolatilitySurface::ImpliedVolSurface,
+               std::shared_ptr<VolatilitySurface::ImpliedVolSurface>>(m, "VolSurface")
+        .def(py::init<>())
+        .def("add_point", &VolatilitySurface::ImpliedVolSurface::addPoint,
+             py::arg("strike"), py::arg("expiry"), py::arg("implied_vol"))
+        .def("add_points", &VolatilitySurface::ImpliedVolSurface::addPoints, py::arg("points"))
+        .def("build", &VolatilitySurface::ImpliedVolSurface::build)
+        .def("is_built", &VolatilitySurface::ImpliedVolSurface::isBuilt)
+        .def("interpolate",
+             py::overload_cast<double, double>(
+                 &VolatilitySurface::ImpliedVolSurface::interpolate, py::const_),
+             py::arg("strike"), py::arg("expiry"))
+        .def("interpolate",
+             py::overload_cast<const std::vector<double>&, const std::vector<double>&>(
+                 &VolatilitySurface::ImpliedVolSurface::interpolate, py::const_),
+             py::arg("strikes"), py::arg("expiries"))
+        .def("skew", &VolatilitySurface::ImpliedVolSurface::skew, py::arg("expiry"))
+        .def("term_structure", &VolatilitySurface::ImpliedVolSurface::termStructure,
+             py::arg("strike"))
+        .def("get_points", &VolatilitySurface::ImpliedVolSurface::getPoints)
+        .def("clear", &VolatilitySurface::ImpliedVolSurface::clear)
+        .def("revision", &VolatilitySurface::ImpliedVolSurface::revision)
+        .def("size", &VolatilitySurface::ImpliedVolSurface::size)
+        .def("__len__", &VolatilitySurface::ImpliedVolSurface::size);
+
     py::class_<MarketData>(m, "MarketData")
         .def(py::init<>())
         .def(py::init<std::string, double, double, double>(),
@@ -37,6 +191,14 @@ PYBIND11_MODULE(quant_risk_engine, m)
         .def_readwrite("risk_free_rate", &MarketData::risk_free_rate)
         .def_readwrite("volatility", &MarketData::volatility)
         .def_readwrite("dividend_yield", &MarketData::dividend_yield)
+        .def_property("vol_surface",
+             [](const MarketData &md) {
+                 return std::const_pointer_cast<VolatilitySurface::ImpliedVolSurface>(md.vol_surface);
+             },
+             [](MarketData &md, std::shared_ptr<VolatilitySurface::ImpliedVolSurface> surface) {
+                 md.vol_surface = std::move(surface);
+             })
+        .def("volatility_for", &MarketData::volatilityFor, py::arg("strike"), py::arg("expiry"))
         .def("validate", &MarketData::validate)
         .def("is_valid", &MarketData::isValid);
 
@@ -55,14 +217,28 @@ PYBIND11_MODULE(quant_risk_engine, m)
         .def("clear", &MarketDataManager::clear)
         .def("size", &MarketDataManager::size)
         .def("get_all_market_data", &MarketDataManager::getAllMarketData)
+        .def("get_handle", &MarketDataManager::getHandle, py::arg("asset_id"))
+        .def("get_market_data_by_handle", &MarketDataManager::getMarketDataByHandle,
+             py::arg("handle"), py::return_value_policy::copy)
         .def("__len__", &MarketDataManager::size);
 
+    py::class_<Greeks>(m, "Greeks")
+        .def(py::init<>())
+        .def_readwrite("price", &Greeks::price)
+        .def_readwrite("delta", &Greeks::delta)
+        .def_readwrite("gamma", &Greeks::gamma)
+        .def_readwrite("vega", &Greeks::vega)
+        .def_readwrite("theta", &Greeks::theta);
+
+    // Pricing calls release the GIL: lattice and jump-diffusion models can
+    // take a while, and they never touch Python objects.
     py::class_<Instrument, std::shared_ptr<Instrument>>(m, "Instrument")
-        .def("price", &Instrument::price)
-        .def("delta", &Instrument::delta)
-        .def("gamma", &Instrument::gamma)
-        .def("vega", &Instrument::vega)
-        .def("theta", &Instrument::theta)
+        .def("price", &Instrument::price, py::call_guard<py::gil_scoped_release>())
+        .def("delta", &Instrument::delta, py::call_guard<py::gil_scoped_release>())
+        .def("gamma", &Instrument::gamma, py::call_guard<py::gil_scoped_release>())
+        .def("vega", &Instrument::vega, py::call_guard<py::gil_scoped_release>())
+        .def("theta", &Instrument::theta, py::call_guard<py::gil_scoped_release>())
+        .def("compute_all", &Instrument::computeAll, py::call_guard<py::gil_scoped_release>())
         .def("get_asset_id", &Instrument::getAssetId)
         .def("get_instrument_type", &Instrument::getInstrumentType)
         .def("is_valid", &Instrument::isValid);
@@ -77,6 +253,8 @@ PYBIND11_MODULE(quant_risk_engine, m)
         .def("get_pricing_model", &EuropeanOption::getPricingModel)
         .def("set_binomial_steps", &EuropeanOption::setBinomialSteps)
         .def("get_binomial_steps", &EuropeanOption::getBinomialSteps)
+        .def("set_lattice_scheme", &EuropeanOption::setLatticeScheme)
+        .def("get_lattice_scheme", &EuropeanOption::getLatticeScheme)
         .def("set_jump_parameters", &EuropeanOption::setJumpParameters,
              py::arg("lambda"), py::arg("jump_mean"), py::arg("jump_vol"))
         .def("get_jump_intensity", &EuropeanOption::getJumpIntensity)
@@ -91,18 +269,45 @@ PYBIND11_MODULE(quant_risk_engine, m)
              py::arg("option_type"), py::arg("strike"), py::arg("expiry"),
              py::arg("asset_id"), py::arg("binomial_steps"))
         .def("set_binomial_steps", &AmericanOption::setBinomialSteps)
-        .def("get_binomial_steps", &AmericanOption::getBinomialSteps);
+        .def("get_binomial_steps", &AmericanOption::getBinomialSteps)
+        .def("set_lattice_scheme", &AmericanOption::setLatticeScheme)
+        .def("get_lattice_scheme", &AmericanOption::getLatticeScheme);
 
     py::class_<Portfolio>(m, "Portfolio")
         .def(py::init<>())
+        // The Python object keeps its own reference and may still be edited
+        // or added again, while the portfolio fixes each line's columns when
+        // it is added, so the line is a copy rather than a shared instrument.
         .def("add_instrument", [](Portfolio &p, EuropeanOption &instr, int quantity)
              {
             auto owned_instr = std::make_unique<EuropeanOption>(instr);
-            p.addInstrument(std::move(owned_instr), quantity); }, py::arg("instrument"), py::arg("quantity"))
+            p.addInstrument(std::move(owned_instr), quantity); }, py::arg("instrument"), py::arg("quantity"),
+             "Adds a copy of instrument. For many vanilla lines, add_option_arrays "
+             "builds them straight from arrays without a Python object or copy per line.")
         .def("add_instrument", [](Portfolio &p, AmericanOption &instr, int quantity)
              {
             auto owned_instr = std::make_unique<AmericanOption>(instr);
-            p.addInstrument(std::move(owned_instr), quantity); }, py::arg("instrument"), py::arg("quantity"))
+            p.addInstrument(std::move(owned_instr), quantity); }, py::arg("instrument"), py::arg("quantity"),
+             "Adds a copy of instrument. For many vanilla lines, add_option_arrays "
+             "builds them straight from arrays without a Python object or copy per line.")
+        .def("add_option_arrays",
+             [](Portfolio &p, const InputArray<uint8_t> &is_call, const InputArray<double> &strike,
+                const InputArray<double> &expiry, const InputArray<int> &quantity,
+                const InputArray<uint32_t> &asset_index, const std::vector<std::string> &asset_ids,
+                const py::object &is_american)
+             {
+            InputArray<uint8_t> american_storage;
+            const OptionLineArrays lines = optionLineArrays(
+                is_call, strike, expiry, quantity, asset_index, is_american, american_storage);
+            // Keeps the GIL: other Python threads may hold this portfolio,
+            // and appending prices nothing.
+            p.addOptionLines(lines, asset_ids); },
+             py::arg("is_call"), py::arg("strike"), py::arg("expiry"), py::arg("quantity"),
+             py::arg("asset_index"), py::arg("asset_ids"), py::arg("is_american") = py::none(),
+             "Appends one option line per array element, the fast path for bulk loads: "
+             "lines are built in place, with no Python object or copy per line. Options "
+             "use their default pricing model and steps; lines needing other settings go "
+             "through add_instrument. asset_index indexes asset_ids.")
         .def("size", &Portfolio::size)
         .def("empty", &Portfolio::empty)
         .def("clear", &Portfolio::clear)
@@ -114,6 +319,22 @@ PYBIND11_MODULE(quant_risk_engine, m)
         .def("__bool__", [](const Portfolio &p)
              { return !p.empty(); });
 
+    py::class_<TailMeasure>(m, "TailMeasure")
+        .def(py::init<>())
+        .def_readwrite("confidence", &TailMeasure::confidence)
+        .def_readwrite("value_at_risk", &TailMeasure::value_at_risk)
+        .def_readwrite("expected_shortfall", &TailMeasure::expected_shortfall);
+
+    py::class_<TailEstimate>(m, "TailEstimate")
+        .def(py::init<>())
+        .def_readwrite("confidence", &TailEstimate::confidence)
+        .def_readwrite("value_at_risk", &TailEstimate::value_at_risk)
+        .def_readwrite("var_lower", &TailEstimate::var_lower)
+        .def_readwrite("var_upper", &TailEstimate::var_upper)
+        .def_readwrite("expected_shortfall", &TailEstimate::expected_shortfall)
+        .def_readwrite("es_lower", &TailEstimate::es_lower)
+        .def_readwrite("es_upper", &TailEstimate::es_upper);
+
     py::class_<PortfolioRiskResult>(m, "PortfolioRiskResult")
         .def(py::init<>())
         .def_readwrite("total_pv", &PortfolioRiskResult::total_pv)
@@ -125,17 +346,566 @@ PYBIND11_MODULE(quant_risk_engine, m)
         .def_readwrite("value_at_risk_99", &PortfolioRiskResult::value_at_risk_99)
         .def_readwrite("expected_shortfall_95", &PortfolioRiskResult::expected_shortfall_95)
         .def_readwrite("expected_shortfall_99", &PortfolioRiskResult::expected_shortfall_99)
+        .def_readwrite("tail_measures", &PortfolioRiskResult::tail_measures)
         .def("is_valid", &PortfolioRiskResult::isValid)
         .def("reset", &PortfolioRiskResult::reset);
 
+    py::class_<BatchRiskResult>(m, "BatchRiskResult")
+        .def(py::init<>())
+        .def_readonly("books", &BatchRiskResult::books)
+        .def_readonly("total", &BatchRiskResult::total)
+        .def_readonly("distinct_lines", &BatchRiskResult::distinct_lines);
+
+    py::enum_<VaRMethod>(m, "VaRMethod")
+        .value("FullRevaluation", VaRMethod::FullRevaluation)
+        .value("DeltaGamma", VaRMethod::DeltaGamma)
+        .value("DeltaGammaVega", VaRMethod::DeltaGammaVega)
+        .export_values();
+
+    py::enum_<VolSurfaceDynamics>(m, "VolSurfaceDynamics")
+        .value("StickyStrike", VolSurfaceDynamics::StickyStrike)
+        .value("StickyMoneyness", VolSurfaceDynamics::StickyMoneyness)
+        .export_values();
+
+    py::class_<VaRApproximationReport>(m, "VaRApproximationReport")
+        .def(py::init<>())
+        .def_readonly("computed", &VaRApproximationReport::computed)
+        .def_readonly("validation_paths", &VaRApproximationReport::validation_paths)
+        .def_readonly("max_abs_pnl_error", &VaRApproximationReport::max_abs_pnl_error)
+        .def_readonly("rms_pnl_error", &VaRApproximationReport::rms_pnl_error)
+        .def_readonly("relative_rms_error", &VaRApproximationReport::relative_rms_error)
+        .def_readonly("full_var_95", &VaRApproximationReport::full_var_95)
+        .def_readonly("approx_var_95", &VaRApproximationReport::approx_var_95)
+        .def_readonly("full_var_99", &VaRApproximationReport::full_var_99)
+        .def_readonly("approx_var_99", &VaRApproximationReport::approx_var_99);
+
+    py::enum_<SamplingMethod>(m, "SamplingMethod")
+        .value("PseudoRandom", SamplingMethod::PseudoRandom)
+        .value("Antithetic", SamplingMethod::Antithetic)
+        .value("Sobol", SamplingMethod::Sobol)
+        .export_values();
+
+    py::class_<VaRSamplingReport>(m, "VaRSamplingReport")
+        .def(py::init<>())
+        .def_readonly("computed", &VaRSamplingReport::computed)
+        .def_readonly("sampling_method", &VaRSamplingReport::sampling_method)
+        .def_readonly("control_variate", &VaRSamplingReport::control_variate)
+        .def_readonly("historical", &VaRSamplingReport::historical)
+        .def_readonly("batches", &VaRSamplingReport::batches)
+        .def_readonly("var_95_standard_error", &VaRSamplingReport::var_95_standard_error)
+        .def_readonly("var_99_standard_error", &VaRSamplingReport::var_99_standard_error)
+        .def_readonly("es_95_standard_error", &VaRSamplingReport::es_95_standard_error)
+        .def_readonly("es_99_standard_error", &VaRSamplingReport::es_99_standard_error)
+        .def_readonly("standard_errors", &VaRSamplingReport::standard_errors);
+
+    py::class_<RiskContribution>(m, "RiskContribution")
+        .def(py::init<>())
+        .def_readonly("confidence", &RiskContribution::confidence)
+        .def_readonly("value_at_risk", &RiskContribution::value_at_risk)
+        .def_readonly("expected_shortfall", &RiskContribution::expected_shortfall)
+        .def_readonly("var_window_paths", &RiskContribution::var_window_paths)
+        .def_readonly("component_var", &RiskContribution::component_var)
+        .def_readonly("component_es", &RiskContribution::component_es)
+        .def_readonly("marginal_var", &RiskContribution::marginal_var)
+        .def_readonly("marginal_es", &RiskContribution::marginal_es);
+
+    py::class_<VaRContributionReport>(m, "VaRContributionReport")
+        .def(py::init<>())
+        .def_readonly("computed", &VaRContributionReport::computed)
+        .def_readonly("levels", &VaRContributionReport::levels);
+
+    py::class_<RunCounters>(m, "RunCounters")
+        .def(py::init<>())
+        .def_readonly("black_scholes_prices", &RunCounters::black_scholes_prices)
+        .def_readonly("lattice_prices", &RunCounters::lattice_prices)
+        .def_readonly("lattice_nodes", &RunCounters::lattice_nodes)
+        .def_readonly("merton_prices", &RunCounters::merton_prices)
+        .def_readonly("rng_draws", &RunCounters::rng_draws)
+        .def_readonly("scratch_allocations", &RunCounters::scratch_allocations)
+        .def_readonly("scratch_bytes", &RunCounters::scratch_bytes);
+
+    py::class_<RiskRunStats>(m, "RiskRunStats")
+        .def(py::init<>())
+        .def_readonly("collected", &RiskRunStats::collected)
+        .def_readonly("paths", &RiskRunStats::paths)
+        .def_readonly("validation_ms", &RiskRunStats::validation_ms)
+        .def_readonly("greeks_ms", &RiskRunStats::greeks_ms)
+        .def_readonly("base_value_ms", &RiskRunStats::base_value_ms)
+        .def_readonly("simulation_ms", &RiskRunStats::simulation_ms)
+        .def_readonly("tail_ms", &RiskRunStats::tail_ms)
+        .def_readonly("total_ms", &RiskRunStats::total_ms)
+        .def_readonly("arena_bytes", &RiskRunStats::arena_bytes)
+        .def_readonly("arena_heap_blocks", &RiskRunStats::arena_heap_blocks)
+        .def_readonly("counters", &RiskRunStats::counters);
+
+    // False when the engine was built without QE_RUN_STATS, in which case
+    // runs never report stats.
+    m.attr("run_stats_compiled") = RunStats::kCompiled;
+
+    py::class_<PricingCacheStats>(m, "PricingCacheStats")
+        .def_readonly("hits", &PricingCacheStats::hits)
+        .def_readonly("misses", &PricingCacheStats::misses)
+        .def_readonly("evictions", &PricingCacheStats::evictions)
+        .def_readonly("size", &PricingCacheStats::size);
+
+    py::class_<PricingCache, std::shared_ptr<PricingCache>>(m, "PricingCache")
+        .def(py::init<size_t, double>(),
+             py::arg("capacity") = 65536, py::arg("market_quantum") = 0.0)
+        .def("clear", &PricingCache::clear)
+        .def("reset_stats", &PricingCache::resetStats)
+        .def("stats", &PricingCache::stats)
+        .def("capacity", &PricingCache::capacity)
+        .def("market_quantum", &PricingCache::marketQuantum);
+
+    py::class_<CorrelationModel, std::shared_ptr<CorrelationModel>> correlation_model(m, "CorrelationModel");
+
+    py::enum_<CorrelationModel::MatrixType>(correlation_model, "MatrixType")
+        .value("Correlation", CorrelationModel::MatrixType::Correlation)
+        .value("Covariance", CorrelationModel::MatrixType::Covariance)
+        .export_values();
+
+    correlation_model
+        .def(py::init([](std::vector<std::string> asset_ids, const std::vector<std::vector<double>> &matrix,
+                         CorrelationModel::MatrixType type) {
+                 const size_t n = asset_ids.size();
+                 if (matrix.size() != n) {
+                     throw std::invalid_argument("Correlation matrix must have one row per asset");
+                 }
+                 return std::make_shared<CorrelationModel>(
+                     std::move(asset_ids), flattenRows(matrix, n, "Correlation matrix"), type);
+             }),
+             py::arg("asset_ids"), py::arg("matrix"),
+             py::arg("matrix_type") = CorrelationModel::MatrixType::Correlation)
+        .def_static("from_factor_loadings",
+             [](std::vector<std::string> asset_ids, const std::vector<std::vector<double>> &loadings) {
+                 if (loadings.size() != asset_ids.size()) {
+                     throw std::invalid_argument("Factor loadings must have one row per asset");
+                 }
+                 const size_t factors = loadings.empty() ? 0 : loadings.front().size();
+                 return std::make_shared<CorrelationModel>(
+                     std::move(asset_ids), flattenRows(loadings, factors, "Factor loadings"), factors);
+             },
+             py::arg("asset_ids"), py::arg("loadings"))
+        .def("size", &CorrelationModel::size)
+        .def("asset_ids", &CorrelationModel::assetIds)
+        .def("is_factor_model", &CorrelationModel::isFactorModel)
+        .def("factor_count", &CorrelationModel::factorCount)
+        .def("correlation", &CorrelationModel::correlation, py::arg("i"), py::arg("j"))
+        .def("factorizations", &CorrelationModel::factorizations);
+
+    py::class_<ReturnsStore, std::shared_ptr<ReturnsStore>> returns_store(m, "ReturnsStore");
+
+    py::enum_<ReturnsStore::ValueType>(returns_store, "ValueType")
+        .value("Float32", ReturnsStore::ValueType::Float32)
+        .value("Float64", ReturnsStore::ValueType::Float64)
+        .export_values();
+
+    returns_store
+        .def(py::init<const std::string &>(), py::arg("path"))
+        .def_static("write",
+             [](const std::string &path, const std::vector<std::string> &asset_ids,
+                const std::vector<int32_t> &dates, const std::vector<std::vector<double>> &returns,
+                ReturnsStore::ValueType type) {
+                 if (returns.size() != asset_ids.size()) {
+                     throw std::invalid_argument("Returns must have one row per asset");
+                 }
+                 ReturnsStore::write(path, asset_ids, dates,
+                                     flattenRows(returns, dates.size(), "Returns"), type);
+             },
+             py::arg("path"), py::arg("asset_ids"), py::arg("dates"), py::arg("returns"),
+             py::arg("value_type") = ReturnsStore::ValueType::Float32)
+        .def("path", &ReturnsStore::path)
+        .def("value_type", &ReturnsStore::valueType)
+        .def("asset_count", &ReturnsStore::assetCount)
+        .def("date_count", &ReturnsStore::dateCount)
+        .def("asset_id", &ReturnsStore::assetId, py::arg("asset"))
+        .def("has_asset", [](const ReturnsStore &store, const std::string &asset_id) {
+                 return store.findAsset(asset_id) != ReturnsStore::npos;
+             }, py::arg("asset_id"))
+        .def("date", &ReturnsStore::date, py::arg("day"))
+        .def("value", &ReturnsStore::value, py::arg("asset"), py::arg("day"));
+
+    py::class_<PnLSink, std::shared_ptr<PnLSink>>(m, "PnLSink")
+        .def("wants_asset_breakdown", &PnLSink::wantsAssetBreakdown);
+
+    py::class_<PnLFileSink, PnLSink, std::shared_ptr<PnLFileSink>>(m, "PnLFileSink")
+        .def(py::init<std::string, bool>(), py::arg("path"), py::arg("asset_breakdown") = false);
+
+    // Writes straight into a float64 array of shape (paths,), or (paths,
+    // 1 + assets) for the asset breakdown, which the sink keeps alive.
+    py::class_<PnLBufferSink, PnLSink, std::shared_ptr<PnLBufferSink>>(m, "PnLBufferSink")
+        .def(py::init([](const py::object &buffer) {
+                 if (!py::isinstance<py::array_t<double>>(buffer)) {
+                     throw std::invalid_argument("P&L buffer must be a NumPy array of dtype float64");
+                 }
+                 auto array = py::reinterpret_borrow<py::array_t<double>>(buffer);
+                 if (!(array.flags() & py::array::c_style) || (array.ndim() != 1 && array.ndim() != 2)) {
+                     throw std::invalid_argument("P&L buffer must be a C-contiguous 1-D or 2-D array");
+                 }
+                 const size_t columns = array.ndim() == 2 ? static_cast<size_t>(array.shape(1)) : 1;
+                 return std::make_shared<PnLBufferSink>(
+                     array.mutable_data(), static_cast<size_t>(array.shape(0)), columns);
+             }),
+             py::arg("buffer"), py::keep_alive<1, 2>());
+
+    // callback(first_path, pnl, asset_pnl) gets copies of each chunk, with
+    // asset_pnl None unless asset_breakdown is set. It runs on the engine's
+    // worker threads, holding the GIL for the call.
+    py::class_<PnLCallbackSink, PnLSink, std::shared_ptr<PnLCallbackSink>>(m, "PnLCallbackSink")
+        .def(py::init([](py::function callback, bool asset_breakdown) {
+                 std::shared_ptr<py::function> function(
+                     new py::function(std::move(callback)),
+                     [](py::function *f) {
+                         py::gil_scoped_acquire acquire;
+                         delete f;
+                     });
+                 return std::make_shared<PnLCallbackSink>(
+                     [function](const PnLChunk &chunk) {
+                         py::gil_scoped_acquire acquire;
+                         try {
+                             py::array_t<double> pnl(chunk.paths, chunk.pnl);
+                             py::object asset_pnl = py::none();
+                             if (chunk.asset_pnl) {
+                                 asset_pnl = py::array_t<double>(
+                                     {chunk.paths, chunk.assets}, chunk.asset_pnl);
+                             }
+                             (*function)(chunk.first_path, pnl, asset_pnl);
+                         } catch (py::error_already_set &e) {
+                             throw std::runtime_error(e.what());
+                         }
+                     },
+                     asset_breakdown);
+             }),
+             py::arg("callback"), py::arg("asset_breakdown") = false);
+
+    py::class_<RiskRunCache>(m, "RiskRunCache")
+        .def(py::init<>())
+        .def("clear", &RiskRunCache::clear)
+        .def("empty", &RiskRunCache::empty)
+        .def("last_repriced_assets", &RiskRunCache::lastRepricedAssets);
+
     py::class_<RiskEngine>(m, "RiskEngine")
         .def(py::init<>())
         .def(py::init<int>())
-        .def("calculate_portfolio_risk", &RiskEngine::calculatePortfolioRisk)
+        .def("calculate_portfolio_risk",
+             py::overload_cast<const Portfolio&, const std::map<std::string, MarketData>&>(
+                 &RiskEngine::calculatePortfolioRisk),
+             py::call_guard<py::gil_scoped_release>())
+        .def("calculate_portfolio_risk",
+             [](RiskEngine &engine, const Portfolio &portfolio, const MarketDataManager &manager)
+             { return engine.calculatePortfolioRisk(portfolio, manager.getSnapshot()); },
+             py::arg("portfolio"), py::arg("market_data"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("calculate_portfolio_risk",
+             [](RiskEngine &engine, const Portfolio &portfolio, const MarketDataManager &manager,
+                RiskRunCache &cache)
+             { return engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache); },
+             py::arg("portfolio"), py::arg("market_data"), py::arg("cache"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("calculate_batch_risk",
+             py::overload_cast<const std::vector<const Portfolio*>&, const std::map<std::string, MarketData>&>(
+                 &RiskEngine::calculateBatchRisk),
+             py::arg("books"), py::arg("market_data"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("calculate_batch_risk",
+             [](RiskEngine &engine, const std::vector<const Portfolio*> &books,
+                const MarketDataManager &manager)
+             { return engine.calculateBatchRisk(books, manager.getSnapshot()); },
+             py::arg("books"), py::arg("market_data"),
+             py::call_guard<py::gil_scoped_release>())
         .def("set_var_simulations", &RiskEngine::setVaRSimulations)
         .def("get_var_simulations", &RiskEngine::getVaRSimulations)
         .def("set_var_time_horizon_days", &RiskEngine::setVaRTimeHorizonDays)
         .def("get_var_time_horizon_days", &RiskEngine::getVaRTimeHorizonDays)
         .def("set_random_seed", &RiskEngine::setRandomSeed)
-        .def("set_use_fixed_seed", &RiskEngine::setUseFixedSeed);
+        .def("set_use_fixed_seed", &RiskEngine::setUseFixedSeed)
+        .def("set_num_threads", &RiskEngine::setNumThreads, py::arg("threads"))
+        .def("get_num_threads", &RiskEngine::getNumThreads)
+        .def("set_var_method", &RiskEngine::setVaRMethod, py::arg("method"))
+        .def("get_var_method", &RiskEngine::getVaRMethod)
+        .def("set_vol_of_vol", &RiskEngine::setVolOfVol, py::arg("vol_of_vol"))
+        .def("get_vol_of_vol", &RiskEngine::getVolOfVol)
+        .def("set_vol_surface_dynamics", &RiskEngine::setVolSurfaceDynamics, py::arg("dynamics"))
+        .def("get_vol_surface_dynamics", &RiskEngine::getVolSurfaceDynamics)
+        .def("set_approximation_check_paths", &RiskEngine::setApproximationCheckPaths, py::arg("paths"))
+        .def("get_approximation_check_paths", &RiskEngine::getApproximationCheckPaths)
+        .def("set_confidence_levels", &RiskEngine::setConfidenceLevels, py::arg("levels"))
+        .def("get_confidence_levels", &RiskEngine::getConfidenceLevels)
+        .def("get_last_approximation_report", &RiskEngine::getLastApproximationReport)
+        .def("set_sampling_method", &RiskEngine::setSamplingMethod, py::arg("method"))
+        .def("get_sampling_method", &RiskEngine::getSamplingMethod)
+        .def("set_use_control_variate", &RiskEngine::setUseControlVariate, py::arg("use_control_variate"))
+        .def("get_use_control_variate", &RiskEngine::getUseControlVariate)
+        .def("get_last_sampling_report", &RiskEngine::getLastSamplingReport)
+        .def("set_compute_contributions", &RiskEngine::setComputeContributions, py::arg("compute"))
+        .def("get_compute_contributions", &RiskEngine::getComputeContributions)
+        .def("get_last_contribution_report", &RiskEngine::getLastContributionReport)
+        .def("set_collect_run_stats", &RiskEngine::setCollectRunStats, py::arg("collect"))
+        .def("get_collect_run_stats", &RiskEngine::getCollectRunStats)
+        .def("get_last_run_stats", &RiskEngine::getLastRunStats)
+        .def("set_correlation_model", &RiskEngine::setCorrelationModel, py::arg("model"))
+        .def("get_correlation_model", &RiskEngine::getCorrelationModel)
+        .def("set_historical_returns", &RiskEngine::setHistoricalReturns,
+             py::arg("store"), py::arg("lookback_days") = 0)
+        .def("get_historical_returns", &RiskEngine::getHistoricalReturns)
+        .def("get_historical_lookback_days", &RiskEngine::getHistoricalLookbackDays)
+        .def("set_pnl_sink", &RiskEngine::setPnLSink, py::arg("sink"))
+        .def("get_pnl_sink", &RiskEngine::getPnLSink)
+        .def("set_run_control", &RiskEngine::setRunControl, py::arg("control"))
+        .def("get_run_control", &RiskEngine::getRunControl)
+        .def("set_pricing_cache", &RiskEngine::setPricingCache, py::arg("cache"))
+        .def("get_pricing_cache", &RiskEngine::getPricingCache);
+
+    py::class_<PortfolioRegistry::QuantityUpdate>(m, "QuantityUpdate")
+        .def(py::init([](size_t line, int value, bool delta)
+                      { return PortfolioRegistry::QuantityUpdate{line, value, delta}; }),
+             py::arg("line"), py::arg("value"), py::arg("delta") = false)
+        .def_readwrite("line", &PortfolioRegistry::QuantityUpdate::line)
+        .def_readwrite("value", &PortfolioRegistry::QuantityUpdate::value)
+        .def_readwrite("delta", &PortfolioRegistry::QuantityUpdate::delta);
+
+    // Unknown portfolio IDs and lines raise IndexError.
+    py::class_<PortfolioRegistry>(m, "PortfolioRegistry")
+        .def(py::init<>())
+        .def("register",
+             [](PortfolioRegistry &registry, Portfolio &portfolio,
+                const std::map<std::string, MarketData> &market_data)
+             {
+            const PortfolioRegistry::PortfolioId id =
+                registry.registerPortfolio(std::move(portfolio), market_data);
+            portfolio.clear();
+            return id; },
+             py::arg("portfolio"), py::arg("market_data"),
+             "Registers portfolio and returns its ID. The registry takes over the lines "
+             "without copying them, so the Portfolio passed in is left empty.")
+        .def("register_from_arrays",
+             [](PortfolioRegistry &registry, const InputArray<uint8_t> &is_call,
+                const InputArray<double> &strike, const InputArray<double> &expiry,
+                const InputArray<int> &quantity, const InputArray<uint32_t> &asset_index,
+                const std::vector<std::string> &asset_ids,
+                const std::map<std::string, MarketData> &market_data,
+                const py::object &is_american)
+             {
+            InputArray<uint8_t> american_storage;
+            const OptionLineArrays lines = optionLineArrays(
+                is_call, strike, expiry, quantity, asset_index, is_american, american_storage);
+            py::gil_scoped_release release;
+            Portfolio portfolio;
+            portfolio.addOptionLines(lines, asset_ids);
+            return registry.registerPortfolio(std::move(portfolio), market_data); },
+             py::arg("is_call"), py::arg("strike"), py::arg("expiry"), py::arg("quantity"),
+             py::arg("asset_index"), py::arg("asset_ids"), py::arg("market_data"),
+             py::arg("is_american") = py::none())
+        .def("remove", &PortfolioRegistry::removePortfolio, py::arg("portfolio_id"))
+        .def("contains", &PortfolioRegistry::contains, py::arg("portfolio_id"))
+        .def("size", &PortfolioRegistry::size)
+        .def("__len__", &PortfolioRegistry::size)
+        .def("__contains__", &PortfolioRegistry::contains)
+        .def("line_count", &PortfolioRegistry::lineCount, py::arg("portfolio_id"))
+        .def("adjust_quantity", &PortfolioRegistry::adjustQuantity,
+             py::arg("portfolio_id"), py::arg("line"), py::arg("delta"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("set_quantity", &PortfolioRegistry::setQuantity,
+             py::arg("portfolio_id"), py::arg("line"), py::arg("quantity"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("update_quantities", &PortfolioRegistry::updateQuantities,
+             py::arg("portfolio_id"), py::arg("updates"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("update_market_data", &PortfolioRegistry::updateMarketData,
+             py::arg("portfolio_id"), py::arg("market_data"),
+             py::call_guard<py::gil_scoped_release>())
+        .def("get_market_data", &PortfolioRegistry::getMarketData, py::arg("portfolio_id"))
+        .def("calculate_risk", &PortfolioRegistry::calculateRisk,
+             py::arg("portfolio_id"), py::arg("engine"),
+             py::call_guard<py::gil_scoped_release>());
+
+    py::class_<RunControl, std::shared_ptr<RunControl>>(m, "RunControl")
+        .def(py::init<>())
+        .def("cancel", &RunControl::cancel)
+        .def("cancelled", &RunControl::cancelled)
+        .def("paths_done", &RunControl::pathsDone)
+        .def("paths_total", &RunControl::pathsTotal);
+
+    py::enum_<RiskJobStatus>(m, "RiskJobStatus")
+        .value("QUEUED", RiskJobStatus::Queued)
+        .value("RUNNING", RiskJobStatus::Running)
+        .value("COMPLETED", RiskJobStatus::Completed)
+        .value("CANCELLED", RiskJobStatus::Cancelled)
+        .value("FAILED", RiskJobStatus::Failed);
+
+    py::class_<RiskJobProgress>(m, "RiskJobProgress")
+        .def_readonly("status", &RiskJobProgress::status)
+        .def_readonly("paths_done", &RiskJobProgress::paths_done)
+        .def_readonly("paths_total", &RiskJobProgress::paths_total)
+        .def_readonly("estimates", &RiskJobProgress::estimates);
+
+    // wait() raises RiskRunCancelled for a cancelled job and RuntimeError
+    // with the job's error for a failed one.
+    py::class_<RiskJob, std::shared_ptr<RiskJob>>(m, "RiskJob")
+        .def("id", &RiskJob::id)
+        .def("priority", &RiskJob::priority)
+        .def("status", &RiskJob::status)
+        .def("progress", &RiskJob::progress, py::call_guard<py::gil_scoped_release>())
+        .def("cancel", &RiskJob::cancel)
+        .def("finished", &RiskJob::finished)
+        .def("wait", &RiskJob::wait, py::call_guard<py::gil_scoped_release>())
+        .def("wait_for",
+             [](const RiskJob &job, double seconds)
+             {
+            const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::duration<double>(std::max(0.0, seconds)));
+            return job.waitFor(timeout); },
+             py::arg("seconds"), py::call_guard<py::gil_scoped_release>())
+        .def("error", &RiskJob::error)
+        .def("engine", &RiskJob::engine, py::return_value_policy::reference_internal);
+
+    // Unknown job IDs raise IndexError.
+    py::class_<RiskJobQueue>(m, "RiskJobQueue")
+        .def(py::init<int, size_t>(), py::arg("workers") = 1, py::arg("max_queued") = 0)
+        .def("submit",
+             [](RiskJobQueue &queue, const RiskEngine &engine, Portfolio &portfolio,
+                std::map<std::string, MarketData> market_data, int priority)
+             {
+            std::shared_ptr<RiskJob> job =
+                queue.submit(engine, std::move(portfolio), std::move(market_data), priority);
+            portfolio.clear();
+            return job; },
+             py::arg("engine"), py::arg("portfolio"), py::arg("market_data"),
+             py::arg("priority") = 0,
+             "Queues a run of engine's settings and returns the RiskJob. The job takes over "
+             "the lines of portfolio without copying them, so the Portfolio passed in is left "
+             "empty; engine and market_data are copied.")
+        .def("job", &RiskJobQueue::job, py::arg("job_id"))
+        .def("contains", &RiskJobQueue::contains, py::arg("job_id"))
+        .def("__contains__", &RiskJobQueue::contains)
+        .def("jobs", &RiskJobQueue::jobs)
+        .def("release", &RiskJobQueue::release, py::arg("job_id"))
+        .def("queued_count", &RiskJobQueue::queuedCount)
+        .def("worker_count", &RiskJobQueue::workerCount);
+
+    py::class_<BinomialTree::ExerciseBoundary>(m, "ExerciseBoundary")
+        .def_readonly("time", &BinomialTree::ExerciseBoundary::time)
+        .def_readonly("critical_spot", &BinomialTree::ExerciseBoundary::critical_spot);
+
+    m.def("exercise_boundary", &BinomialTree::exerciseBoundary,
+          py::arg("spot"), py::arg("strike"), py::arg("rate"), py::arg("expiry"),
+          py::arg("volatility"), py::arg("option_type"), py::arg("steps"),
+          py::call_guard<py::gil_scoped_release>());
+
+    // Array entry points. Inputs are read straight from NumPy buffers and
+    // results are written into the caller's preallocated arrays, with the
+    // GIL released while the kernels run.
+    m.def("greeks_batch",
+          [](const InputArray<double> &spot, const InputArray<double> &strike,
+             const InputArray<double> &rate, const InputArray<double> &expiry,
+             const InputArray<double> &volatility, const InputArray<uint8_t> &is_call,
+             const py::object &price, const py::object &delta, const py::object &gamma,
+             const py::object &vega, const py::object &theta, const py::object &rho)
+          {
+        const BlackScholes::BatchInputs inputs =
+            batchInputs(spot, strike, rate, expiry, volatility, is_call);
+        BlackScholes::BatchOutputs outputs;
+        outputs.price = outputData<double>(price, inputs.size, "price");
+        outputs.delta = outputData<double>(delta, inputs.size, "delta");
+        outputs.gamma = outputData<double>(gamma, inputs.size, "gamma");
+        outputs.vega = outputData<double>(vega, inputs.size, "vega");
+        outputs.theta = outputData<double>(theta, inputs.size, "theta");
+        outputs.rho = outputData<double>(rho, inputs.size, "rho");
+        py::gil_scoped_release release;
+        BlackScholes::priceBatch(inputs, outputs); },
+          py::arg("spot"), py::arg("strike"), py::arg("rate"), py::arg("expiry"),
+          py::arg("volatility"), py::arg("is_call"),
+          py::arg("price") = py::none(), py::arg("delta") = py::none(),
+          py::arg("gamma") = py::none(), py::arg("vega") = py::none(),
+          py::arg("theta") = py::none(), py::arg("rho") = py::none());
+
+    m.def("price_batch",
+          [](const InputArray<double> &spot, const InputArray<double> &strike,
+             const InputArray<double> &rate, const InputArray<double> &expiry,
+             const InputArray<double> &volatility, const InputArray<uint8_t> &is_call,
+             const py::object &out)
+          {
+        const BlackScholes::BatchInputs inputs =
+            batchInputs(spot, strike, rate, expiry, volatility, is_call);
+        if (out.is_none()) {
+            throw std::invalid_argument("price_batch needs an output array");
+        }
+        BlackScholes::BatchOutputs outputs;
+        outputs.price = outputData<double>(out, inputs.size, "out");
+        py::gil_scoped_release release;
+        BlackScholes::priceBatch(inputs, outputs); },
+          py::arg("spot"), py::arg("strike"), py::arg("rate"), py::arg("expiry"),
+          py::arg("volatility"), py::arg("is_call"), py::arg("out"));
+
+    py::enum_<BlackScholes::ImpliedVolStatus>(m, "ImpliedVolStatus")
+        .value("Converged", BlackScholes::ImpliedVolStatus::Converged)
+        .value("InvalidInput", BlackScholes::ImpliedVolStatus::InvalidInput)
+        .value("BelowIntrinsic", BlackScholes::ImpliedVolStatus::BelowIntrinsic)
+        .value("AboveMaximum", BlackScholes::ImpliedVolStatus::AboveMaximum)
+        .value("NotConverged", BlackScholes::ImpliedVolStatus::NotConverged)
+        .value("NoTimeValue", BlackScholes::ImpliedVolStatus::NoTimeValue);
+
+    // status, when given, receives each quote's ImpliedVolStatus as uint8.
+    // Returns the number of converged quotes.
+    m.def("implied_vol_batch",
+          [](const InputArray<double> &price, const InputArray<double> &spot,
+             const InputArray<double> &strike, const InputArray<double> &rate,
+             const InputArray<double> &expiry, const InputArray<uint8_t> &is_call,
+             const py::object &out, const py::object &status,
+             double tolerance, int max_iterations, int num_threads)
+          {
+        BlackScholes::ImpliedVolQuotes quotes;
+        quotes.size = static_cast<size_t>(price.size());
+        quotes.price = price.data();
+        quotes.spot = inputData(spot, quotes.size, "spot");
+        quotes.strike = inputData(strike, quotes.size, "strike");
+        quotes.rate = inputData(rate, quotes.size, "rate");
+        quotes.expiry = inputData(expiry, quotes.size, "expiry");
+        quotes.is_call = inputData(is_call, quotes.size, "is_call");
+        if (out.is_none()) {
+            throw std::invalid_argument("implied_vol_batch needs an output array");
+        }
+        double *vols = outputData<double>(out, quotes.size, "out");
+        uint8_t *status_out = outputData<uint8_t>(status, quotes.size, "status");
+
+        BlackScholes::ImpliedVolSettings settings;
+        settings.tolerance = tolerance;
+        settings.max_iterations = max_iterations;
+        settings.num_threads = num_threads;
+
+        py::gil_scoped_release release;
+        std::vector<BlackScholes::ImpliedVolStatus> statuses(quotes.size);
+        BlackScholes::impliedVolatilityBatch(quotes, vols, statuses.data(), settings);
+
+        size_t converged = 0;
+        for (size_t i = 0; i < quotes.size; ++i) {
+            converged += statuses[i] == BlackScholes::ImpliedVolStatus::Converged;
+            if (status_out) {
+                status_out[i] = static_cast<uint8_t>(statuses[i]);
+            }
+        }
+        return converged; },
+          py::arg("price"), py::arg("spot"), py::arg("strike"), py::arg("rate"),
+          py::arg("expiry"), py::arg("is_call"), py::arg("out"),
+          py::arg("status") = py::none(), py::arg("tolerance") = 1e-10,
+          py::arg("max_iterations") = 50, py::arg("num_threads") = 1);
+
+    m.def("build_portfolio_from_arrays",
+          [](const InputArray<uint8_t> &is_call, const InputArray<double> &strike,
+             const InputArray<double> &expiry, const InputArray<int> &quantity,
+             const InputArray<uint32_t> &asset_index, const std::vector<std::string> &asset_ids,
+             const py::object &is_american)
+          {
+        InputArray<uint8_t> american_storage;
+        const OptionLineArrays lines = optionLineArrays(
+            is_call, strike, expiry, quantity, asset_index, is_american, american_storage);
+        // Returned through the holder, since Portfolio owns its lines.
+        auto portfolio = std::make_unique<Portfolio>();
+        {
+            py::gil_scoped_release release;
+            portfolio->addOptionLines(lines, asset_ids);
+        }
+        return portfolio; },
+          py::arg("is_call"), py::arg("strike"), py::arg("expiry"), py::arg("quantity"),
+          py::arg("asset_index"), py::arg("asset_ids"), py::arg("is_american") = py::none());
 }
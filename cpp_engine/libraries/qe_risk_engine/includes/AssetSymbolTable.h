@@ -0,0 +1,29 @@
+#ifndef ASSETSYMBOLTABLE_H
+#define ASSETSYMBOLTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Interns asset IDs into dense handles, in first-seen order, so hot loops
+// can refer to underlyings by index instead of by string. Handles stay
+// valid until clear().
+class AssetSymbolTable {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    uint32_t intern(const std::string& asset_id);
+    uint32_t find(const std::string& asset_id) const;
+    const std::string& symbol(uint32_t index) const;
+
+    size_t size() const;
+    void clear();
+
+private:
+    std::unordered_map<std::string, uint32_t> index_by_symbol_;
+    std::vector<std::string> symbols_;
+};
+
+#endif
@@ -2,14 +2,45 @@
 #define BINOMIALTREE_H
 
 #include "Instrument.h"
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
 namespace BinomialTree {
+// The pricers reuse per-thread scratch buffers, so repeated calls from the
+// same thread do not allocate once the buffers have grown to size.
 double europeanOptionPrice(double S, double K, double r, double T, double sigma,
-                           OptionType type, int steps);
+                           OptionType type, int steps,
+                           LatticeScheme scheme = LatticeScheme::CoxRossRubinstein);
 
 double americanOptionPrice(double S, double K, double r, double T, double sigma,
-                           OptionType type, int steps);
+                           OptionType type, int steps,
+                           LatticeScheme scheme = LatticeScheme::CoxRossRubinstein);
+
+// Same pricers without the input checks, for callers that validated their
+// inputs once up front. They never throw: a lattice with no valid
+// risk-neutral probability prices as NaN, for the caller to catch when it
+// scans its results.
+double europeanOptionPriceUnchecked(double S, double K, double r, double T,
+                                    double sigma, OptionType type, int steps,
+                                    LatticeScheme scheme = LatticeScheme::CoxRossRubinstein);
+
+double americanOptionPriceUnchecked(double S, double K, double r, double T,
+                                    double sigma, OptionType type, int steps,
+                                    LatticeScheme scheme = LatticeScheme::CoxRossRubinstein);
+
+// Price, delta and gamma read off the first levels of a single lattice,
+// so the spot Greeks cost no extra tree builds.
+struct LatticeGreeks {
+  double price;
+  double delta;
+  double gamma;
+};
+
+LatticeGreeks optionGreeks(double S, double K, double r, double T,
+                           double sigma, OptionType type, int steps,
+                           bool is_american,
+                           LatticeScheme scheme = LatticeScheme::CoxRossRubinstein);
 
 struct TreeNode {
   double stock_price;
@@ -17,6 +48,43 @@ struct TreeNode {
   bool exercise_optimal;
 };
 
+// Whole CRR lattice in one contiguous triangular layout: node (step, i),
+// with i counting down moves, sits at step * (step + 1) / 2 + i. On a
+// recombining tree the spot at a node only depends on step - 2i, so the
+// 2 * steps + 1 distinct spots are stored once, and the exercise flags are
+// bit-packed. Accessors do not bounds-check.
+struct FlatTree {
+  int steps = 0;
+  std::vector<double> spot_levels;   // S * u^k for k = -steps..steps
+  std::vector<double> option_values; // triangular, one per node
+  std::vector<uint64_t> exercise_bits;
+
+  static size_t index(int step, int i);
+  size_t nodeCount() const;
+  double stockPrice(int step, int i) const;
+  double optionValue(int step, int i) const;
+  bool exerciseOptimal(int step, int i) const;
+  TreeNode node(int step, int i) const;
+};
+
+FlatTree buildFlatTree(double S, double K, double r, double T, double sigma,
+                       OptionType type, int steps, bool is_american);
+
+// Early-exercise boundary of an American option, one entry per time step
+// 0..steps: the highest spot at which a put is exercised, or the lowest for
+// a call, and NaN at steps with no exercise. Built in a single rollback, so
+// memory grows with steps rather than steps squared. Exercise flags follow
+// FlatTree, so expiry (where holding is not an option) is always NaN.
+struct ExerciseBoundary {
+  std::vector<double> time;
+  std::vector<double> critical_spot;
+};
+
+ExerciseBoundary exerciseBoundary(double S, double K, double r, double T,
+                                  double sigma, OptionType type, int steps);
+
+// Nested per-level copy of buildFlatTree, kept for existing callers. Prefer
+// buildFlatTree or exerciseBoundary for large step counts.
 std::vector<std::vector<TreeNode>> buildTree(double S, double K, double r,
                                              double T, double sigma,
                                              OptionType type, int steps,
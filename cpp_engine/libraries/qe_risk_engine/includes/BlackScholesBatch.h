@@ -0,0 +1,66 @@
+#ifndef BLACKSCHOLESBATCH_H
+#define BLACKSCHOLESBATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace BlackScholes {
+    // What the batch holds. A batch known to be all calls or all puts runs
+    // a kernel specialized for that type, with no per-element select on
+    // the call/put formulas.
+    enum class BatchOptionTypes { Mixed, Calls, Puts };
+
+    // Structure-of-arrays view over a batch of European options. All arrays
+    // must hold `size` elements; is_call is a mask (non-zero = call). When
+    // types is Calls or Puts, is_call is not read and may be null.
+    struct BatchInputs {
+        const double* spot = nullptr;
+        const double* strike = nullptr;
+        const double* rate = nullptr;
+        const double* expiry = nullptr;
+        const double* volatility = nullptr;
+        const uint8_t* is_call = nullptr;
+        size_t size = 0;
+        BatchOptionTypes types = BatchOptionTypes::Mixed;
+    };
+
+    // Output arrays, each `size` elements long. Any pointer may be null to
+    // skip that output. Units match the scalar functions: theta per day,
+    // rho per 1% rate move, vega per unit volatility.
+    struct BatchOutputs {
+        double* price = nullptr;
+        double* delta = nullptr;
+        double* gamma = nullptr;
+        double* vega = nullptr;
+        double* theta = nullptr;
+        double* rho = nullptr;
+    };
+
+    struct BatchGreeks {
+        std::vector<double> price;
+        std::vector<double> delta;
+        std::vector<double> gamma;
+        std::vector<double> vega;
+        std::vector<double> theta;
+        std::vector<double> rho;
+    };
+
+    // Validates every element once, then prices the whole batch in a single
+    // vectorized pass that shares d1/d2/N(d1)/n(d1) across all outputs.
+    void priceBatch(const BatchInputs& inputs, const BatchOutputs& outputs);
+
+    // Same kernel without the validation pass, for callers that have
+    // already validated their inputs.
+    void priceBatchUnchecked(const BatchInputs& inputs, const BatchOutputs& outputs);
+
+    BatchGreeks priceBatch(
+        const std::vector<double>& S, const std::vector<double>& K,
+        const std::vector<double>& r, const std::vector<double>& T,
+        const std::vector<double>& sigma, const std::vector<uint8_t>& is_call
+    );
+
+    void validateBatchInputs(const BatchInputs& inputs);
+}
+
+#endif
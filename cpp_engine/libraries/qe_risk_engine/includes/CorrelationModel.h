@@ -0,0 +1,129 @@
+#ifndef CORRELATIONMODEL_H
+#define CORRELATIONMODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Linear map from a path's independent standard normal draws to correlated
+// spot shocks, for one fixed list of assets. A path supplies one draw per
+// asset followed by factors() common factor draws; the result is one
+// unit-variance shock per output. Full correlation matrices map through
+// their Cholesky factor, O(assets^2) per path; factor models through their
+// loadings plus an idiosyncratic term, O(assets * factors) per path.
+class ShockFactor {
+public:
+    // Correlated shocks produced per path.
+    size_t outputs() const;
+
+    // Common factor draws each path needs after its per-asset draws; 0 for
+    // a full correlation matrix.
+    size_t factors() const;
+
+    // Independent draws read per path: one per asset of the list the
+    // factor was built for, then the common factors.
+    size_t draws() const;
+
+    // Correlates `paths` paths at once, reading path p's draws from
+    // draws[p * stride ...] and writing its shocks to out[p * outputs() ...].
+    // The work is one matrix product over the whole block, done a tile of
+    // paths, draws and outputs at a time so the operands stay in cache.
+    void correlate(const double* draws, size_t stride, size_t paths, double* out) const;
+
+    // Standard deviation of sum_i weights[i] * shock[i], over outputs().
+    double standardDeviation(const double* weights) const;
+
+    // The same map restricted to the given outputs, in the given order.
+    // Paths still supply every draw of the original list.
+    ShockFactor selectOutputs(const std::vector<uint32_t>& outputs) const;
+
+private:
+    friend class CorrelationModel;
+
+    size_t outputs_ = 0;
+    size_t draws_ = 0;         // per-asset draws of the original list
+    size_t factors_ = 0;
+    size_t input_offset_ = 0;  // first draw multiplied by dense_
+    size_t inputs_ = 0;        // rows of dense_
+    std::vector<double> dense_;            // [input][output]: transposed Cholesky factor or loadings
+    std::vector<size_t> first_output_;     // [input], first non-zero column of its dense_ row
+    std::vector<double> residual_;         // [output], factor models only
+    std::vector<uint32_t> residual_draw_;  // [output], factor models only
+
+    void indexColumns();
+    // row[i0, i1) += one path's inputs [j0, j1) times their dense_ rows.
+    void accumulateRow(const double* draws, double* row, size_t j0, size_t j1, size_t i0, size_t i1) const;
+};
+
+// Correlation of asset spot shocks, as a full correlation (or covariance)
+// matrix or as a factor model with loadings. Only the correlation is used:
+// each asset's vol still comes from its MarketData, so a covariance matrix
+// is reduced to its correlation. Assets the model does not name move
+// independently of everything else.
+//
+// Models are immutable. The factor for each list of assets the model is
+// asked about is built once and kept, so repeated risk runs on the same
+// portfolio never factorize again; setting a new model is what clears it.
+// Every method is thread-safe, so engines may share one model.
+class CorrelationModel {
+public:
+    enum class MatrixType {
+        Correlation,
+        Covariance
+    };
+
+    // `matrix` is row-major, asset_ids.size() squared. Throws
+    // std::invalid_argument for a non-symmetric matrix, a correlation
+    // diagonal other than 1, a non-positive variance, or a matrix that is
+    // not positive semi-definite. Perfect correlations are allowed.
+    CorrelationModel(std::vector<std::string> asset_ids, std::vector<double> matrix,
+                     MatrixType type = MatrixType::Correlation);
+
+    // `loadings` is row-major, asset_ids.size() x factors: asset i's shock
+    // is sum_f loadings[i][f] * factor_f plus an independent residual that
+    // makes its variance 1. Throws std::invalid_argument when a row's
+    // squared loadings sum to more than 1.
+    CorrelationModel(std::vector<std::string> asset_ids, std::vector<double> loadings, size_t factors);
+
+    size_t size() const;
+    const std::vector<std::string>& assetIds() const;
+
+    bool isFactorModel() const;
+    size_t factorCount() const;  // 0 for a full matrix
+
+    // Implied correlation between assets i and j of assetIds().
+    double correlation(size_t i, size_t j) const;
+
+    // Factor for shocks of the given assets, in order. Built on first use
+    // for each list and cached with the model.
+    std::shared_ptr<const ShockFactor> factorFor(const std::vector<std::string>& asset_ids) const;
+
+    // Factors built so far, the model's own included.
+    size_t factorizations() const;
+
+private:
+    static constexpr size_t kMaxCachedFactors = 8;
+
+    std::vector<std::string> asset_ids_;
+    std::unordered_map<std::string, size_t> index_;
+    size_t factors_ = 0;
+    std::vector<double> correlation_;  // [asset][asset], full matrices only
+    std::vector<double> loadings_;     // [asset][factor], factor models only
+    std::vector<double> residual_;     // [asset], factor models only
+
+    using CachedFactor = std::pair<std::vector<std::string>, std::shared_ptr<const ShockFactor>>;
+
+    mutable std::mutex mutex_;
+    mutable std::list<CachedFactor> cached_;  // Most recently used first
+    mutable size_t factorizations_ = 0;
+
+    void indexAssets();
+    std::shared_ptr<const ShockFactor> buildFactor(const std::vector<std::string>& asset_ids) const;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef IMPLIEDVOLATILITYBATCH_H
+#define IMPLIEDVOLATILITYBATCH_H
+
+#include "ImpliedVolatilitySurface.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace BlackScholes {
+    enum class ImpliedVolStatus : uint8_t {
+        Converged,
+        InvalidInput,     // Non-positive spot/strike/expiry, negative price or non-finite input
+        BelowIntrinsic,   // Price under the discounted intrinsic value
+        AboveMaximum,     // Price at or over the no-arbitrage bound, or needs vol above 10
+        NotConverged,     // Iteration limit reached
+        NoTimeValue       // Price at the discounted intrinsic value, so any vol near 0 fits
+    };
+
+    // Structure-of-arrays view over a batch of European option quotes. All
+    // arrays must hold `size` elements; is_call is a mask (non-zero = call).
+    struct ImpliedVolQuotes {
+        const double* price = nullptr;
+        const double* spot = nullptr;
+        const double* strike = nullptr;
+        const double* rate = nullptr;
+        const double* expiry = nullptr;
+        const uint8_t* is_call = nullptr;
+        size_t size = 0;
+    };
+
+    struct ImpliedVolSettings {
+        double tolerance = 1e-10;  // In vol; a quote converges once its step is smaller
+        int max_iterations = 50;
+        int num_threads = 1;       // 0 = hardware concurrency
+    };
+
+    struct ImpliedVolBatch {
+        std::vector<double> vol;
+        std::vector<ImpliedVolStatus> status;
+
+        size_t convergedCount() const;
+    };
+
+    // Inverts every quote to its Black-Scholes vol. Each quote is solved on
+    // its out-of-the-money side (via put-call parity), starting from the
+    // Corrado-Miller approximation and taking Halley steps that fall back
+    // to bisection whenever they would leave the bracket known to hold the
+    // root, so every valid quote converges. Lanes of one block iterate
+    // together in a vectorizable loop; blocks run on num_threads workers.
+    // Quotes that fail leave vol at 0 with a status saying why; invalid
+    // quotes are reported rather than thrown.
+    void impliedVolatilityBatch(
+        const ImpliedVolQuotes& quotes, double* vols, ImpliedVolStatus* status,
+        const ImpliedVolSettings& settings = ImpliedVolSettings()
+    );
+
+    ImpliedVolBatch impliedVolatilityBatch(
+        const std::vector<double>& price, const std::vector<double>& S,
+        const std::vector<double>& K, const std::vector<double>& r,
+        const std::vector<double>& T, const std::vector<uint8_t>& is_call,
+        const ImpliedVolSettings& settings = ImpliedVolSettings()
+    );
+
+    // The converged quotes as surface points, in input order, for
+    // ImpliedVolSurface::addPoints.
+    std::vector<VolatilitySurface::VolPoint> convergedVolPoints(
+        const double* strikes, const double* expiries,
+        const double* vols, const ImpliedVolStatus* status, size_t n
+    );
+    std::vector<VolatilitySurface::VolPoint> convergedVolPoints(
+        const std::vector<double>& strikes, const std::vector<double>& expiries,
+        const ImpliedVolBatch& batch
+    );
+}
+
+#endif
@@ -1,6 +1,10 @@
 #ifndef IMPLIEDVOLSURFACE_H
 #define IMPLIEDVOLSURFACE_H
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
 #include <vector>
 #include <map>
 #include <string>
@@ -11,29 +15,88 @@ namespace VolatilitySurface {
         double expiry;
         double implied_vol;
     };
-    
+
+    // Quotes are indexed by build() into expiry slices, each sorted by
+    // strike. Lookups binary-search the two slices around the expiry,
+    // interpolate linearly in strike within each (flat beyond the quoted
+    // strikes) and linearly in total variance sigma^2 * T between them
+    // (flat vol outside the quoted expiries). Slices need not share
+    // strikes, so scattered quotes work as well as a full grid.
+    //
+    // Lookups may run concurrently with each other, but not with adding
+    // points or clearing.
     class ImpliedVolSurface {
     public:
+        ImpliedVolSurface();
+        ImpliedVolSurface(const ImpliedVolSurface& other);
+        ImpliedVolSurface& operator=(const ImpliedVolSurface& other);
+
         void addPoint(double strike, double expiry, double implied_vol);
+        void addPoints(const std::vector<VolPoint>& points);
+
+        // Sorts the quotes into the slice index. A later quote for the
+        // same strike and expiry replaces an earlier. addPoints does this
+        // itself; after addPoint the first lookup does it, so calling
+        // build() up front only keeps that cost out of the lookup.
+        void build();
+        bool isBuilt() const;
+
         double interpolate(double strike, double expiry) const;
+
+        // Looks up n (strike, expiry) pairs; consecutive queries with the
+        // same expiry share one slice search.
+        void interpolate(const double* strikes, const double* expiries,
+                         double* vols, size_t n) const;
+        std::vector<double> interpolate(const std::vector<double>& strikes,
+                                        const std::vector<double>& expiries) const;
+
+        // Same definitions as the free functions below, answered from
+        // the index.
+        double skew(double expiry) const;
+        double termStructure(double strike) const;
+
         bool hasData() const;
         size_t size() const;
         void clear();
-        
+
+        // Changes with every edit and is unique across all surfaces, so
+        // callers holding a shared surface can tell whether it changed
+        // since they last looked. Never 0.
+        uint64_t revision() const;
+
         std::vector<VolPoint> getPoints() const;
-        
+
     private:
         std::vector<VolPoint> points_;
-        
-        double bilinearInterpolation(
-            double strike, double expiry,
-            const VolPoint& p1, const VolPoint& p2,
-            const VolPoint& p3, const VolPoint& p4
-        ) const;
+        uint64_t revision_;
+        // Set once the index below matches points_; a lookup that finds
+        // it clear builds the index under build_mutex_.
+        mutable std::atomic<bool> built_{false};
+        mutable std::mutex build_mutex_;
+
+        // Slice s covers [slice_begin_[s], slice_begin_[s + 1]) of
+        // strikes_ and vols_.
+        mutable std::vector<double> slice_expiry_;
+        mutable std::vector<size_t> slice_begin_;
+        mutable std::vector<double> strikes_;
+        mutable std::vector<double> vols_;
+
+        void buildIndex() const;
+        // Throws std::runtime_error without data; builds the index if
+        // points were added since it was last built.
+        void ensureBuilt() const;
+        double sliceVol(size_t slice, double strike) const;
+        double interpolateBetween(size_t upper_slice, double strike, double expiry) const;
+        size_t upperSlice(double expiry) const;
     };
-    
+
+    // Slope of vol against strike between the lowest and highest strikes
+    // quoted within 0.01 years of expiry.
     double calculateSkew(const std::vector<VolPoint>& points, double expiry);
+
+    // Slope of vol against expiry between the earliest and latest quotes
+    // within 1% of strike.
     double calculateTermStructure(const std::vector<VolPoint>& points, double strike);
 }
 
-#endif
\ No newline at end of file
+#endif
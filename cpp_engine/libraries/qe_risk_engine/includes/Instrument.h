@@ -14,6 +14,44 @@ enum class PricingModel {
     MertonJumpDiffusion 
 };
 
+enum class ExerciseStyle { European, American };
+
+// Parameterisation of binomial lattices. Leisen-Reimer picks u, d and p by
+// Peizer-Pratt inversion of the Black-Scholes d1/d2, so prices converge at
+// roughly O(1/n^2) instead of oscillating at O(1/n): 25-50 steps typically
+// match Cox-Ross-Rubinstein at several hundred. It always uses an odd step
+// count; even requests are rounded up.
+enum class LatticeScheme {
+    CoxRossRubinstein,
+    LeisenReimer
+};
+
+// Everything calculatePortfolioRisk needs from one instrument, in the same
+// units as the individual accessors.
+struct Greeks {
+    double price = 0.0;
+    double delta = 0.0;
+    double gamma = 0.0;
+    double vega = 0.0;
+    double theta = 0.0;
+};
+
+// Plain description of a vanilla option line. Instruments that can be
+// described this way are stored column-wise by Portfolio and priced by the
+// risk engine without going through the virtual interface.
+struct ContractTerms {
+    OptionType option_type = OptionType::Call;
+    double strike = 0.0;
+    double time_to_expiry = 0.0;
+    bool is_american = false;
+    PricingModel model = PricingModel::BlackScholes;
+    int binomial_steps = 100;
+    LatticeScheme lattice_scheme = LatticeScheme::CoxRossRubinstein;
+    double jump_intensity = 0.0;
+    double jump_mean = 0.0;
+    double jump_volatility = 0.0;
+};
+
 class Instrument {
 public:
     virtual ~Instrument() = default;
@@ -25,6 +63,14 @@ public:
     virtual double theta(const MarketData& md) const = 0;
     virtual std::string getAssetId() const = 0;
     
+    // Price and all Greeks in one call. The default simply calls each
+    // accessor; numerical models override it to share work between them.
+    virtual Greeks computeAll(const MarketData& md) const;
+    
+    // Fills terms and returns true if the instrument is a vanilla option
+    // the columnar pricers understand. The default returns false.
+    virtual bool getContractTerms(ContractTerms& terms) const;
+    
     virtual std::string getInstrumentType() const = 0;
     virtual bool isValid() const = 0;
 };
@@ -52,6 +98,8 @@ public:
     double vega(const MarketData& md) const override;
     double theta(const MarketData& md) const override;
     std::string getAssetId() const override;
+    Greeks computeAll(const MarketData& md) const override;
+    bool getContractTerms(ContractTerms& terms) const override;
     std::string getInstrumentType() const override;
     bool isValid() const override;
     
@@ -61,6 +109,9 @@ public:
     void setBinomialSteps(int steps);
     int getBinomialSteps() const;
     
+    void setLatticeScheme(LatticeScheme scheme);
+    LatticeScheme getLatticeScheme() const;
+    
     void setJumpParameters(double lambda, double jump_mean, double jump_vol);
     double getJumpIntensity() const;
     
@@ -76,19 +127,13 @@ private:
     PricingModel pricing_model_;
     
     int binomial_steps_;
+    LatticeScheme lattice_scheme_;
     double jump_intensity_;
     double jump_mean_;
     double jump_volatility_;
     
     void validateParameters() const;
     void validateMarketData(const MarketData& md) const;
-    
-    double priceBlackScholes(const MarketData& md) const;
-    double priceBinomial(const MarketData& md) const;
-    double priceJumpDiffusion(const MarketData& md) const;
-    
-    double deltaBlackScholes(const MarketData& md) const;
-    double deltaNumerical(const MarketData& md) const;
 };
 
 class AmericanOption : public Instrument {
@@ -107,11 +152,16 @@ public:
     double vega(const MarketData& md) const override;
     double theta(const MarketData& md) const override;
     std::string getAssetId() const override;
+    Greeks computeAll(const MarketData& md) const override;
+    bool getContractTerms(ContractTerms& terms) const override;
     std::string getInstrumentType() const override;
     bool isValid() const override;
     
     void setBinomialSteps(int steps);
     int getBinomialSteps() const;
+    
+    void setLatticeScheme(LatticeScheme scheme);
+    LatticeScheme getLatticeScheme() const;
 
 private:
     OptionType option_type_;
@@ -119,6 +169,7 @@ private:
     double time_to_expiry_years_;
     std::string underlying_asset_id_;
     int binomial_steps_;
+    LatticeScheme lattice_scheme_;
     
     void validateParameters() const;
     void validateMarketData(const MarketData& md) const;
@@ -2,8 +2,61 @@
 #define JUMPDIFFUSION_H
 
 #include "Instrument.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
 
 namespace JumpDiffusion {
+// Price and series Greeks of one Merton option. Rho is per 1% rate move,
+// as in BlackScholes.
+struct MertonGreeks {
+    double price = 0.0;
+    double delta = 0.0;
+    double gamma = 0.0;
+    double vega = 0.0;
+    double rho = 0.0;
+};
+
+// The Merton series for fixed rate, diffusion vol, expiry and jump
+// parameters: one Black-Scholes term per jump count, with its Poisson
+// weight, variance, drift and discount factor computed once. The terms
+// kept do not depend on spot or strike, so any number of them can then be
+// priced at one Black-Scholes evaluation per term, without revalidating.
+// Greeks are the weighted sums of the per-term Black-Scholes Greeks.
+class MertonSeries {
+public:
+    // Inputs are validated as in mertonCallPrice.
+    MertonSeries(double r, double T, double sigma, double lambda,
+                 double jump_mean, double jump_vol, int max_jumps = 50);
+
+    double price(double S, double K, OptionType type) const;
+
+    // Same series with another diffusion vol; the weights and drifts do
+    // not depend on it, so only each term's variance is recomputed.
+    double price(double S, double K, OptionType type, double sigma) const;
+
+    MertonGreeks greeks(double S, double K, OptionType type) const;
+
+    // prices[i] for (spots[i], strikes[i]); is_call is a mask.
+    void priceBatch(const double* spots, const double* strikes,
+                    const uint8_t* is_call, double* prices, size_t n) const;
+
+    size_t termCount() const;
+
+private:
+    double T_;
+    double sigma_;
+    std::vector<double> weight_;
+    std::vector<double> jump_variance_;  // n * jump_vol^2
+    std::vector<double> drift_;          // r_n * T
+    std::vector<double> discount_;       // exp(-r_n * T)
+    std::vector<double> total_variance_; // sigma_n^2 * T
+    std::vector<double> vol_sqrt_T_;     // sigma_n * sqrt(T)
+
+    double termPrice(size_t n, double S, double K, double log_moneyness, bool call,
+                     double total_variance, double vol_sqrt_T) const;
+};
+
 double mertonOptionPrice(double S, double K, double r, double T, double sigma,
                          OptionType type, double lambda, double jump_mean,
                          double jump_vol, int max_jumps = 50);
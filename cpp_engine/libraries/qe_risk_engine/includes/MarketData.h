@@ -1,10 +1,15 @@
 #ifndef MARKETDATA_H
 #define MARKETDATA_H
 
+#include "AssetSymbolTable.h"
+#include "ImpliedVolatilitySurface.h"
+#include <memory>
 #include <string>
 #include <stdexcept>
 #include <cmath>
+#include <cstdint>
 #include <map>
+#include <vector>
 
 struct MarketData {
     std::string asset_id;
@@ -13,6 +18,10 @@ struct MarketData {
     double volatility;
     double dividend_yield;
     
+    // Optional built surface. When set, options price off the surface vol
+    // at their own strike and expiry instead of the flat volatility.
+    std::shared_ptr<const VolatilitySurface::ImpliedVolSurface> vol_surface;
+    
     MarketData()
         : asset_id(""),
           spot_price(0.0),
@@ -63,6 +72,9 @@ struct MarketData {
         if (std::isnan(dividend_yield) || std::isinf(dividend_yield)) {
             throw std::invalid_argument("Invalid dividend yield for " + asset_id);
         }
+        if (vol_surface && !vol_surface->hasData()) {
+            throw std::invalid_argument("Volatility surface for " + asset_id + " must have data");
+        }
     }
     
     bool isValid() const {
@@ -73,6 +85,44 @@ struct MarketData {
             return false;
         }
     }
+    
+    double volatilityFor(double strike, double expiry) const {
+        return vol_surface ? vol_surface->interpolate(strike, expiry) : volatility;
+    }
+};
+
+// Market data stored in a flat vector indexed by the handle its asset ID
+// was interned to. Removing an asset leaves its handle reserved, so
+// handles stay stable until clear(); a later set() reuses the slot.
+// Every set() also stamps the slot with a version that is unique across
+// all snapshots, so callers can tell which assets changed since they last
+// looked.
+class MarketDataSnapshot {
+public:
+    MarketDataSnapshot() = default;
+    explicit MarketDataSnapshot(const std::map<std::string, MarketData>& market_data_map);
+    
+    uint32_t set(const std::string& asset_id, const MarketData& md);
+    bool erase(const std::string& asset_id);
+    void clear();
+    
+    // AssetSymbolTable::npos if the asset has no data.
+    uint32_t handle(const std::string& asset_id) const;
+    bool contains(uint32_t handle) const;
+    const MarketData& at(uint32_t handle) const;
+    
+    // Version of the last set() for handle; 0 if it has no data.
+    uint64_t version(uint32_t handle) const;
+    
+    const AssetSymbolTable& symbols() const;
+    size_t size() const;
+    
+private:
+    AssetSymbolTable symbols_;
+    std::vector<MarketData> data_;
+    std::vector<uint8_t> present_;
+    std::vector<uint64_t> versions_;
+    size_t count_ = 0;
 };
 
 class MarketDataManager {
@@ -86,8 +136,14 @@ public:
     size_t size() const;
     std::map<std::string, MarketData> getAllMarketData() const;
     
+    // Handle-indexed view for callers that resolve asset IDs once up front;
+    // RiskEngine::calculatePortfolioRisk accepts it directly.
+    uint32_t getHandle(const std::string& asset_id) const;
+    const MarketData& getMarketDataByHandle(uint32_t handle) const;
+    const MarketDataSnapshot& getSnapshot() const;
+    
 private:
-    std::map<std::string, MarketData> market_data_map_;
+    MarketDataSnapshot snapshot_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,24 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+namespace Parallel {
+    // Maps a user-facing thread count to the number of workers to run.
+    // 0 selects std::thread::hardware_concurrency().
+    int resolveThreadCount(int requested);
+
+    // Runs fn(block, worker) for every block in [0, num_blocks) on up to
+    // num_threads workers. Blocks are handed out dynamically, so callers
+    // must not assume any block-to-worker mapping. The first exception
+    // thrown by any block is rethrown on the calling thread once all
+    // workers have stopped.
+    void forEachBlock(
+        size_t num_blocks,
+        int num_threads,
+        const std::function<void(size_t block, int worker)>& fn
+    );
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef PNLSINK_H
+#define PNLSINK_H
+
+#include <cstddef>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Scenario P&L of one chunk of consecutive paths.
+struct PnLChunk {
+    size_t first_path = 0;
+    size_t paths = 0;
+    const double* pnl = nullptr;        // [path], portfolio P&L
+    size_t assets = 0;                  // 0 unless the sink asked for a breakdown
+    const double* asset_pnl = nullptr;  // [path][asset], in the portfolio's symbol table order
+};
+
+// Receives every scenario's P&L from a risk run, one chunk at a time, so
+// callers can keep the distribution (or a breakdown of it) without the
+// engine holding it. Chunks may arrive in any path order and from any
+// worker thread, but the engine never calls one sink concurrently.
+// Exceptions thrown by a sink abort the run.
+class PnLSink {
+public:
+    virtual ~PnLSink() = default;
+
+    // Also deliver each asset's own P&L. In the full revaluation modes
+    // this prices the lines per asset, which costs a little more.
+    virtual bool wantsAssetBreakdown() const;
+
+    // Called once before the first chunk of a run.
+    virtual void begin(size_t paths, const std::vector<std::string>& asset_ids);
+    virtual void write(const PnLChunk& chunk) = 0;
+    // Called once after the last chunk.
+    virtual void finish();
+    // Called instead of finish() when a run stops early: a worker or the
+    // sink threw, or the run was cancelled. Must not throw.
+    virtual void abort() noexcept;
+};
+
+// Writes the run to a binary file, little-endian:
+//
+//   char[8]  magic "QEPNL001"
+//   uint64   paths
+//   uint64   assets, 0 without a breakdown
+//   uint64   offset of the rows, a multiple of 64
+//   per asset, uint32 length then that many bytes of ID
+//   rows:    per path, the portfolio P&L then each asset's, as doubles
+//
+// Out-of-order chunks are written in place, so the file is in path order.
+// A run that stops early removes its file rather than leave a partial one.
+class PnLFileSink : public PnLSink {
+public:
+    explicit PnLFileSink(std::string path, bool asset_breakdown = false);
+
+    bool wantsAssetBreakdown() const override;
+    void begin(size_t paths, const std::vector<std::string>& asset_ids) override;
+    void write(const PnLChunk& chunk) override;
+    void finish() override;
+    void abort() noexcept override;
+
+private:
+    std::string path_;
+    bool asset_breakdown_;
+    std::ofstream file_;
+    size_t row_offset_ = 0;
+    size_t columns_ = 1;
+    std::vector<double> row_buffer_;
+};
+
+// Writes into caller-owned memory of rows x columns doubles, row-major by
+// path: column 0 is the portfolio P&L and, when columns > 1, the asset
+// breakdown follows, so columns must then be 1 + the portfolio's assets.
+// The memory must outlive every run the sink is used for.
+class PnLBufferSink : public PnLSink {
+public:
+    PnLBufferSink(double* data, size_t rows, size_t columns = 1);
+
+    bool wantsAssetBreakdown() const override;
+    // Throws std::invalid_argument if the run does not fit the buffer.
+    void begin(size_t paths, const std::vector<std::string>& asset_ids) override;
+    void write(const PnLChunk& chunk) override;
+
+private:
+    double* data_;
+    size_t rows_;
+    size_t columns_;
+};
+
+// Hands each chunk to a function, e.g. one that forwards it to a socket.
+// The chunk's pointers are only valid during the call.
+class PnLCallbackSink : public PnLSink {
+public:
+    using Callback = std::function<void(const PnLChunk&)>;
+
+    explicit PnLCallbackSink(Callback callback, bool asset_breakdown = false);
+
+    bool wantsAssetBreakdown() const override;
+    void write(const PnLChunk& chunk) override;
+
+private:
+    Callback callback_;
+    bool asset_breakdown_;
+};
+
+#endif
@@ -2,17 +2,43 @@
 #define PORTFOLIO_H
 
 #include "Instrument.h"
+#include "PortfolioColumns.h"
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <stdexcept>
 #include <string>
 
+// Column-wise description of vanilla option lines, e.g. from NumPy arrays.
+// Line i is on asset_ids[asset_index[i]]. is_call and is_american are
+// masks; is_american may be null for an all-European batch.
+struct OptionLineArrays {
+    const uint8_t* is_call = nullptr;
+    const double* strike = nullptr;
+    const double* expiry = nullptr;
+    const int* quantity = nullptr;
+    const uint32_t* asset_index = nullptr;
+    const uint8_t* is_american = nullptr;
+    size_t size = 0;
+};
+
 class Portfolio {
 public:
     void addInstrument(std::unique_ptr<Instrument> instrument, int quantity);
     
+    // Constructs every line's option in place and appends them all, or
+    // none if any line is invalid. Options use their default pricing
+    // model and steps.
+    void addOptionLines(const OptionLineArrays& lines, const std::vector<std::string>& asset_ids);
+    
     const std::vector<std::pair<std::unique_ptr<Instrument>, int>>& getInstruments() const;
     
+    // Columnar copy of the lines above, kept in sync by every mutator.
+    // Contract terms are read when a line is added, so instruments must
+    // not be modified in place afterwards.
+    const PortfolioColumns& getColumns() const;
+    
     size_t size() const;
     bool empty() const;
     void clear();
@@ -24,10 +50,19 @@ public:
     
     void updateQuantity(size_t index, int new_quantity);
     
+    // Changes whenever lines are added or removed, to a value no other
+    // portfolio has had; quantity updates leave it alone.
+    uint64_t structureRevision() const;
+    
 private:
     std::vector<std::pair<std::unique_ptr<Instrument>, int>> instruments;
+    PortfolioColumns columns;
+    uint64_t structure_revision = 0;
+    
+    void bumpStructureRevision();
     
     void validateIndex(size_t index) const;
+    void rebuildColumns();
 };
 
 #endif
\ No newline at end of file
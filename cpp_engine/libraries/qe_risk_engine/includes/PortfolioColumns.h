@@ -0,0 +1,69 @@
+#ifndef PORTFOLIOCOLUMNS_H
+#define PORTFOLIOCOLUMNS_H
+
+#include "AssetSymbolTable.h"
+#include "Instrument.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Portfolio lines that share exercise style, pricing model and option type,
+// stored as parallel arrays, so each group maps onto one
+// PricingKernel::Pricer. Row k of every column describes the same line, and
+// line[k] is that line's position in Portfolio::getInstruments(). is_call
+// repeats option_type on every row for the mask-based batch pricers.
+struct InstrumentGroup {
+    bool is_american = false;
+    PricingModel model = PricingModel::BlackScholes;
+    OptionType option_type = OptionType::Call;
+
+    std::vector<uint8_t> is_call;
+    std::vector<double> strike;
+    std::vector<double> time_to_expiry;
+    std::vector<uint32_t> asset;
+    std::vector<int> quantity;
+    std::vector<int> binomial_steps;
+    std::vector<LatticeScheme> lattice_scheme;
+    std::vector<double> jump_intensity;
+    std::vector<double> jump_mean;
+    std::vector<double> jump_volatility;
+    std::vector<size_t> line;
+
+    size_t size() const;
+};
+
+// Columnar view of a portfolio, maintained by Portfolio as lines are added.
+// Contract terms are captured when a line is appended. Instruments that do
+// not expose ContractTerms are listed in genericLines() and still have to
+// be priced through the virtual interface.
+class PortfolioColumns {
+public:
+    void append(const Instrument& instrument, int quantity);
+    void setQuantity(size_t line, int quantity);
+    void clear();
+
+    const AssetSymbolTable& assets() const;
+    const std::vector<InstrumentGroup>& groups() const;
+    const std::vector<size_t>& genericLines() const;
+
+    // Asset index of every line, in portfolio order.
+    const std::vector<uint32_t>& lineAssets() const;
+
+    size_t lineCount() const;
+
+private:
+    struct Location {
+        uint32_t group;  // npos for generic lines
+        uint32_t row;
+    };
+
+    AssetSymbolTable assets_;
+    std::vector<InstrumentGroup> groups_;
+    std::vector<size_t> generic_lines_;
+    std::vector<uint32_t> line_asset_;
+    std::vector<Location> line_location_;
+
+    InstrumentGroup& groupFor(const ContractTerms& terms, uint32_t& group_index);
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef PORTFOLIOREGISTRY_H
+#define PORTFOLIOREGISTRY_H
+
+#include "MarketData.h"
+#include "Portfolio.h"
+#include "RiskEngine.h"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Portfolios kept alive between risk requests, each with its own market
+// data, so repeat requests only pay for the recompute. Every method is
+// thread-safe. Calls on one portfolio are serialized, while different
+// portfolios can be updated and revalued concurrently. IDs are never
+// reused, and unknown IDs throw std::out_of_range.
+class PortfolioRegistry {
+public:
+    using PortfolioId = uint64_t;
+
+    PortfolioId registerPortfolio(
+        Portfolio portfolio,
+        const std::map<std::string, MarketData>& market_data
+    );
+    void removePortfolio(PortfolioId id);
+    bool contains(PortfolioId id) const;
+    size_t size() const;
+
+    // Adds delta to the quantity of line `line`.
+    void adjustQuantity(PortfolioId id, size_t line, int delta);
+    void setQuantity(PortfolioId id, size_t line, int quantity);
+
+    // Sets `line` to `value`, or adds `value` to it when `delta` is set.
+    struct QuantityUpdate {
+        size_t line = 0;
+        int value = 0;
+        bool delta = false;
+    };
+
+    // Applies updates in order, all or none: if any line is out of range
+    // or any delta overflows, counting earlier updates in the list, it
+    // throws before changing the portfolio.
+    void updateQuantities(PortfolioId id, const std::vector<QuantityUpdate>& updates);
+
+    // Adds or replaces md.asset_id's market data.
+    void updateMarketData(PortfolioId id, const MarketData& md);
+
+    size_t lineCount(PortfolioId id) const;
+    std::map<std::string, MarketData> getMarketData(PortfolioId id) const;
+
+    // Runs engine against the stored portfolio and market data. The
+    // engine is the caller's, so the run uses whatever configuration the
+    // request asked for. Each portfolio keeps a RiskRunCache, so repeat
+    // runs with the same settings only reprice assets whose market data
+    // or quantities changed in between.
+    PortfolioRiskResult calculateRisk(PortfolioId id, RiskEngine& engine) const;
+
+private:
+    struct Entry {
+        mutable std::mutex mutex;
+        Portfolio portfolio;
+        MarketDataManager market_data;
+        RiskRunCache risk_cache;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<PortfolioId, std::shared_ptr<Entry>> entries_;
+    PortfolioId next_id_ = 1;
+
+    // The entry stays alive for the caller even if it is removed meanwhile.
+    std::shared_ptr<Entry> find(PortfolioId id) const;
+};
+
+#endif
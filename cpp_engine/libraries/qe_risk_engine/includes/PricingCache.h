@@ -0,0 +1,108 @@
+#ifndef PRICINGCACHE_H
+#define PRICINGCACHE_H
+
+#include "Instrument.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// Market inputs a vanilla line's price depends on. vol is the line's own
+// vol, i.e. the surface vol at its strike and expiry when there is one.
+struct PricingState {
+    double spot = 0.0;
+    double rate = 0.0;
+    double vol = 0.0;
+    double dividend = 0.0;
+};
+
+struct PricingCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t size = 0;
+};
+
+// Bounded memo of per-unit pricing results, keyed by contract terms and
+// market state, so identical contracts on different lines or in repeated
+// requests are priced once. Results from different pricers are kept apart:
+// Greeks come from Instrument::computeAll and ScenarioPrice from the
+// scenario pricers, which must match themselves exactly for an unchanged
+// market to give zero P&L.
+//
+// With market_quantum > 0 each market input of a Greeks entry is rounded
+// to a multiple of it before lookup, so states that close together share
+// a result; 0 (the default) only reuses results for bit-identical inputs.
+// ScenarioPrice entries are never rounded, since a nearby state's price
+// would shift today's value and with it every path's P&L. Entries are
+// spread over independently locked shards, each evicting its least
+// recently used entry when full. Every method is thread-safe.
+class PricingCache {
+public:
+    enum class Kind : uint8_t {
+        Greeks,
+        ScenarioPrice
+    };
+
+    explicit PricingCache(size_t capacity = 65536, double market_quantum = 0.0);
+
+    bool lookup(const ContractTerms& terms, const PricingState& state, Kind kind, Greeks& result);
+    void insert(const ContractTerms& terms, const PricingState& state, Kind kind, const Greeks& result);
+
+    void clear();
+    void resetStats();
+    PricingCacheStats stats() const;
+
+    size_t capacity() const;
+    double marketQuantum() const;
+
+private:
+    struct Key {
+        uint8_t kind;
+        uint8_t option_type;
+        uint8_t is_american;
+        uint8_t model;
+        uint8_t lattice_scheme;
+        int binomial_steps;
+        double strike;
+        double time_to_expiry;
+        double jump_intensity;
+        double jump_mean;
+        double jump_volatility;
+        double spot;
+        double rate;
+        double vol;
+        double dividend;
+
+        bool operator==(const Key& other) const;
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const;
+    };
+
+    using Entry = std::pair<Key, Greeks>;
+
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> entries;  // Most recently used first
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+    };
+
+    static constexpr size_t kShards = 16;
+
+    size_t capacity_;
+    size_t shard_capacity_;
+    double market_quantum_;
+    std::array<Shard, kShards> shards_;
+
+    Key makeKey(const ContractTerms& terms, const PricingState& state, Kind kind) const;
+    Shard& shardFor(size_t hash);
+};
+
+#endif
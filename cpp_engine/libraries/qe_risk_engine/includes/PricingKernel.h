@@ -0,0 +1,230 @@
+#ifndef PRICINGKERNEL_H
+#define PRICINGKERNEL_H
+
+#include "BinomialTree.h"
+#include "BlackScholes.h"
+#include "Instrument.h"
+#include "JumpDiffusion.h"
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+// Pricing core of the vanilla options, specialized at compile time on
+// option type, pricing model and exercise style. Each Pricer is
+// straight-line code for one combination, so a loop over a homogeneous
+// group inlines it with no per-line branch on type or model. dispatch() is
+// the only place the three are branched on at run time; EuropeanOption,
+// AmericanOption and the risk engine's scenario loop all go through it.
+//
+// The functions take contract terms and market data as they are and do
+// no validation of their own beyond what the underlying models do;
+// callers check inputs and results.
+namespace PricingKernel {
+
+template <OptionType Type, PricingModel Model, ExerciseStyle Style>
+struct Pricer {
+    static_assert(Style == ExerciseStyle::European || Model == PricingModel::Binomial,
+                  "American options are only priced on the lattice");
+
+    static constexpr OptionType type = Type;
+    static constexpr PricingModel model = Model;
+    static constexpr ExerciseStyle style = Style;
+    static constexpr bool call = Type == OptionType::Call;
+    static constexpr bool american = Style == ExerciseStyle::American;
+
+    static double price(const ContractTerms& terms, double S, double r, double T, double sigma) {
+        if constexpr (Model == PricingModel::BlackScholes) {
+            if constexpr (call) {
+                return BlackScholes::callPrice(S, terms.strike, r, T, sigma);
+            } else {
+                return BlackScholes::putPrice(S, terms.strike, r, T, sigma);
+            }
+        } else if constexpr (Model == PricingModel::Binomial) {
+            if constexpr (american) {
+                return BinomialTree::americanOptionPrice(S, terms.strike, r, T, sigma, Type,
+                                                         terms.binomial_steps, terms.lattice_scheme);
+            } else {
+                return BinomialTree::europeanOptionPrice(S, terms.strike, r, T, sigma, Type,
+                                                         terms.binomial_steps, terms.lattice_scheme);
+            }
+        } else {
+            return JumpDiffusion::mertonOptionPrice(S, terms.strike, r, T, sigma, Type,
+                                                    terms.jump_intensity, terms.jump_mean,
+                                                    terms.jump_volatility);
+        }
+    }
+
+    static double price(const ContractTerms& terms, const MarketData& md) {
+        return price(terms, md.spot_price, md.risk_free_rate, terms.time_to_expiry, md.volatility);
+    }
+
+    // Lattice price without input checks, NaN on failure; see
+    // BinomialTree::europeanOptionPriceUnchecked.
+    static double latticePriceUnchecked(double S, double K, double r, double T, double sigma,
+                                        int steps, LatticeScheme scheme) {
+        static_assert(Model == PricingModel::Binomial, "Only lattice lines have an unchecked scalar tier");
+        if constexpr (american) {
+            return BinomialTree::americanOptionPriceUnchecked(S, K, r, T, sigma, Type, steps, scheme);
+        } else {
+            return BinomialTree::europeanOptionPriceUnchecked(S, K, r, T, sigma, Type, steps, scheme);
+        }
+    }
+
+    static double delta(const ContractTerms& terms, const MarketData& md) {
+        if constexpr (Model == PricingModel::BlackScholes) {
+            if constexpr (call) {
+                return BlackScholes::callDelta(md.spot_price, terms.strike, md.risk_free_rate,
+                                               terms.time_to_expiry, md.volatility);
+            } else {
+                return BlackScholes::putDelta(md.spot_price, terms.strike, md.risk_free_rate,
+                                              terms.time_to_expiry, md.volatility);
+            }
+        } else if constexpr (Model == PricingModel::Binomial) {
+            return lattice(terms, md).delta;
+        } else {
+            return merton(terms, md).delta;
+        }
+    }
+
+    static double gamma(const ContractTerms& terms, const MarketData& md) {
+        if constexpr (Model == PricingModel::BlackScholes) {
+            return BlackScholes::gamma(md.spot_price, terms.strike, md.risk_free_rate,
+                                       terms.time_to_expiry, md.volatility);
+        } else if constexpr (Model == PricingModel::Binomial) {
+            return lattice(terms, md).gamma;
+        } else {
+            return merton(terms, md).gamma;
+        }
+    }
+
+    static double vega(const ContractTerms& terms, const MarketData& md) {
+        if constexpr (Model == PricingModel::BlackScholes) {
+            return BlackScholes::vega(md.spot_price, terms.strike, md.risk_free_rate,
+                                      terms.time_to_expiry, md.volatility);
+        } else if constexpr (Model == PricingModel::Binomial) {
+            return vegaFromBumps(terms, md);
+        } else {
+            return merton(terms, md).vega;
+        }
+    }
+
+    static double theta(const ContractTerms& terms, const MarketData& md) {
+        if constexpr (Model == PricingModel::BlackScholes) {
+            if constexpr (call) {
+                return BlackScholes::callTheta(md.spot_price, terms.strike, md.risk_free_rate,
+                                               terms.time_to_expiry, md.volatility);
+            } else {
+                return BlackScholes::putTheta(md.spot_price, terms.strike, md.risk_free_rate,
+                                              terms.time_to_expiry, md.volatility);
+            }
+        } else {
+            return thetaFromBase(terms, md, price(terms, md));
+        }
+    }
+
+    // Price and every Greek, sharing work between them: lattice lines take
+    // price, delta and gamma off one tree and reuse its price for theta,
+    // and Merton lines sum the series once.
+    static Greeks greeks(const ContractTerms& terms, const MarketData& md) {
+        Greeks greeks;
+        if constexpr (Model == PricingModel::BlackScholes) {
+            greeks.price = price(terms, md);
+            greeks.delta = delta(terms, md);
+            greeks.gamma = gamma(terms, md);
+            greeks.vega = vega(terms, md);
+            greeks.theta = theta(terms, md);
+        } else if constexpr (Model == PricingModel::Binomial) {
+            const BinomialTree::LatticeGreeks base = lattice(terms, md);
+            greeks.price = base.price;
+            greeks.delta = base.delta;
+            greeks.gamma = base.gamma;
+            greeks.vega = vegaFromBumps(terms, md);
+            greeks.theta = thetaFromBase(terms, md, greeks.price);
+        } else {
+            const JumpDiffusion::MertonGreeks series = merton(terms, md);
+            greeks.price = series.price;
+            greeks.delta = series.delta;
+            greeks.gamma = series.gamma;
+            greeks.vega = series.vega;
+            greeks.theta = thetaFromBase(terms, md, greeks.price);
+        }
+        return greeks;
+    }
+
+private:
+    static BinomialTree::LatticeGreeks lattice(const ContractTerms& terms, const MarketData& md) {
+        return BinomialTree::optionGreeks(md.spot_price, terms.strike, md.risk_free_rate,
+                                          terms.time_to_expiry, md.volatility, Type,
+                                          terms.binomial_steps, american, terms.lattice_scheme);
+    }
+
+    static JumpDiffusion::MertonGreeks merton(const ContractTerms& terms, const MarketData& md) {
+        const JumpDiffusion::MertonSeries series(md.risk_free_rate, terms.time_to_expiry, md.volatility,
+                                                 terms.jump_intensity, terms.jump_mean,
+                                                 terms.jump_volatility);
+        return series.greeks(md.spot_price, terms.strike, Type);
+    }
+
+    // Central difference over a one-point vol bump, floored at zero vol.
+    static double vegaFromBumps(const ContractTerms& terms, const MarketData& md) {
+        const double bump = 0.01;
+        const double S = md.spot_price;
+        const double r = md.risk_free_rate;
+        const double T = terms.time_to_expiry;
+        const double price_up = price(terms, S, r, T, md.volatility + bump);
+        const double price_down = price(terms, S, r, T, std::max(0.0, md.volatility - bump));
+        return (price_up - price_down) / (2.0 * bump);
+    }
+
+    // One-day forward difference from current_price; zero inside the last day.
+    static double thetaFromBase(const ContractTerms& terms, const MarketData& md, double current_price) {
+        const double bump = 1.0 / 365.0;
+        if (terms.time_to_expiry < bump) {
+            return 0.0;
+        }
+        const double future_price = price(terms, md.spot_price, md.risk_free_rate,
+                                          std::max(0.0, terms.time_to_expiry - bump), md.volatility);
+        return (future_price - current_price) / bump;
+    }
+};
+
+namespace detail {
+
+template <PricingModel Model, ExerciseStyle Style, typename Visitor>
+decltype(auto) withType(OptionType type, Visitor&& visit) {
+    if (type == OptionType::Call) {
+        return visit(Pricer<OptionType::Call, Model, Style>());
+    }
+    return visit(Pricer<OptionType::Put, Model, Style>());
+}
+
+}
+
+// Calls visit with the Pricer for the given combination and returns what
+// it returns. American options always take the lattice, whatever model
+// says. Throws std::runtime_error for an unknown model.
+template <typename Visitor>
+decltype(auto) dispatch(OptionType type, PricingModel model, bool is_american, Visitor&& visit) {
+    if (is_american) {
+        return detail::withType<PricingModel::Binomial, ExerciseStyle::American>(type, visit);
+    }
+    switch (model) {
+    case PricingModel::BlackScholes:
+        return detail::withType<PricingModel::BlackScholes, ExerciseStyle::European>(type, visit);
+    case PricingModel::Binomial:
+        return detail::withType<PricingModel::Binomial, ExerciseStyle::European>(type, visit);
+    case PricingModel::MertonJumpDiffusion:
+        return detail::withType<PricingModel::MertonJumpDiffusion, ExerciseStyle::European>(type, visit);
+    default:
+        throw std::runtime_error("Unknown pricing model");
+    }
+}
+
+template <typename Visitor>
+decltype(auto) dispatch(const ContractTerms& terms, Visitor&& visit) {
+    return dispatch(terms.option_type, terms.model, terms.is_american, std::forward<Visitor>(visit));
+}
+
+}
+
+#endif
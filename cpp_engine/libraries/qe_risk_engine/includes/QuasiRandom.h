@@ -0,0 +1,41 @@
+#ifndef QUASIRANDOM_H
+#define QUASIRANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace QuasiRandom {
+    // Inverse of the standard normal CDF for p in (0, 1), accurate to
+    // about 1e-15. Returns -inf/+inf at 0/1 and NaN outside [0, 1].
+    double inverseNormal(double p);
+
+    // Sobol low-discrepancy sequence in base 2. Dimension 0 is the van der
+    // Corput sequence; every further dimension uses the next primitive
+    // polynomial over GF(2) in order of degree, with fixed pseudo-random
+    // initial direction numbers. Points are Owen-scrambled with a hashed
+    // nested uniform permutation, so sequences with different seeds are
+    // independent randomizations of the same net and their spread gives a
+    // standard error.
+    class SobolSequence {
+    public:
+        static constexpr size_t kMaxDimensions = 4096;
+
+        // Throws std::invalid_argument unless 0 < dimensions <= kMaxDimensions.
+        explicit SobolSequence(size_t dimensions);
+
+        size_t dimensions() const;
+
+        // Writes point `index` scrambled with `seed` to out[0..dimensions),
+        // each coordinate strictly inside (0, 1). Points are computed
+        // directly from the index, so any subset can be generated in any
+        // order or from several threads.
+        void point(uint32_t index, uint64_t seed, double* out) const;
+
+    private:
+        size_t dimensions_;
+        std::vector<uint32_t> directions_;  // [dimension][bit]
+    };
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef RETURNSSTORE_H
+#define RETURNSSTORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Read-only view of a binary file of daily log returns, one contiguous
+// column per asset over a shared calendar of dates. The file is memory
+// mapped and never parsed beyond its header and asset table, so opening
+// it costs the same for one year of history as for ten, and only the
+// pages of the columns a portfolio actually reads are ever loaded.
+//
+// Layout, little-endian:
+//
+//   offset 0   char[8]   magic "QERETS01"
+//              uint32    value size in bytes: 4 (float32) or 8 (float64)
+//              uint32    reserved, 0
+//              uint64    asset count
+//              uint64    date count
+//              uint64    offset of the asset table
+//              uint64    offset of the dates
+//              uint64    offset of the returns, a multiple of 64
+//   asset table: per asset, uint32 length then that many bytes of ID
+//   dates:       int32 per date, YYYYMMDD, ascending
+//   returns:     asset-major, column a at returns + a * dates * value size
+//
+// A NaN return marks a day the asset has no price for (e.g. before it
+// listed) and is read as no move.
+class ReturnsStore {
+public:
+    enum class ValueType : uint32_t {
+        Float32 = 4,
+        Float64 = 8
+    };
+
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    // Throws std::runtime_error if the file cannot be mapped or is not a
+    // well-formed returns file.
+    explicit ReturnsStore(const std::string& path);
+    ~ReturnsStore();
+
+    ReturnsStore(const ReturnsStore&) = delete;
+    ReturnsStore& operator=(const ReturnsStore&) = delete;
+
+    const std::string& path() const;
+    ValueType valueType() const;
+    size_t assetCount() const;
+    size_t dateCount() const;
+
+    const std::string& assetId(size_t asset) const;
+    size_t findAsset(const std::string& asset_id) const;  // npos if absent
+    int32_t date(size_t day) const;
+
+    double value(size_t asset, size_t day) const;
+
+    // out[k] = sum of the asset's returns over days [first_day + k,
+    // first_day + k + days), for k < count. Each window is summed on its
+    // own, so a window's result does not depend on how the range is split.
+    void windowReturns(size_t asset, size_t first_day, size_t count, size_t days, double* out) const;
+
+    // Writes a returns file. `returns` is asset-major, asset_ids.size() x
+    // dates.size(); float32 files store it rounded. Throws
+    // std::invalid_argument for inconsistent inputs and std::runtime_error
+    // if the file cannot be written.
+    static void write(
+        const std::string& path,
+        const std::vector<std::string>& asset_ids,
+        const std::vector<int32_t>& dates,
+        const std::vector<double>& returns,
+        ValueType type = ValueType::Float32
+    );
+
+private:
+    std::string path_;
+    const unsigned char* data_ = nullptr;
+    size_t size_ = 0;
+#if defined(_WIN32)
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+
+    ValueType value_type_ = ValueType::Float32;
+    size_t asset_count_ = 0;
+    size_t date_count_ = 0;
+    const unsigned char* dates_ = nullptr;
+    const unsigned char* returns_ = nullptr;
+    std::vector<std::string> asset_ids_;
+    std::unordered_map<std::string, size_t> index_;
+
+    void map();
+    void unmap();
+    void readHeader();
+};
+
+#endif
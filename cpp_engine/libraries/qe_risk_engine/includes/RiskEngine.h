@@ -1,9 +1,19 @@
 #ifndef RISKENGINE_H
 #define RISKENGINE_H
 
+#include "CorrelationModel.h"
 #include "Portfolio.h"
 #include "MarketData.h"
+#include "PnLSink.h"
+#include "PricingCache.h"
+#include "ReturnsStore.h"
+#include "RunArena.h"
+#include "RunControl.h"
+#include "RunStats.h"
+#include "TailStatistics.h"
+#include <cstdint>
 #include <map>
+#include <memory>
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -18,6 +28,8 @@ struct PortfolioRiskResult {
     double value_at_risk_99 = 0.0;
     double expected_shortfall_95 = 0.0;
     double expected_shortfall_99 = 0.0;
+    // One entry per level set with RiskEngine::setConfidenceLevels.
+    std::vector<TailMeasure> tail_measures;
     
     void reset() {
         total_pv = 0.0;
@@ -29,9 +41,15 @@ struct PortfolioRiskResult {
         value_at_risk_99 = 0.0;
         expected_shortfall_95 = 0.0;
         expected_shortfall_99 = 0.0;
+        tail_measures.clear();
     }
     
     bool isValid() const {
+        for (const TailMeasure& measure : tail_measures) {
+            if (!std::isfinite(measure.value_at_risk) || !std::isfinite(measure.expected_shortfall)) {
+                return false;
+            }
+        }
         return !std::isnan(total_pv) && !std::isnan(total_delta) && 
                !std::isnan(total_gamma) && !std::isnan(total_vega) && 
                !std::isnan(total_theta) && !std::isnan(value_at_risk_95) &&
@@ -45,11 +63,188 @@ struct PortfolioRiskResult {
     }
 };
 
+// How calculateRiskMetrics turns scenario moves into P&L.
+enum class VaRMethod {
+    FullRevaluation,  // Reprice every instrument on every path
+    DeltaGamma,       // Second-order expansion in spot around today's Greeks
+    DeltaGammaVega    // Adds a first-order vol term; needs setVolOfVol > 0
+};
+
+// How a line's implied vol moves with spot across scenarios, for assets
+// whose MarketData carries a vol surface. Sticky strike keeps each line on
+// today's vol at its strike; sticky moneyness re-reads the smile at the
+// strike with today's moneyness. Either way the vol shock scales the result.
+enum class VolSurfaceDynamics {
+    StickyStrike,
+    StickyMoneyness
+};
+
+// How scenario shocks are sampled. Pseudo-random draws are plain
+// independent normals. Antithetic sampling pairs every path with its
+// mirror image, which halves the fresh draws and cancels the odd-order
+// noise in the P&L. Sobol uses a scrambled low-discrepancy sequence, one
+// dimension per shock, mapped to normals through the inverse CDF; it
+// works best with a power-of-two number of paths per batch (see
+// VaRSamplingReport).
+enum class SamplingMethod {
+    PseudoRandom,
+    Antithetic,
+    Sobol
+};
+
+// Sampling error of the last run. Long enough runs are split into
+// `batches` independent batches of consecutive paths (each its own
+// scrambled sequence under Sobol), and each measure's standard error is
+// the spread of its batch estimates divided by sqrt(batches). batches is
+// 0, and the standard errors are left at 0, when the run has too few
+// paths to split.
+struct VaRSamplingReport {
+    bool computed = false;
+    SamplingMethod sampling_method = SamplingMethod::PseudoRandom;
+    bool control_variate = false;  // applied, not just requested
+    bool historical = false;       // scenarios came from setHistoricalReturns
+    int batches = 0;
+    double var_95_standard_error = 0.0;
+    double var_99_standard_error = 0.0;
+    double es_95_standard_error = 0.0;
+    double es_99_standard_error = 0.0;
+    // One entry per confidence level, with value_at_risk and
+    // expected_shortfall holding their standard errors.
+    std::vector<TailMeasure> standard_errors;
+};
+
+// Approximation error of the last DeltaGamma/DeltaGammaVega run, measured by
+// fully revaluing its first validation_paths scenarios. The VaR figures are
+// computed on that subset only, so they compare the two methods on equal
+// footing but are noisier than the headline VaR.
+struct VaRApproximationReport {
+    bool computed = false;
+    int validation_paths = 0;
+    double max_abs_pnl_error = 0.0;
+    double rms_pnl_error = 0.0;
+    double relative_rms_error = 0.0;  // RMS error / stddev of full P&L
+    double full_var_95 = 0.0;
+    double approx_var_95 = 0.0;
+    double full_var_99 = 0.0;
+    double approx_var_99 = 0.0;
+};
+
+// Euler allocation of one confidence level's VaR and ES to the portfolio
+// lines, indexed like Portfolio::getInstruments(). Component ES is minus
+// each line's mean P&L over the tail scenarios; component VaR is minus its
+// mean over the var_window_paths scenarios ranked nearest the VaR,
+// rescaled to add up to it. Components add up to value_at_risk and
+// expected_shortfall, which are the plain tail figures of the run's
+// scenarios (the headline figures unless a control variate reweighted
+// those). Marginals are per unit of quantity: component / quantity.
+struct RiskContribution {
+    double confidence = 0.0;
+    double value_at_risk = 0.0;
+    double expected_shortfall = 0.0;
+    int var_window_paths = 0;
+    std::vector<double> component_var;
+    std::vector<double> component_es;
+    std::vector<double> marginal_var;
+    std::vector<double> marginal_es;
+};
+
+// Contributions of the last run made with setComputeContributions(true):
+// 95%, 99%, then each other level set with setConfidenceLevels.
+struct VaRContributionReport {
+    bool computed = false;
+    std::vector<RiskContribution> levels;
+};
+
+// Where the time of the last run made with setCollectRunStats(true) went,
+// and the hot-path work it did. Phases are wall-clock milliseconds on the
+// calling thread, so with several workers simulation_ms is elapsed time,
+// not CPU time; counters add up every worker's. Validation covers the
+// parameter and market data checks, greeks today's price and Greeks of
+// every line, base_value the scenario setup and today's value on the
+// scenario pricers, simulation drawing and revaluing every path, and tails
+// reading VaR, ES, standard errors and contributions off the P&L. The
+// cached overload counts its repricing of stale assets as simulation.
+// arena_bytes is the run scratch handed out by the engine's arenas, and
+// arena_heap_blocks the heap blocks they had to add for it; a warm engine
+// running the same shape of portfolio again reports none.
+// collected stays false when the library was built without QE_RUN_STATS.
+struct RiskRunStats {
+    bool collected = false;
+    uint64_t paths = 0;
+    double validation_ms = 0.0;
+    double greeks_ms = 0.0;
+    double base_value_ms = 0.0;
+    double simulation_ms = 0.0;
+    double tail_ms = 0.0;
+    double total_ms = 0.0;
+    uint64_t arena_bytes = 0;
+    uint64_t arena_heap_blocks = 0;
+    RunCounters counters;
+};
+
+// Results of RiskEngine::calculateBatchRisk: one per book, in the order
+// given, and the firm total of all the books, all on the same scenarios.
+struct BatchRiskResult {
+    std::vector<PortfolioRiskResult> books;
+    PortfolioRiskResult total;
+    // Contracts priced per scenario once lines shared between books are
+    // merged.
+    size_t distinct_lines = 0;
+};
+
+// Per-asset results of the last calculatePortfolioRisk call made with this
+// cache, so the next call on the same portfolio only reprices assets whose
+// market data or line quantities have changed. A vol surface edited in
+// place counts as changed market data of every asset it is attached to. Keep one cache per
+// portfolio; it must not be used from two threads at once.
+class RiskRunCache {
+public:
+    void clear();
+    bool empty() const;
+    
+    // Assets repriced by the last call that used this cache.
+    size_t lastRepricedAssets() const;
+    
+private:
+    friend class RiskEngine;
+    
+    bool valid_ = false;
+    uint64_t portfolio_revision_ = 0;
+    
+    // Settings the cached scenarios were generated under.
+    int simulations_ = 0;
+    double time_horizon_days_ = 0.0;
+    bool fixed_seed_ = false;
+    uint64_t run_seed_ = 0;
+    VaRMethod var_method_ = VaRMethod::FullRevaluation;
+    double vol_of_vol_ = 0.0;
+    VolSurfaceDynamics vol_surface_dynamics_ = VolSurfaceDynamics::StickyStrike;
+    size_t validation_paths_ = 0;
+    SamplingMethod sampling_method_ = SamplingMethod::PseudoRandom;
+    bool control_variate_ = false;
+    std::shared_ptr<CorrelationModel> correlation_model_;
+    std::shared_ptr<ReturnsStore> historical_returns_;
+    int historical_lookback_days_ = 0;
+    size_t scenarios_ = 0;
+    
+    std::vector<int> line_quantity_;         // [line]
+    std::vector<uint64_t> asset_version_;    // [asset], MarketDataSnapshot::version
+    std::vector<uint64_t> asset_surface_revision_;  // [asset], ImpliedVolSurface::revision, 0 without one
+    std::vector<Greeks> asset_greeks_;       // [asset], quantity-weighted sums
+    std::vector<double> asset_base_value_;   // [asset], today's value on the scenario pricers
+    std::vector<std::vector<double>> asset_pnl_;             // [asset][path]
+    std::vector<std::vector<double>> asset_validation_pnl_;  // [asset][path], full revaluation
+    std::vector<double> asset_control_scale_;                 // [asset], control variate only
+    std::vector<std::vector<double>> asset_control_;          // [asset][path], control variate only
+    size_t last_repriced_assets_ = 0;
+};
+
 struct RiskMetrics {
     double var_95 = 0.0;
     double var_99 = 0.0;
     double es_95 = 0.0;
     double es_99 = 0.0;
+    std::vector<TailMeasure> tail_measures;
 };
 
 class RiskEngine {
@@ -62,6 +257,48 @@ public:
         const std::map<std::string, MarketData>& market_data_map
     );
     
+    // Same calculation against handle-indexed market data, e.g.
+    // MarketDataManager::getSnapshot(). Asset IDs are resolved once per
+    // distinct underlying; nothing after that touches a string.
+    PortfolioRiskResult calculatePortfolioRisk(
+        const Portfolio& portfolio,
+        const MarketDataSnapshot& market_data
+    );
+    
+    // Incremental form of the snapshot overload. Only assets whose
+    // MarketDataSnapshot::version or line quantities changed since the
+    // call that filled cache are repriced and resimulated; the totals and
+    // tail measures are recombined from the per-asset Greeks and scenario
+    // P&L cached for the rest. Adding or removing lines, or changing any
+    // setting other than the confidence levels, rebuilds the cache. The
+    // cached scenarios are reused until then even without a fixed seed.
+    // Results match the overload above up to summation order. With
+    // contributions on it is that overload, see setComputeContributions.
+    PortfolioRiskResult calculatePortfolioRisk(
+        const Portfolio& portfolio,
+        const MarketDataSnapshot& market_data,
+        RiskRunCache& cache
+    );
+    
+    // Risk of many books on one set of scenarios. Lines with the same
+    // ContractTerms on the same asset are priced once per scenario
+    // whichever books hold them, and each book's P&L is its quantities
+    // times those prices; lines without ContractTerms are priced once per
+    // instrument object. The firm total is the sum of the books. Books
+    // follow the engine's settings except that no control variate, P&L
+    // sink, contributions or approximation check are applied; the
+    // sampling report describes the firm total. The books must outlive
+    // the call and may not be modified during it.
+    BatchRiskResult calculateBatchRisk(
+        const std::vector<const Portfolio*>& books,
+        const std::map<std::string, MarketData>& market_data_map
+    );
+    
+    BatchRiskResult calculateBatchRisk(
+        const std::vector<const Portfolio*>& books,
+        const MarketDataSnapshot& market_data
+    );
+    
     void setVaRSimulations(int simulations);
     int getVaRSimulations() const;
     
@@ -70,30 +307,234 @@ public:
     
     void setRandomSeed(unsigned int seed);
     void setUseFixedSeed(bool use_fixed);
+    
+    // Number of worker threads used for VaR path simulation. 0 selects the
+    // hardware concurrency. Results under setRandomSeed are identical for
+    // every thread count.
+    void setNumThreads(int threads);
+    int getNumThreads() const;
+    
+    void setVaRMethod(VaRMethod method);
+    VaRMethod getVaRMethod() const;
+    
+    // Annualized lognormal volatility of each asset's implied vol. 0 (the
+    // default) keeps vol fixed across scenarios in every method.
+    void setVolOfVol(double vol_of_vol);
+    double getVolOfVol() const;
+    
+    // Only affects full revaluation; the Taylor modes expand around
+    // today's sticky-strike Greeks.
+    void setVolSurfaceDynamics(VolSurfaceDynamics dynamics);
+    VolSurfaceDynamics getVolSurfaceDynamics() const;
+    
+    void setSamplingMethod(SamplingMethod method);
+    SamplingMethod getSamplingMethod() const;
+    
+    // Delta control variate: each path's first-order P&L from today's
+    // deltas and its spot shocks is exactly normal, so its known tail
+    // probabilities are used to reweight the simulated P&L before VaR and
+    // ES are read off. Works with every sampling method and VaR method;
+    // it is skipped when the portfolio's delta exposure is zero.
+    void setUseControlVariate(bool use_control_variate);
+    bool getUseControlVariate() const;
+    
+    // Correlates the assets' spot shocks; null (the default) keeps them
+    // independent, and vol shocks stay independent either way. The model
+    // caches the factor for each portfolio's assets, so later runs and
+    // other engines sharing it skip the factorization. Replace the model
+    // to change the correlations.
+    void setCorrelationModel(std::shared_ptr<CorrelationModel> model);
+    std::shared_ptr<CorrelationModel> getCorrelationModel() const;
+    
+    // Historical VaR: instead of simulating, each scenario applies the sum
+    // of an asset's log returns over one window of time-horizon days to
+    // today's spot, for every overlapping window in the last lookback_days
+    // of the store (0 uses all of it). The time horizon must then be a
+    // whole number of days, vol stays at today's level, and the sampling
+    // method, control variate, correlation model and simulation count are
+    // ignored; the returns carry their own correlation. Every portfolio
+    // asset needs a column in the store. Null (the default) simulates.
+    void setHistoricalReturns(std::shared_ptr<ReturnsStore> store, int lookback_days = 0);
+    std::shared_ptr<ReturnsStore> getHistoricalReturns() const;
+    int getHistoricalLookbackDays() const;
+    
+    // Streams every scenario's P&L to sink, in chunks of consecutive paths,
+    // as the run produces them. Without a control variate the engine itself
+    // then keeps only the tails the VaR and ES read, so a run's memory no
+    // longer grows with the whole distribution; this holds with or without
+    // a sink. Runs of an empty or worthless portfolio write nothing. Null
+    // (the default) streams nowhere.
+    void setPnLSink(std::shared_ptr<PnLSink> sink);
+    std::shared_ptr<PnLSink> getPnLSink() const;
+    
+    // Keeps each line's P&L on the worst scenarios during the run and
+    // allocates VaR and ES to lines from them, see RiskContribution. This
+    // costs one extra value per line on those scenarios, about
+    // (1 - lowest level) x paths x lines doubles, and in full revaluation
+    // a per-line split of each scenario's pricing. The cached overload
+    // then runs in full, without reading or updating its cache. Off by
+    // default.
+    void setComputeContributions(bool compute);
+    bool getComputeContributions() const;
+    
+    // Times each phase of every run and counts the work its pricers and
+    // scenario stage do, see RiskRunStats. The cost is a clock read per
+    // phase and a thread-local increment per price or block of draws. Off
+    // by default.
+    void setCollectRunStats(bool collect);
+    bool getCollectRunStats() const;
+    
+    // Reports each run's scenario progress to control and stops the run
+    // with RiskRunCancelled once it is cancelled, see RunControl. Engines
+    // sharing a control must not run at the same time. Null (the default)
+    // runs to completion.
+    void setRunControl(std::shared_ptr<RunControl> control);
+    std::shared_ptr<RunControl> getRunControl() const;
+    
+    // Scenarios fully revalued in the approximate modes to fill the
+    // approximation report. 0 skips the check.
+    void setApproximationCheckPaths(int paths);
+    int getApproximationCheckPaths() const;
+    
+    // Confidence levels reported in PortfolioRiskResult::tail_measures, in
+    // the order given. The legacy 95%/99% fields are always filled.
+    void setConfidenceLevels(const std::vector<double>& levels);
+    const std::vector<double>& getConfidenceLevels() const;
+    
+    const VaRApproximationReport& getLastApproximationReport() const;
+    const VaRSamplingReport& getLastSamplingReport() const;
+    const VaRContributionReport& getLastContributionReport() const;
+    const RiskRunStats& getLastRunStats() const;
+    
+    // Optional cache, which any number of engines may share. The Greeks
+    // pass and today's valuation of lattice and jump-diffusion lines look
+    // results up in it; Black-Scholes batch groups, lines without
+    // ContractTerms and scenario revaluation bypass it. Off by default.
+    void setPricingCache(std::shared_ptr<PricingCache> cache);
+    std::shared_ptr<PricingCache> getPricingCache() const;
 
 private:
     int var_simulations_;
     double time_horizon_days_;
     unsigned int random_seed_;
     bool use_fixed_seed_;
+    int num_threads_;
+    VaRMethod var_method_;
+    double vol_of_vol_;
+    VolSurfaceDynamics vol_surface_dynamics_;
+    int approximation_check_paths_;
+    std::vector<double> confidence_levels_;
+    VaRApproximationReport last_approximation_report_;
+    SamplingMethod sampling_method_;
+    bool use_control_variate_;
+    VaRSamplingReport last_sampling_report_;
+    std::shared_ptr<CorrelationModel> correlation_model_;
+    std::shared_ptr<ReturnsStore> historical_returns_;
+    int historical_lookback_days_;
+    std::shared_ptr<PnLSink> pnl_sink_;
+    bool compute_contributions_;
+    VaRContributionReport last_contribution_report_;
+    std::shared_ptr<PricingCache> pricing_cache_;
+    bool collect_run_stats_;
+    RiskRunStats last_run_stats_;
+    std::shared_ptr<RunControl> run_control_;
+    // Scratch of the current run, reset when the next one starts; a copied
+    // engine gets arenas of its own.
+    RunArenas run_arenas_;
+    
+    // Quantity-weighted Greeks of each portfolio line, in portfolio order.
+    struct LineSensitivities {
+        std::vector<double> delta;
+        std::vector<double> gamma;
+        std::vector<double> vega;
+    };
+    
+    // Market data of each asset in the portfolio's symbol table, indexed
+    // like PortfolioColumns::lineAssets().
+    using AssetMarketData = std::vector<const MarketData*>;
+    
+    PortfolioRiskResult calculateResolvedRisk(
+        const Portfolio& portfolio,
+        const AssetMarketData& asset_market_data
+    );
+    
+    PortfolioRiskResult calculateIncrementalRisk(
+        const Portfolio& portfolio,
+        const AssetMarketData& asset_market_data,
+        const std::vector<uint64_t>& versions,
+        RiskRunCache& cache
+    );
+    
+    // Reprices and resimulates the lines of the selected assets into cache.
+    void refreshCachedAssets(
+        const Portfolio& portfolio,
+        const AssetMarketData& asset_market_data,
+        const std::vector<uint8_t>& selected,
+        RiskRunCache& cache
+    );
     
     RiskMetrics calculateRiskMetrics(
         const Portfolio& portfolio, 
-        const std::map<std::string, MarketData>& market_data_map
+        const AssetMarketData& asset_market_data,
+        const LineSensitivities& sensitivities
     );
     
+    // A book's (line, quantity) pairs over the unit lines of a merged
+    // portfolio.
+    using BookPositions = std::vector<std::pair<uint32_t, int>>;
+    
+    BatchRiskResult calculateResolvedBatchRisk(
+        const Portfolio& merged,
+        const std::vector<BookPositions>& books,
+        const AssetMarketData& asset_market_data
+    );
+    
+    // Tail metrics of every book, then of the firm total, with
+    // unit_sensitivities the Greeks of one unit of each merged line.
+    std::vector<RiskMetrics> calculateBatchMetrics(
+        const Portfolio& merged,
+        const std::vector<BookPositions>& books,
+        const AssetMarketData& asset_market_data,
+        const LineSensitivities& unit_sensitivities
+    );
+    
+    // Runs once per risk run, before any pricing. The scenario loop prices
+    // through the unchecked tier on the strength of it, so anything those
+    // pricers assume about market data must be checked here.
     void validateMarketData(
         const Portfolio& portfolio,
-        const std::map<std::string, MarketData>& market_data_map
+        const AssetMarketData& asset_market_data
     ) const;
     
     void validateParameters() const;
     
-    double calculateSingleInstrumentMetric(
+    // Where a PhaseTimer adds the time of phase for the current run, or
+    // null when the run is not collecting stats.
+    double* phaseClock(double RiskRunStats::*phase);
+    
+    // Correlation factor for the portfolio's assets in symbol table order,
+    // or null without a correlation model.
+    std::shared_ptr<const ShockFactor> shockFactor(const PortfolioColumns& columns) const;
+    
+    // Hands the recombined distribution of an incremental run to the sink,
+    // with the asset breakdown taken from cache.
+    void streamCachedPnL(
+        const PortfolioColumns& columns,
+        const RiskRunCache& cache,
+        const std::vector<double>& pnl_distribution
+    ) const;
+    
+    // Paths per run: the simulation count, or the number of historical
+    // windows. Throws std::invalid_argument if the history cannot cover
+    // the time horizon.
+    size_t scenarioCount() const;
+    
+    // Quantity-weighted price and Greeks of one line from a single
+    // computeAll call.
+    Greeks calculateInstrumentGreeks(
         const std::unique_ptr<Instrument>& instrument,
         int quantity,
-        const MarketData& md,
-        const std::string& metric_name
+        const MarketData& md
     ) const;
 };
 
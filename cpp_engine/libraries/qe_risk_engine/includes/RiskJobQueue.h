@@ -0,0 +1,171 @@
+#ifndef RISKJOBQUEUE_H
+#define RISKJOBQUEUE_H
+
+#include "MarketData.h"
+#include "Portfolio.h"
+#include "RiskEngine.h"
+#include "RunControl.h"
+#include "TailStatistics.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class RiskJobStatus {
+    Queued,
+    Running,
+    Completed,
+    Cancelled,
+    Failed
+};
+
+// Snapshot of a job. While it runs, estimates are read off the scenario
+// P&L produced so far, one per confidence level of the job's engine, with
+// intervals that narrow as paths come in; once it has finished they cover
+// every path the run got through. They are plain empirical figures: a
+// control variate only enters the final result. Empty until the first
+// block of paths is in.
+struct RiskJobProgress {
+    RiskJobStatus status = RiskJobStatus::Queued;
+    uint64_t paths_done = 0;
+    uint64_t paths_total = 0;
+    std::vector<TailEstimate> estimates;
+};
+
+class PnLCollector;
+
+// One risk run submitted to a RiskJobQueue. The job owns a copy of the
+// engine it was submitted with, the portfolio and the market data, so the
+// caller's objects are free as soon as submit() returns. Every method is
+// thread-safe.
+class RiskJob {
+public:
+    using JobId = uint64_t;
+
+    JobId id() const;
+    int priority() const;
+    RiskJobStatus status() const;
+    RiskJobProgress progress() const;
+
+    // A queued job is cancelled at once. A running one stops after the
+    // block of paths each worker is on, or after its Greeks pass if it
+    // has not reached its scenarios yet; one whose last blocks are already
+    // underway may still complete. Returns false if the job had already
+    // finished.
+    bool cancel();
+
+    bool finished() const;
+    // Blocks until the job has finished. Returns its result, or throws
+    // RiskRunCancelled if it was cancelled and std::runtime_error with
+    // its error if it failed.
+    PortfolioRiskResult wait() const;
+    // Returns whether the job finished within timeout.
+    bool waitFor(std::chrono::milliseconds timeout) const;
+    // Empty unless the job failed.
+    std::string error() const;
+
+    // The job's engine, for its reports once the job has finished. Its P&L
+    // sink is the job's own; one set on the submitted engine is not used.
+    const RiskEngine& engine() const;
+
+private:
+    friend class RiskJobQueue;
+
+    RiskJob(JobId id, int priority, const RiskEngine& engine, Portfolio portfolio,
+            std::map<std::string, MarketData> market_data);
+
+    void run();
+    // Moves a queued job to Running; false if it was cancelled meanwhile.
+    bool start();
+
+    const JobId id_;
+    const int priority_;
+    RiskEngine engine_;
+    Portfolio portfolio_;
+    std::map<std::string, MarketData> market_data_;
+    std::shared_ptr<RunControl> control_;
+    std::shared_ptr<PnLCollector> collector_;
+
+    mutable std::mutex mutex_;
+    mutable std::condition_variable done_;
+    RiskJobStatus status_ = RiskJobStatus::Queued;
+    PortfolioRiskResult result_;
+    std::string error_;
+    std::vector<TailEstimate> final_estimates_;
+};
+
+// Runs risk jobs in the background on a fixed pool of workers. Queued jobs
+// start in priority order, higher first, and in submission order among
+// equal priorities. Each job's engine also runs its scenarios on its own
+// threads, see RiskEngine::setNumThreads, so a pool of w workers can keep
+// w times that many threads busy. Jobs are kept until released, and
+// unknown IDs throw std::out_of_range. Every method is thread-safe.
+// Destroying the queue cancels every unfinished job and waits for the
+// running ones to stop.
+class RiskJobQueue {
+public:
+    using JobId = RiskJob::JobId;
+
+    // workers 0 selects the hardware concurrency. max_queued bounds the
+    // jobs waiting to start; 0 leaves it unbounded.
+    explicit RiskJobQueue(int workers = 1, size_t max_queued = 0);
+    ~RiskJobQueue();
+
+    RiskJobQueue(const RiskJobQueue&) = delete;
+    RiskJobQueue& operator=(const RiskJobQueue&) = delete;
+
+    // Queues a run of engine's configuration against portfolio and
+    // market_data. Throws std::runtime_error if max_queued jobs are
+    // already waiting.
+    std::shared_ptr<RiskJob> submit(
+        const RiskEngine& engine,
+        Portfolio portfolio,
+        std::map<std::string, MarketData> market_data,
+        int priority = 0
+    );
+
+    std::shared_ptr<RiskJob> job(JobId id) const;
+    bool contains(JobId id) const;
+    // Every job not yet released, in submission order.
+    std::vector<std::shared_ptr<RiskJob>> jobs() const;
+
+    // Forgets a finished job. Returns false, and keeps it, if it has not
+    // finished.
+    bool release(JobId id);
+
+    size_t queuedCount() const;
+    int workerCount() const;
+
+private:
+    struct Pending {
+        int priority;
+        uint64_t sequence;
+        std::shared_ptr<RiskJob> job;
+    };
+    // Orders the heap so the highest priority, earliest job is on top.
+    struct PendingOrder {
+        bool operator()(const Pending& a, const Pending& b) const;
+    };
+
+    mutable std::mutex mutex_;
+    std::condition_variable work_;
+    std::priority_queue<Pending, std::vector<Pending>, PendingOrder> pending_;
+    std::map<JobId, std::shared_ptr<RiskJob>> jobs_;
+    JobId next_id_ = 1;
+    size_t max_queued_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+
+    void workerLoop();
+    // Drops cancelled jobs from the heap. Needs mutex_.
+    void purgeCancelled();
+};
+
+#endif
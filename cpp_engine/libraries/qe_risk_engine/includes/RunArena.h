@@ -0,0 +1,75 @@
+#ifndef RUNARENA_H
+#define RUNARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Scratch memory of one risk run, handed out by bumping a pointer through
+// one block and given back all at once by reset(); deallocate does
+// nothing. A run that outgrows the block spills into extra heap blocks,
+// and the next reset() replaces them all with a single block big enough
+// for that run, so a warm arena serves a whole run without touching the
+// heap. Not thread-safe: each thread needs its own.
+class RunArena : public std::pmr::memory_resource {
+public:
+    explicit RunArena(size_t initial_bytes = 0);
+
+    RunArena(const RunArena&) = delete;
+    RunArena& operator=(const RunArena&) = delete;
+
+    // Invalidates everything handed out since the last reset.
+    void reset();
+    // Grows the block to at least bytes. Only valid straight after reset.
+    void reserve(size_t bytes);
+
+    // Bytes handed out since the last reset, padding included.
+    size_t used() const;
+    size_t capacity() const;
+    // Heap blocks allocated since the last reset: 0 for a warm arena.
+    uint64_t heapAllocations() const;
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    std::unique_ptr<std::byte[]> block_;
+    size_t capacity_ = 0;
+    size_t offset_ = 0;
+    std::vector<std::unique_ptr<std::byte[]>> spill_;
+    size_t spill_bytes_ = 0;
+    uint64_t heap_allocations_ = 0;
+};
+
+// The arenas a RiskEngine runs on: one for the calling thread and one per
+// worker, which each worker allocates from alone. A copy starts with
+// arenas of its own, so copied engines never share scratch.
+class RunArenas {
+public:
+    RunArenas() = default;
+    RunArenas(const RunArenas&);
+    RunArenas& operator=(const RunArenas&);
+
+    // Resets every arena at the start of a run. Blocks go to whichever
+    // worker is free, so each worker arena is sized for the busiest one.
+    void reset();
+    // Makes sure arenas exist for the given number of workers. Call it on
+    // the calling thread before starting them.
+    void reserveWorkers(size_t workers);
+
+    RunArena& caller();
+    RunArena& worker(size_t worker);
+
+    // Totals over every arena since the last reset.
+    size_t used() const;
+    uint64_t heapAllocations() const;
+
+private:
+    std::unique_ptr<RunArena> caller_ = std::make_unique<RunArena>();
+    std::vector<std::unique_ptr<RunArena>> workers_;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef RUNCONTROL_H
+#define RUNCONTROL_H
+
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+
+// Thrown out of a risk run whose RunControl was cancelled.
+class RiskRunCancelled : public std::runtime_error {
+public:
+    RiskRunCancelled();
+};
+
+// Lets another thread follow a risk run and stop it. The engine reports
+// each block of paths as it finishes and checks for cancellation before
+// starting the next, so a cancelled run stops within one block per worker
+// and throws RiskRunCancelled. Greeks and setup before the first block are
+// not interrupted. One control follows one run at a time.
+class RunControl {
+public:
+    // Safe to call from any thread, before or during the run.
+    void cancel();
+    bool cancelled() const;
+
+    uint64_t pathsDone() const;
+    // 0 until the run reaches its scenarios.
+    uint64_t pathsTotal() const;
+
+    // Called by the engine.
+    void begin(uint64_t paths_total);
+    void addPaths(uint64_t paths);
+    // Throws RiskRunCancelled once cancel() has been called.
+    void checkpoint() const;
+
+private:
+    std::atomic<bool> cancelled_{false};
+    std::atomic<uint64_t> paths_done_{0};
+    std::atomic<uint64_t> paths_total_{0};
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef RUNSTATS_H
+#define RUNSTATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Work done on the hot paths of a risk run, counted by the pricers and the
+// scenario stage on whichever thread does it.
+struct RunCounters {
+    uint64_t black_scholes_prices = 0;  // scalar and batch kernel prices
+    uint64_t lattice_prices = 0;        // binomial rollbacks, one per price or Greeks lattice
+    uint64_t lattice_nodes = 0;         // nodes visited by those rollbacks
+    uint64_t merton_prices = 0;         // jump-diffusion series evaluations
+    uint64_t rng_draws = 0;             // fresh normals or Sobol coordinates; mirrored draws are free
+    // Reallocations of the scratch buffers reused from path to path (lattice
+    // workspace, batch gather buffers, scenario grids) and the bytes they
+    // asked for. A warm engine should only show them on its first blocks.
+    uint64_t scratch_allocations = 0;
+    uint64_t scratch_bytes = 0;
+
+    RunCounters& operator+=(const RunCounters& other);
+};
+
+// Collection is compiled in when the library is built with QE_RUN_STATS
+// (the CMake option of the same name, on by default); without it the
+// counters and timers below compile to nothing. Even when compiled in,
+// nothing is counted on a thread unless a Scope has pointed it at
+// counters, so an idle thread pays one thread-local load per count.
+namespace RunStats {
+#if defined(QE_RUN_STATS)
+    constexpr bool kCompiled = true;
+#else
+    constexpr bool kCompiled = false;
+#endif
+
+    // The calling thread's counters, or null when it is not collecting.
+    extern thread_local RunCounters* active;
+
+    // Points the calling thread at counters (null stops collection) until
+    // the scope ends, then restores what it pointed at before.
+    class Scope {
+    public:
+        explicit Scope(RunCounters* counters);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        RunCounters* previous_;
+    };
+
+    // Adds the wall-clock milliseconds from construction to stop() (or
+    // destruction) to *elapsed_ms; a null target times nothing.
+    class PhaseTimer {
+    public:
+        explicit PhaseTimer(double* elapsed_ms);
+        ~PhaseTimer();
+
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+        void stop();
+
+    private:
+        double* elapsed_ms_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // resize() of a reused scratch buffer, counting the reallocation when
+    // it outgrows its capacity. When it does, room for at least `capacity`
+    // elements is made, so a buffer whose largest size is known up front
+    // grows once however its sizes arrive. Works for arena-backed std::pmr
+    // vectors too.
+    template <typename T, typename Allocator>
+    void resizeScratch(std::vector<T, Allocator>& buffer, size_t size, size_t capacity = 0) {
+        if (size > buffer.capacity()) {
+            const size_t reserved = size > capacity ? size : capacity;
+#if defined(QE_RUN_STATS)
+            if (RunCounters* counters = active) {
+                ++counters->scratch_allocations;
+                counters->scratch_bytes += reserved * sizeof(T);
+            }
+#endif
+            buffer.reserve(reserved);
+        }
+        buffer.resize(size);
+    }
+}
+
+#if defined(QE_RUN_STATS)
+#define QE_COUNT(field, amount)                                   \
+    do {                                                          \
+        if (RunCounters* qe_run_counters = RunStats::active) {    \
+            qe_run_counters->field += (amount);                   \
+        }                                                         \
+    } while (0)
+#else
+#define QE_COUNT(field, amount) \
+    do {                        \
+    } while (0)
+#endif
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef TAILSTATISTICS_H
+#define TAILSTATISTICS_H
+
+#include <cstddef>
+#include <vector>
+
+// VaR and expected shortfall of a P&L sample at one confidence level. Both
+// are reported as positive losses.
+struct TailMeasure {
+    double confidence = 0.0;
+    double value_at_risk = 0.0;
+    double expected_shortfall = 0.0;
+};
+
+// A TailMeasure read off a sample that may still be growing, with
+// approximate confidence intervals around both figures.
+struct TailEstimate {
+    double confidence = 0.0;
+    double value_at_risk = 0.0;
+    double var_lower = 0.0;
+    double var_upper = 0.0;
+    double expected_shortfall = 0.0;
+    double es_lower = 0.0;
+    double es_upper = 0.0;
+};
+
+namespace TailStatistics {
+    // Index of the VaR order statistic in an ascending sample of n values:
+    // floor((1 - confidence) * n), clamped to the sample.
+    size_t tailIndex(double confidence, size_t n);
+
+    // Throws std::invalid_argument unless every level lies in (0, 1).
+    void validateConfidenceLevels(const std::vector<double>& confidence_levels);
+
+    // Computes VaR and ES for every level from a single tail partition.
+    // Uses nth_element on successively shorter prefixes instead of a full
+    // sort, so the cost is O(n) plus the size of the deepest tail. pnl is
+    // reordered in place. Results are returned in the order of
+    // confidence_levels.
+    std::vector<TailMeasure> computeTailMeasures(
+        std::vector<double>& pnl,
+        const std::vector<double>& confidence_levels
+    );
+
+    // computeTailMeasures with intervals at interval_level: VaR between
+    // the order statistics a normal approximation to the binomial count
+    // below the quantile allows, ES plus or minus its asymptotic standard
+    // error, sqrt((tail variance + c (ES - VaR)^2) / tail size). Meant for
+    // judging how far a run has converged, so the intervals are only as
+    // good as those approximations on a small tail. pnl is reordered in
+    // place.
+    std::vector<TailEstimate> estimateTailMeasures(
+        std::vector<double>& pnl,
+        const std::vector<double>& confidence_levels,
+        double interval_level = 0.95
+    );
+
+    // Same measures with a control variate of known distribution:
+    // control[i] is a N(0, control_sd^2) draw taken on the same path as
+    // pnl[i]. For each level the paths are reweighted so the share of them
+    // in the control's own tail at that level matches its exact
+    // probability, which is a control variate on the tail indicator, and
+    // VaR and ES are read off the weighted sample. Levels where no path
+    // (or every path) is in the control's tail keep equal weights, which
+    // reproduces computeTailMeasures. Sorts a copy of the sample.
+    std::vector<TailMeasure> computeControlledTailMeasures(
+        const double* pnl,
+        const double* control,
+        size_t n,
+        double control_sd,
+        const std::vector<double>& confidence_levels
+    );
+
+    // computeTailMeasures for a sample of known size that arrives in
+    // pieces. Only the worst outcomes the deepest level needs are kept,
+    // so memory follows (1 - lowest level) x sample size rather than the
+    // whole sample. The kept tail is sorted before it is summed, so the
+    // measures do not depend on the order the pieces arrive in; they
+    // match computeTailMeasures up to that summation order.
+    class TailAccumulator {
+    public:
+        TailAccumulator(const std::vector<double>& confidence_levels, size_t sample_size);
+
+        // Throws std::invalid_argument past sample_size values.
+        void add(const double* pnl, size_t n);
+        size_t count() const;
+
+        // Throws std::runtime_error until all sample_size values are in.
+        std::vector<TailMeasure> measures() const;
+
+    private:
+        std::vector<double> confidence_levels_;
+        std::vector<size_t> indices_;  // [level], tailIndex in the whole sample
+        size_t sample_size_ = 0;
+        size_t keep_ = 0;              // worst outcomes any level reads
+        size_t count_ = 0;
+        std::vector<double> kept_;     // holds up to 2 * keep_ before compact()
+        bool full_ = false;            // kept_ has held keep_ values once
+        double threshold_ = 0.0;       // largest kept value once full_
+
+        void compact();
+    };
+}
+
+#endif
@@ -0,0 +1,38 @@
+#include "AssetSymbolTable.h"
+#include <stdexcept>
+
+uint32_t AssetSymbolTable::intern(const std::string& asset_id) {
+    auto it = index_by_symbol_.find(asset_id);
+    if (it != index_by_symbol_.end()) {
+        return it->second;
+    }
+    if (symbols_.size() >= npos) {
+        throw std::overflow_error("Too many distinct assets");
+    }
+
+    const uint32_t index = static_cast<uint32_t>(symbols_.size());
+    symbols_.push_back(asset_id);
+    index_by_symbol_.emplace(asset_id, index);
+    return index;
+}
+
+uint32_t AssetSymbolTable::find(const std::string& asset_id) const {
+    auto it = index_by_symbol_.find(asset_id);
+    return it == index_by_symbol_.end() ? npos : it->second;
+}
+
+const std::string& AssetSymbolTable::symbol(uint32_t index) const {
+    if (index >= symbols_.size()) {
+        throw std::out_of_range("Asset index out of range");
+    }
+    return symbols_[index];
+}
+
+size_t AssetSymbolTable::size() const {
+    return symbols_.size();
+}
+
+void AssetSymbolTable::clear() {
+    index_by_symbol_.clear();
+    symbols_.clear();
+}
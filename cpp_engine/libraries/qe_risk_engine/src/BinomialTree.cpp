@@ -1,14 +1,15 @@
 #include "BinomialTree.h"
+#include "RunStats.h"
 #include <cmath>
 #include <algorithm>
+#include <limits>
 #include <stdexcept>
 
 namespace BinomialTree {
 
-double europeanOptionPrice(
-    double S, double K, double r, double T, double sigma,
-    OptionType type, int steps
-) {
+namespace {
+
+void validateInputs(double S, double K, double T, double sigma, int steps) {
     if (S <= 0.0 || K <= 0.0) {
         throw std::invalid_argument("Stock price and strike must be positive");
     }
@@ -21,164 +22,421 @@ double europeanOptionPrice(
     if (steps < 1) {
         throw std::invalid_argument("Number of steps must be positive");
     }
+}
+
+// Peizer-Pratt method 2 inversion used by Leisen-Reimer to map a normal
+// quantile to a binomial probability.
+double peizerPratt(double z, int n) {
+    const double denom = n + 1.0 / 3.0 + 0.1 / (n + 1.0);
+    const double root = std::sqrt(0.25 - 0.25 * std::exp(-(z / denom) * (z / denom) * (n + 1.0 / 6.0)));
+    return z >= 0.0 ? 0.5 + root : 0.5 - root;
+}
+
+struct LatticeParameters {
+    int steps;
+    double u;
+    double d;
+    double disc_p;  // discount * p
+    double disc_q;  // discount * (1 - p)
+};
+
+// Returns false when the lattice has no valid risk-neutral probability.
+bool tryLatticeParameters(
+    double S, double K, double r, double T, double sigma,
+    int steps, LatticeScheme scheme, LatticeParameters& params
+) {
+    double p = 0.0;
     
-    if (T == 0.0) {
-        if (type == OptionType::Call) {
-            return std::max(0.0, S - K);
-        } else {
-            return std::max(0.0, K - S);
-        }
+    if (scheme == LatticeScheme::LeisenReimer) {
+        // Leisen-Reimer needs an odd number of steps so the strike sits
+        // between two terminal nodes.
+        params.steps = steps % 2 == 0 ? steps + 1 : steps;
+        const double dt = T / params.steps;
+        const double growth = std::exp(r * dt);
+        const double vol_sqrt_T = sigma * std::sqrt(T);
+        const double d1 = (std::log(S / K) + (r + 0.5 * sigma * sigma) * T) / vol_sqrt_T;
+        const double d2 = d1 - vol_sqrt_T;
+        p = peizerPratt(d2, params.steps);
+        const double p_star = peizerPratt(d1, params.steps);
+        params.u = growth * p_star / p;
+        params.d = (growth - p * params.u) / (1.0 - p);
+    } else {
+        params.steps = steps;
+        const double dt = T / steps;
+        params.u = std::exp(sigma * std::sqrt(dt));
+        params.d = 1.0 / params.u;
+        p = (std::exp(r * dt) - params.d) / (params.u - params.d);
     }
     
-    const double dt = T / steps;
-    const double u = std::exp(sigma * std::sqrt(dt));
-    const double d = 1.0 / u;
-    const double p = (std::exp(r * dt) - d) / (u - d);
-    const double discount = std::exp(-r * dt);
+    // Written so that a NaN probability fails too.
+    if (!(p >= 0.0 && p <= 1.0)) {
+        return false;
+    }
     
-    if (p < 0.0 || p > 1.0) {
+    const double discount = std::exp(-r * T / params.steps);
+    params.disc_p = discount * p;
+    params.disc_q = discount * (1.0 - p);
+    return true;
+}
+
+LatticeParameters latticeParameters(
+    double S, double K, double r, double T, double sigma,
+    int steps, LatticeScheme scheme
+) {
+    LatticeParameters params;
+    if (!tryLatticeParameters(S, K, r, T, sigma, steps, scheme, params)) {
         throw std::runtime_error("Invalid probability in binomial tree");
     }
+    return params;
+}
+
+// Scratch space reused by every lattice evaluation on the same thread, so
+// repricing inside the VaR loop does not allocate.
+struct LatticeWorkspace {
+    std::vector<double> values;
+    std::vector<double> spots;
+};
+
+LatticeWorkspace& workspace() {
+    thread_local LatticeWorkspace ws;
+    return ws;
+}
+
+// Option values at levels 1 and 2, for reading off delta and gamma.
+struct TopLevels {
+    double level1[2] = {0.0, 0.0};
+    double level2[3] = {0.0, 0.0, 0.0};
+};
+
+// Backward induction shared by every pricer. Node (step, i) sits at
+// S * u^(step - i) * d^i; moving one level back divides every spot by u,
+// so the inner loop needs no pow or exp. The payoff is written as
+// sign * (spot - K) and maxed against the continuation value, which is
+// never negative, so the exercise test is a plain select the compiler can
+// vectorize.
+double rollback(
+    double S, double K, OptionType type, bool is_american,
+    const LatticeParameters& params, TopLevels* top
+) {
+    const int n = params.steps;
+    const double sign = type == OptionType::Call ? 1.0 : -1.0;
+    const double ratio = params.d / params.u;
+    const double inv_u = 1.0 / params.u;
+    const double disc_p = params.disc_p;
+    const double disc_q = params.disc_q;
     
-    std::vector<double> prices(steps + 1);
+    LatticeWorkspace& ws = workspace();
+    RunStats::resizeScratch(ws.values, static_cast<size_t>(n) + 1);
+    RunStats::resizeScratch(ws.spots, static_cast<size_t>(n) + 1);
+    QE_COUNT(lattice_prices, 1);
+    QE_COUNT(lattice_nodes, (static_cast<uint64_t>(n) + 1) * (static_cast<uint64_t>(n) + 2) / 2);
+    double* values = ws.values.data();
+    double* spots = ws.spots.data();
     
-    for (int i = 0; i <= steps; ++i) {
-        double spot_at_maturity = S * std::pow(u, steps - i) * std::pow(d, i);
-        
-        if (type == OptionType::Call) {
-            prices[i] = std::max(0.0, spot_at_maturity - K);
-        } else {
-            prices[i] = std::max(0.0, K - spot_at_maturity);
-        }
+    spots[0] = S * std::pow(params.u, n);
+    for (int i = 1; i <= n; ++i) {
+        spots[i] = spots[i - 1] * ratio;
+    }
+    for (int i = 0; i <= n; ++i) {
+        values[i] = std::max(0.0, sign * (spots[i] - K));
     }
     
-    for (int step = steps - 1; step >= 0; --step) {
-        for (int i = 0; i <= step; ++i) {
-            prices[i] = discount * (p * prices[i] + (1.0 - p) * prices[i + 1]);
+    auto keep = [&](int step) {
+        if (!top) {
+            return;
+        }
+        if (step == 2) {
+            std::copy(values, values + 3, top->level2);
+        } else if (step == 1) {
+            std::copy(values, values + 2, top->level1);
         }
+    };
+    keep(n);
+    
+    for (int step = n - 1; step >= 0; --step) {
+        if (is_american) {
+            for (int i = 0; i <= step; ++i) {
+                spots[i] *= inv_u;
+                const double hold_value = disc_p * values[i] + disc_q * values[i + 1];
+                const double exercise_value = sign * (spots[i] - K);
+                values[i] = hold_value > exercise_value ? hold_value : exercise_value;
+            }
+        } else {
+            for (int i = 0; i <= step; ++i) {
+                values[i] = disc_p * values[i] + disc_q * values[i + 1];
+            }
+        }
+        keep(step);
     }
     
-    return prices[0];
+    return values[0];
 }
 
-double americanOptionPrice(
+double intrinsic(double S, double K, OptionType type) {
+    return type == OptionType::Call ? std::max(0.0, S - K) : std::max(0.0, K - S);
+}
+
+double uncheckedPrice(
     double S, double K, double r, double T, double sigma,
-    OptionType type, int steps
+    OptionType type, int steps, LatticeScheme scheme, bool is_american
 ) {
-    if (S <= 0.0 || K <= 0.0) {
-        throw std::invalid_argument("Stock price and strike must be positive");
+    if (T == 0.0) {
+        return intrinsic(S, K, type);
     }
-    if (T < 0.0) {
-        throw std::invalid_argument("Time to expiry cannot be negative");
+    
+    LatticeParameters params;
+    if (!tryLatticeParameters(S, K, r, T, sigma, steps, scheme, params)) {
+        return std::numeric_limits<double>::quiet_NaN();
     }
-    if (sigma < 0.0) {
-        throw std::invalid_argument("Volatility cannot be negative");
+    return rollback(S, K, type, is_american, params, nullptr);
+}
+
+}
+
+double europeanOptionPrice(
+    double S, double K, double r, double T, double sigma,
+    OptionType type, int steps, LatticeScheme scheme
+) {
+    validateInputs(S, K, T, sigma, steps);
+    
+    if (T == 0.0) {
+        return intrinsic(S, K, type);
     }
-    if (steps < 1) {
-        throw std::invalid_argument("Number of steps must be positive");
+    
+    const LatticeParameters params = latticeParameters(S, K, r, T, sigma, steps, scheme);
+    return rollback(S, K, type, false, params, nullptr);
+}
+
+double americanOptionPrice(
+    double S, double K, double r, double T, double sigma,
+    OptionType type, int steps, LatticeScheme scheme
+) {
+    validateInputs(S, K, T, sigma, steps);
+    
+    if (T == 0.0) {
+        return intrinsic(S, K, type);
     }
     
+    const LatticeParameters params = latticeParameters(S, K, r, T, sigma, steps, scheme);
+    return rollback(S, K, type, true, params, nullptr);
+}
+
+double europeanOptionPriceUnchecked(
+    double S, double K, double r, double T, double sigma,
+    OptionType type, int steps, LatticeScheme scheme
+) {
+    return uncheckedPrice(S, K, r, T, sigma, type, steps, scheme, false);
+}
+
+double americanOptionPriceUnchecked(
+    double S, double K, double r, double T, double sigma,
+    OptionType type, int steps, LatticeScheme scheme
+) {
+    return uncheckedPrice(S, K, r, T, sigma, type, steps, scheme, true);
+}
+
+LatticeGreeks optionGreeks(
+    double S, double K, double r, double T, double sigma,
+    OptionType type, int steps, bool is_american, LatticeScheme scheme
+) {
+    validateInputs(S, K, T, sigma, steps);
+    
+    LatticeGreeks greeks{0.0, 0.0, 0.0};
+    
     if (T == 0.0) {
+        greeks.price = intrinsic(S, K, type);
         if (type == OptionType::Call) {
-            return std::max(0.0, S - K);
+            greeks.delta = S > K ? 1.0 : 0.0;
         } else {
-            return std::max(0.0, K - S);
+            greeks.delta = S < K ? -1.0 : 0.0;
         }
+        return greeks;
     }
     
-    const double dt = T / steps;
-    const double u = std::exp(sigma * std::sqrt(dt));
-    const double d = 1.0 / u;
-    const double p = (std::exp(r * dt) - d) / (u - d);
-    const double discount = std::exp(-r * dt);
+    const LatticeParameters params = latticeParameters(S, K, r, T, sigma, steps, scheme);
+    TopLevels top;
+    greeks.price = rollback(S, K, type, is_american, params, &top);
     
-    if (p < 0.0 || p > 1.0) {
-        throw std::runtime_error("Invalid probability in binomial tree");
+    // Level 1 nodes sit at S*u and S*d; level 2 at S*u^2, S*u*d and S*d^2.
+    const double u = params.u;
+    const double d = params.d;
+    greeks.delta = (top.level1[0] - top.level1[1]) / (S * u - S * d);
+    
+    if (params.steps >= 2) {
+        const double s_uu = S * u * u;
+        const double s_ud = S * u * d;
+        const double s_dd = S * d * d;
+        const double delta_up = (top.level2[0] - top.level2[1]) / (s_uu - s_ud);
+        const double delta_down = (top.level2[1] - top.level2[2]) / (s_ud - s_dd);
+        greeks.gamma = (delta_up - delta_down) / (0.5 * (s_uu - s_dd));
+    }
+    
+    return greeks;
+}
+
+namespace {
+
+void validateTreeInputs(double S, double K, double T, double sigma, int steps) {
+    validateInputs(S, K, T, sigma, steps);
+    if (T == 0.0 || sigma == 0.0) {
+        throw std::invalid_argument("Building a tree requires positive time to expiry and volatility");
+    }
+}
+
+// S * u^k for k = -steps..steps; node (step, i) sits at k = step - 2i.
+std::vector<double> spotLevels(double S, const LatticeParameters& params) {
+    const int n = params.steps;
+    std::vector<double> levels(2 * n + 1);
+    for (int k = -n; k <= n; ++k) {
+        levels[k + n] = S * std::pow(params.u, k);
     }
+    return levels;
+}
+
+// Backward induction over a CRR lattice that reports every node's value
+// and exercise decision to visit(step, i, value, exercised), so callers
+// decide how much of the tree to keep. Only one level of values is live
+// at a time.
+template <typename Visitor>
+void rollbackNodes(
+    double K, OptionType type, bool is_american, const LatticeParameters& params,
+    const std::vector<double>& spot_levels, Visitor&& visit
+) {
+    const int n = params.steps;
+    const double sign = type == OptionType::Call ? 1.0 : -1.0;
+    const double* level_spot = spot_levels.data() + n;
     
-    std::vector<double> prices(steps + 1);
-    std::vector<double> spots(steps + 1);
+    LatticeWorkspace& ws = workspace();
+    ws.values.resize(n + 1);
+    double* values = ws.values.data();
     
-    for (int i = 0; i <= steps; ++i) {
-        spots[i] = S * std::pow(u, steps - i) * std::pow(d, i);
-        
-        if (type == OptionType::Call) {
-            prices[i] = std::max(0.0, spots[i] - K);
-        } else {
-            prices[i] = std::max(0.0, K - spots[i]);
-        }
+    for (int i = 0; i <= n; ++i) {
+        values[i] = std::max(0.0, sign * (level_spot[n - 2 * i] - K));
+        visit(n, i, values[i], false);
     }
     
-    for (int step = steps - 1; step >= 0; --step) {
+    for (int step = n - 1; step >= 0; --step) {
         for (int i = 0; i <= step; ++i) {
-            spots[i] = S * std::pow(u, step - i) * std::pow(d, i);
-            
-            double hold_value = discount * (p * prices[i] + (1.0 - p) * prices[i + 1]);
-            
-            double exercise_value;
-            if (type == OptionType::Call) {
-                exercise_value = std::max(0.0, spots[i] - K);
-            } else {
-                exercise_value = std::max(0.0, K - spots[i]);
-            }
-            
-            prices[i] = std::max(hold_value, exercise_value);
+            const double hold_value = params.disc_p * values[i] + params.disc_q * values[i + 1];
+            const double exercise_value = std::max(0.0, sign * (level_spot[step - 2 * i] - K));
+            const bool exercised = is_american && exercise_value > hold_value;
+            values[i] = exercised ? exercise_value : hold_value;
+            visit(step, i, values[i], exercised);
         }
     }
-    
-    return prices[0];
 }
 
-std::vector<std::vector<TreeNode>> buildTree(
+}
+
+size_t FlatTree::index(int step, int i) {
+    return static_cast<size_t>(step) * (step + 1) / 2 + i;
+}
+
+size_t FlatTree::nodeCount() const {
+    return option_values.size();
+}
+
+double FlatTree::stockPrice(int step, int i) const {
+    return spot_levels[steps + step - 2 * i];
+}
+
+double FlatTree::optionValue(int step, int i) const {
+    return option_values[index(step, i)];
+}
+
+bool FlatTree::exerciseOptimal(int step, int i) const {
+    const size_t bit = index(step, i);
+    return (exercise_bits[bit / 64] >> (bit % 64)) & 1u;
+}
+
+TreeNode FlatTree::node(int step, int i) const {
+    return TreeNode{stockPrice(step, i), optionValue(step, i), exerciseOptimal(step, i)};
+}
+
+FlatTree buildFlatTree(
     double S, double K, double r, double T, double sigma,
     OptionType type, int steps, bool is_american
 ) {
-    std::vector<std::vector<TreeNode>> tree(steps + 1);
+    validateTreeInputs(S, K, T, sigma, steps);
     
-    const double dt = T / steps;
-    const double u = std::exp(sigma * std::sqrt(dt));
-    const double d = 1.0 / u;
-    const double p = (std::exp(r * dt) - d) / (u - d);
-    const double discount = std::exp(-r * dt);
+    const LatticeParameters params = latticeParameters(
+        S, K, r, T, sigma, steps, LatticeScheme::CoxRossRubinstein);
     
-    for (int step = 0; step <= steps; ++step) {
-        tree[step].resize(step + 1);
-        for (int i = 0; i <= step; ++i) {
-            tree[step][i].stock_price = S * std::pow(u, step - i) * std::pow(d, i);
-        }
-    }
+    FlatTree tree;
+    tree.steps = params.steps;
+    tree.spot_levels = spotLevels(S, params);
     
-    for (int i = 0; i <= steps; ++i) {
-        double spot = tree[steps][i].stock_price;
-        if (type == OptionType::Call) {
-            tree[steps][i].option_value = std::max(0.0, spot - K);
-        } else {
-            tree[steps][i].option_value = std::max(0.0, K - spot);
-        }
-        tree[steps][i].exercise_optimal = false;
+    const size_t nodes = FlatTree::index(params.steps + 1, 0);
+    tree.option_values.resize(nodes);
+    tree.exercise_bits.assign((nodes + 63) / 64, 0);
+    
+    double* values = tree.option_values.data();
+    uint64_t* bits = tree.exercise_bits.data();
+    
+    rollbackNodes(K, type, is_american, params, tree.spot_levels,
+        [&](int step, int i, double value, bool exercised) {
+            const size_t idx = FlatTree::index(step, i);
+            values[idx] = value;
+            if (exercised) {
+                bits[idx / 64] |= uint64_t(1) << (idx % 64);
+            }
+        });
+    
+    return tree;
+}
+
+ExerciseBoundary exerciseBoundary(
+    double S, double K, double r, double T, double sigma,
+    OptionType type, int steps
+) {
+    validateTreeInputs(S, K, T, sigma, steps);
+    
+    const LatticeParameters params = latticeParameters(
+        S, K, r, T, sigma, steps, LatticeScheme::CoxRossRubinstein);
+    const std::vector<double> spot_levels = spotLevels(S, params);
+    const double* level_spot = spot_levels.data() + params.steps;
+    const bool is_call = type == OptionType::Call;
+    
+    ExerciseBoundary boundary;
+    boundary.time.resize(params.steps + 1);
+    boundary.critical_spot.assign(params.steps + 1, std::numeric_limits<double>::quiet_NaN());
+    
+    const double dt = T / params.steps;
+    for (int step = 0; step <= params.steps; ++step) {
+        boundary.time[step] = step * dt;
     }
     
-    for (int step = steps - 1; step >= 0; --step) {
+    double* critical = boundary.critical_spot.data();
+    rollbackNodes(K, type, true, params, spot_levels,
+        [&](int step, int i, double, bool exercised) {
+            if (!exercised) {
+                return;
+            }
+            const double spot = level_spot[step - 2 * i];
+            double& current = critical[step];
+            if (std::isnan(current) || (is_call ? spot < current : spot > current)) {
+                current = spot;
+            }
+        });
+    
+    return boundary;
+}
+
+std::vector<std::vector<TreeNode>> buildTree(
+    double S, double K, double r, double T, double sigma,
+    OptionType type, int steps, bool is_american
+) {
+    const FlatTree flat = buildFlatTree(S, K, r, T, sigma, type, steps, is_american);
+    
+    std::vector<std::vector<TreeNode>> tree(flat.steps + 1);
+    for (int step = 0; step <= flat.steps; ++step) {
+        tree[step].reserve(step + 1);
         for (int i = 0; i <= step; ++i) {
-            double hold_value = discount * (
-                p * tree[step + 1][i].option_value + 
-                (1.0 - p) * tree[step + 1][i + 1].option_value
-            );
-            
-            double exercise_value = 0.0;
-            if (type == OptionType::Call) {
-                exercise_value = std::max(0.0, tree[step][i].stock_price - K);
-                } else {
-            exercise_value = std::max(0.0, K - tree[step][i].stock_price);
-                }
-                if (is_american && exercise_value > hold_value) {
-            tree[step][i].option_value = exercise_value;
-            tree[step][i].exercise_optimal = true;
-        } else {
-            tree[step][i].option_value = hold_value;
-            tree[step][i].exercise_optimal = false;
+            tree[step].push_back(flat.node(step, i));
         }
-    }}
+    }
+    
+    return tree;
+}
 
-return tree;}
-}
\ No newline at end of file
+}
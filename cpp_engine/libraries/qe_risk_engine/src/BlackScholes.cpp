@@ -1,4 +1,5 @@
 #include "BlackScholes.h"
+#include "RunStats.h"
 #include <cmath>
 #include <algorithm>
 #include <limits>
@@ -49,6 +50,7 @@ void validateInputs(double S, double K, double r, double T, double sigma) {
 
 double callPrice(double S, double K, double r, double T, double sigma) {
     validateInputs(S, K, r, T, sigma);
+    QE_COUNT(black_scholes_prices, 1);
     
     if (T <= 0.0 || sigma <= 0.0) {
         return std::max(0.0, S - K);
@@ -62,6 +64,7 @@ double callPrice(double S, double K, double r, double T, double sigma) {
 
 double putPrice(double S, double K, double r, double T, double sigma) {
     validateInputs(S, K, r, T, sigma);
+    QE_COUNT(black_scholes_prices, 1);
     
     if (T <= 0.0 || sigma <= 0.0) {
         return std::max(0.0, K - S);
@@ -0,0 +1,244 @@
+#include "BlackScholesBatch.h"
+#include "RunStats.h"
+#include "VectorMath.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+// On x86-64 Linux with GCC the kernel is compiled for AVX-512, AVX2/FMA and
+// the baseline ISA, and the loader picks the best one for the host CPU.
+// Other toolchains get the baseline build, which still auto-vectorizes to
+// whatever the target flags allow.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define QE_BATCH_TARGET_CLONES \
+    __attribute__((target_clones("arch=skylake-avx512", "arch=haswell", "default")))
+#else
+#define QE_BATCH_TARGET_CLONES
+#endif
+
+// The kernel body is a template over the batch's option types, forced
+// inline into one non-template clone set per type.
+#if defined(__GNUC__)
+#define QE_BATCH_INLINE inline __attribute__((always_inline))
+#else
+#define QE_BATCH_INLINE inline
+#endif
+
+namespace BlackScholes {
+
+namespace {
+
+// Outputs the caller did not ask for are written to stack scratch of this
+// many elements, so the kernel itself never branches on null pointers.
+constexpr size_t kChunkSize = 256;
+
+template <BatchOptionTypes Types>
+QE_BATCH_INLINE void batchBody(
+    size_t n,
+    const double* __restrict spot, const double* __restrict strike,
+    const double* __restrict rate, const double* __restrict expiry,
+    const double* __restrict volatility, const uint8_t* __restrict is_call,
+    double* __restrict price, double* __restrict delta,
+    double* __restrict gamma, double* __restrict vega,
+    double* __restrict theta, double* __restrict rho
+) {
+    for (size_t i = 0; i < n; ++i) {
+        const double S = spot[i];
+        const double K = strike[i];
+        const double r = rate[i];
+        const double T = expiry[i];
+        const double sigma = volatility[i];
+        bool call;
+        if constexpr (Types == BatchOptionTypes::Calls) {
+            call = true;
+        } else if constexpr (Types == BatchOptionTypes::Puts) {
+            call = false;
+        } else {
+            call = is_call[i] != 0;
+        }
+
+        // Expired or zero-vol options take the same limits as the scalar
+        // functions; used as a select mask so the loop stays branch-free.
+        const bool live = T > 0.0 && sigma > 0.0;
+
+        const double sqrt_T = std::sqrt(T);
+        const double vol_sqrt_T = live ? sigma * sqrt_T : 1.0;
+        const double safe_sqrt_T = live ? sqrt_T : 1.0;
+        const double discount = VectorMath::exp(-r * T);
+        const double K_disc = K * discount;
+
+        const double d1 = (VectorMath::log(S / K) + (r + 0.5 * sigma * sigma) * T) / vol_sqrt_T;
+        const double d2 = d1 - vol_sqrt_T;
+
+        double N_d1, N_minus_d1, N_d2, N_minus_d2;
+        VectorMath::normalCdfPair(d1, N_d1, N_minus_d1);
+        VectorMath::normalCdfPair(d2, N_d2, N_minus_d2);
+        const double n_d1 = VectorMath::normalPdf(d1);
+
+        const double decay = -(S * n_d1 * sigma) / (2.0 * safe_sqrt_T);
+
+        const double live_price = call ? S * N_d1 - K_disc * N_d2
+                                       : K_disc * N_minus_d2 - S * N_minus_d1;
+        const double live_delta = call ? N_d1 : N_d1 - 1.0;
+        const double live_gamma = n_d1 / (S * vol_sqrt_T);
+        const double live_vega = S * n_d1 * sqrt_T;
+        const double live_theta = call ? (decay - r * K_disc * N_d2) / 365.0
+                                       : (decay + r * K_disc * N_minus_d2) / 365.0;
+        const double live_rho = call ? K * T * discount * N_d2 / 100.0
+                                     : -K * T * discount * N_minus_d2 / 100.0;
+
+        const double intrinsic = call ? std::max(0.0, S - K) : std::max(0.0, K - S);
+        const double dead_delta = call ? (S > K ? 1.0 : 0.0) : (S < K ? -1.0 : 0.0);
+        // With T > 0 and zero vol, rho is the limit of the live formula:
+        // the discounted strike is either fully paid or not at all.
+        const double zero_vol_rho = call ? (S > K_disc ? K * T * discount / 100.0 : 0.0)
+                                         : (S < K_disc ? -K * T * discount / 100.0 : 0.0);
+        const double dead_rho = T > 0.0 ? zero_vol_rho : 0.0;
+
+        price[i] = live ? live_price : intrinsic;
+        delta[i] = live ? live_delta : dead_delta;
+        gamma[i] = live ? live_gamma : 0.0;
+        vega[i] = live ? live_vega : 0.0;
+        theta[i] = live ? live_theta : 0.0;
+        rho[i] = live ? live_rho : dead_rho;
+    }
+}
+
+#define QE_BATCH_KERNEL(name, types)                                            \
+    QE_BATCH_TARGET_CLONES                                                      \
+    void name(                                                                  \
+        size_t n,                                                               \
+        const double* __restrict spot, const double* __restrict strike,         \
+        const double* __restrict rate, const double* __restrict expiry,         \
+        const double* __restrict volatility, const uint8_t* __restrict is_call, \
+        double* __restrict price, double* __restrict delta,                     \
+        double* __restrict gamma, double* __restrict vega,                      \
+        double* __restrict theta, double* __restrict rho                        \
+    ) {                                                                         \
+        batchBody<types>(n, spot, strike, rate, expiry, volatility, is_call,    \
+                         price, delta, gamma, vega, theta, rho);                \
+    }
+
+QE_BATCH_KERNEL(batchKernel, BatchOptionTypes::Mixed)
+QE_BATCH_KERNEL(callBatchKernel, BatchOptionTypes::Calls)
+QE_BATCH_KERNEL(putBatchKernel, BatchOptionTypes::Puts)
+
+#undef QE_BATCH_KERNEL
+
+void checkCompleteInputs(const BatchInputs& inputs) {
+    if (inputs.size == 0) {
+        return;
+    }
+    if (!inputs.spot || !inputs.strike || !inputs.rate || !inputs.expiry ||
+        !inputs.volatility ||
+        (inputs.types == BatchOptionTypes::Mixed && !inputs.is_call)) {
+        throw std::invalid_argument("Batch inputs must provide every input array");
+    }
+}
+
+}
+
+void validateBatchInputs(const BatchInputs& inputs) {
+    checkCompleteInputs(inputs);
+
+    for (size_t i = 0; i < inputs.size; ++i) {
+        const double S = inputs.spot[i];
+        const double K = inputs.strike[i];
+        const double r = inputs.rate[i];
+        const double T = inputs.expiry[i];
+        const double sigma = inputs.volatility[i];
+
+        if (!(S > 0.0) || std::isinf(S)) {
+            throw std::invalid_argument("Invalid spot price at batch index " + std::to_string(i));
+        }
+        if (!(K > 0.0) || std::isinf(K)) {
+            throw std::invalid_argument("Invalid strike price at batch index " + std::to_string(i));
+        }
+        if (std::isnan(r) || std::isinf(r)) {
+            throw std::invalid_argument("Invalid risk-free rate at batch index " + std::to_string(i));
+        }
+        if (!(T >= 0.0) || std::isinf(T)) {
+            throw std::invalid_argument("Invalid time to expiry at batch index " + std::to_string(i));
+        }
+        if (!(sigma >= 0.0) || std::isinf(sigma)) {
+            throw std::invalid_argument("Invalid volatility at batch index " + std::to_string(i));
+        }
+    }
+}
+
+void priceBatchUnchecked(const BatchInputs& inputs, const BatchOutputs& outputs) {
+    checkCompleteInputs(inputs);
+    QE_COUNT(black_scholes_prices, inputs.size);
+
+    double scratch[6][kChunkSize];
+
+    auto kernel = inputs.types == BatchOptionTypes::Calls ? callBatchKernel
+                : inputs.types == BatchOptionTypes::Puts ? putBatchKernel
+                : batchKernel;
+
+    for (size_t begin = 0; begin < inputs.size; begin += kChunkSize) {
+        const size_t count = std::min(kChunkSize, inputs.size - begin);
+
+        auto target = [&](double* out, int slot) {
+            return out ? out + begin : scratch[slot];
+        };
+
+        kernel(
+            count,
+            inputs.spot + begin, inputs.strike + begin, inputs.rate + begin,
+            inputs.expiry + begin, inputs.volatility + begin,
+            inputs.is_call ? inputs.is_call + begin : nullptr,
+            target(outputs.price, 0), target(outputs.delta, 1),
+            target(outputs.gamma, 2), target(outputs.vega, 3),
+            target(outputs.theta, 4), target(outputs.rho, 5)
+        );
+    }
+}
+
+void priceBatch(const BatchInputs& inputs, const BatchOutputs& outputs) {
+    validateBatchInputs(inputs);
+    priceBatchUnchecked(inputs, outputs);
+}
+
+BatchGreeks priceBatch(
+    const std::vector<double>& S, const std::vector<double>& K,
+    const std::vector<double>& r, const std::vector<double>& T,
+    const std::vector<double>& sigma, const std::vector<uint8_t>& is_call
+) {
+    const size_t n = S.size();
+    if (K.size() != n || r.size() != n || T.size() != n ||
+        sigma.size() != n || is_call.size() != n) {
+        throw std::invalid_argument("Batch input arrays must all have the same length");
+    }
+
+    BatchGreeks result;
+    result.price.resize(n);
+    result.delta.resize(n);
+    result.gamma.resize(n);
+    result.vega.resize(n);
+    result.theta.resize(n);
+    result.rho.resize(n);
+
+    BatchInputs inputs;
+    inputs.spot = S.data();
+    inputs.strike = K.data();
+    inputs.rate = r.data();
+    inputs.expiry = T.data();
+    inputs.volatility = sigma.data();
+    inputs.is_call = is_call.data();
+    inputs.size = n;
+
+    BatchOutputs outputs;
+    outputs.price = result.price.data();
+    outputs.delta = result.delta.data();
+    outputs.gamma = result.gamma.data();
+    outputs.vega = result.vega.data();
+    outputs.theta = result.theta.data();
+    outputs.rho = result.rho.data();
+
+    priceBatch(inputs, outputs);
+    return result;
+}
+
+}
@@ -0,0 +1,422 @@
+#include "CorrelationModel.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// Tolerance on user input (symmetry, unit diagonal, loadings norm) and on
+// the pivots of the semi-definite Cholesky factorization.
+constexpr double kInputTolerance = 1e-8;
+constexpr double kPivotTolerance = 1e-10;
+
+// Tile of the block product in correlate(): paths x inputs x outputs. A
+// 64 x 128 tile of the factor is 64 KB and is reused across every path of
+// the tile before moving on.
+constexpr size_t kTilePaths = 64;
+constexpr size_t kTileInputs = 64;
+constexpr size_t kTileOutputs = 128;
+
+// Within a tile, 4 paths x 8 outputs are accumulated in registers across
+// the tile's inputs; ragged edges fall back to one path at a time.
+constexpr size_t kMicroPaths = 4;
+constexpr size_t kMicroOutputs = 8;
+
+constexpr size_t npos = static_cast<size_t>(-1);
+
+// Lower-triangular L with L * L^T = c for a positive semi-definite c,
+// both row-major m x m. A pivot that vanishes leaves a zero column, which
+// is what a perfectly correlated asset needs.
+std::vector<double> choleskyFactor(const std::vector<double>& c, size_t m) {
+    std::vector<double> lower(m * m, 0.0);
+
+    for (size_t i = 0; i < m; ++i) {
+        double* row = &lower[i * m];
+        for (size_t j = 0; j <= i; ++j) {
+            const double* pivot_row = &lower[j * m];
+            double s = c[i * m + j];
+            for (size_t k = 0; k < j; ++k) {
+                s -= row[k] * pivot_row[k];
+            }
+
+            if (j == i) {
+                if (s < -kPivotTolerance) {
+                    throw std::invalid_argument("Correlation matrix is not positive semi-definite");
+                }
+                row[i] = s > kPivotTolerance ? std::sqrt(s) : 0.0;
+            } else if (pivot_row[j] > 0.0) {
+                row[j] = s / pivot_row[j];
+            } else if (std::abs(s) > 2.0 * std::sqrt(kPivotTolerance)) {
+                // On a zero pivot the Schur complement bounds |s| by
+                // sqrt(pivot), so anything larger is not semi-definite.
+                throw std::invalid_argument("Correlation matrix is not positive semi-definite");
+            }
+        }
+    }
+
+    return lower;
+}
+
+}
+
+size_t ShockFactor::outputs() const {
+    return outputs_;
+}
+
+size_t ShockFactor::factors() const {
+    return factors_;
+}
+
+size_t ShockFactor::draws() const {
+    return draws_ + factors_;
+}
+
+void ShockFactor::correlate(const double* draws, size_t stride, size_t paths, double* out) const {
+    const size_t m = outputs_;
+
+    for (size_t p0 = 0; p0 < paths; p0 += kTilePaths) {
+        const size_t p1 = std::min(paths, p0 + kTilePaths);
+
+        for (size_t p = p0; p < p1; ++p) {
+            double* row = out + p * m;
+            if (residual_.empty()) {
+                std::fill(row, row + m, 0.0);
+            } else {
+                const double* z = draws + p * stride;
+                for (size_t i = 0; i < m; ++i) {
+                    row[i] = residual_[i] * z[residual_draw_[i]];
+                }
+            }
+        }
+
+        for (size_t j0 = 0; j0 < inputs_; j0 += kTileInputs) {
+            const size_t j1 = std::min(inputs_, j0 + kTileInputs);
+            for (size_t i0 = 0; i0 < m; i0 += kTileOutputs) {
+                const size_t i1 = std::min(m, i0 + kTileOutputs);
+
+                size_t p = p0;
+                for (; p + kMicroPaths <= p1; p += kMicroPaths) {
+                    size_t i = i0;
+                    for (; i + kMicroOutputs <= i1; i += kMicroOutputs) {
+                        double acc[kMicroPaths][kMicroOutputs];
+                        for (size_t q = 0; q < kMicroPaths; ++q) {
+                            for (size_t r = 0; r < kMicroOutputs; ++r) {
+                                acc[q][r] = out[(p + q) * m + i + r];
+                            }
+                        }
+                        for (size_t j = j0; j < j1; ++j) {
+                            // Skips the zero half of a Cholesky factor.
+                            if (first_output_[j] >= i + kMicroOutputs) {
+                                continue;
+                            }
+                            const double* weights = &dense_[j * m + i];
+                            for (size_t q = 0; q < kMicroPaths; ++q) {
+                                const double zj = draws[(p + q) * stride + input_offset_ + j];
+                                for (size_t r = 0; r < kMicroOutputs; ++r) {
+                                    acc[q][r] += zj * weights[r];
+                                }
+                            }
+                        }
+                        for (size_t q = 0; q < kMicroPaths; ++q) {
+                            for (size_t r = 0; r < kMicroOutputs; ++r) {
+                                out[(p + q) * m + i + r] = acc[q][r];
+                            }
+                        }
+                    }
+                    for (size_t q = 0; q < kMicroPaths; ++q) {
+                        accumulateRow(draws + (p + q) * stride, out + (p + q) * m, j0, j1, i, i1);
+                    }
+                }
+                for (; p < p1; ++p) {
+                    accumulateRow(draws + p * stride, out + p * m, j0, j1, i0, i1);
+                }
+            }
+        }
+    }
+}
+
+void ShockFactor::accumulateRow(
+    const double* draws, double* row, size_t j0, size_t j1, size_t i0, size_t i1
+) const {
+    const size_t m = outputs_;
+    for (size_t j = j0; j < j1; ++j) {
+        const size_t begin = std::max(i0, first_output_[j]);
+        const double zj = draws[input_offset_ + j];
+        const double* weights = &dense_[j * m];
+        for (size_t i = begin; i < i1; ++i) {
+            row[i] += zj * weights[i];
+        }
+    }
+}
+
+double ShockFactor::standardDeviation(const double* weights) const {
+    double variance = 0.0;
+    for (size_t i = 0; i < residual_.size(); ++i) {
+        const double idiosyncratic = residual_[i] * weights[i];
+        variance += idiosyncratic * idiosyncratic;
+    }
+    for (size_t j = 0; j < inputs_; ++j) {
+        double exposure = 0.0;
+        for (size_t i = first_output_[j]; i < outputs_; ++i) {
+            exposure += dense_[j * outputs_ + i] * weights[i];
+        }
+        variance += exposure * exposure;
+    }
+    return std::sqrt(variance);
+}
+
+ShockFactor ShockFactor::selectOutputs(const std::vector<uint32_t>& outputs) const {
+    ShockFactor selected;
+    selected.outputs_ = outputs.size();
+    selected.draws_ = draws_;
+    selected.factors_ = factors_;
+    selected.input_offset_ = input_offset_;
+    selected.inputs_ = inputs_;
+
+    selected.dense_.resize(inputs_ * outputs.size());
+    for (size_t j = 0; j < inputs_; ++j) {
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            selected.dense_[j * outputs.size() + i] = dense_[j * outputs_ + outputs[i]];
+        }
+    }
+    if (!residual_.empty()) {
+        for (uint32_t output : outputs) {
+            selected.residual_.push_back(residual_[output]);
+            selected.residual_draw_.push_back(residual_draw_[output]);
+        }
+    }
+    selected.indexColumns();
+    return selected;
+}
+
+void ShockFactor::indexColumns() {
+    first_output_.assign(inputs_, outputs_);
+    for (size_t j = 0; j < inputs_; ++j) {
+        for (size_t i = 0; i < outputs_; ++i) {
+            if (dense_[j * outputs_ + i] != 0.0) {
+                first_output_[j] = i;
+                break;
+            }
+        }
+    }
+}
+
+CorrelationModel::CorrelationModel(
+    std::vector<std::string> asset_ids, std::vector<double> matrix, MatrixType type
+) : asset_ids_(std::move(asset_ids)), correlation_(std::move(matrix)) {
+    indexAssets();
+    const size_t n = asset_ids_.size();
+    if (correlation_.size() != n * n) {
+        throw std::invalid_argument("Correlation matrix must have " + std::to_string(n * n) +
+                                    " entries for " + std::to_string(n) + " assets");
+    }
+    for (double value : correlation_) {
+        if (!std::isfinite(value)) {
+            throw std::invalid_argument("Correlation matrix entries must be finite");
+        }
+    }
+
+    if (type == MatrixType::Covariance) {
+        std::vector<double> scale(n);
+        for (size_t i = 0; i < n; ++i) {
+            if (!(correlation_[i * n + i] > 0.0)) {
+                throw std::invalid_argument("Covariance matrix variances must be positive for " +
+                                            asset_ids_[i]);
+            }
+            scale[i] = 1.0 / std::sqrt(correlation_[i * n + i]);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                correlation_[i * n + j] *= scale[i] * scale[j];
+            }
+            correlation_[i * n + i] = 1.0;
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        if (std::abs(correlation_[i * n + i] - 1.0) > kInputTolerance) {
+            throw std::invalid_argument("Correlation matrix diagonal must be 1 for " + asset_ids_[i]);
+        }
+        correlation_[i * n + i] = 1.0;
+        for (size_t j = 0; j < i; ++j) {
+            const double upper = correlation_[j * n + i];
+            const double lower = correlation_[i * n + j];
+            if (std::abs(upper - lower) > kInputTolerance) {
+                throw std::invalid_argument("Correlation matrix must be symmetric");
+            }
+            const double rho = 0.5 * (upper + lower);
+            if (std::abs(rho) > 1.0 + kInputTolerance) {
+                throw std::invalid_argument("Correlations must be between -1 and 1");
+            }
+            correlation_[i * n + j] = correlation_[j * n + i] = std::max(-1.0, std::min(1.0, rho));
+        }
+    }
+
+    // Factorizing up front also rejects a matrix that is not semi-definite.
+    cached_.emplace_front(asset_ids_, buildFactor(asset_ids_));
+}
+
+CorrelationModel::CorrelationModel(
+    std::vector<std::string> asset_ids, std::vector<double> loadings, size_t factors
+) : asset_ids_(std::move(asset_ids)), factors_(factors), loadings_(std::move(loadings)) {
+    indexAssets();
+    const size_t n = asset_ids_.size();
+    if (factors == 0) {
+        throw std::invalid_argument("Factor model needs at least one factor");
+    }
+    if (loadings_.size() != n * factors) {
+        throw std::invalid_argument("Factor loadings must have " + std::to_string(n * factors) +
+                                    " entries for " + std::to_string(n) + " assets and " +
+                                    std::to_string(factors) + " factors");
+    }
+
+    residual_.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        double explained = 0.0;
+        for (size_t f = 0; f < factors; ++f) {
+            const double loading = loadings_[i * factors + f];
+            if (!std::isfinite(loading)) {
+                throw std::invalid_argument("Factor loadings must be finite");
+            }
+            explained += loading * loading;
+        }
+        if (explained > 1.0 + kInputTolerance) {
+            throw std::invalid_argument("Factor loadings explain more than all the variance of " +
+                                        asset_ids_[i]);
+        }
+        residual_[i] = std::sqrt(std::max(0.0, 1.0 - explained));
+    }
+
+    cached_.emplace_front(asset_ids_, buildFactor(asset_ids_));
+}
+
+void CorrelationModel::indexAssets() {
+    if (asset_ids_.empty()) {
+        throw std::invalid_argument("Correlation model needs at least one asset");
+    }
+    for (size_t i = 0; i < asset_ids_.size(); ++i) {
+        if (asset_ids_[i].empty()) {
+            throw std::invalid_argument("Correlation model asset IDs cannot be empty");
+        }
+        if (!index_.emplace(asset_ids_[i], i).second) {
+            throw std::invalid_argument("Duplicate asset in correlation model: " + asset_ids_[i]);
+        }
+    }
+}
+
+size_t CorrelationModel::size() const {
+    return asset_ids_.size();
+}
+
+const std::vector<std::string>& CorrelationModel::assetIds() const {
+    return asset_ids_;
+}
+
+bool CorrelationModel::isFactorModel() const {
+    return factors_ > 0;
+}
+
+size_t CorrelationModel::factorCount() const {
+    return factors_;
+}
+
+double CorrelationModel::correlation(size_t i, size_t j) const {
+    const size_t n = asset_ids_.size();
+    if (i >= n || j >= n) {
+        throw std::out_of_range("Correlation model asset index out of range");
+    }
+    if (factors_ == 0) {
+        return correlation_[i * n + j];
+    }
+    if (i == j) {
+        return 1.0;
+    }
+    double rho = 0.0;
+    for (size_t f = 0; f < factors_; ++f) {
+        rho += loadings_[i * factors_ + f] * loadings_[j * factors_ + f];
+    }
+    return rho;
+}
+
+std::shared_ptr<const ShockFactor> CorrelationModel::factorFor(
+    const std::vector<std::string>& asset_ids
+) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = cached_.begin(); it != cached_.end(); ++it) {
+        if (it->first == asset_ids) {
+            cached_.splice(cached_.begin(), cached_, it);
+            return cached_.front().second;
+        }
+    }
+
+    std::shared_ptr<const ShockFactor> factor = buildFactor(asset_ids);
+    cached_.emplace_front(asset_ids, factor);
+    if (cached_.size() > kMaxCachedFactors) {
+        cached_.pop_back();
+    }
+    return factor;
+}
+
+size_t CorrelationModel::factorizations() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return factorizations_;
+}
+
+std::shared_ptr<const ShockFactor> CorrelationModel::buildFactor(
+    const std::vector<std::string>& asset_ids
+) const {
+    const size_t n = asset_ids_.size();
+    const size_t m = asset_ids.size();
+    std::vector<size_t> model_index(m);
+    for (size_t i = 0; i < m; ++i) {
+        const auto it = index_.find(asset_ids[i]);
+        model_index[i] = it == index_.end() ? npos : it->second;
+    }
+
+    auto factor = std::make_shared<ShockFactor>();
+    factor->outputs_ = m;
+    factor->draws_ = m;
+
+    if (factors_ > 0) {
+        factor->factors_ = factors_;
+        factor->input_offset_ = m;
+        factor->inputs_ = factors_;
+        factor->dense_.assign(factors_ * m, 0.0);
+        factor->residual_.assign(m, 1.0);
+        factor->residual_draw_.resize(m);
+        for (size_t i = 0; i < m; ++i) {
+            factor->residual_draw_[i] = static_cast<uint32_t>(i);
+            if (model_index[i] == npos) {
+                continue;
+            }
+            for (size_t f = 0; f < factors_; ++f) {
+                factor->dense_[f * m + i] = loadings_[model_index[i] * factors_ + f];
+            }
+            factor->residual_[i] = residual_[model_index[i]];
+        }
+    } else {
+        std::vector<double> c(m * m, 0.0);
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < m; ++j) {
+                if (model_index[i] != npos && model_index[j] != npos) {
+                    c[i * m + j] = correlation_[model_index[i] * n + model_index[j]];
+                } else {
+                    c[i * m + j] = i == j ? 1.0 : 0.0;
+                }
+            }
+        }
+        const std::vector<double> lower = choleskyFactor(c, m);
+
+        factor->inputs_ = m;
+        factor->dense_.resize(m * m);
+        for (size_t i = 0; i < m; ++i) {
+            for (size_t j = 0; j < m; ++j) {
+                factor->dense_[j * m + i] = lower[i * m + j];
+            }
+        }
+    }
+
+    factor->indexColumns();
+    ++factorizations_;
+    return factor;
+}
@@ -0,0 +1,319 @@
+#include "ImpliedVolatilityBatch.h"
+#include "Parallel.h"
+#include "VectorMath.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Same multi-versioning as the pricing kernel in BlackScholesBatch.cpp.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define QE_IV_TARGET_CLONES \
+    __attribute__((target_clones("arch=skylake-avx512", "arch=haswell", "default")))
+#else
+#define QE_IV_TARGET_CLONES
+#endif
+
+namespace BlackScholes {
+
+namespace {
+
+// Quotes solved together; also the unit of work handed to each thread.
+constexpr size_t kBlockSize = 256;
+
+// Upper end of the search bracket, matching the vol range the surface accepts.
+constexpr double kMaxVolatility = 10.0;
+
+// Bounds on the Corrado-Miller seed, which can be zero or meaningless far
+// from the money; the bracket takes care of the rest.
+constexpr double kMinSeed = 1e-3;
+constexpr double kMaxSeed = 5.0;
+
+// Per-block solver state. Each quote has been turned into its
+// out-of-the-money option, priced as if r = 0 against the discounted strike.
+struct BlockState {
+    double log_moneyness[kBlockSize];  // log(S / K_disc)
+    double spot[kBlockSize];
+    double strike_disc[kBlockSize];
+    double sqrt_T[kBlockSize];
+    double target[kBlockSize];         // Out-of-the-money price to match
+    uint8_t is_call[kBlockSize];
+    double sigma[kBlockSize];
+    double lo[kBlockSize];
+    double hi[kBlockSize];
+    uint8_t active[kBlockSize];
+};
+
+// One safeguarded Halley step for every active lane. The root is kept in
+// [lo, hi] using the sign of the pricing error (price is increasing in
+// vol), and any step landing outside it is replaced by bisection. Inactive
+// lanes are carried through unchanged so the loop stays branch-free.
+QE_IV_TARGET_CLONES
+void halleyStep(
+    size_t n,
+    const double* __restrict log_moneyness, const double* __restrict spot,
+    const double* __restrict strike_disc, const double* __restrict sqrt_T,
+    const double* __restrict target, const uint8_t* __restrict is_call,
+    double tolerance,
+    double* __restrict sigma, double* __restrict lo, double* __restrict hi,
+    uint8_t* __restrict active
+) {
+    for (size_t i = 0; i < n; ++i) {
+        const double s = sigma[i];
+        const double S = spot[i];
+        const double K_disc = strike_disc[i];
+        const double vol_sqrt_T = s * sqrt_T[i];
+
+        const double d1 = log_moneyness[i] / vol_sqrt_T + 0.5 * vol_sqrt_T;
+        const double d2 = d1 - vol_sqrt_T;
+
+        double N_d1, N_minus_d1, N_d2, N_minus_d2;
+        VectorMath::normalCdfPair(d1, N_d1, N_minus_d1);
+        VectorMath::normalCdfPair(d2, N_d2, N_minus_d2);
+
+        const double price = is_call[i] ? S * N_d1 - K_disc * N_d2
+                                        : K_disc * N_minus_d2 - S * N_minus_d1;
+        const double error = price - target[i];
+        const double vega = S * VectorMath::normalPdf(d1) * sqrt_T[i];
+
+        // Halley's correction uses vomma / vega = d1 * d2 / sigma; when it
+        // would more than double the Newton step, plain Newton is used.
+        const double newton = error / vega;
+        const double correction = 1.0 - 0.5 * newton * d1 * d2 / s;
+        const double step = correction > 0.5 ? newton / correction : newton;
+
+        const double low = error < 0.0 ? s : lo[i];
+        const double high = error > 0.0 ? s : hi[i];
+        const double candidate = s - step;
+        const double next = (candidate > low && candidate < high) ? candidate
+                                                                  : 0.5 * (low + high);
+        const bool done = std::abs(next - s) < tolerance || error == 0.0;
+
+        const bool on = active[i] != 0;
+        sigma[i] = on ? next : s;
+        lo[i] = on ? low : lo[i];
+        hi[i] = on ? high : hi[i];
+        active[i] = on && !done;
+    }
+}
+
+void checkCompleteQuotes(const ImpliedVolQuotes& quotes) {
+    if (quotes.size == 0) {
+        return;
+    }
+    if (!quotes.price || !quotes.spot || !quotes.strike || !quotes.rate ||
+        !quotes.expiry || !quotes.is_call) {
+        throw std::invalid_argument("Implied vol quotes must provide every input array");
+    }
+}
+
+void validateSettings(const ImpliedVolSettings& settings) {
+    if (!(settings.tolerance > 0.0) || std::isinf(settings.tolerance)) {
+        throw std::invalid_argument("Implied vol tolerance must be positive");
+    }
+    if (settings.max_iterations <= 0) {
+        throw std::invalid_argument("Implied vol iteration limit must be positive");
+    }
+}
+
+bool isFinite(double x) {
+    return !std::isnan(x) && !std::isinf(x);
+}
+
+// Classifies quote q and, when it needs solving, loads it into lane k.
+// Returns true if the lane has to be iterated.
+bool loadQuote(
+    const ImpliedVolQuotes& quotes, size_t q, size_t k, BlockState& state,
+    double* vols, ImpliedVolStatus* status
+) {
+    const double price = quotes.price[q];
+    const double S = quotes.spot[q];
+    const double K = quotes.strike[q];
+    const double r = quotes.rate[q];
+    const double T = quotes.expiry[q];
+    const bool call = quotes.is_call[q] != 0;
+
+    vols[q] = 0.0;
+
+    if (!isFinite(price) || !isFinite(S) || !isFinite(K) || !isFinite(r) || !isFinite(T) ||
+        price < 0.0 || S <= 0.0 || K <= 0.0 || T <= 0.0) {
+        status[q] = ImpliedVolStatus::InvalidInput;
+        return false;
+    }
+
+    const double K_disc = K * std::exp(-r * T);
+    const double intrinsic = call ? std::max(0.0, S - K_disc) : std::max(0.0, K_disc - S);
+    const double upper = call ? S : K_disc;
+
+    if (price < intrinsic - 1e-12 * upper) {
+        status[q] = ImpliedVolStatus::BelowIntrinsic;
+        return false;
+    }
+    if (price >= upper) {
+        status[q] = ImpliedVolStatus::AboveMaximum;
+        return false;
+    }
+
+    // Time value is the out-of-the-money price on the other side of parity.
+    const double time_value = price - intrinsic;
+    if (time_value <= 0.0) {
+        status[q] = ImpliedVolStatus::NoTimeValue;
+        return false;
+    }
+
+    const bool otm_call = S < K_disc;
+    const double sqrt_T = std::sqrt(T);
+
+    // Corrado-Miller, written against the discounted strike.
+    const double call_price = otm_call ? time_value : time_value + S - K_disc;
+    const double half_gap = 0.5 * (S - K_disc);
+    const double a = call_price - half_gap;
+    const double discriminant = a * a - 4.0 * half_gap * half_gap / M_PI;
+    const double seed_vol_sqrt_T = std::sqrt(2.0 * M_PI) / (S + K_disc) *
+                                   (a + std::sqrt(std::max(0.0, discriminant)));
+    const double seed = std::min(kMaxSeed, std::max(kMinSeed, seed_vol_sqrt_T / sqrt_T));
+
+    state.log_moneyness[k] = std::log(S / K_disc);
+    state.spot[k] = S;
+    state.strike_disc[k] = K_disc;
+    state.sqrt_T[k] = sqrt_T;
+    state.target[k] = time_value;
+    state.is_call[k] = otm_call ? 1 : 0;
+    state.sigma[k] = seed;
+    state.lo[k] = 0.0;
+    state.hi[k] = kMaxVolatility;
+    state.active[k] = 1;
+    return true;
+}
+
+void solveBlock(
+    const ImpliedVolQuotes& quotes, size_t begin, size_t count,
+    double* vols, ImpliedVolStatus* status, const ImpliedVolSettings& settings
+) {
+    BlockState state{};
+    size_t lanes[kBlockSize];
+    size_t num_lanes = 0;
+
+    for (size_t q = begin; q < begin + count; ++q) {
+        if (loadQuote(quotes, q, num_lanes, state, vols, status)) {
+            lanes[num_lanes++] = q;
+        }
+    }
+
+    for (int iteration = 0; num_lanes > 0 && iteration < settings.max_iterations; ++iteration) {
+        halleyStep(
+            num_lanes, state.log_moneyness, state.spot, state.strike_disc, state.sqrt_T,
+            state.target, state.is_call, settings.tolerance,
+            state.sigma, state.lo, state.hi, state.active
+        );
+
+        size_t remaining = 0;
+        for (size_t k = 0; k < num_lanes; ++k) {
+            remaining += state.active[k];
+        }
+        if (remaining == 0) {
+            break;
+        }
+    }
+
+    for (size_t k = 0; k < num_lanes; ++k) {
+        const size_t q = lanes[k];
+        if (state.active[k]) {
+            status[q] = ImpliedVolStatus::NotConverged;
+        } else if (state.sigma[k] >= kMaxVolatility - settings.tolerance) {
+            status[q] = ImpliedVolStatus::AboveMaximum;
+        } else {
+            vols[q] = state.sigma[k];
+            status[q] = ImpliedVolStatus::Converged;
+        }
+    }
+}
+
+}
+
+size_t ImpliedVolBatch::convergedCount() const {
+    return static_cast<size_t>(
+        std::count(status.begin(), status.end(), ImpliedVolStatus::Converged));
+}
+
+void impliedVolatilityBatch(
+    const ImpliedVolQuotes& quotes, double* vols, ImpliedVolStatus* status,
+    const ImpliedVolSettings& settings
+) {
+    checkCompleteQuotes(quotes);
+    validateSettings(settings);
+    if (quotes.size == 0) {
+        return;
+    }
+    if (!vols || !status) {
+        throw std::invalid_argument("Implied vol outputs must not be null");
+    }
+
+    const size_t num_blocks = (quotes.size + kBlockSize - 1) / kBlockSize;
+    const int num_threads = Parallel::resolveThreadCount(settings.num_threads);
+
+    Parallel::forEachBlock(num_blocks, num_threads, [&](size_t block, int) {
+        const size_t begin = block * kBlockSize;
+        const size_t count = std::min(kBlockSize, quotes.size - begin);
+        solveBlock(quotes, begin, count, vols, status, settings);
+    });
+}
+
+ImpliedVolBatch impliedVolatilityBatch(
+    const std::vector<double>& price, const std::vector<double>& S,
+    const std::vector<double>& K, const std::vector<double>& r,
+    const std::vector<double>& T, const std::vector<uint8_t>& is_call,
+    const ImpliedVolSettings& settings
+) {
+    const size_t n = price.size();
+    if (S.size() != n || K.size() != n || r.size() != n ||
+        T.size() != n || is_call.size() != n) {
+        throw std::invalid_argument("Implied vol input arrays must all have the same length");
+    }
+
+    ImpliedVolQuotes quotes;
+    quotes.price = price.data();
+    quotes.spot = S.data();
+    quotes.strike = K.data();
+    quotes.rate = r.data();
+    quotes.expiry = T.data();
+    quotes.is_call = is_call.data();
+    quotes.size = n;
+
+    ImpliedVolBatch result;
+    result.vol.resize(n);
+    result.status.resize(n);
+    impliedVolatilityBatch(quotes, result.vol.data(), result.status.data(), settings);
+    return result;
+}
+
+std::vector<VolatilitySurface::VolPoint> convergedVolPoints(
+    const double* strikes, const double* expiries,
+    const double* vols, const ImpliedVolStatus* status, size_t n
+) {
+    std::vector<VolatilitySurface::VolPoint> points;
+    points.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        if (status[i] == ImpliedVolStatus::Converged) {
+            points.push_back({strikes[i], expiries[i], vols[i]});
+        }
+    }
+    return points;
+}
+
+std::vector<VolatilitySurface::VolPoint> convergedVolPoints(
+    const std::vector<double>& strikes, const std::vector<double>& expiries,
+    const ImpliedVolBatch& batch
+) {
+    const size_t n = batch.status.size();
+    if (strikes.size() != n || expiries.size() != n || batch.vol.size() != n) {
+        throw std::invalid_argument("Strike and expiry arrays must match the batch size");
+    }
+    return convergedVolPoints(strikes.data(), expiries.data(), batch.vol.data(),
+                              batch.status.data(), n);
+}
+
+}
@@ -6,7 +6,20 @@
 
 namespace VolatilitySurface {
 
-void ImpliedVolSurface::addPoint(double strike, double expiry, double implied_vol) {
+namespace {
+
+constexpr double kSkewExpiryTolerance = 0.01;
+constexpr double kTermStrikeTolerance = 0.01;
+
+// Shared by every surface so a revision never identifies two different
+// sets of quotes.
+std::atomic<uint64_t> next_revision{1};
+
+uint64_t nextRevision() {
+    return next_revision.fetch_add(1, std::memory_order_relaxed);
+}
+
+void validatePoint(double strike, double expiry, double implied_vol) {
     if (strike <= 0.0) {
         throw std::invalid_argument("Strike must be positive");
     }
@@ -16,8 +29,94 @@ void ImpliedVolSurface::addPoint(double strike, double expiry, double implied_vo
     if (implied_vol < 0.0 || implied_vol > 10.0) {
         throw std::invalid_argument("Implied volatility out of reasonable range");
     }
-    
+}
+
+bool matchesStrike(double point_strike, double strike) {
+    return std::abs(point_strike - strike) / strike < kTermStrikeTolerance;
+}
+
+}
+
+ImpliedVolSurface::ImpliedVolSurface() : revision_(nextRevision()) {
+}
+
+ImpliedVolSurface::ImpliedVolSurface(const ImpliedVolSurface& other) {
+    *this = other;
+}
+
+ImpliedVolSurface& ImpliedVolSurface::operator=(const ImpliedVolSurface& other) {
+    if (this == &other) {
+        return *this;
+    }
+    // other may be building its index in a concurrent lookup.
+    std::lock_guard<std::mutex> lock(other.build_mutex_);
+    points_ = other.points_;
+    slice_expiry_ = other.slice_expiry_;
+    slice_begin_ = other.slice_begin_;
+    strikes_ = other.strikes_;
+    vols_ = other.vols_;
+    built_.store(other.built_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    revision_ = nextRevision();
+    return *this;
+}
+
+void ImpliedVolSurface::addPoint(double strike, double expiry, double implied_vol) {
+    validatePoint(strike, expiry, implied_vol);
+
     points_.push_back({strike, expiry, implied_vol});
+    built_.store(false, std::memory_order_relaxed);
+    revision_ = nextRevision();
+}
+
+void ImpliedVolSurface::addPoints(const std::vector<VolPoint>& points) {
+    for (const VolPoint& point : points) {
+        validatePoint(point.strike, point.expiry, point.implied_vol);
+    }
+
+    points_.insert(points_.end(), points.begin(), points.end());
+    revision_ = nextRevision();
+    build();
+}
+
+void ImpliedVolSurface::build() {
+    std::lock_guard<std::mutex> lock(build_mutex_);
+    buildIndex();
+}
+
+void ImpliedVolSurface::buildIndex() const {
+    std::vector<VolPoint> sorted = points_;
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const VolPoint& a, const VolPoint& b) {
+                         return a.expiry < b.expiry ||
+                                (a.expiry == b.expiry && a.strike < b.strike);
+                     });
+
+    slice_expiry_.clear();
+    slice_begin_.clear();
+    strikes_.clear();
+    vols_.clear();
+    strikes_.reserve(sorted.size());
+    vols_.reserve(sorted.size());
+
+    for (const VolPoint& point : sorted) {
+        if (slice_expiry_.empty() || point.expiry != slice_expiry_.back()) {
+            slice_expiry_.push_back(point.expiry);
+            slice_begin_.push_back(strikes_.size());
+        } else if (point.strike == strikes_.back()) {
+            // The sort is stable, so this quote was added later.
+            vols_.back() = point.implied_vol;
+            continue;
+        }
+        strikes_.push_back(point.strike);
+        vols_.push_back(point.implied_vol);
+    }
+    slice_begin_.push_back(strikes_.size());
+
+    built_.store(true, std::memory_order_release);
+}
+
+bool ImpliedVolSurface::isBuilt() const {
+    return built_.load(std::memory_order_acquire);
 }
 
 bool ImpliedVolSurface::hasData() const {
@@ -30,97 +129,257 @@ size_t ImpliedVolSurface::size() const {
 
 void ImpliedVolSurface::clear() {
     points_.clear();
+    slice_expiry_.clear();
+    slice_begin_.clear();
+    strikes_.clear();
+    vols_.clear();
+    built_.store(false, std::memory_order_relaxed);
+    revision_ = nextRevision();
+}
+
+uint64_t ImpliedVolSurface::revision() const {
+    return revision_;
 }
 
 std::vector<VolPoint> ImpliedVolSurface::getPoints() const {
     return points_;
 }
 
-double ImpliedVolSurface::interpolate(double strike, double expiry) const {
+void ImpliedVolSurface::ensureBuilt() const {
     if (points_.empty()) {
         throw std::runtime_error("No volatility data available");
     }
-    
-    if (points_.size() == 1) {
-        return points_[0].implied_vol;
-    }
-    
-    double min_dist = std::numeric_limits<double>::max();
-    double nearest_vol = points_[0].implied_vol;
-    
-    for (const auto& point : points_) {
-        const double dist = std::sqrt(
-            std::pow(strike - point.strike, 2) + 
-            std::pow(expiry - point.expiry, 2)
-        );
-        
-        if (dist < min_dist) {
-            min_dist = dist;
-            nearest_vol = point.implied_vol;
+    if (built_.load(std::memory_order_acquire)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(build_mutex_);
+    if (!built_.load(std::memory_order_relaxed)) {
+        buildIndex();
+    }
+}
+
+double ImpliedVolSurface::sliceVol(size_t slice, double strike) const {
+    const size_t begin = slice_begin_[slice];
+    const size_t end = slice_begin_[slice + 1];
+
+    const size_t i = std::lower_bound(strikes_.begin() + begin, strikes_.begin() + end, strike) -
+                     strikes_.begin();
+    if (i == begin) {
+        return vols_[begin];
+    }
+    if (i == end) {
+        return vols_[end - 1];
+    }
+    if (strikes_[i] == strike) {
+        return vols_[i];
+    }
+
+    const double weight = (strike - strikes_[i - 1]) / (strikes_[i] - strikes_[i - 1]);
+    return vols_[i - 1] + weight * (vols_[i] - vols_[i - 1]);
+}
+
+size_t ImpliedVolSurface::upperSlice(double expiry) const {
+    return std::upper_bound(slice_expiry_.begin(), slice_expiry_.end(), expiry) -
+           slice_expiry_.begin();
+}
+
+double ImpliedVolSurface::interpolateBetween(size_t upper_slice, double strike, double expiry) const {
+    const size_t num_slices = slice_expiry_.size();
+    if (upper_slice == 0) {
+        return sliceVol(0, strike);
+    }
+    if (upper_slice == num_slices) {
+        return sliceVol(num_slices - 1, strike);
+    }
+
+    const double t1 = slice_expiry_[upper_slice - 1];
+    const double v1 = sliceVol(upper_slice - 1, strike);
+    if (expiry == t1) {
+        return v1;
+    }
+
+    const double t2 = slice_expiry_[upper_slice];
+    const double v2 = sliceVol(upper_slice, strike);
+    const double w1 = v1 * v1 * t1;
+    const double w2 = v2 * v2 * t2;
+    const double w = w1 + (expiry - t1) / (t2 - t1) * (w2 - w1);
+
+    return std::sqrt(std::max(0.0, w) / expiry);
+}
+
+double ImpliedVolSurface::interpolate(double strike, double expiry) const {
+    ensureBuilt();
+    return interpolateBetween(upperSlice(expiry), strike, expiry);
+}
+
+void ImpliedVolSurface::interpolate(
+    const double* strikes, const double* expiries, double* vols, size_t n
+) const {
+    if (n == 0) {
+        return;
+    }
+    ensureBuilt();
+
+    size_t upper = upperSlice(expiries[0]);
+    for (size_t i = 0; i < n; ++i) {
+        if (i > 0 && expiries[i] != expiries[i - 1]) {
+            upper = upperSlice(expiries[i]);
+        }
+        vols[i] = interpolateBetween(upper, strikes[i], expiries[i]);
+    }
+}
+
+std::vector<double> ImpliedVolSurface::interpolate(
+    const std::vector<double>& strikes, const std::vector<double>& expiries
+) const {
+    if (strikes.size() != expiries.size()) {
+        throw std::invalid_argument("Strike and expiry arrays must have the same length");
+    }
+
+    std::vector<double> vols(strikes.size());
+    interpolate(strikes.data(), expiries.data(), vols.data(), strikes.size());
+    return vols;
+}
+
+double ImpliedVolSurface::skew(double expiry) const {
+    if (points_.empty()) {
+        return 0.0;
+    }
+    ensureBuilt();
+
+    const size_t first = std::upper_bound(slice_expiry_.begin(), slice_expiry_.end(),
+                                          expiry - kSkewExpiryTolerance) - slice_expiry_.begin();
+    const size_t last = std::lower_bound(slice_expiry_.begin(), slice_expiry_.end(),
+                                         expiry + kSkewExpiryTolerance) - slice_expiry_.begin();
+    if (first >= last || slice_begin_[last] - slice_begin_[first] < 2) {
+        return 0.0;
+    }
+
+    size_t low = slice_begin_[first];
+    size_t high = slice_begin_[first + 1] - 1;
+    for (size_t s = first + 1; s < last; ++s) {
+        if (strikes_[slice_begin_[s]] < strikes_[low]) {
+            low = slice_begin_[s];
+        }
+        if (strikes_[slice_begin_[s + 1] - 1] > strikes_[high]) {
+            high = slice_begin_[s + 1] - 1;
+        }
+    }
+
+    const double strike_range = strikes_[high] - strikes_[low];
+    if (strike_range < 1e-10) {
+        return 0.0;
+    }
+
+    return (vols_[high] - vols_[low]) / strike_range;
+}
+
+double ImpliedVolSurface::termStructure(double strike) const {
+    if (points_.empty() || !(strike > 0.0)) {
+        return 0.0;
+    }
+    ensureBuilt();
+
+    // Quotes within tolerance of strike sit in a short run of each slice.
+    const double low_strike = strike * (1.0 - kTermStrikeTolerance);
+    size_t matches = 0;
+    size_t first_match = 0;
+    size_t last_match = 0;
+    double first_expiry = 0.0;
+    double last_expiry = 0.0;
+
+    for (size_t s = 0; s < slice_expiry_.size(); ++s) {
+        const size_t end = slice_begin_[s + 1];
+        size_t i = std::lower_bound(strikes_.begin() + slice_begin_[s], strikes_.begin() + end,
+                                    low_strike) - strikes_.begin();
+        for (; i < end && strikes_[i] <= strike * (1.0 + kTermStrikeTolerance); ++i) {
+            if (!matchesStrike(strikes_[i], strike)) {
+                continue;
+            }
+            if (matches == 0) {
+                first_match = i;
+                first_expiry = slice_expiry_[s];
+            }
+            if (matches == 0 || slice_expiry_[s] != last_expiry) {
+                last_match = i;
+                last_expiry = slice_expiry_[s];
+            }
+            ++matches;
         }
     }
-    
-    return nearest_vol;
+
+    if (matches < 2) {
+        return 0.0;
+    }
+
+    const double time_range = last_expiry - first_expiry;
+    if (time_range < 1e-10) {
+        return 0.0;
+    }
+
+    return (vols_[last_match] - vols_[first_match]) / time_range;
 }
 
 double calculateSkew(const std::vector<VolPoint>& points, double expiry) {
-    std::vector<VolPoint> matching_expiry;
-    
-    const double tolerance = 0.01;
+    const VolPoint* low = nullptr;
+    const VolPoint* high = nullptr;
+    size_t matches = 0;
+
     for (const auto& point : points) {
-        if (std::abs(point.expiry - expiry) < tolerance) {
-            matching_expiry.push_back(point);
+        if (std::abs(point.expiry - expiry) >= kSkewExpiryTolerance) {
+            continue;
         }
+        if (!low || point.strike < low->strike) {
+            low = &point;
+        }
+        if (!high || point.strike > high->strike) {
+            high = &point;
+        }
+        ++matches;
     }
-    
-    if (matching_expiry.size() < 2) {
+
+    if (matches < 2) {
         return 0.0;
     }
-    
-    std::sort(matching_expiry.begin(), matching_expiry.end(),
-              [](const VolPoint& a, const VolPoint& b) {
-                  return a.strike < b.strike;
-              });
-    
-    const double low_strike_vol = matching_expiry.front().implied_vol;
-    const double high_strike_vol = matching_expiry.back().implied_vol;
-    const double strike_range = matching_expiry.back().strike - matching_expiry.front().strike;
-    
+
+    const double strike_range = high->strike - low->strike;
+
     if (strike_range < 1e-10) {
         return 0.0;
     }
-    
-    return (high_strike_vol - low_strike_vol) / strike_range;
+
+    return (high->implied_vol - low->implied_vol) / strike_range;
 }
 
 double calculateTermStructure(const std::vector<VolPoint>& points, double strike) {
-    std::vector<VolPoint> matching_strike;
-    
-    const double tolerance_pct = 0.01;
+    const VolPoint* shortest = nullptr;
+    const VolPoint* longest = nullptr;
+    size_t matches = 0;
+
     for (const auto& point : points) {
-        if (std::abs(point.strike - strike) / strike < tolerance_pct) {
-            matching_strike.push_back(point);
+        if (!matchesStrike(point.strike, strike)) {
+            continue;
         }
+        if (!shortest || point.expiry < shortest->expiry) {
+            shortest = &point;
+        }
+        if (!longest || point.expiry > longest->expiry) {
+            longest = &point;
+        }
+        ++matches;
     }
-    
-    if (matching_strike.size() < 2) {
+
+    if (matches < 2) {
         return 0.0;
     }
-    
-    std::sort(matching_strike.begin(), matching_strike.end(),
-              [](const VolPoint& a, const VolPoint& b) {
-                  return a.expiry < b.expiry;
-              });
-    
-    const double short_term_vol = matching_strike.front().implied_vol;
-    const double long_term_vol = matching_strike.back().implied_vol;
-    const double time_range = matching_strike.back().expiry - matching_strike.front().expiry;
-    
+
+    const double time_range = longest->expiry - shortest->expiry;
+
     if (time_range < 1e-10) {
         return 0.0;
     }
-    
-    return (long_term_vol - short_term_vol) / time_range;
+
+    return (longest->implied_vol - shortest->implied_vol) / time_range;
 }
 
-}
\ No newline at end of file
+}
@@ -1,18 +1,48 @@
 #include "Instrument.h"
-#include "BinomialTree.h"
-#include "BlackScholes.h"
-#include "JumpDiffusion.h"
+#include "PricingKernel.h"
 #include <algorithm>
 #include <cmath>
 #include <limits>
 
+namespace {
+
+// Flat-vol copy of md at the surface vol for one strike and expiry, so the
+// models and their bumps never look the surface up again.
+MarketData withSurfaceVol(const MarketData &md, double strike, double expiry) {
+  MarketData flat = md;
+  flat.volatility = md.vol_surface->interpolate(strike, expiry);
+  flat.vol_surface.reset();
+  return flat;
+}
+
+// Terms the pricing kernel reads, taken without going through the virtual
+// interface.
+template <typename Option> ContractTerms termsOf(const Option &option) {
+  ContractTerms terms;
+  option.Option::getContractTerms(terms);
+  return terms;
+}
+
+} // namespace
+
+Greeks Instrument::computeAll(const MarketData &md) const {
+  Greeks greeks;
+  greeks.price = price(md);
+  greeks.delta = delta(md);
+  greeks.gamma = gamma(md);
+  greeks.vega = vega(md);
+  greeks.theta = theta(md);
+  return greeks;
+}
+
+bool Instrument::getContractTerms(ContractTerms &) const { return false; }
 
 EuropeanOption::EuropeanOption(OptionType type, double strike,
                                double time_to_expiry, std::string asset_id)
     : option_type_(type), strike_price_(strike),
       time_to_expiry_years_(time_to_expiry), underlying_asset_id_(asset_id),
       pricing_model_(PricingModel::BlackScholes), binomial_steps_(100),
-      jump_intensity_(0.0), jump_mean_(0.0), jump_volatility_(0.0) {
+      lattice_scheme_(LatticeScheme::CoxRossRubinstein), jump_intensity_(0.0), jump_mean_(0.0), jump_volatility_(0.0) {
   validateParameters();
 }
 
@@ -21,7 +51,8 @@ EuropeanOption::EuropeanOption(OptionType type, double strike,
                                PricingModel model)
     : option_type_(type), strike_price_(strike),
       time_to_expiry_years_(time_to_expiry), underlying_asset_id_(asset_id),
-      pricing_model_(model), binomial_steps_(100), jump_intensity_(0.0),
+      pricing_model_(model), binomial_steps_(100),
+      lattice_scheme_(LatticeScheme::CoxRossRubinstein), jump_intensity_(0.0),
       jump_mean_(0.0), jump_volatility_(0.0) {
   validateParameters();
 }
@@ -90,6 +121,14 @@ void EuropeanOption::setBinomialSteps(int steps) {
 
 int EuropeanOption::getBinomialSteps() const { return binomial_steps_; }
 
+void EuropeanOption::setLatticeScheme(LatticeScheme scheme) {
+  lattice_scheme_ = scheme;
+}
+
+LatticeScheme EuropeanOption::getLatticeScheme() const {
+  return lattice_scheme_;
+}
+
 void EuropeanOption::setJumpParameters(double lambda, double jump_mean,
                                        double jump_vol) {
   if (lambda < 0.0) {
@@ -111,49 +150,16 @@ double EuropeanOption::getStrike() const { return strike_price_; }
 
 double EuropeanOption::getTimeToExpiry() const { return time_to_expiry_years_; }
 
-double EuropeanOption::priceBlackScholes(const MarketData &md) const {
-  if (option_type_ == OptionType::Call) {
-    return BlackScholes::callPrice(md.spot_price, strike_price_,
-                                   md.risk_free_rate, time_to_expiry_years_,
-                                   md.volatility);
-  } else {
-    return BlackScholes::putPrice(md.spot_price, strike_price_,
-                                  md.risk_free_rate, time_to_expiry_years_,
-                                  md.volatility);
-  }
-}
-
-double EuropeanOption::priceBinomial(const MarketData &md) const {
-  return BinomialTree::europeanOptionPrice(
-      md.spot_price, strike_price_, md.risk_free_rate, time_to_expiry_years_,
-      md.volatility, option_type_, binomial_steps_);
-}
-
-double EuropeanOption::priceJumpDiffusion(const MarketData &md) const {
-  return JumpDiffusion::mertonOptionPrice(
-      md.spot_price, strike_price_, md.risk_free_rate, time_to_expiry_years_,
-      md.volatility, option_type_, jump_intensity_, jump_mean_,
-      jump_volatility_);
-}
-
 double EuropeanOption::price(const MarketData &md) const {
+  if (md.vol_surface) {
+    return price(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  double result = 0.0;
-
-  switch (pricing_model_) {
-  case PricingModel::BlackScholes:
-    result = priceBlackScholes(md);
-    break;
-  case PricingModel::Binomial:
-    result = priceBinomial(md);
-    break;
-  case PricingModel::MertonJumpDiffusion:
-    result = priceJumpDiffusion(md);
-    break;
-  default:
-    throw std::runtime_error("Unknown pricing model");
-  }
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::price(terms, md);
+  });
 
   if (std::isnan(result) || std::isinf(result) || result < 0.0) {
     throw std::runtime_error("Invalid option price calculated");
@@ -162,42 +168,16 @@ double EuropeanOption::price(const MarketData &md) const {
   return result;
 }
 
-double EuropeanOption::deltaBlackScholes(const MarketData &md) const {
-  if (option_type_ == OptionType::Call) {
-    return BlackScholes::callDelta(md.spot_price, strike_price_,
-                                   md.risk_free_rate, time_to_expiry_years_,
-                                   md.volatility);
-  } else {
-    return BlackScholes::putDelta(md.spot_price, strike_price_,
-                                  md.risk_free_rate, time_to_expiry_years_,
-                                  md.volatility);
-  }
-}
-
-double EuropeanOption::deltaNumerical(const MarketData &md) const {
-  const double bump = md.spot_price * 0.01;
-
-  MarketData md_up = md;
-  MarketData md_down = md;
-  md_up.spot_price = md.spot_price + bump;
-  md_down.spot_price = md.spot_price - bump;
-
-  double price_up = price(md_up);
-  double price_down = price(md_down);
-
-  return (price_up - price_down) / (2.0 * bump);
-}
-
 double EuropeanOption::delta(const MarketData &md) const {
+  if (md.vol_surface) {
+    return delta(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  double result = 0.0;
-
-  if (pricing_model_ == PricingModel::BlackScholes) {
-    result = deltaBlackScholes(md);
-  } else {
-    result = deltaNumerical(md);
-  }
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::delta(terms, md);
+  });
 
   if (std::isnan(result) || std::isinf(result)) {
     throw std::runtime_error("Invalid delta calculated");
@@ -207,29 +187,18 @@ double EuropeanOption::delta(const MarketData &md) const {
 }
 
 double EuropeanOption::gamma(const MarketData &md) const {
+  if (md.vol_surface) {
+    return gamma(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  double result = 0.0;
-
-  if (pricing_model_ == PricingModel::BlackScholes) {
-    result =
-        BlackScholes::gamma(md.spot_price, strike_price_, md.risk_free_rate,
-                            time_to_expiry_years_, md.volatility);
-  } else {
-    const double bump = md.spot_price * 0.01;
-
-    MarketData md_up = md;
-    MarketData md_down = md;
-    md_up.spot_price = md.spot_price + bump;
-    md_down.spot_price = md.spot_price - bump;
-
-    double delta_up = delta(md_up);
-    double delta_down = delta(md_down);
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::gamma(terms, md);
+  });
 
-    result = (delta_up - delta_down) / (2.0 * bump);
-  }
-
-  if (std::isnan(result) || std::isinf(result) || result < 0.0) {
+  if (std::isnan(result) || std::isinf(result) ||
+      (pricing_model_ == PricingModel::BlackScholes && result < 0.0)) {
     throw std::runtime_error("Invalid gamma calculated");
   }
 
@@ -237,26 +206,15 @@ double EuropeanOption::gamma(const MarketData &md) const {
 }
 
 double EuropeanOption::vega(const MarketData &md) const {
+  if (md.vol_surface) {
+    return vega(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  double result = 0.0;
-
-  if (pricing_model_ == PricingModel::BlackScholes) {
-    result = BlackScholes::vega(md.spot_price, strike_price_, md.risk_free_rate,
-                                time_to_expiry_years_, md.volatility);
-  } else {
-    const double bump = 0.01;
-
-    MarketData md_up = md;
-    MarketData md_down = md;
-    md_up.volatility = md.volatility + bump;
-    md_down.volatility = std::max(0.0, md.volatility - bump);
-
-    double price_up = price(md_up);
-    double price_down = price(md_down);
-
-    result = (price_up - price_down) / (2.0 * bump);
-  }
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::vega(terms, md);
+  });
 
   if (std::isnan(result) || std::isinf(result) || result < 0.0) {
     throw std::runtime_error("Invalid vega calculated");
@@ -266,52 +224,78 @@ double EuropeanOption::vega(const MarketData &md) const {
 }
 
 double EuropeanOption::theta(const MarketData &md) const {
+  if (md.vol_surface) {
+    return theta(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  double result = 0.0;
-
-  if (pricing_model_ == PricingModel::BlackScholes) {
-    if (option_type_ == OptionType::Call) {
-      result = BlackScholes::callTheta(md.spot_price, strike_price_,
-                                       md.risk_free_rate, time_to_expiry_years_,
-                                       md.volatility);
-    } else {
-      result = BlackScholes::putTheta(md.spot_price, strike_price_,
-                                      md.risk_free_rate, time_to_expiry_years_,
-                                      md.volatility);
-    }
-  } else {
-    const double bump = 1.0 / 365.0;
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::theta(terms, md);
+  });
 
-    if (time_to_expiry_years_ < bump) {
-      return 0.0;
-    }
+  if (std::isnan(result) || std::isinf(result)) {
+    throw std::runtime_error("Invalid theta calculated");
+  }
 
-    double current_price = price(md);
+  return result;
+}
 
-    EuropeanOption temp_option = *this;
-    temp_option.time_to_expiry_years_ =
-        std::max(0.0, time_to_expiry_years_ - bump);
-    double future_price = temp_option.price(md);
+std::string EuropeanOption::getAssetId() const { return underlying_asset_id_; }
 
-    result = (future_price - current_price) / bump;
+bool EuropeanOption::getContractTerms(ContractTerms &terms) const {
+  terms.option_type = option_type_;
+  terms.strike = strike_price_;
+  terms.time_to_expiry = time_to_expiry_years_;
+  terms.is_american = false;
+  terms.model = pricing_model_;
+  terms.binomial_steps = binomial_steps_;
+  terms.lattice_scheme = lattice_scheme_;
+  terms.jump_intensity = jump_intensity_;
+  terms.jump_mean = jump_mean_;
+  terms.jump_volatility = jump_volatility_;
+  return true;
+}
+
+Greeks EuropeanOption::computeAll(const MarketData &md) const {
+  if (md.vol_surface) {
+    return computeAll(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
   }
+  validateMarketData(md);
 
-  if (std::isnan(result) || std::isinf(result)) {
+  const ContractTerms terms = termsOf(*this);
+  const Greeks greeks = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::greeks(terms, md);
+  });
+
+  if (std::isnan(greeks.price) || std::isinf(greeks.price) ||
+      greeks.price < 0.0) {
+    throw std::runtime_error("Invalid option price calculated");
+  }
+  if (std::isnan(greeks.delta) || std::isinf(greeks.delta)) {
+    throw std::runtime_error("Invalid delta calculated");
+  }
+  if (std::isnan(greeks.gamma) || std::isinf(greeks.gamma) ||
+      (pricing_model_ == PricingModel::BlackScholes && greeks.gamma < 0.0)) {
+    throw std::runtime_error("Invalid gamma calculated");
+  }
+  if (std::isnan(greeks.vega) || std::isinf(greeks.vega) || greeks.vega < 0.0) {
+    throw std::runtime_error("Invalid vega calculated");
+  }
+  if (std::isnan(greeks.theta) || std::isinf(greeks.theta)) {
     throw std::runtime_error("Invalid theta calculated");
   }
 
-  return result;
+  return greeks;
 }
 
-std::string EuropeanOption::getAssetId() const { return underlying_asset_id_; }
-
 AmericanOption::AmericanOption(OptionType type, double strike,
                                double time_to_expiry, std::string asset_id,
                                int binomial_steps)
     : option_type_(type), strike_price_(strike),
       time_to_expiry_years_(time_to_expiry), underlying_asset_id_(asset_id),
-      binomial_steps_(binomial_steps) {
+      binomial_steps_(binomial_steps),
+      lattice_scheme_(LatticeScheme::CoxRossRubinstein) {
   validateParameters();
 }
 
@@ -348,6 +332,18 @@ bool AmericanOption::isValid() const {
   }
 }
 
+bool AmericanOption::getContractTerms(ContractTerms &terms) const {
+  terms = ContractTerms();
+  terms.option_type = option_type_;
+  terms.strike = strike_price_;
+  terms.time_to_expiry = time_to_expiry_years_;
+  terms.is_american = true;
+  terms.model = PricingModel::Binomial;
+  terms.binomial_steps = binomial_steps_;
+  terms.lattice_scheme = lattice_scheme_;
+  return true;
+}
+
 std::string AmericanOption::getInstrumentType() const {
   return "AmericanOption";
 }
@@ -361,6 +357,14 @@ void AmericanOption::setBinomialSteps(int steps) {
 
 int AmericanOption::getBinomialSteps() const { return binomial_steps_; }
 
+void AmericanOption::setLatticeScheme(LatticeScheme scheme) {
+  lattice_scheme_ = scheme;
+}
+
+LatticeScheme AmericanOption::getLatticeScheme() const {
+  return lattice_scheme_;
+}
+
 double AmericanOption::calculateIntrinsicValue(double spot_price) const {
   if (option_type_ == OptionType::Call) {
     return std::max(0.0, spot_price - strike_price_);
@@ -370,11 +374,15 @@ double AmericanOption::calculateIntrinsicValue(double spot_price) const {
 }
 
 double AmericanOption::price(const MarketData &md) const {
+  if (md.vol_surface) {
+    return price(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  double result = BinomialTree::americanOptionPrice(
-      md.spot_price, strike_price_, md.risk_free_rate, time_to_expiry_years_,
-      md.volatility, option_type_, binomial_steps_);
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::price(terms, md);
+  });
 
   if (std::isnan(result) || std::isinf(result) || result < 0.0) {
     throw std::runtime_error("Invalid American option price calculated");
@@ -384,19 +392,15 @@ double AmericanOption::price(const MarketData &md) const {
 }
 
 double AmericanOption::delta(const MarketData &md) const {
+  if (md.vol_surface) {
+    return delta(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  const double bump = md.spot_price * 0.01;
-
-  MarketData md_up = md;
-  MarketData md_down = md;
-  md_up.spot_price = md.spot_price + bump;
-  md_down.spot_price = md.spot_price - bump;
-
-  double price_up = price(md_up);
-  double price_down = price(md_down);
-
-  double result = (price_up - price_down) / (2.0 * bump);
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::delta(terms, md);
+  });
 
   if (std::isnan(result) || std::isinf(result)) {
     throw std::runtime_error("Invalid delta calculated");
@@ -406,19 +410,15 @@ double AmericanOption::delta(const MarketData &md) const {
 }
 
 double AmericanOption::gamma(const MarketData &md) const {
+  if (md.vol_surface) {
+    return gamma(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  const double bump = md.spot_price * 0.01;
-
-  MarketData md_up = md;
-  MarketData md_down = md;
-  md_up.spot_price = md.spot_price + bump;
-  md_down.spot_price = md.spot_price - bump;
-
-  double delta_up = delta(md_up);
-  double delta_down = delta(md_down);
-
-  double result = (delta_up - delta_down) / (2.0 * bump);
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::gamma(terms, md);
+  });
 
   if (std::isnan(result) || std::isinf(result)) {
     throw std::runtime_error("Invalid gamma calculated");
@@ -428,19 +428,15 @@ double AmericanOption::gamma(const MarketData &md) const {
 }
 
 double AmericanOption::vega(const MarketData &md) const {
+  if (md.vol_surface) {
+    return vega(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  const double bump = 0.01;
-
-  MarketData md_up = md;
-  MarketData md_down = md;
-  md_up.volatility = md.volatility + bump;
-  md_down.volatility = std::max(0.0, md.volatility - bump);
-
-  double price_up = price(md_up);
-  double price_down = price(md_down);
-
-  double result = (price_up - price_down) / (2.0 * bump);
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::vega(terms, md);
+  });
 
   if (std::isnan(result) || std::isinf(result)) {
     throw std::runtime_error("Invalid vega calculated");
@@ -450,28 +446,52 @@ double AmericanOption::vega(const MarketData &md) const {
 }
 
 double AmericanOption::theta(const MarketData &md) const {
+  if (md.vol_surface) {
+    return theta(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
   validateMarketData(md);
 
-  const double bump = 1.0 / 365.0;
+  const ContractTerms terms = termsOf(*this);
+  double result = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::theta(terms, md);
+  });
 
-  if (time_to_expiry_years_ < bump) {
-    return 0.0;
+  if (std::isnan(result) || std::isinf(result)) {
+    throw std::runtime_error("Invalid theta calculated");
   }
 
-  double current_price = price(md);
+  return result;
+}
 
-  AmericanOption temp_option = *this;
-  temp_option.time_to_expiry_years_ =
-      std::max(0.0, time_to_expiry_years_ - bump);
-  double future_price = temp_option.price(md);
+Greeks AmericanOption::computeAll(const MarketData &md) const {
+  if (md.vol_surface) {
+    return computeAll(withSurfaceVol(md, strike_price_, time_to_expiry_years_));
+  }
+  validateMarketData(md);
 
-  double result = (future_price - current_price) / bump;
+  const ContractTerms terms = termsOf(*this);
+  const Greeks greeks = PricingKernel::dispatch(terms, [&](auto pricer) {
+    return decltype(pricer)::greeks(terms, md);
+  });
 
-  if (std::isnan(result) || std::isinf(result)) {
+  if (std::isnan(greeks.price) || std::isinf(greeks.price) ||
+      greeks.price < 0.0) {
+    throw std::runtime_error("Invalid American option price calculated");
+  }
+  if (std::isnan(greeks.delta) || std::isinf(greeks.delta)) {
+    throw std::runtime_error("Invalid delta calculated");
+  }
+  if (std::isnan(greeks.gamma) || std::isinf(greeks.gamma)) {
+    throw std::runtime_error("Invalid gamma calculated");
+  }
+  if (std::isnan(greeks.vega) || std::isinf(greeks.vega)) {
+    throw std::runtime_error("Invalid vega calculated");
+  }
+  if (std::isnan(greeks.theta) || std::isinf(greeks.theta)) {
     throw std::runtime_error("Invalid theta calculated");
   }
 
-  return result;
+  return greeks;
 }
 
 std::string AmericanOption::getAssetId() const { return underlying_asset_id_; }
\ No newline at end of file
@@ -1,11 +1,34 @@
 #include "JumpDiffusion.h"
 #include "BlackScholes.h"
+#include "RunStats.h"
 #include <cmath>
 #include <stdexcept>
 #include <algorithm>
 
 namespace JumpDiffusion {
 
+namespace {
+
+void validateSeriesInputs(double T, double sigma, double lambda, double jump_vol) {
+    if (T < 0.0) {
+        throw std::invalid_argument("Time to expiry cannot be negative");
+    }
+    if (sigma < 0.0 || jump_vol < 0.0) {
+        throw std::invalid_argument("Volatilities cannot be negative");
+    }
+    if (lambda < 0.0) {
+        throw std::invalid_argument("Jump intensity must be non-negative");
+    }
+}
+
+void validateSpotAndStrike(double S, double K) {
+    if (S <= 0.0 || K <= 0.0) {
+        throw std::invalid_argument("Stock price and strike must be positive");
+    }
+}
+
+}
+
 double poissonProbability(int n, double lambda_t) {
     if (lambda_t < 0.0) {
         throw std::invalid_argument("Lambda * T must be non-negative");
@@ -18,40 +41,22 @@ double poissonProbability(int n, double lambda_t) {
         return n == 0 ? 1.0 : 0.0;
     }
     
-    double log_prob = n * std::log(lambda_t) - lambda_t;
-    for (int i = 2; i <= n; ++i) {
-        log_prob -= std::log(static_cast<double>(i));
-    }
-    
-    return std::exp(log_prob);
+    return std::exp(n * std::log(lambda_t) - lambda_t - std::lgamma(n + 1.0));
 }
 
-double mertonCallPrice(
-    double S, double K, double r, double T, double sigma,
-    double lambda, double jump_mean, double jump_vol,
-    int max_jumps
-) {
-    if (S <= 0.0 || K <= 0.0) {
-        throw std::invalid_argument("Stock price and strike must be positive");
-    }
-    if (T < 0.0) {
-        throw std::invalid_argument("Time to expiry cannot be negative");
-    }
-    if (sigma < 0.0 || jump_vol < 0.0) {
-        throw std::invalid_argument("Volatilities cannot be negative");
-    }
-    if (lambda < 0.0) {
-        throw std::invalid_argument("Jump intensity must be non-negative");
-    }
+MertonSeries::MertonSeries(
+    double r, double T, double sigma, double lambda,
+    double jump_mean, double jump_vol, int max_jumps
+) : T_(T), sigma_(sigma) {
+    validateSeriesInputs(T, sigma, lambda, jump_vol);
     
     if (T == 0.0) {
-        return std::max(0.0, S - K);
+        return;
     }
     
     const double k = std::exp(jump_mean + 0.5 * jump_vol * jump_vol) - 1.0;
-    // const double lambda_prime = lambda * (1.0 + k);
+    const double diffusion_variance = sigma * sigma * T;
     
-    double option_value = 0.0;
     double sum_prob = 0.0;
     
     for (int n = 0; n <= max_jumps; ++n) {
@@ -63,79 +68,158 @@ double mertonCallPrice(
         
         sum_prob += prob;
         
-        const double sigma_n = std::sqrt(
-            sigma * sigma + n * jump_vol * jump_vol / T
-        );
-        
         const double r_n = r - lambda * k + n * (jump_mean + 0.5 * jump_vol * jump_vol) / T;
+        const double jump_variance = n * jump_vol * jump_vol;
         
-        const double bs_price = BlackScholes::callPrice(S, K, r_n, T, sigma_n);
-        
-        option_value += prob * bs_price;
+        weight_.push_back(prob);
+        jump_variance_.push_back(jump_variance);
+        drift_.push_back(r_n * T);
+        discount_.push_back(std::exp(-r_n * T));
+        total_variance_.push_back(diffusion_variance + jump_variance);
+        vol_sqrt_T_.push_back(std::sqrt(diffusion_variance + jump_variance));
         
         if (sum_prob > 0.9999 && prob < 1e-8) {
             break;
         }
     }
-    
-    if (std::isnan(option_value) || std::isinf(option_value)) {
-        throw std::runtime_error("Invalid Merton jump diffusion price");
+}
+
+double MertonSeries::termPrice(
+    size_t n, double S, double K, double log_moneyness, bool call,
+    double total_variance, double vol_sqrt_T
+) const {
+    if (vol_sqrt_T <= 0.0) {
+        return call ? std::max(0.0, S - K) : std::max(0.0, K - S);
     }
     
-    return option_value;
+    const double d1 = (log_moneyness + drift_[n] + 0.5 * total_variance) / vol_sqrt_T;
+    const double d2 = d1 - vol_sqrt_T;
+    const double K_disc = K * discount_[n];
+    
+    return call ? S * BlackScholes::N(d1) - K_disc * BlackScholes::N(d2)
+                : K_disc * BlackScholes::N(-d2) - S * BlackScholes::N(-d1);
 }
 
-double mertonPutPrice(
-    double S, double K, double r, double T, double sigma,
-    double lambda, double jump_mean, double jump_vol,
-    int max_jumps
-) {
-    if (S <= 0.0 || K <= 0.0) {
-        throw std::invalid_argument("Stock price and strike must be positive");
-    }
-    if (T < 0.0) {
-        throw std::invalid_argument("Time to expiry cannot be negative");
+double MertonSeries::price(double S, double K, OptionType type) const {
+    QE_COUNT(merton_prices, 1);
+    const bool call = type == OptionType::Call;
+    if (T_ == 0.0) {
+        return call ? std::max(0.0, S - K) : std::max(0.0, K - S);
     }
-    if (sigma < 0.0 || jump_vol < 0.0) {
-        throw std::invalid_argument("Volatilities cannot be negative");
+    
+    const double log_moneyness = std::log(S / K);
+    double value = 0.0;
+    for (size_t n = 0; n < weight_.size(); ++n) {
+        value += weight_[n] * termPrice(n, S, K, log_moneyness, call,
+                                        total_variance_[n], vol_sqrt_T_[n]);
     }
-    if (lambda < 0.0) {
-        throw std::invalid_argument("Jump intensity must be non-negative");
+    return value;
+}
+
+double MertonSeries::price(double S, double K, OptionType type, double sigma) const {
+    if (sigma == sigma_) {
+        return price(S, K, type);
     }
+    QE_COUNT(merton_prices, 1);
     
-    if (T == 0.0) {
-        return std::max(0.0, K - S);
+    const bool call = type == OptionType::Call;
+    if (T_ == 0.0) {
+        return call ? std::max(0.0, S - K) : std::max(0.0, K - S);
     }
     
-    const double k = std::exp(jump_mean + 0.5 * jump_vol * jump_vol) - 1.0;
+    const double diffusion_variance = sigma * sigma * T_;
+    const double log_moneyness = std::log(S / K);
+    double value = 0.0;
+    for (size_t n = 0; n < weight_.size(); ++n) {
+        const double total_variance = diffusion_variance + jump_variance_[n];
+        value += weight_[n] * termPrice(n, S, K, log_moneyness, call,
+                                        total_variance, std::sqrt(total_variance));
+    }
+    return value;
+}
+
+MertonGreeks MertonSeries::greeks(double S, double K, OptionType type) const {
+    const bool call = type == OptionType::Call;
+    MertonGreeks result;
     
-    double option_value = 0.0;
-    double sum_prob = 0.0;
+    if (T_ == 0.0) {
+        result.price = call ? std::max(0.0, S - K) : std::max(0.0, K - S);
+        result.delta = call ? (S > K ? 1.0 : 0.0) : (S < K ? -1.0 : 0.0);
+        return result;
+    }
     
-    for (int n = 0; n <= max_jumps; ++n) {
-        const double prob = poissonProbability(n, lambda * T);
-        
-        if (prob < 1e-10) {
-            break;
-        }
-        
-        sum_prob += prob;
-        
-        const double sigma_n = std::sqrt(
-            sigma * sigma + n * jump_vol * jump_vol / T
-        );
+    const double log_moneyness = std::log(S / K);
+    
+    for (size_t n = 0; n < weight_.size(); ++n) {
+        const double w = weight_[n];
+        const double vol_sqrt_T = vol_sqrt_T_[n];
+        const double K_disc = K * discount_[n];
         
-        const double r_n = r - lambda * k + n * (jump_mean + 0.5 * jump_vol * jump_vol) / T;
+        result.price += w * termPrice(n, S, K, log_moneyness, call,
+                                      total_variance_[n], vol_sqrt_T);
         
-        const double bs_price = BlackScholes::putPrice(S, K, r_n, T, sigma_n);
+        if (vol_sqrt_T <= 0.0) {
+            result.delta += w * (call ? (S > K ? 1.0 : 0.0) : (S < K ? -1.0 : 0.0));
+            const bool paid = call ? S > K : S < K;
+            result.rho += paid ? w * (call ? 1.0 : -1.0) * K_disc * T_ / 100.0 : 0.0;
+            continue;
+        }
         
-        option_value += prob * bs_price;
+        const double d1 = (log_moneyness + drift_[n] + 0.5 * total_variance_[n]) / vol_sqrt_T;
+        const double d2 = d1 - vol_sqrt_T;
+        const double n_d1 = BlackScholes::nPrime(d1);
         
-        if (sum_prob > 0.9999 && prob < 1e-8) {
-            break;
-        }
+        result.delta += w * (call ? BlackScholes::N(d1) : BlackScholes::N(d1) - 1.0);
+        result.gamma += w * n_d1 / (S * vol_sqrt_T);
+        // d(sigma_n)/d(sigma) = sigma / sigma_n.
+        result.vega += w * S * n_d1 * sigma_ * T_ / vol_sqrt_T;
+        result.rho += w * (call ? K_disc * T_ * BlackScholes::N(d2)
+                                : -K_disc * T_ * BlackScholes::N(-d2)) / 100.0;
     }
     
+    return result;
+}
+
+void MertonSeries::priceBatch(
+    const double* spots, const double* strikes,
+    const uint8_t* is_call, double* prices, size_t n
+) const {
+    for (size_t i = 0; i < n; ++i) {
+        prices[i] = price(spots[i], strikes[i], is_call[i] ? OptionType::Call : OptionType::Put);
+    }
+}
+
+size_t MertonSeries::termCount() const {
+    return weight_.size();
+}
+
+double mertonCallPrice(
+    double S, double K, double r, double T, double sigma,
+    double lambda, double jump_mean, double jump_vol,
+    int max_jumps
+) {
+    validateSpotAndStrike(S, K);
+    
+    const double option_value = MertonSeries(r, T, sigma, lambda, jump_mean, jump_vol, max_jumps)
+                                    .price(S, K, OptionType::Call);
+    
+    if (std::isnan(option_value) || std::isinf(option_value)) {
+        throw std::runtime_error("Invalid Merton jump diffusion price");
+    }
+    
+    return option_value;
+}
+
+double mertonPutPrice(
+    double S, double K, double r, double T, double sigma,
+    double lambda, double jump_mean, double jump_vol,
+    int max_jumps
+) {
+    validateSpotAndStrike(S, K);
+    
+    const double option_value = MertonSeries(r, T, sigma, lambda, jump_mean, jump_vol, max_jumps)
+                                    .price(S, K, OptionType::Put);
+    
     if (std::isnan(option_value) || std::isinf(option_value)) {
         throw std::runtime_error("Invalid Merton jump diffusion price");
     }
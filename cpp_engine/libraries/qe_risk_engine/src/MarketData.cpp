@@ -1,4 +1,90 @@
 #include "MarketData.h"
+#include <atomic>
+
+namespace {
+
+// Shared by every snapshot so a version never identifies two different
+// writes, even across managers.
+std::atomic<uint64_t> next_version{1};
+
+}
+
+MarketDataSnapshot::MarketDataSnapshot(const std::map<std::string, MarketData>& market_data_map) {
+    data_.reserve(market_data_map.size());
+    present_.reserve(market_data_map.size());
+    versions_.reserve(market_data_map.size());
+    for (const auto& [asset_id, md] : market_data_map) {
+        set(asset_id, md);
+    }
+}
+
+uint32_t MarketDataSnapshot::set(const std::string& asset_id, const MarketData& md) {
+    const uint32_t handle = symbols_.intern(asset_id);
+    const uint64_t version = next_version.fetch_add(1, std::memory_order_relaxed);
+    if (handle == data_.size()) {
+        data_.push_back(md);
+        present_.push_back(1);
+        versions_.push_back(version);
+        ++count_;
+        return handle;
+    }
+    
+    data_[handle] = md;
+    versions_[handle] = version;
+    if (!present_[handle]) {
+        present_[handle] = 1;
+        ++count_;
+    }
+    return handle;
+}
+
+bool MarketDataSnapshot::erase(const std::string& asset_id) {
+    const uint32_t handle = this->handle(asset_id);
+    if (handle == AssetSymbolTable::npos) {
+        return false;
+    }
+    present_[handle] = 0;
+    data_[handle] = MarketData();
+    versions_[handle] = 0;
+    --count_;
+    return true;
+}
+
+void MarketDataSnapshot::clear() {
+    symbols_.clear();
+    data_.clear();
+    present_.clear();
+    versions_.clear();
+    count_ = 0;
+}
+
+uint32_t MarketDataSnapshot::handle(const std::string& asset_id) const {
+    const uint32_t handle = symbols_.find(asset_id);
+    return handle != AssetSymbolTable::npos && present_[handle] ? handle : AssetSymbolTable::npos;
+}
+
+bool MarketDataSnapshot::contains(uint32_t handle) const {
+    return handle < present_.size() && present_[handle];
+}
+
+const MarketData& MarketDataSnapshot::at(uint32_t handle) const {
+    if (!contains(handle)) {
+        throw std::out_of_range("No market data for handle " + std::to_string(handle));
+    }
+    return data_[handle];
+}
+
+uint64_t MarketDataSnapshot::version(uint32_t handle) const {
+    return contains(handle) ? versions_[handle] : 0;
+}
+
+const AssetSymbolTable& MarketDataSnapshot::symbols() const {
+    return symbols_;
+}
+
+size_t MarketDataSnapshot::size() const {
+    return count_;
+}
 
 void MarketDataManager::addMarketData(const std::string& asset_id, const MarketData& md) {
     if (asset_id.empty()) {
@@ -7,11 +93,11 @@ void MarketDataManager::addMarketData(const std::string& asset_id, const MarketD
     
     md.validate();
     
-    if (market_data_map_.find(asset_id) != market_data_map_.end()) {
+    if (snapshot_.handle(asset_id) != AssetSymbolTable::npos) {
         throw std::runtime_error("Market data for " + asset_id + " already exists. Use updateMarketData instead.");
     }
     
-    market_data_map_[asset_id] = md;
+    snapshot_.set(asset_id, md);
 }
 
 void MarketDataManager::updateMarketData(const std::string& asset_id, const MarketData& md) {
@@ -21,11 +107,11 @@ void MarketDataManager::updateMarketData(const std::string& asset_id, const Mark
     
     md.validate();
     
-    if (market_data_map_.find(asset_id) == market_data_map_.end()) {
+    if (snapshot_.handle(asset_id) == AssetSymbolTable::npos) {
         throw std::runtime_error("Market data for " + asset_id + " does not exist. Use addMarketData instead.");
     }
     
-    market_data_map_[asset_id] = md;
+    snapshot_.set(asset_id, md);
 }
 
 MarketData MarketDataManager::getMarketData(const std::string& asset_id) const {
@@ -33,16 +119,16 @@ MarketData MarketDataManager::getMarketData(const std::string& asset_id) const {
         throw std::invalid_argument("Asset ID cannot be empty");
     }
     
-    auto it = market_data_map_.find(asset_id);
-    if (it == market_data_map_.end()) {
+    const uint32_t handle = snapshot_.handle(asset_id);
+    if (handle == AssetSymbolTable::npos) {
         throw std::runtime_error("Market data for " + asset_id + " not found");
     }
     
-    return it->second;
+    return snapshot_.at(handle);
 }
 
 bool MarketDataManager::hasMarketData(const std::string& asset_id) const {
-    return market_data_map_.find(asset_id) != market_data_map_.end();
+    return snapshot_.handle(asset_id) != AssetSymbolTable::npos;
 }
 
 void MarketDataManager::removeMarketData(const std::string& asset_id) {
@@ -50,22 +136,38 @@ void MarketDataManager::removeMarketData(const std::string& asset_id) {
         throw std::invalid_argument("Asset ID cannot be empty");
     }
     
-    auto it = market_data_map_.find(asset_id);
-    if (it == market_data_map_.end()) {
+    if (!snapshot_.erase(asset_id)) {
         throw std::runtime_error("Market data for " + asset_id + " not found");
     }
-    
-    market_data_map_.erase(it);
 }
 
 void MarketDataManager::clear() {
-    market_data_map_.clear();
+    snapshot_.clear();
 }
 
 size_t MarketDataManager::size() const {
-    return market_data_map_.size();
+    return snapshot_.size();
 }
 
 std::map<std::string, MarketData> MarketDataManager::getAllMarketData() const {
-    return market_data_map_;
+    std::map<std::string, MarketData> all;
+    const AssetSymbolTable& symbols = snapshot_.symbols();
+    for (uint32_t handle = 0; handle < symbols.size(); ++handle) {
+        if (snapshot_.contains(handle)) {
+            all.emplace(symbols.symbol(handle), snapshot_.at(handle));
+        }
+    }
+    return all;
+}
+
+uint32_t MarketDataManager::getHandle(const std::string& asset_id) const {
+    return snapshot_.handle(asset_id);
+}
+
+const MarketData& MarketDataManager::getMarketDataByHandle(uint32_t handle) const {
+    return snapshot_.at(handle);
+}
+
+const MarketDataSnapshot& MarketDataManager::getSnapshot() const {
+    return snapshot_;
 }
\ No newline at end of file
@@ -0,0 +1,93 @@
+#include "Parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+
+int resolveThreadCount(int requested) {
+    if (requested < 0) {
+        throw std::invalid_argument("Thread count cannot be negative");
+    }
+    if (requested == 0) {
+        const unsigned int hw = std::thread::hardware_concurrency();
+        return hw == 0 ? 1 : static_cast<int>(hw);
+    }
+    return requested;
+}
+
+void forEachBlock(
+    size_t num_blocks,
+    int num_threads,
+    const std::function<void(size_t block, int worker)>& fn
+) {
+    if (num_blocks == 0) {
+        return;
+    }
+
+    const size_t workers = std::min(
+        num_blocks, static_cast<size_t>(std::max(1, num_threads))
+    );
+
+    if (workers == 1) {
+        for (size_t block = 0; block < num_blocks; ++block) {
+            fn(block, 0);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next_block(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr first_error;
+    std::mutex error_mutex;
+
+    auto worker_loop = [&](int worker) {
+        while (!failed.load(std::memory_order_relaxed)) {
+            const size_t block = next_block.fetch_add(1, std::memory_order_relaxed);
+            if (block >= num_blocks) {
+                return;
+            }
+            try {
+                fn(block, worker);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!first_error) {
+                    first_error = std::current_exception();
+                }
+                failed.store(true, std::memory_order_relaxed);
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(workers - 1);
+
+    try {
+        for (size_t w = 1; w < workers; ++w) {
+            threads.emplace_back(worker_loop, static_cast<int>(w));
+        }
+    } catch (...) {
+        failed.store(true);
+        for (auto& t : threads) {
+            t.join();
+        }
+        throw std::runtime_error("Failed to start worker threads");
+    }
+
+    worker_loop(0);
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    if (first_error) {
+        std::rethrow_exception(first_error);
+    }
+}
+
+}
@@ -0,0 +1,153 @@
+#include "PnLSink.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+const char kMagic[8] = {'Q', 'E', 'P', 'N', 'L', '0', '0', '1'};
+
+constexpr size_t kRowAlignment = 64;
+
+template <typename T>
+void appendRaw(std::vector<char>& out, T value) {
+    const size_t at = out.size();
+    out.resize(at + sizeof(T));
+    std::memcpy(&out[at], &value, sizeof(T));
+}
+
+}
+
+bool PnLSink::wantsAssetBreakdown() const {
+    return false;
+}
+
+void PnLSink::begin(size_t, const std::vector<std::string>&) {
+}
+
+void PnLSink::finish() {
+}
+
+void PnLSink::abort() noexcept {
+}
+
+PnLFileSink::PnLFileSink(std::string path, bool asset_breakdown)
+    : path_(std::move(path)), asset_breakdown_(asset_breakdown) {
+}
+
+bool PnLFileSink::wantsAssetBreakdown() const {
+    return asset_breakdown_;
+}
+
+void PnLFileSink::begin(size_t paths, const std::vector<std::string>& asset_ids) {
+    const size_t assets = asset_breakdown_ ? asset_ids.size() : 0;
+    columns_ = 1 + assets;
+
+    std::vector<char> head(kMagic, kMagic + sizeof(kMagic));
+    appendRaw<uint64_t>(head, paths);
+    appendRaw<uint64_t>(head, assets);
+    const size_t offset_at = head.size();
+    appendRaw<uint64_t>(head, 0);
+    for (size_t a = 0; a < assets; ++a) {
+        appendRaw<uint32_t>(head, static_cast<uint32_t>(asset_ids[a].size()));
+        head.insert(head.end(), asset_ids[a].begin(), asset_ids[a].end());
+    }
+    head.resize((head.size() + kRowAlignment - 1) / kRowAlignment * kRowAlignment, 0);
+    row_offset_ = head.size();
+    const uint64_t offset = row_offset_;
+    std::memcpy(&head[offset_at], &offset, sizeof(offset));
+
+    file_.close();
+    file_.clear();
+    file_.open(path_, std::ios::binary | std::ios::trunc);
+    if (!file_) {
+        throw std::runtime_error("Cannot create P&L file: " + path_);
+    }
+    file_.write(head.data(), static_cast<std::streamsize>(head.size()));
+    if (!file_) {
+        throw std::runtime_error("Failed writing P&L file: " + path_);
+    }
+}
+
+void PnLFileSink::write(const PnLChunk& chunk) {
+    if (!file_.is_open()) {
+        throw std::runtime_error("P&L file sink written outside a run");
+    }
+    row_buffer_.resize(chunk.paths * columns_);
+    for (size_t p = 0; p < chunk.paths; ++p) {
+        double* row = &row_buffer_[p * columns_];
+        row[0] = chunk.pnl[p];
+        if (columns_ > 1) {
+            std::memcpy(row + 1, chunk.asset_pnl + p * chunk.assets, chunk.assets * sizeof(double));
+        }
+    }
+    file_.seekp(static_cast<std::streamoff>(row_offset_ + chunk.first_path * columns_ * sizeof(double)));
+    file_.write(reinterpret_cast<const char*>(row_buffer_.data()),
+                static_cast<std::streamsize>(row_buffer_.size() * sizeof(double)));
+    if (!file_) {
+        throw std::runtime_error("Failed writing P&L file: " + path_);
+    }
+}
+
+void PnLFileSink::finish() {
+    file_.close();
+    if (!file_) {
+        throw std::runtime_error("Failed writing P&L file: " + path_);
+    }
+}
+
+void PnLFileSink::abort() noexcept {
+    if (file_.is_open()) {
+        file_.close();
+        std::remove(path_.c_str());
+    }
+    file_.clear();
+}
+
+PnLBufferSink::PnLBufferSink(double* data, size_t rows, size_t columns)
+    : data_(data), rows_(rows), columns_(columns) {
+    if (!data || columns == 0) {
+        throw std::invalid_argument("P&L buffer needs memory and at least one column");
+    }
+}
+
+bool PnLBufferSink::wantsAssetBreakdown() const {
+    return columns_ > 1;
+}
+
+void PnLBufferSink::begin(size_t paths, const std::vector<std::string>& asset_ids) {
+    if (paths > rows_) {
+        throw std::invalid_argument("P&L buffer has " + std::to_string(rows_) +
+                                    " rows for " + std::to_string(paths) + " paths");
+    }
+    if (columns_ > 1 && columns_ != 1 + asset_ids.size()) {
+        throw std::invalid_argument("P&L buffer needs 1 + " + std::to_string(asset_ids.size()) +
+                                    " columns for an asset breakdown");
+    }
+}
+
+void PnLBufferSink::write(const PnLChunk& chunk) {
+    for (size_t p = 0; p < chunk.paths; ++p) {
+        double* row = data_ + (chunk.first_path + p) * columns_;
+        row[0] = chunk.pnl[p];
+        if (columns_ > 1) {
+            std::memcpy(row + 1, chunk.asset_pnl + p * chunk.assets, chunk.assets * sizeof(double));
+        }
+    }
+}
+
+PnLCallbackSink::PnLCallbackSink(Callback callback, bool asset_breakdown)
+    : callback_(std::move(callback)), asset_breakdown_(asset_breakdown) {
+    if (!callback_) {
+        throw std::invalid_argument("P&L callback sink needs a callback");
+    }
+}
+
+bool PnLCallbackSink::wantsAssetBreakdown() const {
+    return asset_breakdown_;
+}
+
+void PnLCallbackSink::write(const PnLChunk& chunk) {
+    callback_(chunk);
+}
@@ -2,6 +2,14 @@
 #include <algorithm>
 #include <sstream>
 #include <climits>
+#include <atomic>
+
+namespace
+{
+
+std::atomic<uint64_t> next_structure_revision{1};
+
+}
 
 void Portfolio::addInstrument(std::unique_ptr<Instrument> instrument, int quantity)
 {
@@ -40,6 +48,86 @@ void Portfolio::addInstrument(std::unique_ptr<Instrument> instrument, int quanti
     {
         throw std::runtime_error(std::string("Failed to add instrument: ") + e.what());
     }
+
+    try
+    {
+        columns.append(*instruments.back().first, quantity);
+    }
+    catch (const std::exception &e)
+    {
+        instruments.pop_back();
+        rebuildColumns();
+        throw std::runtime_error(std::string("Failed to add instrument: ") + e.what());
+    }
+    bumpStructureRevision();
+}
+
+void Portfolio::addOptionLines(const OptionLineArrays &lines, const std::vector<std::string> &asset_ids)
+{
+    if (lines.size == 0)
+    {
+        return;
+    }
+    if (!lines.is_call || !lines.strike || !lines.expiry || !lines.quantity || !lines.asset_index)
+    {
+        throw std::invalid_argument("Option lines must provide every input array");
+    }
+
+    // Build every option before touching the portfolio, so a bad line
+    // leaves it unchanged.
+    std::vector<std::unique_ptr<Instrument>> built;
+    built.reserve(lines.size);
+    for (size_t i = 0; i < lines.size; ++i)
+    {
+        const uint32_t asset = lines.asset_index[i];
+        if (asset >= asset_ids.size() || asset_ids[asset].empty())
+        {
+            throw std::invalid_argument("Invalid asset index for option line " + std::to_string(i));
+        }
+
+        const OptionType type = lines.is_call[i] ? OptionType::Call : OptionType::Put;
+        try
+        {
+            if (lines.is_american && lines.is_american[i])
+            {
+                built.push_back(std::make_unique<AmericanOption>(
+                    type, lines.strike[i], lines.expiry[i], asset_ids[asset]));
+            }
+            else
+            {
+                built.push_back(std::make_unique<EuropeanOption>(
+                    type, lines.strike[i], lines.expiry[i], asset_ids[asset]));
+            }
+        }
+        catch (const std::exception &e)
+        {
+            throw std::invalid_argument("Invalid option line " + std::to_string(i) + ": " + e.what());
+        }
+    }
+
+    const size_t old_size = instruments.size();
+    // Grow geometrically, as addInstrument does, so repeated small
+    // batches do not move every line each time.
+    if (instruments.capacity() < old_size + lines.size)
+    {
+        instruments.reserve(std::max(old_size + lines.size, instruments.capacity() * 2));
+    }
+
+    try
+    {
+        for (size_t i = 0; i < lines.size; ++i)
+        {
+            instruments.emplace_back(std::move(built[i]), lines.quantity[i]);
+            columns.append(*instruments.back().first, lines.quantity[i]);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        instruments.erase(instruments.begin() + old_size, instruments.end());
+        rebuildColumns();
+        throw std::runtime_error(std::string("Failed to add option lines: ") + e.what());
+    }
+    bumpStructureRevision();
 }
 
 const std::vector<std::pair<std::unique_ptr<Instrument>, int>> &Portfolio::getInstruments() const
@@ -47,6 +135,11 @@ const std::vector<std::pair<std::unique_ptr<Instrument>, int>> &Portfolio::getIn
     return instruments;
 }
 
+const PortfolioColumns &Portfolio::getColumns() const
+{
+    return columns;
+}
+
 size_t Portfolio::size() const
 {
     return instruments.size();
@@ -61,6 +154,8 @@ void Portfolio::clear()
 {
     instruments.clear();
     instruments.shrink_to_fit();
+    columns.clear();
+    bumpStructureRevision();
 }
 
 void Portfolio::reserve(size_t capacity)
@@ -102,12 +197,25 @@ void Portfolio::removeInstrument(size_t index)
 {
     validateIndex(index);
     instruments.erase(instruments.begin() + index);
+    rebuildColumns();
+    bumpStructureRevision();
 }
 
 void Portfolio::updateQuantity(size_t index, int new_quantity)
 {
     validateIndex(index);
     instruments[index].second = new_quantity;
+    columns.setQuantity(index, new_quantity);
+}
+
+uint64_t Portfolio::structureRevision() const
+{
+    return structure_revision;
+}
+
+void Portfolio::bumpStructureRevision()
+{
+    structure_revision = next_structure_revision.fetch_add(1, std::memory_order_relaxed);
 }
 
 void Portfolio::validateIndex(size_t index) const
@@ -118,4 +226,13 @@ void Portfolio::validateIndex(size_t index) const
         oss << "Index " << index << " out of range. Portfolio size: " << instruments.size();
         throw std::out_of_range(oss.str());
     }
+}
+
+void Portfolio::rebuildColumns()
+{
+    columns.clear();
+    for (const auto &[instr, qty] : instruments)
+    {
+        columns.append(*instr, qty);
+    }
 }
\ No newline at end of file
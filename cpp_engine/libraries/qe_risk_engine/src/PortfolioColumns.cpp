@@ -0,0 +1,96 @@
+#include "PortfolioColumns.h"
+#include <stdexcept>
+
+size_t InstrumentGroup::size() const {
+    return line.size();
+}
+
+InstrumentGroup& PortfolioColumns::groupFor(
+    const ContractTerms& terms, uint32_t& group_index
+) {
+    for (size_t g = 0; g < groups_.size(); ++g) {
+        const InstrumentGroup& group = groups_[g];
+        if (group.is_american == terms.is_american && group.model == terms.model &&
+            group.option_type == terms.option_type) {
+            group_index = static_cast<uint32_t>(g);
+            return groups_[g];
+        }
+    }
+
+    group_index = static_cast<uint32_t>(groups_.size());
+    groups_.emplace_back();
+    groups_.back().is_american = terms.is_american;
+    groups_.back().model = terms.model;
+    groups_.back().option_type = terms.option_type;
+    return groups_.back();
+}
+
+void PortfolioColumns::append(const Instrument& instrument, int quantity) {
+    const size_t line = line_location_.size();
+    const uint32_t asset = assets_.intern(instrument.getAssetId());
+
+    ContractTerms terms;
+    if (!instrument.getContractTerms(terms)) {
+        generic_lines_.push_back(line);
+        line_asset_.push_back(asset);
+        line_location_.push_back(Location{AssetSymbolTable::npos, 0});
+        return;
+    }
+
+    uint32_t group_index = 0;
+    InstrumentGroup& group = groupFor(terms, group_index);
+    const uint32_t row = static_cast<uint32_t>(group.size());
+
+    group.is_call.push_back(terms.option_type == OptionType::Call ? 1 : 0);
+    group.strike.push_back(terms.strike);
+    group.time_to_expiry.push_back(terms.time_to_expiry);
+    group.asset.push_back(asset);
+    group.quantity.push_back(quantity);
+    group.binomial_steps.push_back(terms.binomial_steps);
+    group.lattice_scheme.push_back(terms.lattice_scheme);
+    group.jump_intensity.push_back(terms.jump_intensity);
+    group.jump_mean.push_back(terms.jump_mean);
+    group.jump_volatility.push_back(terms.jump_volatility);
+    group.line.push_back(line);
+
+    line_asset_.push_back(asset);
+    line_location_.push_back(Location{group_index, row});
+}
+
+void PortfolioColumns::setQuantity(size_t line, int quantity) {
+    if (line >= line_location_.size()) {
+        throw std::out_of_range("Line index out of range");
+    }
+    const Location& location = line_location_[line];
+    if (location.group != AssetSymbolTable::npos) {
+        groups_[location.group].quantity[location.row] = quantity;
+    }
+}
+
+void PortfolioColumns::clear() {
+    assets_.clear();
+    groups_.clear();
+    generic_lines_.clear();
+    line_asset_.clear();
+    line_location_.clear();
+}
+
+const AssetSymbolTable& PortfolioColumns::assets() const {
+    return assets_;
+}
+
+const std::vector<InstrumentGroup>& PortfolioColumns::groups() const {
+    return groups_;
+}
+
+const std::vector<size_t>& PortfolioColumns::genericLines() const {
+    return generic_lines_;
+}
+
+const std::vector<uint32_t>& PortfolioColumns::lineAssets() const {
+    return line_asset_;
+}
+
+size_t PortfolioColumns::lineCount() const {
+    return line_location_.size();
+}
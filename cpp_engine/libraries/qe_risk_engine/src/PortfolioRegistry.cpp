@@ -0,0 +1,128 @@
+#include "PortfolioRegistry.h"
+#include <climits>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+void checkLine(PortfolioRegistry::PortfolioId id, const Portfolio& portfolio, size_t line) {
+    if (line >= portfolio.size()) {
+        throw std::out_of_range("Line " + std::to_string(line) + " out of range for portfolio " +
+                                std::to_string(id));
+    }
+}
+
+int adjustedQuantity(int quantity, int delta, size_t line) {
+    if ((delta > 0 && quantity > INT_MAX - delta) || (delta < 0 && quantity < INT_MIN - delta)) {
+        throw std::overflow_error("Quantity overflow for line " + std::to_string(line));
+    }
+    return quantity + delta;
+}
+
+}
+
+PortfolioRegistry::PortfolioId PortfolioRegistry::registerPortfolio(
+    Portfolio portfolio,
+    const std::map<std::string, MarketData>& market_data
+) {
+    auto entry = std::make_shared<Entry>();
+    entry->portfolio = std::move(portfolio);
+    for (const auto& [asset_id, md] : market_data) {
+        entry->market_data.addMarketData(asset_id, md);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    const PortfolioId id = next_id_++;
+    entries_.emplace(id, std::move(entry));
+    return id;
+}
+
+void PortfolioRegistry::removePortfolio(PortfolioId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (entries_.erase(id) == 0) {
+        throw std::out_of_range("Unknown portfolio ID: " + std::to_string(id));
+    }
+}
+
+bool PortfolioRegistry::contains(PortfolioId id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.count(id) != 0;
+}
+
+size_t PortfolioRegistry::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+}
+
+std::shared_ptr<PortfolioRegistry::Entry> PortfolioRegistry::find(PortfolioId id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = entries_.find(id);
+    if (it == entries_.end()) {
+        throw std::out_of_range("Unknown portfolio ID: " + std::to_string(id));
+    }
+    return it->second;
+}
+
+void PortfolioRegistry::adjustQuantity(PortfolioId id, size_t line, int delta) {
+    const std::shared_ptr<Entry> entry = find(id);
+    std::lock_guard<std::mutex> lock(entry->mutex);
+
+    checkLine(id, entry->portfolio, line);
+    const int quantity = entry->portfolio.getInstruments()[line].second;
+    entry->portfolio.updateQuantity(line, adjustedQuantity(quantity, delta, line));
+}
+
+void PortfolioRegistry::setQuantity(PortfolioId id, size_t line, int quantity) {
+    const std::shared_ptr<Entry> entry = find(id);
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    entry->portfolio.updateQuantity(line, quantity);
+}
+
+void PortfolioRegistry::updateQuantities(PortfolioId id, const std::vector<QuantityUpdate>& updates) {
+    const std::shared_ptr<Entry> entry = find(id);
+    std::lock_guard<std::mutex> lock(entry->mutex);
+
+    // Every line's final quantity is worked out before any is written.
+    std::unordered_map<size_t, int> quantities;
+    for (const QuantityUpdate& update : updates) {
+        checkLine(id, entry->portfolio, update.line);
+        auto [it, inserted] = quantities.try_emplace(
+            update.line, entry->portfolio.getInstruments()[update.line].second);
+        it->second = update.delta ? adjustedQuantity(it->second, update.value, update.line)
+                                  : update.value;
+    }
+    for (const auto& [line, quantity] : quantities) {
+        entry->portfolio.updateQuantity(line, quantity);
+    }
+}
+
+void PortfolioRegistry::updateMarketData(PortfolioId id, const MarketData& md) {
+    md.validate();
+
+    const std::shared_ptr<Entry> entry = find(id);
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    if (entry->market_data.hasMarketData(md.asset_id)) {
+        entry->market_data.updateMarketData(md.asset_id, md);
+    } else {
+        entry->market_data.addMarketData(md.asset_id, md);
+    }
+}
+
+size_t PortfolioRegistry::lineCount(PortfolioId id) const {
+    const std::shared_ptr<Entry> entry = find(id);
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    return entry->portfolio.size();
+}
+
+std::map<std::string, MarketData> PortfolioRegistry::getMarketData(PortfolioId id) const {
+    const std::shared_ptr<Entry> entry = find(id);
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    return entry->market_data.getAllMarketData();
+}
+
+PortfolioRiskResult PortfolioRegistry::calculateRisk(PortfolioId id, RiskEngine& engine) const {
+    const std::shared_ptr<Entry> entry = find(id);
+    std::lock_guard<std::mutex> lock(entry->mutex);
+    return engine.calculatePortfolioRisk(
+        entry->portfolio, entry->market_data.getSnapshot(), entry->risk_cache);
+}
@@ -0,0 +1,183 @@
+#include "PricingCache.h"
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+uint64_t bits(double x) {
+    // -0.0 and 0.0 compare equal, so they must hash equal too.
+    const double normalized = x + 0.0;
+    uint64_t result;
+    std::memcpy(&result, &normalized, sizeof(result));
+    return result;
+}
+
+size_t combine(size_t seed, uint64_t value) {
+    value *= 0x9E3779B97F4A7C15ULL;
+    value ^= value >> 32;
+    return seed ^ (static_cast<size_t>(value) + 0x9E3779B9u + (seed << 6) + (seed >> 2));
+}
+
+}
+
+bool PricingCache::Key::operator==(const Key& other) const {
+    return kind == other.kind &&
+           option_type == other.option_type &&
+           is_american == other.is_american &&
+           model == other.model &&
+           lattice_scheme == other.lattice_scheme &&
+           binomial_steps == other.binomial_steps &&
+           strike == other.strike &&
+           time_to_expiry == other.time_to_expiry &&
+           jump_intensity == other.jump_intensity &&
+           jump_mean == other.jump_mean &&
+           jump_volatility == other.jump_volatility &&
+           spot == other.spot &&
+           rate == other.rate &&
+           vol == other.vol &&
+           dividend == other.dividend;
+}
+
+size_t PricingCache::KeyHash::operator()(const Key& key) const {
+    size_t seed = (static_cast<size_t>(key.kind) << 32) ^
+                  (static_cast<size_t>(key.option_type) << 24) ^
+                  (static_cast<size_t>(key.is_american) << 16) ^
+                  (static_cast<size_t>(key.model) << 8) ^
+                  static_cast<size_t>(key.lattice_scheme);
+    seed = combine(seed, static_cast<uint64_t>(key.binomial_steps));
+    seed = combine(seed, bits(key.strike));
+    seed = combine(seed, bits(key.time_to_expiry));
+    seed = combine(seed, bits(key.jump_intensity));
+    seed = combine(seed, bits(key.jump_mean));
+    seed = combine(seed, bits(key.jump_volatility));
+    seed = combine(seed, bits(key.spot));
+    seed = combine(seed, bits(key.rate));
+    seed = combine(seed, bits(key.vol));
+    seed = combine(seed, bits(key.dividend));
+    return seed;
+}
+
+PricingCache::PricingCache(size_t capacity, double market_quantum)
+    : capacity_(capacity), market_quantum_(market_quantum) {
+    if (capacity == 0) {
+        throw std::invalid_argument("Pricing cache capacity must be positive");
+    }
+    if (!(market_quantum >= 0.0) || std::isinf(market_quantum)) {
+        throw std::invalid_argument("Pricing cache market quantum must be non-negative");
+    }
+    shard_capacity_ = (capacity + kShards - 1) / kShards;
+}
+
+PricingCache::Key PricingCache::makeKey(
+    const ContractTerms& terms, const PricingState& state, Kind kind
+) const {
+    // Scenario prices fix today's value, which every path's P&L is measured
+    // against, so they are only ever shared between identical states.
+    const bool quantized = market_quantum_ > 0.0 && kind != Kind::ScenarioPrice;
+    auto quantize = [&](double x) {
+        return quantized ? std::round(x / market_quantum_) * market_quantum_ : x;
+    };
+
+    Key key;
+    key.kind = static_cast<uint8_t>(kind);
+    key.option_type = static_cast<uint8_t>(terms.option_type);
+    key.is_american = terms.is_american ? 1 : 0;
+    key.model = static_cast<uint8_t>(terms.model);
+    key.lattice_scheme = static_cast<uint8_t>(terms.lattice_scheme);
+    key.binomial_steps = terms.binomial_steps;
+    key.strike = terms.strike;
+    key.time_to_expiry = terms.time_to_expiry;
+    key.jump_intensity = terms.jump_intensity;
+    key.jump_mean = terms.jump_mean;
+    key.jump_volatility = terms.jump_volatility;
+    key.spot = quantize(state.spot);
+    key.rate = quantize(state.rate);
+    key.vol = quantize(state.vol);
+    key.dividend = quantize(state.dividend);
+    return key;
+}
+
+PricingCache::Shard& PricingCache::shardFor(size_t hash) {
+    return shards_[(hash >> 7) % kShards];
+}
+
+bool PricingCache::lookup(
+    const ContractTerms& terms, const PricingState& state, Kind kind, Greeks& result
+) {
+    const Key key = makeKey(terms, state, kind);
+    const size_t hash = KeyHash()(key);
+    Shard& shard = shardFor(hash);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+        ++shard.misses;
+        return false;
+    }
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    result = it->second->second;
+    ++shard.hits;
+    return true;
+}
+
+void PricingCache::insert(
+    const ContractTerms& terms, const PricingState& state, Kind kind, const Greeks& result
+) {
+    const Key key = makeKey(terms, state, kind);
+    const size_t hash = KeyHash()(key);
+    Shard& shard = shardFor(hash);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+        it->second->second = result;
+        shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+        return;
+    }
+
+    if (shard.entries.size() >= shard_capacity_) {
+        shard.index.erase(shard.entries.back().first);
+        shard.entries.pop_back();
+        ++shard.evictions;
+    }
+    shard.entries.emplace_front(key, result);
+    shard.index.emplace(key, shard.entries.begin());
+}
+
+void PricingCache::clear() {
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.clear();
+        shard.index.clear();
+    }
+}
+
+void PricingCache::resetStats() {
+    for (Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.hits = 0;
+        shard.misses = 0;
+        shard.evictions = 0;
+    }
+}
+
+PricingCacheStats PricingCache::stats() const {
+    PricingCacheStats total;
+    for (const Shard& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total.hits += shard.hits;
+        total.misses += shard.misses;
+        total.evictions += shard.evictions;
+        total.size += shard.entries.size();
+    }
+    return total;
+}
+
+size_t PricingCache::capacity() const {
+    return capacity_;
+}
+
+double PricingCache::marketQuantum() const {
+    return market_quantum_;
+}
@@ -0,0 +1,362 @@
+#include "QuasiRandom.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+namespace QuasiRandom {
+
+namespace {
+
+constexpr int kBits = 32;
+
+// Dimensions whose initial direction numbers are searched for good 2D
+// projections, candidates tried per dimension, and the net size (2^bits
+// points) the projections are judged at.
+constexpr size_t kSearchedDimensions = 32;
+constexpr int kCandidates = 16;
+constexpr int kProjectionBits = 10;
+
+uint64_t splitMix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Product of two residues modulo a degree-`degree` polynomial over GF(2),
+// all held as bit masks.
+uint32_t multiplyMod(uint32_t a, uint32_t b, uint32_t poly, int degree) {
+    uint32_t result = 0;
+    while (b != 0) {
+        if (b & 1u) {
+            result ^= a;
+        }
+        b >>= 1;
+        a <<= 1;
+        if (a & (1u << degree)) {
+            a ^= poly;
+        }
+    }
+    return result;
+}
+
+uint32_t powerOfX(uint64_t exponent, uint32_t poly, int degree) {
+    uint32_t result = 1;
+    uint32_t base = degree == 1 ? 2u ^ poly : 2u;  // x reduced mod poly
+    while (exponent != 0) {
+        if (exponent & 1u) {
+            result = multiplyMod(result, base, poly, degree);
+        }
+        base = multiplyMod(base, base, poly, degree);
+        exponent >>= 1;
+    }
+    return result;
+}
+
+// poly is primitive iff x has order exactly 2^degree - 1 modulo it.
+bool isPrimitive(uint32_t poly, int degree, const std::vector<uint64_t>& prime_factors) {
+    const uint64_t order = (1ULL << degree) - 1;
+    if (powerOfX(order, poly, degree) != 1) {
+        return false;
+    }
+    for (uint64_t q : prime_factors) {
+        if (powerOfX(order / q, poly, degree) == 1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<uint64_t> primeFactors(uint64_t n) {
+    std::vector<uint64_t> factors;
+    for (uint64_t q = 2; q * q <= n; ++q) {
+        if (n % q == 0) {
+            factors.push_back(q);
+            while (n % q == 0) {
+                n /= q;
+            }
+        }
+    }
+    if (n > 1) {
+        factors.push_back(n);
+    }
+    return factors;
+}
+
+// The first `count` primitive polynomials, by degree and then by value.
+std::vector<uint32_t> primitivePolynomials(size_t count) {
+    std::vector<uint32_t> polys;
+    for (int degree = 1; polys.size() < count; ++degree) {
+        const std::vector<uint64_t> factors = primeFactors((1ULL << degree) - 1);
+        // Both x^degree and the constant term must be present.
+        for (uint32_t poly = (1u << degree) | 1u; poly < (2u << degree) && polys.size() < count; poly += 2) {
+            if (isPrimitive(poly, degree, factors)) {
+                polys.push_back(poly);
+            }
+        }
+    }
+    return polys;
+}
+
+int degreeOf(uint32_t poly) {
+    int degree = 0;
+    while (poly >> (degree + 1)) {
+        ++degree;
+    }
+    return degree;
+}
+
+// Row `row` (most significant output bit first) of a dimension's
+// generating matrix, as a mask over the low `bits` index bits.
+uint32_t matrixRow(const uint32_t* v, int row, int bits) {
+    uint32_t mask = 0;
+    for (int k = 0; k < bits; ++k) {
+        mask |= ((v[k] >> (kBits - 1 - row)) & 1u) << k;
+    }
+    return mask;
+}
+
+bool fullRank(uint32_t* rows, int count) {
+    for (int i = 0; i < count; ++i) {
+        int pivot = i;
+        while (pivot < count && rows[pivot] == 0) {
+            ++pivot;
+        }
+        if (pivot == count) {
+            return false;
+        }
+        std::swap(rows[i], rows[pivot]);
+        const uint32_t lead = rows[i] & (~rows[i] + 1);
+        for (int j = 0; j < count; ++j) {
+            if (j != i && (rows[j] & lead)) {
+                rows[j] ^= rows[i];
+            }
+        }
+    }
+    return true;
+}
+
+// Quality parameter t of the 2D projection onto two dimensions, given the
+// first `bits` rows of their generating matrices: the first 2^bits points
+// form a (t, bits, 2)-net, i.e. every box of 2^-a by 2^-b with
+// a + b = bits - t holds exactly 2^t points.
+int projectionT(const uint32_t* rows1, const uint32_t* rows2, int bits) {
+    // Boxes of 2^-a by 2^-(n-a) balance for every a; a = 0 and a = n are
+    // one-dimensional and always do. Balancing at n implies it below n,
+    // so the largest such n is found by bisection.
+    auto is_net = [&](int n) {
+        for (int a = 1; a < n; ++a) {
+            uint32_t rows[kBits];
+            std::copy(rows1, rows1 + a, rows);
+            std::copy(rows2, rows2 + (n - a), rows + a);
+            if (!fullRank(rows, n)) {
+                return false;
+            }
+        }
+        return true;
+    };
+    
+    int low = 1;  // always a net
+    int high = bits + 1;  // never checked
+    while (high - low > 1) {
+        const int mid = (low + high) / 2;
+        if (is_net(mid)) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return bits - low;
+}
+
+void directionNumbers(uint32_t poly, size_t dim, int candidate, uint32_t* v) {
+    const int s = degreeOf(poly);
+    uint32_t m[kBits + 1];
+
+    // Initial direction numbers m_1..m_s: any odd m_k < 2^k gives a valid
+    // sequence.
+    for (int k = 1; k <= s && k <= kBits; ++k) {
+        const uint64_t hash = splitMix64(
+            (static_cast<uint64_t>(dim) * kCandidates + static_cast<uint64_t>(candidate)) * 64 +
+            static_cast<uint64_t>(k));
+        m[k] = static_cast<uint32_t>(((hash >> 11) % (1ULL << (k - 1))) * 2 + 1);
+    }
+    // m_k = 2 a_1 m_{k-1} ^ 4 a_2 m_{k-2} ^ ... ^ 2^s m_{k-s} ^ m_{k-s},
+    // where a_j is the coefficient of x^(s-j).
+    for (int k = s + 1; k <= kBits; ++k) {
+        uint32_t value = m[k - s] ^ (m[k - s] << s);
+        for (int j = 1; j < s; ++j) {
+            if ((poly >> (s - j)) & 1u) {
+                value ^= m[k - j] << j;
+            }
+        }
+        m[k] = value;
+    }
+    for (int k = 1; k <= kBits; ++k) {
+        v[k - 1] = m[k] << (kBits - k);
+    }
+}
+
+// Direction numbers of the first `dimensions` dimensions, [dimension][bit].
+// Built once and extended on demand, since the search is the costly part
+// of constructing a sequence. For the first kSearchedDimensions, each
+// dimension keeps the candidate whose 2D projections with the earlier
+// dimensions have the smallest total t.
+std::vector<uint32_t> directionTable(size_t dimensions) {
+    static std::mutex mutex;
+    static std::vector<uint32_t> table;
+    static std::vector<uint32_t> polys;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (table.empty()) {
+        table.resize(kBits);
+        for (int k = 0; k < kBits; ++k) {
+            table[k] = 1u << (kBits - 1 - k);
+        }
+    }
+
+    size_t built = table.size() / kBits;
+    if (built < dimensions) {
+        polys = primitivePolynomials(dimensions - 1);
+        table.resize(dimensions * kBits);
+    }
+    for (; built < dimensions; ++built) {
+        const size_t dim = built;
+        uint32_t* v = &table[dim * kBits];
+        directionNumbers(polys[dim - 1], dim, 0, v);
+        if (dim >= kSearchedDimensions) {
+            continue;
+        }
+
+        std::vector<uint32_t> rows(dim * kProjectionBits);
+        for (size_t other = 0; other < dim; ++other) {
+            for (int r = 0; r < kProjectionBits; ++r) {
+                rows[other * kProjectionBits + r] = matrixRow(&table[other * kBits], r, kProjectionBits);
+            }
+        }
+        
+        uint32_t candidate_v[kBits];
+        uint32_t candidate_rows[kProjectionBits];
+        int best_score = -1;
+        for (int candidate = 0; candidate < kCandidates; ++candidate) {
+            directionNumbers(polys[dim - 1], dim, candidate, candidate_v);
+            for (int r = 0; r < kProjectionBits; ++r) {
+                candidate_rows[r] = matrixRow(candidate_v, r, kProjectionBits);
+            }
+            int score = 0;
+            for (size_t other = 0; other < dim && (best_score < 0 || score < best_score); ++other) {
+                score += projectionT(&rows[other * kProjectionBits], candidate_rows, kProjectionBits);
+            }
+            if (best_score < 0 || score < best_score) {
+                best_score = score;
+                std::copy(candidate_v, candidate_v + kBits, v);
+            }
+        }
+    }
+
+    return std::vector<uint32_t>(table.begin(), table.begin() + dimensions * kBits);
+}
+
+uint32_t reverseBits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// Hash-based nested uniform scramble (Laine-Karras permutation on the
+// reversed bits): every output bit depends only on the same and more
+// significant input bits, which is what keeps the scrambled points a net.
+uint32_t owenScramble(uint32_t x, uint32_t seed) {
+    x = reverseBits(x);
+    x += seed;
+    x ^= x * 0x6C50B47Cu;
+    x ^= x * 0xB82F1E52u;
+    x ^= x * 0xC7AFE638u;
+    x ^= x * 0x8D22F6E6u;
+    return reverseBits(x);
+}
+
+}
+
+double inverseNormal(double p) {
+    if (std::isnan(p) || p < 0.0 || p > 1.0) {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    if (p == 0.0) {
+        return -std::numeric_limits<double>::infinity();
+    }
+    if (p == 1.0) {
+        return std::numeric_limits<double>::infinity();
+    }
+
+    // Acklam's rational approximation, good to about 1e-9 ...
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                               -2.759285104469687e+02, 1.383577518672690e+02,
+                               -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                               -1.556989798598866e+02, 6.680131188771972e+01,
+                               -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                               -2.400758277161838e+00, -2.549732539343734e+00,
+                               4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                               2.445134137142996e+00, 3.754408661907416e+00};
+    const double p_low = 0.02425;
+
+    double x;
+    if (p < p_low || p > 1.0 - p_low) {
+        const double q = std::sqrt(-2.0 * std::log(p < p_low ? p : 1.0 - p));
+        x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+            ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+        if (p > 1.0 - p_low) {
+            x = -x;
+        }
+    } else {
+        const double q = p - 0.5;
+        const double r = q * q;
+        x = (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+            (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+    }
+
+    // ... and one Halley step against erfc takes it to full precision.
+    const double error = 0.5 * std::erfc(-x / std::sqrt(2.0)) - p;
+    const double u = error * std::sqrt(2.0 * 3.14159265358979323846) * std::exp(0.5 * x * x);
+    return x - u / (1.0 + 0.5 * x * u);
+}
+
+SobolSequence::SobolSequence(size_t dimensions) : dimensions_(dimensions) {
+    if (dimensions == 0 || dimensions > kMaxDimensions) {
+        throw std::invalid_argument("Sobol dimensions must be between 1 and " +
+                                    std::to_string(kMaxDimensions));
+    }
+
+    directions_ = directionTable(dimensions);
+}
+
+size_t SobolSequence::dimensions() const {
+    return dimensions_;
+}
+
+void SobolSequence::point(uint32_t index, uint64_t seed, double* out) const {
+    const uint32_t gray = index ^ (index >> 1);
+    const double scale = 1.0 / 4294967296.0;
+
+    for (size_t dim = 0; dim < dimensions_; ++dim) {
+        const uint32_t* v = &directions_[dim * kBits];
+        uint32_t x = 0;
+        for (uint32_t bits = gray, k = 0; bits != 0; bits >>= 1, ++k) {
+            if (bits & 1u) {
+                x ^= v[k];
+            }
+        }
+        const uint32_t dim_seed = static_cast<uint32_t>(splitMix64(seed ^ splitMix64(dim)));
+        out[dim] = (static_cast<double>(owenScramble(x, dim_seed)) + 0.5) * scale;
+    }
+}
+
+}
@@ -0,0 +1,349 @@
+#include "ReturnsStore.h"
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char kMagic[8] = {'Q', 'E', 'R', 'E', 'T', 'S', '0', '1'};
+
+constexpr size_t kHeaderSize = 56;
+constexpr size_t kReturnsAlignment = 64;
+
+bool isLittleEndian() {
+    const uint32_t one = 1;
+    unsigned char first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+uint32_t readU32(const unsigned char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint64_t readU64(const unsigned char* p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+template <typename T>
+void appendRaw(std::vector<unsigned char>& out, T value) {
+    const size_t at = out.size();
+    out.resize(at + sizeof(T));
+    std::memcpy(&out[at], &value, sizeof(T));
+}
+
+size_t alignUp(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+template <typename T>
+void sumWindows(const T* column, size_t first_day, size_t count, size_t days, double* out) {
+    for (size_t k = 0; k < count; ++k) {
+        const T* window = column + first_day + k;
+        double sum = 0.0;
+        for (size_t d = 0; d < days; ++d) {
+            const double r = static_cast<double>(window[d]);
+            if (r == r) {  // NaN: no price that day
+                sum += r;
+            }
+        }
+        out[k] = sum;
+    }
+}
+
+}
+
+ReturnsStore::ReturnsStore(const std::string& path) : path_(path) {
+    if (!isLittleEndian()) {
+        throw std::runtime_error("Returns files can only be read on little-endian hosts");
+    }
+    map();
+    try {
+        readHeader();
+    } catch (...) {
+        unmap();
+        throw;
+    }
+}
+
+ReturnsStore::~ReturnsStore() {
+    unmap();
+}
+
+void ReturnsStore::map() {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path_.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Cannot open returns file: " + path_);
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart < static_cast<LONGLONG>(kHeaderSize)) {
+        CloseHandle(file);
+        throw std::runtime_error("Returns file is too small: " + path_);
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (!view) {
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+        throw std::runtime_error("Cannot map returns file: " + path_);
+    }
+    file_ = file;
+    mapping_ = mapping;
+    size_ = static_cast<size_t>(file_size.QuadPart);
+    data_ = static_cast<const unsigned char*>(view);
+#else
+    const int fd = ::open(path_.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open returns file: " + path_);
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(kHeaderSize)) {
+        ::close(fd);
+        throw std::runtime_error("Returns file is too small: " + path_);
+    }
+    void* view = ::mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);  // The mapping keeps the file open.
+    if (view == MAP_FAILED) {
+        throw std::runtime_error("Cannot map returns file: " + path_);
+    }
+    size_ = static_cast<size_t>(info.st_size);
+    data_ = static_cast<const unsigned char*>(view);
+#endif
+}
+
+void ReturnsStore::unmap() {
+    if (!data_) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(data_);
+    CloseHandle(static_cast<HANDLE>(mapping_));
+    CloseHandle(static_cast<HANDLE>(file_));
+    mapping_ = nullptr;
+    file_ = nullptr;
+#else
+    ::munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
+
+void ReturnsStore::readHeader() {
+    auto malformed = [&](const std::string& what) {
+        return std::runtime_error("Malformed returns file " + path_ + ": " + what);
+    };
+
+    if (std::memcmp(data_, kMagic, sizeof(kMagic)) != 0) {
+        throw malformed("bad magic");
+    }
+    const uint32_t value_size = readU32(data_ + 8);
+    if (value_size != 4 && value_size != 8) {
+        throw malformed("value size must be 4 or 8");
+    }
+    value_type_ = static_cast<ValueType>(value_size);
+
+    const uint64_t asset_count = readU64(data_ + 16);
+    const uint64_t date_count = readU64(data_ + 24);
+    const uint64_t assets_offset = readU64(data_ + 32);
+    const uint64_t dates_offset = readU64(data_ + 40);
+    const uint64_t returns_offset = readU64(data_ + 48);
+
+    if (asset_count == 0 || date_count == 0) {
+        throw malformed("no assets or no dates");
+    }
+    if (returns_offset % kReturnsAlignment != 0 || dates_offset % sizeof(int32_t) != 0) {
+        throw malformed("misaligned section");
+    }
+    if (assets_offset > size_ || dates_offset > size_ || returns_offset > size_ ||
+        date_count > (size_ - dates_offset) / sizeof(int32_t) ||
+        asset_count > (size_ - returns_offset) / value_size / date_count) {
+        throw malformed("sections extend past the end of the file");
+    }
+    asset_count_ = static_cast<size_t>(asset_count);
+    date_count_ = static_cast<size_t>(date_count);
+    dates_ = data_ + dates_offset;
+    returns_ = data_ + returns_offset;
+
+    // The asset table is the one part that is read up front: it is
+    // O(assets), and lookups by ID need it anyway.
+    size_t at = static_cast<size_t>(assets_offset);
+    asset_ids_.reserve(asset_count_);
+    for (size_t a = 0; a < asset_count_; ++a) {
+        if (size_ - at < sizeof(uint32_t)) {
+            throw malformed("truncated asset table");
+        }
+        const uint32_t length = readU32(data_ + at);
+        at += sizeof(uint32_t);
+        if (length == 0 || size_ - at < length) {
+            throw malformed("truncated asset table");
+        }
+        asset_ids_.emplace_back(reinterpret_cast<const char*>(data_ + at), length);
+        at += length;
+        if (!index_.emplace(asset_ids_.back(), a).second) {
+            throw malformed("duplicate asset " + asset_ids_.back());
+        }
+    }
+}
+
+const std::string& ReturnsStore::path() const {
+    return path_;
+}
+
+ReturnsStore::ValueType ReturnsStore::valueType() const {
+    return value_type_;
+}
+
+size_t ReturnsStore::assetCount() const {
+    return asset_count_;
+}
+
+size_t ReturnsStore::dateCount() const {
+    return date_count_;
+}
+
+const std::string& ReturnsStore::assetId(size_t asset) const {
+    if (asset >= asset_count_) {
+        throw std::out_of_range("Returns store asset index out of range");
+    }
+    return asset_ids_[asset];
+}
+
+size_t ReturnsStore::findAsset(const std::string& asset_id) const {
+    const auto it = index_.find(asset_id);
+    return it == index_.end() ? npos : it->second;
+}
+
+int32_t ReturnsStore::date(size_t day) const {
+    if (day >= date_count_) {
+        throw std::out_of_range("Returns store date index out of range");
+    }
+    int32_t value;
+    std::memcpy(&value, dates_ + day * sizeof(int32_t), sizeof(value));
+    return value;
+}
+
+double ReturnsStore::value(size_t asset, size_t day) const {
+    if (asset >= asset_count_ || day >= date_count_) {
+        throw std::out_of_range("Returns store index out of range");
+    }
+    const size_t index = asset * date_count_ + day;
+    if (value_type_ == ValueType::Float32) {
+        return reinterpret_cast<const float*>(returns_)[index];
+    }
+    return reinterpret_cast<const double*>(returns_)[index];
+}
+
+void ReturnsStore::windowReturns(
+    size_t asset, size_t first_day, size_t count, size_t days, double* out
+) const {
+    if (asset >= asset_count_ || days == 0 || first_day > date_count_ ||
+        count > date_count_ - first_day || (count > 0 && days - 1 > date_count_ - first_day - count)) {
+        throw std::out_of_range("Returns store window out of range");
+    }
+    const size_t column = asset * date_count_;
+    if (value_type_ == ValueType::Float32) {
+        sumWindows(reinterpret_cast<const float*>(returns_) + column, first_day, count, days, out);
+    } else {
+        sumWindows(reinterpret_cast<const double*>(returns_) + column, first_day, count, days, out);
+    }
+}
+
+void ReturnsStore::write(
+    const std::string& path,
+    const std::vector<std::string>& asset_ids,
+    const std::vector<int32_t>& dates,
+    const std::vector<double>& returns,
+    ValueType type
+) {
+    if (asset_ids.empty() || dates.empty()) {
+        throw std::invalid_argument("Returns file needs at least one asset and one date");
+    }
+    if (type != ValueType::Float32 && type != ValueType::Float64) {
+        throw std::invalid_argument("Returns file value type must be float32 or float64");
+    }
+    if (returns.size() / asset_ids.size() != dates.size() ||
+        returns.size() % asset_ids.size() != 0) {
+        throw std::invalid_argument("Returns must have one value per asset and date");
+    }
+    for (size_t d = 1; d < dates.size(); ++d) {
+        if (dates[d] <= dates[d - 1]) {
+            throw std::invalid_argument("Returns file dates must be strictly ascending");
+        }
+    }
+    std::unordered_set<std::string> seen;
+    for (const std::string& asset_id : asset_ids) {
+        if (asset_id.empty() || asset_id.size() > std::numeric_limits<uint32_t>::max()) {
+            throw std::invalid_argument("Returns file asset IDs must be non-empty");
+        }
+        if (!seen.insert(asset_id).second) {
+            throw std::invalid_argument("Duplicate asset in returns file: " + asset_id);
+        }
+    }
+
+    std::vector<unsigned char> head;
+    head.insert(head.end(), kMagic, kMagic + sizeof(kMagic));
+    appendRaw<uint32_t>(head, static_cast<uint32_t>(type));
+    appendRaw<uint32_t>(head, 0);
+    appendRaw<uint64_t>(head, asset_ids.size());
+    appendRaw<uint64_t>(head, dates.size());
+    const size_t offsets_at = head.size();
+    head.resize(kHeaderSize, 0);
+
+    const size_t assets_offset = head.size();
+    for (const std::string& asset_id : asset_ids) {
+        appendRaw<uint32_t>(head, static_cast<uint32_t>(asset_id.size()));
+        head.insert(head.end(), asset_id.begin(), asset_id.end());
+    }
+    head.resize(alignUp(head.size(), sizeof(int32_t)), 0);
+    const size_t dates_offset = head.size();
+    for (int32_t date : dates) {
+        appendRaw<int32_t>(head, date);
+    }
+    head.resize(alignUp(head.size(), kReturnsAlignment), 0);
+    const size_t returns_offset = head.size();
+
+    const uint64_t offsets[3] = {assets_offset, dates_offset, returns_offset};
+    std::memcpy(&head[offsets_at], offsets, sizeof(offsets));
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("Cannot create returns file: " + path);
+    }
+    file.write(reinterpret_cast<const char*>(head.data()), static_cast<std::streamsize>(head.size()));
+    if (type == ValueType::Float64) {
+        file.write(reinterpret_cast<const char*>(returns.data()),
+                   static_cast<std::streamsize>(returns.size() * sizeof(double)));
+    } else {
+        std::vector<float> column(dates.size());
+        for (size_t a = 0; a < asset_ids.size(); ++a) {
+            for (size_t d = 0; d < dates.size(); ++d) {
+                column[d] = static_cast<float>(returns[a * dates.size() + d]);
+            }
+            file.write(reinterpret_cast<const char*>(column.data()),
+                       static_cast<std::streamsize>(column.size() * sizeof(float)));
+        }
+    }
+    if (!file) {
+        throw std::runtime_error("Failed writing returns file: " + path);
+    }
+}
@@ -1,4 +1,16 @@
 #include "RiskEngine.h"
+#include "BinomialTree.h"
+#include "BlackScholesBatch.h"
+#include "JumpDiffusion.h"
+#include "Parallel.h"
+#include "PricingKernel.h"
+#include "QuasiRandom.h"
+#include "RunStats.h"
+#include "TailStatistics.h"
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <numeric>
 #include <random>
 #include <algorithm>
@@ -6,19 +18,1312 @@
 #include <cmath>
 #include <sstream>
 #include <limits>
+#include <tuple>
+
+namespace {
+
+// Paths are simulated in fixed-size blocks, each with its own RNG stream
+// derived from the run seed and the block index. The block size must not
+// depend on the thread count, otherwise seeded runs would stop being
+// reproducible across machines.
+constexpr size_t kPathsPerBlock = 1024;
+
+constexpr int kMaxThreads = 256;
+
+constexpr double kMaxVolOfVol = 5.0;
+
+constexpr int kMaxApproximationCheckPaths = 1000000;
+
+constexpr size_t kMaxConfidenceLevels = 64;
+
+// Runs with at least kMinBatchPaths paths per batch are split into
+// kSamplingBatches batches for the standard errors.
+constexpr size_t kSamplingBatches = 16;
+constexpr size_t kMinBatchPaths = 100;
+
+uint64_t splitMix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+std::mt19937 makeBlockGenerator(uint64_t run_seed, size_t block) {
+    const uint64_t mixed = splitMix64(run_seed ^ splitMix64(block));
+    std::seed_seq seq{
+        static_cast<uint32_t>(mixed),
+        static_cast<uint32_t>(mixed >> 32),
+        static_cast<uint32_t>(block)
+    };
+    return std::mt19937(seq);
+}
+
+// Start of every sampling batch, followed by num_paths. Boundaries are
+// even so antithetic pairs never straddle two batches.
+std::vector<size_t> samplingBatches(size_t num_paths) {
+    const size_t batches = num_paths >= kSamplingBatches * kMinBatchPaths ? kSamplingBatches : 1;
+    std::vector<size_t> begin(batches + 1);
+    for (size_t b = 0; b < batches; ++b) {
+        begin[b] = (num_paths * b / batches) & ~static_cast<size_t>(1);
+    }
+    begin[batches] = num_paths;
+    return begin;
+}
+
+// Market data of each asset in the portfolio's symbol table, looked up
+// once per call so the path loop never touches a string.
+std::vector<const MarketData*> resolveAssets(
+    const PortfolioColumns& columns,
+    const std::map<std::string, MarketData>& market_data_map
+) {
+    const AssetSymbolTable& symbols = columns.assets();
+    std::vector<const MarketData*> market_data(symbols.size());
+    for (uint32_t a = 0; a < symbols.size(); ++a) {
+        auto it = market_data_map.find(symbols.symbol(a));
+        if (it == market_data_map.end()) {
+            throw std::runtime_error("Missing market data for asset: " + symbols.symbol(a));
+        }
+        market_data[a] = &it->second;
+    }
+    return market_data;
+}
+
+// Optionally also reports each asset's MarketDataSnapshot::version.
+std::vector<const MarketData*> resolveAssets(
+    const PortfolioColumns& columns,
+    const MarketDataSnapshot& snapshot,
+    std::vector<uint64_t>* versions = nullptr
+) {
+    const AssetSymbolTable& symbols = columns.assets();
+    std::vector<const MarketData*> market_data(symbols.size());
+    if (versions) {
+        versions->resize(symbols.size());
+    }
+    for (uint32_t a = 0; a < symbols.size(); ++a) {
+        const uint32_t handle = snapshot.handle(symbols.symbol(a));
+        if (handle == AssetSymbolTable::npos) {
+            throw std::runtime_error("Missing market data for asset: " + symbols.symbol(a));
+        }
+        market_data[a] = &snapshot.at(handle);
+        if (versions) {
+            (*versions)[a] = snapshot.version(handle);
+        }
+    }
+    return market_data;
+}
+
+// Per-worker gather buffers for the batch Black-Scholes groups, in the
+// worker's run arena. The contract columns and rows are only gathered when
+// pricing a subset of assets; otherwise the group's own columns are passed
+// straight through. Every group holds one option type, so no call/put mask
+// is gathered.
+struct GroupScratch {
+    explicit GroupScratch(std::pmr::memory_resource* arena)
+        : spot(arena), rate(arena), volatility(arena), price(arena),
+          strike(arena), expiry(arena), row(arena) {
+    }
+    
+    std::pmr::vector<double> spot;
+    std::pmr::vector<double> rate;
+    std::pmr::vector<double> volatility;
+    std::pmr::vector<double> price;
+    std::pmr::vector<double> strike;
+    std::pmr::vector<double> expiry;
+    std::pmr::vector<size_t> row;
+};
+
+// Today's vol of every grouped line, read once per run from its asset's
+// surface at the line's strike and expiry (or the flat vol without one).
+// For sticky moneyness the local smile slope d(vol)/d(strike) is kept too,
+// so scenarios can move along the smile without another lookup. When
+// `selected` is given only lines on selected assets are read. This is the
+// last check the scenario pricers get, so a vol no pricer would accept is
+// rejected here rather than on every path.
+struct LineVols {
+    std::vector<std::vector<double>> vol;    // [group][row]
+    std::vector<std::vector<double>> slope;  // [group][row], sticky moneyness only
+    bool sticky_moneyness = false;
+};
+
+LineVols resolveLineVols(
+    const PortfolioColumns& columns,
+    const std::vector<const MarketData*>& asset_md,
+    VolSurfaceDynamics dynamics,
+    const uint8_t* selected = nullptr
+) {
+    const double bump = 0.01;  // relative strike bump for the smile slope
+    
+    LineVols line_vols;
+    line_vols.sticky_moneyness = dynamics == VolSurfaceDynamics::StickyMoneyness;
+    
+    for (const InstrumentGroup& group : columns.groups()) {
+        std::vector<double> vol(group.size());
+        std::vector<double> slope(line_vols.sticky_moneyness ? group.size() : 0, 0.0);
+        
+        for (size_t k = 0; k < group.size(); ++k) {
+            if (selected && !selected[group.asset[k]]) {
+                continue;
+            }
+            const MarketData& md = *asset_md[group.asset[k]];
+            const double K = group.strike[k];
+            const double T = group.time_to_expiry[k];
+            vol[k] = md.volatilityFor(K, T);
+            if (!(vol[k] >= 0.0) || std::isinf(vol[k])) {
+                throw std::invalid_argument(
+                    "Invalid volatility for " + columns.assets().symbol(group.asset[k]) +
+                    " at strike " + std::to_string(K));
+            }
+            
+            if (line_vols.sticky_moneyness && md.vol_surface) {
+                slope[k] = (md.volatilityFor(K * (1.0 + bump), T) -
+                            md.volatilityFor(K * (1.0 - bump), T)) / (2.0 * bump * K);
+            }
+        }
+        
+        line_vols.vol.push_back(std::move(vol));
+        line_vols.slope.push_back(std::move(slope));
+    }
+    
+    return line_vols;
+}
+
+// Merton series of every jump-diffusion line, built once per run at the
+// line's rate and vol; indexed [group][row] and empty for other groups.
+// Lines on assets that are not selected get an expired placeholder, which
+// costs nothing to build.
+using MertonLines = std::vector<std::vector<JumpDiffusion::MertonSeries>>;
+
+MertonLines prepareMertonLines(
+    const PortfolioColumns& columns, const LineVols& line_vols, const double* rates,
+    const uint8_t* selected = nullptr
+) {
+    const std::vector<InstrumentGroup>& groups = columns.groups();
+    MertonLines merton(groups.size());
+    
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const InstrumentGroup& group = groups[g];
+        if (group.is_american || group.model != PricingModel::MertonJumpDiffusion) {
+            continue;
+        }
+        merton[g].reserve(group.size());
+        for (size_t k = 0; k < group.size(); ++k) {
+            if (selected && !selected[group.asset[k]]) {
+                merton[g].emplace_back(0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+                continue;
+            }
+            merton[g].emplace_back(
+                rates[group.asset[k]], group.time_to_expiry[k], line_vols.vol[g][k],
+                group.jump_intensity[k], group.jump_mean[k], group.jump_volatility[k]);
+        }
+    }
+    
+    return merton;
+}
+
+// Everything about the portfolio that stays fixed across scenarios.
+struct ScenarioModel {
+    const PortfolioColumns& columns;
+    const std::vector<std::pair<std::unique_ptr<Instrument>, int>>& instruments;
+    const LineVols& line_vols;
+    const MertonLines& merton;
+    const double* base_spot;
+    const double* base_vol;
+    const double* rates;
+};
+
+// Vol of grouped line k at a scenario. Sticky moneyness moves to the vol
+// of the strike whose moneyness matches today's, K * S0 / S, to first
+// order in the strike shift; the asset's vol shock then scales either.
+inline double scenarioVol(
+    const ScenarioModel& model, size_t group, size_t k, uint32_t asset,
+    double strike, double spot, double vol_factor
+) {
+    double vol = model.line_vols.vol[group][k];
+    if (model.line_vols.sticky_moneyness) {
+        const double shifted_strike = strike * model.base_spot[asset] / spot;
+        vol = std::max(0.0, vol + model.line_vols.slope[group][k] * (shifted_strike - strike));
+    }
+    return vol * vol_factor;
+}
+
+ContractTerms groupTerms(const InstrumentGroup& group, size_t k) {
+    ContractTerms terms;
+    terms.option_type = group.is_call[k] ? OptionType::Call : OptionType::Put;
+    terms.strike = group.strike[k];
+    terms.time_to_expiry = group.time_to_expiry[k];
+    terms.is_american = group.is_american;
+    terms.model = group.model;
+    terms.binomial_steps = group.binomial_steps[k];
+    terms.lattice_scheme = group.lattice_scheme[k];
+    terms.jump_intensity = group.jump_intensity[k];
+    terms.jump_mean = group.jump_mean[k];
+    terms.jump_volatility = group.jump_volatility[k];
+    return terms;
+}
+
+// Restricts portfolioValue to the lines of selected assets, adding each
+// line's value to its asset's slot in values as well as to the total.
+struct AssetSplit {
+    const uint8_t* selected;       // [asset]
+    double* values;                // [asset]
+    double* line_values = nullptr; // [line], each selected line's value when set
+};
+
+// Adds the quantity-weighted value of group g at one scenario to value
+// (and to split's slots), for a group whose lines are all priced by Pricer.
+// Black-Scholes groups go through the batch kernel for their option type;
+// lattice and jump-diffusion lines are priced one by one through cache
+// when one is given.
+template <typename Pricer>
+void addGroupValue(
+    const ScenarioModel& model, size_t g,
+    const double* spots, const double* vol_factors, GroupScratch& scratch,
+    const AssetSplit* split, PricingCache* cache, double& value
+) {
+    const InstrumentGroup& group = model.columns.groups()[g];
+    const double* rates = model.rates;
+    const size_t n = group.size();
+    
+    if constexpr (Pricer::model == PricingModel::BlackScholes) {
+        RunStats::resizeScratch(scratch.spot, n);
+        RunStats::resizeScratch(scratch.rate, n);
+        RunStats::resizeScratch(scratch.volatility, n);
+        RunStats::resizeScratch(scratch.price, n);
+        if (split) {
+            RunStats::resizeScratch(scratch.strike, n);
+            RunStats::resizeScratch(scratch.expiry, n);
+            RunStats::resizeScratch(scratch.row, n);
+        }
+        
+        size_t m = 0;
+        for (size_t k = 0; k < n; ++k) {
+            const uint32_t asset = group.asset[k];
+            if (split) {
+                if (!split->selected[asset]) {
+                    continue;
+                }
+                scratch.strike[m] = group.strike[k];
+                scratch.expiry[m] = group.time_to_expiry[k];
+                scratch.row[m] = k;
+            }
+            scratch.spot[m] = spots[asset];
+            scratch.rate[m] = rates[asset];
+            scratch.volatility[m] = scenarioVol(
+                model, g, k, asset, group.strike[k], spots[asset], vol_factors[asset]);
+            ++m;
+        }
+        if (m == 0) {
+            return;
+        }
+        
+        BlackScholes::BatchInputs inputs;
+        inputs.spot = scratch.spot.data();
+        inputs.strike = split ? scratch.strike.data() : group.strike.data();
+        inputs.rate = scratch.rate.data();
+        inputs.expiry = split ? scratch.expiry.data() : group.time_to_expiry.data();
+        inputs.volatility = scratch.volatility.data();
+        inputs.size = m;
+        inputs.types = Pricer::call ? BlackScholes::BatchOptionTypes::Calls
+                                    : BlackScholes::BatchOptionTypes::Puts;
+        
+        BlackScholes::BatchOutputs outputs;
+        outputs.price = scratch.price.data();
+        BlackScholes::priceBatchUnchecked(inputs, outputs);
+        
+        for (size_t j = 0; j < m; ++j) {
+            const size_t k = split ? scratch.row[j] : j;
+            const double line_value = scratch.price[j] * group.quantity[k];
+            value += line_value;
+            if (split) {
+                split->values[group.asset[k]] += line_value;
+                if (split->line_values) {
+                    split->line_values[group.line[k]] = line_value;
+                }
+            }
+        }
+    } else {
+        for (size_t k = 0; k < n; ++k) {
+            const uint32_t asset = group.asset[k];
+            if (split && !split->selected[asset]) {
+                continue;
+            }
+            const double vol = scenarioVol(
+                model, g, k, asset, group.strike[k], spots[asset], vol_factors[asset]);
+            double price = 0.0;
+            
+            // The scenario pricers take no dividend, so it stays out of the key.
+            ContractTerms terms;
+            PricingState state;
+            Greeks cached;
+            if (cache) {
+                terms = groupTerms(group, k);
+                state.spot = spots[asset];
+                state.rate = rates[asset];
+                state.vol = vol;
+                if (cache->lookup(terms, state, PricingCache::Kind::ScenarioPrice, cached)) {
+                    value += cached.price * group.quantity[k];
+                    if (split) {
+                        split->values[asset] += cached.price * group.quantity[k];
+                        if (split->line_values) {
+                            split->line_values[group.line[k]] = cached.price * group.quantity[k];
+                        }
+                    }
+                    continue;
+                }
+            }
+            
+            if constexpr (Pricer::model == PricingModel::Binomial) {
+                price = Pricer::latticePriceUnchecked(
+                    spots[asset], group.strike[k], rates[asset], group.time_to_expiry[k],
+                    vol, group.binomial_steps[k], group.lattice_scheme[k]);
+            } else {
+                price = model.merton[g][k].price(spots[asset], group.strike[k], Pricer::type, vol);
+            }
+            
+            // A failed price is never cached; the caller's scan reports it.
+            if (cache && std::isfinite(price)) {
+                cached.price = price;
+                cache->insert(terms, state, PricingCache::Kind::ScenarioPrice, cached);
+            }
+            
+            const double line_value = price * group.quantity[k];
+            value += line_value;
+            if (split) {
+                split->values[asset] += line_value;
+                if (split->line_values) {
+                    split->line_values[group.line[k]] = line_value;
+                }
+            }
+        }
+    }
+}
+
+// Quantity-weighted value of every line at one scenario, given one spot
+// and one vol shock factor per asset. Each group is dispatched once to the
+// addGroupValue specialized for its type, model and exercise style, so no
+// line branches on them; only lines without ContractTerms use the virtual
+// interface, against scenario_md (one MarketData per asset). Such lines see
+// the shocked flat vol, or price off their asset's surface when it has one.
+//
+// Grouped lines use the unchecked pricers: validateMarketData and
+// resolveLineVols have vetted every input once per run, and the scenario
+// spots and vol factors are positive and finite by construction. A line
+// that still fails prices as NaN, which poisons the total, so callers scan
+// the value once per path (or per asset with `split`) instead of checking
+// every line.
+double portfolioValue(
+    const ScenarioModel& model,
+    const double* spots, const double* vol_factors,
+    std::vector<MarketData>& scenario_md, GroupScratch& scratch,
+    const AssetSplit* split = nullptr, PricingCache* cache = nullptr
+) {
+    const std::vector<InstrumentGroup>& groups = model.columns.groups();
+    double value = 0.0;
+    
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const InstrumentGroup& group = groups[g];
+        PricingKernel::dispatch(group.option_type, group.model, group.is_american, [&](auto pricer) {
+            addGroupValue<decltype(pricer)>(
+                model, g, spots, vol_factors, scratch, split, cache, value);
+        });
+    }
+    
+    const std::vector<uint32_t>& line_asset = model.columns.lineAssets();
+    for (size_t line : model.columns.genericLines()) {
+        const uint32_t asset = line_asset[line];
+        if (split && !split->selected[asset]) {
+            continue;
+        }
+        MarketData& md = scenario_md[asset];
+        md.spot_price = spots[asset];
+        md.volatility = model.base_vol[asset] * vol_factors[asset];
+        const double line_value = model.instruments[line].first->price(md) * model.instruments[line].second;
+        value += line_value;
+        if (split) {
+            split->values[asset] += line_value;
+            if (split->line_values) {
+                split->line_values[line] = line_value;
+            }
+        }
+    }
+    
+    return value;
+}
+
+// Per-asset inputs of the scenario stage, fixed for the whole run.
+struct ScenarioDraws {
+    size_t num_assets = 0;
+    const double* base_spot = nullptr;
+    std::vector<double> drift;
+    std::vector<double> diffusion;
+    bool shock_volatility = false;
+    double vol_drift = 0.0;
+    double vol_diffusion = 0.0;
+    // Correlates the spot shocks when set. Its outputs are the assets in
+    // correlated_assets, in order: every asset, or only the selected ones
+    // when a subset is being resimulated.
+    std::shared_ptr<const ShockFactor> correlation;
+    std::vector<uint32_t> correlated_assets;
+    // Historical runs replace the random draws with the store's windows:
+    // path k uses days [history_first_day + k, + history_days).
+    const ReturnsStore* history = nullptr;
+    std::vector<size_t> history_asset;  // [asset], store column
+    size_t history_first_day = 0;
+    size_t history_days = 0;
+};
+
+// Independent draws behind one path: one per asset, then the correlation's
+// common factors, then one vol draw per asset when vol is shocked.
+size_t drawsPerPath(const ScenarioDraws& draws) {
+    if (draws.history) {
+        return 0;
+    }
+    return draws.num_assets + (draws.correlation ? draws.correlation->factors() : 0) +
+           (draws.shock_volatility ? draws.num_assets : 0);
+}
+
+// Volatility moves lognormally with vol_of_vol when it is enabled, as one
+// factor per asset that scales every line's vol. The extra draw per asset
+// is only taken then, so runs without it keep the same scenarios, and the
+// same goes for the common factors of a factor model.
+ScenarioDraws makeScenarioDraws(
+    const std::vector<const MarketData*>& asset_md, const double* base_spot,
+    double time_horizon_days, double vol_of_vol,
+    std::shared_ptr<const ShockFactor> correlation, const uint8_t* selected = nullptr
+) {
+    const double dt = time_horizon_days / 252.0;
+    const double sqrt_dt = std::sqrt(dt);
+    
+    ScenarioDraws draws;
+    draws.num_assets = asset_md.size();
+    draws.base_spot = base_spot;
+    draws.drift.resize(draws.num_assets);
+    draws.diffusion.resize(draws.num_assets);
+    for (size_t a = 0; a < draws.num_assets; ++a) {
+        const MarketData& md = *asset_md[a];
+        draws.drift[a] = (md.risk_free_rate - 0.5 * md.volatility * md.volatility) * dt;
+        draws.diffusion[a] = md.volatility * sqrt_dt;
+    }
+    
+    draws.shock_volatility = vol_of_vol > 0.0;
+    draws.vol_drift = -0.5 * vol_of_vol * vol_of_vol * dt;
+    draws.vol_diffusion = vol_of_vol * sqrt_dt;
+    
+    if (correlation) {
+        for (uint32_t a = 0; a < draws.num_assets; ++a) {
+            if (!selected || selected[a]) {
+                draws.correlated_assets.push_back(a);
+            }
+        }
+        if (draws.correlated_assets.size() < draws.num_assets) {
+            correlation = std::make_shared<const ShockFactor>(
+                correlation->selectOutputs(draws.correlated_assets));
+        }
+        draws.correlation = std::move(correlation);
+    }
+    return draws;
+}
+
+// Switches draws to historical windows of `store`. Returns already carry
+// their own correlation and vol is left at today's level, so both are
+// dropped.
+void attachHistory(
+    ScenarioDraws& draws, const ReturnsStore& store, const AssetSymbolTable& symbols,
+    size_t first_day, size_t horizon_days
+) {
+    draws.shock_volatility = false;
+    draws.correlation.reset();
+    draws.correlated_assets.clear();
+    draws.history = &store;
+    draws.history_first_day = first_day;
+    draws.history_days = horizon_days;
+    draws.history_asset.resize(draws.num_assets);
+    for (uint32_t a = 0; a < draws.num_assets; ++a) {
+        const size_t column = store.findAsset(symbols.symbol(a));
+        if (column == ReturnsStore::npos) {
+            throw std::runtime_error("Missing historical returns for asset: " + symbols.symbol(a));
+        }
+        draws.history_asset[a] = column;
+    }
+}
+
+// How one run's normal shocks are generated, shared by every block.
+struct ScenarioSampler {
+    SamplingMethod method = SamplingMethod::PseudoRandom;
+    uint64_t run_seed = 0;
+    std::vector<size_t> batch_begin;  // samplingBatches, or one batch for historical runs
+    std::unique_ptr<QuasiRandom::SobolSequence> sobol;
+};
+
+// Sobol runs use one dimension per draw, in drawsPerPath order.
+ScenarioSampler makeScenarioSampler(
+    SamplingMethod method, uint64_t run_seed, size_t num_paths, const ScenarioDraws& draws
+) {
+    ScenarioSampler sampler;
+    sampler.method = method;
+    sampler.run_seed = run_seed;
+    if (draws.history) {
+        // Overlapping windows are not independent, so splitting them into
+        // batches would not give meaningful standard errors.
+        sampler.batch_begin = {0, num_paths};
+        return sampler;
+    }
+    sampler.batch_begin = samplingBatches(num_paths);
+    if (method == SamplingMethod::Sobol) {
+        const size_t dimensions = drawsPerPath(draws);
+        if (dimensions > QuasiRandom::SobolSequence::kMaxDimensions) {
+            throw std::invalid_argument("Sobol sampling supports at most " +
+                                        std::to_string(QuasiRandom::SobolSequence::kMaxDimensions) +
+                                        " draws per path");
+        }
+        sampler.sobol = std::make_unique<QuasiRandom::SobolSequence>(dimensions);
+    }
+    return sampler;
+}
+
+// Per-worker buffers of the scenario stage, in the worker's run arena and
+// reused from block to block.
+struct ScenarioBlock {
+    explicit ScenarioBlock(std::pmr::memory_resource* arena)
+        : normals(arena), correlated(arena), shocks(arena), spots(arena),
+          vols(arena), windows(arena), uniforms(arena) {
+    }
+    
+    std::pmr::vector<double> normals;     // [path][draw], independent, in drawsPerPath order
+    std::pmr::vector<double> correlated;  // [path][correlated asset]
+    std::pmr::vector<double> shocks;      // [path][asset], spot shocks
+    std::pmr::vector<double> spots;       // [path][asset]
+    std::pmr::vector<double> vols;        // [path][asset], vol factors when vol is shocked
+    std::pmr::vector<double> windows;     // [path], one asset's window returns, historical runs only
+    std::pmr::vector<double> uniforms;    // [draw], one Sobol point
+};
+
+// NaN fails both comparisons, so this also catches it.
+void checkScenarioSpots(const ScenarioBlock& block, size_t block_paths, size_t num_assets,
+                        const uint8_t* selected) {
+    const double max_spot = std::numeric_limits<double>::max();
+    bool valid = true;
+    for (size_t p = 0; p < block_paths; ++p) {
+        const double* row = &block.spots[p * num_assets];
+        for (size_t a = 0; a < num_assets; ++a) {
+            if (!selected || selected[a]) {
+                valid &= row[a] > 0.0 && row[a] <= max_spot;
+            }
+        }
+    }
+    if (!valid) {
+        throw std::runtime_error("Invalid simulated spot price in risk metrics calculation");
+    }
+}
+
+// Historical form of the scenario stage: each selected asset's column of
+// the block is read from the store in one pass over its window returns.
+// The spot shocks are left at zero; no control variate is used.
+void historicalScenarios(
+    const ScenarioDraws& draws, size_t begin, size_t block_paths, const uint8_t* selected,
+    ScenarioBlock& out
+) {
+    const size_t num_assets = draws.num_assets;
+    RunStats::resizeScratch(out.shocks, block_paths * num_assets, kPathsPerBlock * num_assets);
+    std::fill(out.shocks.begin(), out.shocks.end(), 0.0);
+    RunStats::resizeScratch(out.spots, block_paths * num_assets, kPathsPerBlock * num_assets);
+    out.vols.clear();
+    RunStats::resizeScratch(out.windows, block_paths, kPathsPerBlock);
+    for (size_t a = 0; a < num_assets; ++a) {
+        if (selected && !selected[a]) {
+            continue;
+        }
+        draws.history->windowReturns(draws.history_asset[a], draws.history_first_day + begin,
+                                     block_paths, draws.history_days, out.windows.data());
+        for (size_t p = 0; p < block_paths; ++p) {
+            out.spots[p * num_assets + a] = draws.base_spot[a] * std::exp(out.windows[p]);
+        }
+    }
+}
+
+// Scenario stage of one block: one shock per underlying per path, stored
+// as a [paths x assets] grid of simulated spots, plus a grid of vol
+// factors when vol is shocked. Instruments on the same underlying
+// therefore see the same spot path. With `selected`, spots are only
+// computed for selected assets, but every draw is still taken so a path's
+// scenario does not depend on the selection. The spots are checked in one
+// pass over the block rather than one branch per draw.
+//
+// All of the block's independent draws are taken first. Pseudo-random
+// blocks draw from their own stream, spot then vol draw per asset, then
+// any common factors. Antithetic runs draw the same way for even paths and
+// negate them for the next, odd, path; blocks start on even paths, so pairs
+// never cross blocks. Sobol paths take the point of their index within
+// their batch, scrambled with the batch's seed. A correlation then turns
+// the whole block's spot draws into correlated shocks in one product.
+// Historical runs read their windows instead; see historicalScenarios.
+void drawScenarios(
+    const ScenarioDraws& draws, const ScenarioSampler& sampler, size_t block, size_t block_paths,
+    const uint8_t* selected, ScenarioBlock& out
+) {
+    const size_t num_assets = draws.num_assets;
+    const size_t num_factors = draws.correlation ? draws.correlation->factors() : 0;
+    const size_t vol_offset = num_assets + num_factors;
+    const size_t dimensions = drawsPerPath(draws);
+    const size_t begin = block * kPathsPerBlock;
+    
+    if (draws.history) {
+        historicalScenarios(draws, begin, block_paths, selected, out);
+        checkScenarioSpots(out, block_paths, num_assets, selected);
+        return;
+    }
+    
+    // Sized for a full block, so a short last block never makes a later
+    // full one regrow, whichever order a worker meets them in.
+    const size_t vol_grid = draws.shock_volatility ? kPathsPerBlock * num_assets : 0;
+    RunStats::resizeScratch(out.normals, block_paths * dimensions, kPathsPerBlock * dimensions);
+    RunStats::resizeScratch(out.shocks, block_paths * num_assets, kPathsPerBlock * num_assets);
+    RunStats::resizeScratch(out.spots, block_paths * num_assets, kPathsPerBlock * num_assets);
+    RunStats::resizeScratch(out.vols, draws.shock_volatility ? block_paths * num_assets : 0, vol_grid);
+    
+    std::mt19937 generator = makeBlockGenerator(sampler.run_seed, block);
+    std::normal_distribution<double> distribution(0.0, 1.0);
+    RunStats::resizeScratch(out.uniforms, sampler.sobol ? dimensions : 0);
+    
+    for (size_t p = 0; p < block_paths; ++p) {
+        const size_t path = begin + p;
+        double* normals = &out.normals[p * dimensions];
+        
+        if (sampler.method == SamplingMethod::Sobol) {
+            const std::vector<size_t>& batch_begin = sampler.batch_begin;
+            const size_t batch = static_cast<size_t>(
+                std::upper_bound(batch_begin.begin(), batch_begin.end(), path) - batch_begin.begin()) - 1;
+            const uint64_t batch_seed = splitMix64(splitMix64(sampler.run_seed) ^ (batch + 1));
+            sampler.sobol->point(static_cast<uint32_t>(path - batch_begin[batch]), batch_seed, out.uniforms.data());
+            for (size_t d = 0; d < dimensions; ++d) {
+                normals[d] = QuasiRandom::inverseNormal(out.uniforms[d]);
+            }
+        } else if (sampler.method == SamplingMethod::Antithetic && path % 2 == 1) {
+            const double* previous = normals - dimensions;
+            for (size_t d = 0; d < dimensions; ++d) {
+                normals[d] = -previous[d];
+            }
+        } else {
+            for (size_t a = 0; a < num_assets; ++a) {
+                normals[a] = distribution(generator);
+                if (draws.shock_volatility) {
+                    normals[vol_offset + a] = distribution(generator);
+                }
+            }
+            for (size_t f = 0; f < num_factors; ++f) {
+                normals[num_assets + f] = distribution(generator);
+            }
+        }
+    }
+    // Antithetic blocks start on even paths and only draw for those.
+    QE_COUNT(rng_draws, (sampler.method == SamplingMethod::Antithetic ? (block_paths + 1) / 2 : block_paths) *
+                            dimensions);
+    
+    if (draws.correlation) {
+        const size_t outputs = draws.correlated_assets.size();
+        RunStats::resizeScratch(out.correlated, block_paths * outputs, kPathsPerBlock * outputs);
+        draws.correlation->correlate(out.normals.data(), dimensions, block_paths, out.correlated.data());
+        for (size_t p = 0; p < block_paths; ++p) {
+            for (size_t i = 0; i < outputs; ++i) {
+                out.shocks[p * num_assets + draws.correlated_assets[i]] = out.correlated[p * outputs + i];
+            }
+        }
+    } else {
+        for (size_t p = 0; p < block_paths; ++p) {
+            std::copy(&out.normals[p * dimensions], &out.normals[p * dimensions] + num_assets,
+                      &out.shocks[p * num_assets]);
+        }
+    }
+    
+    for (size_t p = 0; p < block_paths; ++p) {
+        const double* shocks = &out.shocks[p * num_assets];
+        const double* normals = &out.normals[p * dimensions];
+        double* row = &out.spots[p * num_assets];
+        for (size_t a = 0; a < num_assets; ++a) {
+            if (selected && !selected[a]) {
+                continue;
+            }
+            
+            row[a] = draws.base_spot[a] *
+                std::exp(draws.drift[a] + draws.diffusion[a] * shocks[a]);
+            
+            if (draws.shock_volatility) {
+                out.vols[p * num_assets + a] =
+                    std::exp(draws.vol_drift + draws.vol_diffusion * normals[vol_offset + a]);
+            }
+        }
+    }
+    
+    checkScenarioSpots(out, block_paths, num_assets, selected);
+}
+
+// Levels every run measures: the legacy 95%/99% fields, then the
+// requested ones.
+std::vector<double> tailLevels(const std::vector<double>& confidence_levels) {
+    std::vector<double> levels = {0.95, 0.99};
+    levels.insert(levels.end(), confidence_levels.begin(), confidence_levels.end());
+    return levels;
+}
+
+// Metrics and report from the whole-sample measures at tailLevels and, for
+// runs split into sampling batches, each batch's own; the spread of the
+// batch estimates gives the standard errors.
+RiskMetrics summarizeTails(
+    const std::vector<TailMeasure>& measures,
+    const std::vector<std::vector<TailMeasure>>& batch_measures,
+    bool control, VaRSamplingReport& report
+) {
+    const size_t batches = batch_measures.size();
+    std::vector<TailMeasure> standard_errors(measures.size());
+    for (size_t k = 0; k < measures.size(); ++k) {
+        standard_errors[k].confidence = measures[k].confidence;
+    }
+    if (batches > 1) {
+        const double count = static_cast<double>(batches);
+        for (size_t k = 0; k < measures.size(); ++k) {
+            double var_mean = 0.0;
+            double es_mean = 0.0;
+            for (const auto& measures : batch_measures) {
+                var_mean += measures[k].value_at_risk / count;
+                es_mean += measures[k].expected_shortfall / count;
+            }
+            double var_sq = 0.0;
+            double es_sq = 0.0;
+            for (const auto& measures : batch_measures) {
+                var_sq += (measures[k].value_at_risk - var_mean) * (measures[k].value_at_risk - var_mean);
+                es_sq += (measures[k].expected_shortfall - es_mean) * (measures[k].expected_shortfall - es_mean);
+            }
+            standard_errors[k].value_at_risk = std::sqrt(var_sq / (count * (count - 1.0)));
+            standard_errors[k].expected_shortfall = std::sqrt(es_sq / (count * (count - 1.0)));
+        }
+    }
+    
+    RiskMetrics metrics;
+    metrics.var_95 = measures[0].value_at_risk;
+    metrics.es_95 = measures[0].expected_shortfall;
+    metrics.var_99 = measures[1].value_at_risk;
+    metrics.es_99 = measures[1].expected_shortfall;
+    metrics.tail_measures.assign(measures.begin() + 2, measures.end());
+    
+    report.computed = true;
+    report.control_variate = control;
+    report.batches = batches > 1 ? static_cast<int>(batches) : 0;
+    report.var_95_standard_error = standard_errors[0].value_at_risk;
+    report.es_95_standard_error = standard_errors[0].expected_shortfall;
+    report.var_99_standard_error = standard_errors[1].value_at_risk;
+    report.es_99_standard_error = standard_errors[1].expected_shortfall;
+    report.standard_errors.assign(standard_errors.begin() + 2, standard_errors.end());
+    return metrics;
+}
+
+// The legacy 95%/99% fields and every requested level come out of one
+// partition of the distribution; there is no full sort unless a control
+// variate is given (control[path], N(0, control_sd^2)). Each sampling
+// batch is estimated on its own as well.
+RiskMetrics tailMetrics(
+    std::vector<double>& pnl_distribution, const std::vector<double>& confidence_levels,
+    const std::vector<size_t>& batch_begin, const double* control, double control_sd,
+    VaRSamplingReport& report
+) {
+    const std::vector<double> levels = tailLevels(confidence_levels);
+    
+    auto estimate = [&](size_t begin, size_t end) {
+        if (control) {
+            return TailStatistics::computeControlledTailMeasures(
+                &pnl_distribution[begin], control + begin, end - begin, control_sd, levels);
+        }
+        std::vector<double> sample(pnl_distribution.begin() + begin, pnl_distribution.begin() + end);
+        return TailStatistics::computeTailMeasures(sample, levels);
+    };
+    
+    std::vector<std::vector<TailMeasure>> batch_measures;
+    if (batch_begin.size() > 2) {
+        for (size_t b = 0; b + 1 < batch_begin.size(); ++b) {
+            batch_measures.push_back(estimate(batch_begin[b], batch_begin[b + 1]));
+        }
+    }
+    
+    const std::vector<TailMeasure> measures = control
+        ? estimate(0, pnl_distribution.size())
+        : TailStatistics::computeTailMeasures(pnl_distribution, levels);
+    return summarizeTails(measures, batch_measures, control != nullptr, report);
+}
+
+// Tail measures of a run whose P&L arrives a chunk of paths at a time,
+// overall and per sampling batch, keeping only the tails.
+class StreamingTails {
+public:
+    StreamingTails(const std::vector<double>& confidence_levels, const std::vector<size_t>& batch_begin)
+        : levels_(tailLevels(confidence_levels)),
+          batch_begin_(batch_begin),
+          total_(levels_, batch_begin.back()) {
+        if (batch_begin.size() > 2) {
+            for (size_t b = 0; b + 1 < batch_begin.size(); ++b) {
+                batches_.emplace_back(levels_, batch_begin[b + 1] - batch_begin[b]);
+            }
+        }
+    }
+    
+    // Paths [first_path, first_path + paths), in any order of chunks.
+    void add(size_t first_path, size_t paths, const double* pnl) {
+        total_.add(pnl, paths);
+        const size_t end = first_path + paths;
+        for (size_t b = 0; b < batches_.size(); ++b) {
+            const size_t lo = std::max(first_path, batch_begin_[b]);
+            const size_t hi = std::min(end, batch_begin_[b + 1]);
+            if (lo < hi) {
+                batches_[b].add(pnl + (lo - first_path), hi - lo);
+            }
+        }
+    }
+    
+    RiskMetrics metrics(VaRSamplingReport& report) const {
+        std::vector<std::vector<TailMeasure>> batch_measures;
+        for (const TailStatistics::TailAccumulator& batch : batches_) {
+            batch_measures.push_back(batch.measures());
+        }
+        return summarizeTails(total_.measures(), batch_measures, false, report);
+    }
+    
+private:
+    std::vector<double> levels_;
+    std::vector<size_t> batch_begin_;
+    TailStatistics::TailAccumulator total_;
+    std::vector<TailStatistics::TailAccumulator> batches_;
+};
+
+// The worst paths of a run together with each one's per-line P&L, kept a
+// chunk at a time like StreamingTails, for the Euler allocation of each
+// distinct level. Paths rank by (P&L, path index), so ties break the same
+// way whatever order the chunks arrive in. Each level's VaR is allocated over the paths
+// ranked within a tenth of its tail size (at least one) either side of it.
+class ContributionTails {
+public:
+    ContributionTails(const std::vector<double>& levels, size_t num_paths, size_t num_lines)
+        : num_paths_(num_paths), num_lines_(num_lines) {
+        for (double level : levels) {
+            if (std::any_of(levels_.begin(), levels_.end(),
+                            [&](const Level& seen) { return seen.confidence == level; })) {
+                continue;
+            }
+            const size_t index = TailStatistics::tailIndex(level, num_paths);
+            const size_t window = std::max<size_t>(1, (index + 1) / 10);
+            levels_.push_back({level, index, window});
+            keep_ = std::max(keep_, std::min(num_paths, index + window + 1));
+        }
+    }
+    
+    // pnl[p] and line_pnl[p * lines + l] for paths [first_path, + paths).
+    void add(size_t first_path, size_t paths, const double* pnl, const double* line_pnl) {
+        for (size_t p = 0; p < paths; ++p) {
+            const Key key{pnl[p], first_path + p};
+            if (full_ && !(key < threshold_)) {
+                continue;
+            }
+            keys_.push_back(key);
+            rows_.insert(rows_.end(), line_pnl + p * num_lines_, line_pnl + (p + 1) * num_lines_);
+            if (keys_.size() == 2 * keep_) {
+                compact();
+            }
+        }
+    }
+    
+    VaRContributionReport report(const std::vector<int>& quantities) const {
+        std::vector<size_t> order(keys_.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys_[a] < keys_[b]; });
+        
+        VaRContributionReport report;
+        report.computed = true;
+        for (const Level& level : levels_) {
+            RiskContribution contribution;
+            contribution.confidence = level.confidence;
+            contribution.component_var.assign(num_lines_, 0.0);
+            contribution.component_es.assign(num_lines_, 0.0);
+            
+            double tail_sum = 0.0;
+            for (size_t r = 0; r <= level.index; ++r) {
+                tail_sum += keys_[order[r]].first;
+                const double* row = &rows_[order[r] * num_lines_];
+                for (size_t l = 0; l < num_lines_; ++l) {
+                    contribution.component_es[l] += row[l];
+                }
+            }
+            const double tail_paths = static_cast<double>(level.index + 1);
+            contribution.value_at_risk = -keys_[order[level.index]].first;
+            contribution.expected_shortfall = -tail_sum / tail_paths;
+            for (double& component : contribution.component_es) {
+                component = -component / tail_paths;
+            }
+            
+            const size_t lo = level.index - std::min(level.index, level.window);
+            const size_t hi = std::min(keep_ - 1, level.index + level.window);
+            double window_sum = 0.0;
+            for (size_t r = lo; r <= hi; ++r) {
+                window_sum += keys_[order[r]].first;
+                const double* row = &rows_[order[r] * num_lines_];
+                for (size_t l = 0; l < num_lines_; ++l) {
+                    contribution.component_var[l] += row[l];
+                }
+            }
+            // Scale the window's mean line P&L to add up to the VaR itself;
+            // a window whose P&L nets to zero is reported unscaled.
+            const double window_paths = static_cast<double>(hi - lo + 1);
+            const double scale = std::abs(window_sum) > 0.0
+                ? contribution.value_at_risk / window_sum
+                : -1.0 / window_paths;
+            for (double& component : contribution.component_var) {
+                component *= scale;
+            }
+            contribution.var_window_paths = static_cast<int>(hi - lo + 1);
+            
+            contribution.marginal_var.assign(num_lines_, 0.0);
+            contribution.marginal_es.assign(num_lines_, 0.0);
+            for (size_t l = 0; l < num_lines_; ++l) {
+                if (quantities[l] != 0) {
+                    contribution.marginal_var[l] = contribution.component_var[l] / quantities[l];
+                    contribution.marginal_es[l] = contribution.component_es[l] / quantities[l];
+                }
+            }
+            report.levels.push_back(std::move(contribution));
+        }
+        return report;
+    }
+    
+private:
+    using Key = std::pair<double, size_t>;  // (P&L, path)
+    struct Level {
+        double confidence;
+        size_t index;   // TailStatistics::tailIndex
+        size_t window;  // paths either side averaged for the VaR
+    };
+    
+    size_t num_paths_;
+    size_t num_lines_;
+    size_t keep_ = 0;
+    std::vector<Level> levels_;
+    std::vector<Key> keys_;
+    std::vector<double> rows_;  // [kept][line]
+    bool full_ = false;
+    Key threshold_;
+    
+    void compact() {
+        std::vector<size_t> order(keys_.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::nth_element(order.begin(), order.begin() + (keep_ - 1), order.end(),
+                         [&](size_t a, size_t b) { return keys_[a] < keys_[b]; });
+        std::vector<Key> keys(keep_);
+        std::vector<double> rows(keep_ * num_lines_);
+        for (size_t i = 0; i < keep_; ++i) {
+            keys[i] = keys_[order[i]];
+            std::copy(&rows_[order[i] * num_lines_], &rows_[order[i] * num_lines_] + num_lines_,
+                      &rows[i * num_lines_]);
+        }
+        threshold_ = keys_[order[keep_ - 1]];
+        keys_ = std::move(keys);
+        rows_ = std::move(rows);
+        full_ = true;
+    }
+};
+
+// Standard deviation of the delta control variate, whose value on a path
+// is sum over assets of scale[a] * spot shock[a], with the shocks
+// correlated by `correlation` when given.
+double controlStandardDeviation(const std::vector<double>& scale, const ShockFactor* correlation) {
+    if (correlation) {
+        return correlation->standardDeviation(scale.data());
+    }
+    double variance = 0.0;
+    for (double s : scale) {
+        variance += s * s;
+    }
+    return std::sqrt(variance);
+}
+
+VaRApproximationReport buildApproximationReport(
+    std::vector<double> approx_pnl,
+    std::vector<double> full_pnl
+) {
+    VaRApproximationReport report;
+    report.computed = true;
+    report.validation_paths = static_cast<int>(full_pnl.size());
+    
+    double sum_sq_error = 0.0;
+    double sum_full = 0.0;
+    double sum_sq_full = 0.0;
+    for (size_t i = 0; i < full_pnl.size(); ++i) {
+        const double error = approx_pnl[i] - full_pnl[i];
+        report.max_abs_pnl_error = std::max(report.max_abs_pnl_error, std::abs(error));
+        sum_sq_error += error * error;
+        sum_full += full_pnl[i];
+        sum_sq_full += full_pnl[i] * full_pnl[i];
+    }
+    
+    const double n = static_cast<double>(full_pnl.size());
+    report.rms_pnl_error = std::sqrt(sum_sq_error / n);
+    
+    const double mean_full = sum_full / n;
+    const double stddev_full = std::sqrt(std::max(0.0, sum_sq_full / n - mean_full * mean_full));
+    report.relative_rms_error = stddev_full > 0.0 ? report.rms_pnl_error / stddev_full : 0.0;
+    
+    const std::vector<double> levels = {0.95, 0.99};
+    const std::vector<TailMeasure> full_tail = TailStatistics::computeTailMeasures(full_pnl, levels);
+    const std::vector<TailMeasure> approx_tail = TailStatistics::computeTailMeasures(approx_pnl, levels);
+    report.full_var_95 = full_tail[0].value_at_risk;
+    report.full_var_99 = full_tail[1].value_at_risk;
+    report.approx_var_95 = approx_tail[0].value_at_risk;
+    report.approx_var_99 = approx_tail[1].value_at_risk;
+    
+    return report;
+}
+
+// A book's line in a merged portfolio: forwards to the book's own
+// instrument, which outlives the batch run.
+class SharedLine : public Instrument {
+public:
+    explicit SharedLine(const Instrument& instrument) : instrument_(instrument) {}
+    
+    double price(const MarketData& md) const override { return instrument_.price(md); }
+    double delta(const MarketData& md) const override { return instrument_.delta(md); }
+    double gamma(const MarketData& md) const override { return instrument_.gamma(md); }
+    double vega(const MarketData& md) const override { return instrument_.vega(md); }
+    double theta(const MarketData& md) const override { return instrument_.theta(md); }
+    std::string getAssetId() const override { return instrument_.getAssetId(); }
+    Greeks computeAll(const MarketData& md) const override { return instrument_.computeAll(md); }
+    bool getContractTerms(ContractTerms& terms) const override { return instrument_.getContractTerms(terms); }
+    std::string getInstrumentType() const override { return instrument_.getInstrumentType(); }
+    bool isValid() const override { return instrument_.isValid(); }
+    
+private:
+    const Instrument& instrument_;
+};
+
+using ContractKey = std::tuple<
+    std::string, int, double, double, bool, int, int, int, double, double, double>;
+
+ContractKey contractKey(const std::string& asset_id, const ContractTerms& terms) {
+    return ContractKey(
+        asset_id, static_cast<int>(terms.option_type), terms.strike, terms.time_to_expiry,
+        terms.is_american, static_cast<int>(terms.model), terms.binomial_steps,
+        static_cast<int>(terms.lattice_scheme), terms.jump_intensity, terms.jump_mean,
+        terms.jump_volatility);
+}
+
+// The distinct lines of several books as one portfolio of unit lines, and
+// each book's (line, quantity) positions in it. A contract held twice by
+// one book is one position.
+struct MergedBooks {
+    Portfolio portfolio;
+    std::vector<std::vector<std::pair<uint32_t, int>>> positions;
+};
+
+MergedBooks mergeBooks(const std::vector<const Portfolio*>& books) {
+    MergedBooks merged;
+    merged.positions.resize(books.size());
+    std::map<ContractKey, uint32_t> contract_lines;
+    std::map<const Instrument*, uint32_t> generic_lines;
+    
+    for (size_t b = 0; b < books.size(); ++b) {
+        if (!books[b]) {
+            throw std::invalid_argument("Batch risk needs a portfolio for every book");
+        }
+        std::map<uint32_t, int> book_quantity;
+        for (const auto& [instrument, quantity] : books[b]->getInstruments()) {
+            ContractTerms terms;
+            const uint32_t next = static_cast<uint32_t>(merged.portfolio.size());
+            uint32_t line = next;
+            if (instrument->getContractTerms(terms)) {
+                line = contract_lines.emplace(contractKey(instrument->getAssetId(), terms), next).first->second;
+            } else {
+                line = generic_lines.emplace(instrument.get(), next).first->second;
+            }
+            if (line == next) {
+                merged.portfolio.addInstrument(std::make_unique<SharedLine>(*instrument), 1);
+            }
+            book_quantity[line] += quantity;
+        }
+        merged.positions[b].assign(book_quantity.begin(), book_quantity.end());
+    }
+    return merged;
+}
+
+// Resets stats for a new run and reports whether it collects.
+bool startRunStats(bool collect, RiskRunStats& stats) {
+    stats = RiskRunStats();
+    stats.collected = collect && RunStats::kCompiled;
+    return stats.collected;
+}
+
+// Lifetime of one public call's stats: times the whole call and points the
+// calling thread at the run's counters.
+class RunStatsScope {
+public:
+    // Also starts the run on fresh scratch, since every earlier run's
+    // buffers are dead by now.
+    RunStatsScope(bool collect, RiskRunStats& stats, RunArenas& arenas)
+        : counters_(startRunStats(collect, stats) ? &stats.counters : nullptr),
+          total_(stats.collected ? &stats.total_ms : nullptr),
+          stats_(stats), arenas_(arenas) {
+        arenas_.reset();
+    }
+
+    ~RunStatsScope() {
+        if (stats_.collected) {
+            stats_.arena_bytes = arenas_.used();
+            stats_.arena_heap_blocks = arenas_.heapAllocations();
+        }
+    }
+
+    RunStatsScope(const RunStatsScope&) = delete;
+    RunStatsScope& operator=(const RunStatsScope&) = delete;
+
+private:
+    RunStats::Scope counters_;
+    RunStats::PhaseTimer total_;
+    RiskRunStats& stats_;
+    RunArenas& arenas_;
+};
+
+// One instance per worker, each built on its worker's arena.
+template <typename T>
+std::vector<T> perWorker(RunArenas& arenas, size_t workers) {
+    arenas.reserveWorkers(workers);
+    std::vector<T> buffers;
+    buffers.reserve(workers);
+    for (size_t w = 0; w < workers; ++w) {
+        buffers.emplace_back(&arenas.worker(w));
+    }
+    return buffers;
+}
+
+// One zeroed buffer of size doubles per worker, in its worker's arena.
+std::vector<std::pmr::vector<double>> workerBuffers(RunArenas& arenas, size_t workers, size_t size) {
+    std::vector<std::pmr::vector<double>> buffers = perWorker<std::pmr::vector<double>>(arenas, workers);
+    for (std::pmr::vector<double>& buffer : buffers) {
+        buffer.assign(size, 0.0);
+    }
+    return buffers;
+}
+
+// Per-worker counters of one parallel loop, added to the calling thread's
+// counters when the loop's scope ends. Slots sit on their own cache lines
+// so workers counting side by side never share one.
+class WorkerCounters {
+public:
+    explicit WorkerCounters(size_t workers)
+        : target_(RunStats::active), slots_(target_ ? workers : 0) {
+    }
+
+    ~WorkerCounters() {
+        for (const Slot& slot : slots_) {
+            *target_ += slot.counters;
+        }
+    }
+
+    WorkerCounters(const WorkerCounters&) = delete;
+    WorkerCounters& operator=(const WorkerCounters&) = delete;
+
+    // Null when the caller is not collecting.
+    RunCounters* at(int worker) {
+        return target_ ? &slots_[worker].counters : nullptr;
+    }
+
+private:
+    struct alignas(64) Slot {
+        RunCounters counters;
+    };
+
+    RunCounters* target_;
+    std::vector<Slot> slots_;
+};
+
+// One run's use of a P&L sink, which may be null. Begins the sink, and
+// aborts it unless finish() is reached, so a run that throws or is
+// cancelled never leaves it half written.
+class SinkRun {
+public:
+    SinkRun(PnLSink* sink, size_t paths, const std::vector<std::string>& asset_ids)
+        : sink_(sink) {
+        if (!sink_) {
+            return;
+        }
+        try {
+            sink_->begin(paths, asset_ids);
+        } catch (...) {
+            sink_->abort();
+            throw;
+        }
+    }
+
+    ~SinkRun() {
+        if (sink_) {
+            sink_->abort();
+        }
+    }
+
+    SinkRun(const SinkRun&) = delete;
+    SinkRun& operator=(const SinkRun&) = delete;
+
+    void finish() {
+        PnLSink* sink = sink_;
+        sink_ = nullptr;
+        if (sink) {
+            sink->finish();
+        }
+    }
+
+private:
+    PnLSink* sink_;
+};
+
+}
+
+void RiskRunCache::clear() {
+    *this = RiskRunCache();
+}
+
+bool RiskRunCache::empty() const {
+    return !valid_;
+}
+
+size_t RiskRunCache::lastRepricedAssets() const {
+    return last_repriced_assets_;
+}
 
 RiskEngine::RiskEngine() 
     : var_simulations_(10000),
       time_horizon_days_(1.0),
       random_seed_(0),
-      use_fixed_seed_(false) {
+      use_fixed_seed_(false),
+      num_threads_(1),
+      var_method_(VaRMethod::FullRevaluation),
+      vol_of_vol_(0.0),
+      vol_surface_dynamics_(VolSurfaceDynamics::StickyStrike),
+      approximation_check_paths_(1000),
+      confidence_levels_{0.95, 0.99},
+      sampling_method_(SamplingMethod::PseudoRandom),
+      use_control_variate_(false),
+      historical_lookback_days_(0),
+      compute_contributions_(false),
+      collect_run_stats_(false) {
 }
 
 RiskEngine::RiskEngine(int var_simulations)
     : var_simulations_(var_simulations),
       time_horizon_days_(1.0),
       random_seed_(0),
-      use_fixed_seed_(false) {
+      use_fixed_seed_(false),
+      num_threads_(1),
+      var_method_(VaRMethod::FullRevaluation),
+      vol_of_vol_(0.0),
+      vol_surface_dynamics_(VolSurfaceDynamics::StickyStrike),
+      approximation_check_paths_(1000),
+      confidence_levels_{0.95, 0.99},
+      sampling_method_(SamplingMethod::PseudoRandom),
+      use_control_variate_(false),
+      historical_lookback_days_(0),
+      compute_contributions_(false),
+      collect_run_stats_(false) {
     validateParameters();
 }
 
@@ -59,6 +1364,180 @@ void RiskEngine::setUseFixedSeed(bool use_fixed) {
     use_fixed_seed_ = use_fixed;
 }
 
+void RiskEngine::setNumThreads(int threads) {
+    if (threads < 0) {
+        throw std::invalid_argument("Thread count cannot be negative");
+    }
+    if (threads > kMaxThreads) {
+        throw std::invalid_argument("Thread count cannot exceed 256");
+    }
+    num_threads_ = threads;
+}
+
+int RiskEngine::getNumThreads() const {
+    return num_threads_;
+}
+
+void RiskEngine::setVaRMethod(VaRMethod method) {
+    var_method_ = method;
+}
+
+VaRMethod RiskEngine::getVaRMethod() const {
+    return var_method_;
+}
+
+void RiskEngine::setVolOfVol(double vol_of_vol) {
+    if (std::isnan(vol_of_vol) || vol_of_vol < 0.0) {
+        throw std::invalid_argument("Vol of vol cannot be negative");
+    }
+    if (vol_of_vol > kMaxVolOfVol) {
+        throw std::invalid_argument("Vol of vol cannot exceed 5.0");
+    }
+    vol_of_vol_ = vol_of_vol;
+}
+
+double RiskEngine::getVolOfVol() const {
+    return vol_of_vol_;
+}
+
+void RiskEngine::setVolSurfaceDynamics(VolSurfaceDynamics dynamics) {
+    vol_surface_dynamics_ = dynamics;
+}
+
+VolSurfaceDynamics RiskEngine::getVolSurfaceDynamics() const {
+    return vol_surface_dynamics_;
+}
+
+void RiskEngine::setSamplingMethod(SamplingMethod method) {
+    sampling_method_ = method;
+}
+
+SamplingMethod RiskEngine::getSamplingMethod() const {
+    return sampling_method_;
+}
+
+void RiskEngine::setUseControlVariate(bool use_control_variate) {
+    use_control_variate_ = use_control_variate;
+}
+
+bool RiskEngine::getUseControlVariate() const {
+    return use_control_variate_;
+}
+
+void RiskEngine::setCorrelationModel(std::shared_ptr<CorrelationModel> model) {
+    correlation_model_ = std::move(model);
+}
+
+std::shared_ptr<CorrelationModel> RiskEngine::getCorrelationModel() const {
+    return correlation_model_;
+}
+
+void RiskEngine::setHistoricalReturns(std::shared_ptr<ReturnsStore> store, int lookback_days) {
+    if (lookback_days < 0) {
+        throw std::invalid_argument("Historical lookback cannot be negative");
+    }
+    if (store && static_cast<size_t>(lookback_days) > store->dateCount()) {
+        throw std::invalid_argument("Historical lookback exceeds the " +
+                                    std::to_string(store->dateCount()) + " days in the returns store");
+    }
+    historical_returns_ = std::move(store);
+    historical_lookback_days_ = historical_returns_ ? lookback_days : 0;
+}
+
+void RiskEngine::setComputeContributions(bool compute) {
+    compute_contributions_ = compute;
+}
+
+bool RiskEngine::getComputeContributions() const {
+    return compute_contributions_;
+}
+
+const VaRContributionReport& RiskEngine::getLastContributionReport() const {
+    return last_contribution_report_;
+}
+
+void RiskEngine::setCollectRunStats(bool collect) {
+    collect_run_stats_ = collect;
+}
+
+bool RiskEngine::getCollectRunStats() const {
+    return collect_run_stats_;
+}
+
+const RiskRunStats& RiskEngine::getLastRunStats() const {
+    return last_run_stats_;
+}
+
+double* RiskEngine::phaseClock(double RiskRunStats::*phase) {
+    return last_run_stats_.collected ? &(last_run_stats_.*phase) : nullptr;
+}
+
+void RiskEngine::setPnLSink(std::shared_ptr<PnLSink> sink) {
+    pnl_sink_ = std::move(sink);
+}
+
+std::shared_ptr<PnLSink> RiskEngine::getPnLSink() const {
+    return pnl_sink_;
+}
+
+void RiskEngine::setRunControl(std::shared_ptr<RunControl> control) {
+    run_control_ = std::move(control);
+}
+
+std::shared_ptr<RunControl> RiskEngine::getRunControl() const {
+    return run_control_;
+}
+
+std::shared_ptr<ReturnsStore> RiskEngine::getHistoricalReturns() const {
+    return historical_returns_;
+}
+
+int RiskEngine::getHistoricalLookbackDays() const {
+    return historical_lookback_days_;
+}
+
+void RiskEngine::setApproximationCheckPaths(int paths) {
+    if (paths < 0) {
+        throw std::invalid_argument("Approximation check paths cannot be negative");
+    }
+    if (paths > kMaxApproximationCheckPaths) {
+        throw std::invalid_argument("Approximation check paths cannot exceed 1,000,000");
+    }
+    approximation_check_paths_ = paths;
+}
+
+int RiskEngine::getApproximationCheckPaths() const {
+    return approximation_check_paths_;
+}
+
+void RiskEngine::setConfidenceLevels(const std::vector<double>& levels) {
+    TailStatistics::validateConfidenceLevels(levels);
+    if (levels.size() > kMaxConfidenceLevels) {
+        throw std::invalid_argument("Cannot request more than 64 confidence levels");
+    }
+    confidence_levels_ = levels;
+}
+
+const std::vector<double>& RiskEngine::getConfidenceLevels() const {
+    return confidence_levels_;
+}
+
+const VaRApproximationReport& RiskEngine::getLastApproximationReport() const {
+    return last_approximation_report_;
+}
+
+const VaRSamplingReport& RiskEngine::getLastSamplingReport() const {
+    return last_sampling_report_;
+}
+
+void RiskEngine::setPricingCache(std::shared_ptr<PricingCache> cache) {
+    pricing_cache_ = std::move(cache);
+}
+
+std::shared_ptr<PricingCache> RiskEngine::getPricingCache() const {
+    return pricing_cache_;
+}
+
 void RiskEngine::validateParameters() const {
     if (var_simulations_ <= 0 || var_simulations_ > 1000000) {
         throw std::invalid_argument("Invalid VaR simulations parameter");
@@ -66,162 +1545,860 @@ void RiskEngine::validateParameters() const {
     if (time_horizon_days_ <= 0.0 || time_horizon_days_ > 252.0) {
         throw std::invalid_argument("Invalid time horizon parameter");
     }
+    if (num_threads_ < 0 || num_threads_ > kMaxThreads) {
+        throw std::invalid_argument("Invalid thread count parameter");
+    }
+    if (vol_of_vol_ < 0.0 || vol_of_vol_ > kMaxVolOfVol) {
+        throw std::invalid_argument("Invalid vol of vol parameter");
+    }
+    if (approximation_check_paths_ < 0 || approximation_check_paths_ > kMaxApproximationCheckPaths) {
+        throw std::invalid_argument("Invalid approximation check paths parameter");
+    }
+}
+
+void RiskEngine::streamCachedPnL(
+    const PortfolioColumns& columns,
+    const RiskRunCache& cache,
+    const std::vector<double>& pnl_distribution
+) const {
+    const size_t num_assets = cache.asset_pnl_.size();
+    const size_t num_paths = pnl_distribution.size();
+    const bool breakdown = pnl_sink_->wantsAssetBreakdown();
+    
+    std::vector<std::string> asset_ids;
+    for (uint32_t a = 0; a < num_assets; ++a) {
+        asset_ids.push_back(columns.assets().symbol(a));
+    }
+    SinkRun sink(pnl_sink_.get(), num_paths, asset_ids);
+    
+    std::vector<double> asset_pnl(breakdown ? kPathsPerBlock * num_assets : 0);
+    for (size_t begin = 0; begin < num_paths; begin += kPathsPerBlock) {
+        const size_t paths = std::min(kPathsPerBlock, num_paths - begin);
+        if (breakdown) {
+            for (size_t p = 0; p < paths; ++p) {
+                for (size_t a = 0; a < num_assets; ++a) {
+                    asset_pnl[p * num_assets + a] = cache.asset_pnl_[a][begin + p];
+                }
+            }
+        }
+        PnLChunk chunk;
+        chunk.first_path = begin;
+        chunk.paths = paths;
+        chunk.pnl = &pnl_distribution[begin];
+        chunk.assets = breakdown ? num_assets : 0;
+        chunk.asset_pnl = breakdown ? asset_pnl.data() : nullptr;
+        pnl_sink_->write(chunk);
+    }
+    sink.finish();
+}
+
+size_t RiskEngine::scenarioCount() const {
+    if (!historical_returns_) {
+        return static_cast<size_t>(var_simulations_);
+    }
+    if (time_horizon_days_ != std::floor(time_horizon_days_)) {
+        throw std::invalid_argument("Historical VaR needs a whole number of days as time horizon");
+    }
+    const size_t horizon = static_cast<size_t>(time_horizon_days_);
+    const size_t lookback = historical_lookback_days_ > 0
+        ? static_cast<size_t>(historical_lookback_days_)
+        : historical_returns_->dateCount();
+    if (lookback < horizon) {
+        throw std::invalid_argument("Historical lookback is shorter than the VaR time horizon");
+    }
+    return lookback - horizon + 1;
+}
+
+std::shared_ptr<const ShockFactor> RiskEngine::shockFactor(const PortfolioColumns& columns) const {
+    if (!correlation_model_ || historical_returns_) {
+        return nullptr;
+    }
+    const AssetSymbolTable& symbols = columns.assets();
+    std::vector<std::string> asset_ids;
+    asset_ids.reserve(symbols.size());
+    for (uint32_t a = 0; a < symbols.size(); ++a) {
+        asset_ids.push_back(symbols.symbol(a));
+    }
+    return correlation_model_->factorFor(asset_ids);
 }
 
 void RiskEngine::validateMarketData(
     const Portfolio& portfolio,
-    const std::map<std::string, MarketData>& market_data_map
-) const {
+    const AssetMarketData& asset_market_data
+) const {
+    // Portfolio::addInstrument rejects null instruments and empty asset
+    // IDs, so only the distinct underlyings need checking.
+    const AssetSymbolTable& symbols = portfolio.getColumns().assets();
+    
+    for (uint32_t a = 0; a < symbols.size(); ++a) {
+        const std::string& asset_id = symbols.symbol(a);
+        const MarketData& md = *asset_market_data[a];
+        
+        if (md.spot_price <= 0.0) {
+            throw std::invalid_argument("Spot price must be positive for " + asset_id);
+        }
+        if (md.volatility < 0.0) {
+            throw std::invalid_argument("Volatility cannot be negative for " + asset_id);
+        }
+        if (std::isnan(md.spot_price) || std::isinf(md.spot_price)) {
+            throw std::invalid_argument("Invalid spot price for " + asset_id);
+        }
+        if (std::isnan(md.risk_free_rate) || std::isinf(md.risk_free_rate)) {
+            throw std::invalid_argument("Invalid risk-free rate for " + asset_id);
+        }
+        if (std::isnan(md.volatility) || std::isinf(md.volatility)) {
+            throw std::invalid_argument("Invalid volatility for " + asset_id);
+        }
+        if (md.vol_surface && !md.vol_surface->hasData()) {
+            throw std::invalid_argument("Volatility surface for " + asset_id + " must have data");
+        }
+    }
+}
+
+Greeks RiskEngine::calculateInstrumentGreeks(
+    const std::unique_ptr<Instrument>& instrument,
+    int quantity,
+    const MarketData& md
+) const {
+    Greeks greeks;
+    
+    // Keyed on the line's own vol, which is all computeAll reads from a
+    // surface.
+    ContractTerms terms;
+    PricingState state;
+    const bool cacheable = pricing_cache_ && instrument->getContractTerms(terms);
+    if (cacheable) {
+        state.spot = md.spot_price;
+        state.rate = md.risk_free_rate;
+        state.vol = md.volatilityFor(terms.strike, terms.time_to_expiry);
+        state.dividend = md.dividend_yield;
+    }
+    
+    if (!cacheable || !pricing_cache_->lookup(terms, state, PricingCache::Kind::Greeks, greeks)) {
+        try {
+            greeks = instrument->computeAll(md);
+        } catch (const std::exception& e) {
+            throw std::runtime_error(
+                std::string("Failed to calculate Greeks for ") +
+                instrument->getAssetId() + ": " + e.what()
+            );
+        }
+        if (cacheable) {
+            pricing_cache_->insert(terms, state, PricingCache::Kind::Greeks, greeks);
+        }
+    }
+    
+    auto scale = [&](double metric_value, const char* metric_name) {
+        if (std::isnan(metric_value) || std::isinf(metric_value)) {
+            throw std::runtime_error(
+                std::string("Invalid ") + metric_name + " value for " + instrument->getAssetId()
+            );
+        }
+        
+        double result = metric_value * quantity;
+        
+        if (std::isnan(result) || std::isinf(result)) {
+            throw std::overflow_error(
+                std::string("Overflow in ") + metric_name + " calculation for " + instrument->getAssetId()
+            );
+        }
+        
+        return result;
+    };
+    
+    Greeks scaled;
+    scaled.price = scale(greeks.price, "price");
+    scaled.delta = scale(greeks.delta, "delta");
+    scaled.gamma = scale(greeks.gamma, "gamma");
+    scaled.vega = scale(greeks.vega, "vega");
+    scaled.theta = scale(greeks.theta, "theta");
+    return scaled;
+}
+
+PortfolioRiskResult RiskEngine::calculatePortfolioRisk(
+    const Portfolio& portfolio, 
+    const std::map<std::string, MarketData>& market_data_map
+) {
+    RunStatsScope run(collect_run_stats_, last_run_stats_, run_arenas_);
+    RunStats::PhaseTimer validation(phaseClock(&RiskRunStats::validation_ms));
+    validateParameters();
+    const AssetMarketData asset_md = resolveAssets(portfolio.getColumns(), market_data_map);
+    validation.stop();
+    return calculateResolvedRisk(portfolio, asset_md);
+}
+
+PortfolioRiskResult RiskEngine::calculatePortfolioRisk(
+    const Portfolio& portfolio,
+    const MarketDataSnapshot& market_data
+) {
+    RunStatsScope run(collect_run_stats_, last_run_stats_, run_arenas_);
+    RunStats::PhaseTimer validation(phaseClock(&RiskRunStats::validation_ms));
+    validateParameters();
+    const AssetMarketData asset_md = resolveAssets(portfolio.getColumns(), market_data);
+    validation.stop();
+    return calculateResolvedRisk(portfolio, asset_md);
+}
+
+PortfolioRiskResult RiskEngine::calculatePortfolioRisk(
+    const Portfolio& portfolio,
+    const MarketDataSnapshot& market_data,
+    RiskRunCache& cache
+) {
+    RunStatsScope run(collect_run_stats_, last_run_stats_, run_arenas_);
+    RunStats::PhaseTimer validation(phaseClock(&RiskRunStats::validation_ms));
+    validateParameters();
+    std::vector<uint64_t> versions;
+    const AssetMarketData asset_md = resolveAssets(portfolio.getColumns(), market_data, &versions);
+    validation.stop();
+    
+    // The cache keeps no per-line P&L, so contributions need a full run,
+    // which leaves the cache as it was.
+    if (compute_contributions_) {
+        return calculateResolvedRisk(portfolio, asset_md);
+    }
+    
+    // A failed run may have refreshed only some assets, so nothing in the
+    // cache can be trusted afterwards.
+    try {
+        return calculateIncrementalRisk(portfolio, asset_md, versions, cache);
+    } catch (...) {
+        cache.clear();
+        throw;
+    }
+}
+
+BatchRiskResult RiskEngine::calculateBatchRisk(
+    const std::vector<const Portfolio*>& books,
+    const std::map<std::string, MarketData>& market_data_map
+) {
+    RunStatsScope run(collect_run_stats_, last_run_stats_, run_arenas_);
+    RunStats::PhaseTimer validation(phaseClock(&RiskRunStats::validation_ms));
+    validateParameters();
+    const MergedBooks merged = mergeBooks(books);
+    const AssetMarketData asset_md = resolveAssets(merged.portfolio.getColumns(), market_data_map);
+    validation.stop();
+    return calculateResolvedBatchRisk(merged.portfolio, merged.positions, asset_md);
+}
+
+BatchRiskResult RiskEngine::calculateBatchRisk(
+    const std::vector<const Portfolio*>& books,
+    const MarketDataSnapshot& market_data
+) {
+    RunStatsScope run(collect_run_stats_, last_run_stats_, run_arenas_);
+    RunStats::PhaseTimer validation(phaseClock(&RiskRunStats::validation_ms));
+    validateParameters();
+    const MergedBooks merged = mergeBooks(books);
+    const AssetMarketData asset_md = resolveAssets(merged.portfolio.getColumns(), market_data);
+    validation.stop();
+    return calculateResolvedBatchRisk(merged.portfolio, merged.positions, asset_md);
+}
+
+PortfolioRiskResult RiskEngine::calculateResolvedRisk(
+    const Portfolio& portfolio,
+    const AssetMarketData& asset_md
+) {
+    PortfolioRiskResult result;
+    result.reset();
+    last_approximation_report_ = VaRApproximationReport();
+    last_contribution_report_ = VaRContributionReport();
+    last_sampling_report_ = VaRSamplingReport();
+    last_sampling_report_.sampling_method = sampling_method_;
+    last_sampling_report_.historical = historical_returns_ != nullptr;
+    
+    if (portfolio.empty()) {
+        return result;
+    }
+    
+    RunStats::PhaseTimer validation(phaseClock(&RiskRunStats::validation_ms));
+    validateMarketData(portfolio, asset_md);
+    validation.stop();
+    
     const auto& instruments = portfolio.getInstruments();
+    const std::vector<uint32_t>& line_asset = portfolio.getColumns().lineAssets();
     
-    for (const auto& [instrument, quantity] : instruments) {
-        if (!instrument) {
-            throw std::runtime_error("Portfolio contains null instrument");
-        }
-        
-        std::string asset_id;
-        try {
-            asset_id = instrument->getAssetId();
-        } catch (const std::exception& e) {
-            throw std::runtime_error(std::string("Failed to get asset ID: ") + e.what());
-        }
-        
-        if (asset_id.empty()) {
-            throw std::runtime_error("Instrument has empty asset ID");
-        }
+    // The per-line Greeks are kept so the approximate VaR modes can reuse
+    // them instead of pricing anything again.
+    LineSensitivities sensitivities;
+    sensitivities.delta.reserve(instruments.size());
+    sensitivities.gamma.reserve(instruments.size());
+    sensitivities.vega.reserve(instruments.size());
+    
+    RunStats::PhaseTimer greeks(phaseClock(&RiskRunStats::greeks_ms));
+    for (size_t i = 0; i < instruments.size(); ++i) {
+        const auto& [instrument, quantity] = instruments[i];
+        const MarketData& md = *asset_md[line_asset[i]];
         
-        if (market_data_map.find(asset_id) == market_data_map.end()) {
-            throw std::runtime_error("Missing market data for asset: " + asset_id);
-        }
+        // One computeAll per line lets numerical models share their base
+        // lattice and bumps across all five outputs.
+        const Greeks line = calculateInstrumentGreeks(instrument, quantity, md);
         
-        const MarketData& md = market_data_map.at(asset_id);
+        result.total_pv += line.price;
+        result.total_delta += line.delta;
+        result.total_gamma += line.gamma;
+        result.total_vega += line.vega;
+        result.total_theta += line.theta;
         
-        if (md.spot_price <= 0.0) {
-            throw std::invalid_argument("Spot price must be positive for " + asset_id);
-        }
-        if (md.volatility < 0.0) {
-            throw std::invalid_argument("Volatility cannot be negative for " + asset_id);
-        }
-        if (std::isnan(md.spot_price) || std::isinf(md.spot_price)) {
-            throw std::invalid_argument("Invalid spot price for " + asset_id);
-        }
-        if (std::isnan(md.risk_free_rate) || std::isinf(md.risk_free_rate)) {
-            throw std::invalid_argument("Invalid risk-free rate for " + asset_id);
-        }
-        if (std::isnan(md.volatility) || std::isinf(md.volatility)) {
-            throw std::invalid_argument("Invalid volatility for " + asset_id);
-        }
+        sensitivities.delta.push_back(line.delta);
+        sensitivities.gamma.push_back(line.gamma);
+        sensitivities.vega.push_back(line.vega);
+    }
+    greeks.stop();
+    
+    if (!result.isValid()) {
+        throw std::runtime_error("Portfolio risk calculation produced invalid results");
     }
-}
-
-double RiskEngine::calculateSingleInstrumentMetric(
-    const std::unique_ptr<Instrument>& instrument,
-    int quantity,
-    const MarketData& md,
-    const std::string& metric_name
-) const {
-    double metric_value = 0.0;
     
     try {
-        if (metric_name == "price") {
-            metric_value = instrument->price(md);
-        } else if (metric_name == "delta") {
-            metric_value = instrument->delta(md);
-        } else if (metric_name == "gamma") {
-            metric_value = instrument->gamma(md);
-        } else if (metric_name == "vega") {
-            metric_value = instrument->vega(md);
-        } else if (metric_name == "theta") {
-            metric_value = instrument->theta(md);
-        }
+        RiskMetrics metrics = calculateRiskMetrics(portfolio, asset_md, sensitivities);
+        result.value_at_risk_95 = metrics.var_95;
+        result.value_at_risk_99 = metrics.var_99;
+        result.expected_shortfall_95 = metrics.es_95;
+        result.expected_shortfall_99 = metrics.es_99;
+        result.tail_measures = std::move(metrics.tail_measures);
+    } catch (const RiskRunCancelled&) {
+        throw;
     } catch (const std::exception& e) {
-        throw std::runtime_error(
-            std::string("Failed to calculate ") + metric_name + 
-            " for " + instrument->getAssetId() + ": " + e.what()
-        );
+        throw std::runtime_error(std::string("Risk metrics calculation failed: ") + e.what());
     }
     
-    if (std::isnan(metric_value) || std::isinf(metric_value)) {
-        throw std::runtime_error(
-            "Invalid " + metric_name + " value for " + instrument->getAssetId()
-        );
+    return result;
+}
+
+BatchRiskResult RiskEngine::calculateResolvedBatchRisk(
+    const Portfolio& merged,
+    const std::vector<BookPositions>& books,
+    const AssetMarketData& asset_md
+) {
+    BatchRiskResult result;
+    result.books.resize(books.size());
+    for (PortfolioRiskResult& book : result.books) {
+        book.reset();
     }
+    result.total.reset();
+    result.distinct_lines = merged.size();
+    last_approximation_report_ = VaRApproximationReport();
+    last_contribution_report_ = VaRContributionReport();
+    last_sampling_report_ = VaRSamplingReport();
+    last_sampling_report_.sampling_method = sampling_method_;
+    last_sampling_report_.historical = historical_returns_ != nullptr;
     
-    double result = metric_value * quantity;
+    if (merged.empty()) {
+        return result;
+    }
     
-    if (std::isnan(result) || std::isinf(result)) {
-        throw std::overflow_error(
-            "Overflow in " + metric_name + " calculation for " + instrument->getAssetId()
-        );
+    RunStats::PhaseTimer validation(phaseClock(&RiskRunStats::validation_ms));
+    validateMarketData(merged, asset_md);
+    validation.stop();
+    
+    // Each distinct line is priced once, for one unit; a book's totals
+    // are its quantities times those.
+    const auto& instruments = merged.getInstruments();
+    const std::vector<uint32_t>& line_asset = merged.getColumns().lineAssets();
+    std::vector<Greeks> unit(instruments.size());
+    LineSensitivities unit_sensitivities;
+    RunStats::PhaseTimer greeks(phaseClock(&RiskRunStats::greeks_ms));
+    for (size_t i = 0; i < instruments.size(); ++i) {
+        unit[i] = calculateInstrumentGreeks(instruments[i].first, 1, *asset_md[line_asset[i]]);
+        unit_sensitivities.delta.push_back(unit[i].delta);
+        unit_sensitivities.gamma.push_back(unit[i].gamma);
+        unit_sensitivities.vega.push_back(unit[i].vega);
+    }
+    greeks.stop();
+    
+    auto add_position = [](PortfolioRiskResult& totals, const Greeks& line, int quantity) {
+        totals.total_pv += line.price * quantity;
+        totals.total_delta += line.delta * quantity;
+        totals.total_gamma += line.gamma * quantity;
+        totals.total_vega += line.vega * quantity;
+        totals.total_theta += line.theta * quantity;
+    };
+    for (size_t b = 0; b < books.size(); ++b) {
+        for (const auto& [line, quantity] : books[b]) {
+            add_position(result.books[b], unit[line], quantity);
+            add_position(result.total, unit[line], quantity);
+        }
+        if (!result.books[b].isValid()) {
+            throw std::runtime_error("Portfolio risk calculation produced invalid results");
+        }
+    }
+    
+    auto assign_metrics = [](PortfolioRiskResult& totals, RiskMetrics& metrics) {
+        totals.value_at_risk_95 = metrics.var_95;
+        totals.value_at_risk_99 = metrics.var_99;
+        totals.expected_shortfall_95 = metrics.es_95;
+        totals.expected_shortfall_99 = metrics.es_99;
+        totals.tail_measures = std::move(metrics.tail_measures);
+    };
+    try {
+        std::vector<RiskMetrics> metrics = calculateBatchMetrics(merged, books, asset_md, unit_sensitivities);
+        for (size_t b = 0; b < books.size(); ++b) {
+            assign_metrics(result.books[b], metrics[b]);
+        }
+        assign_metrics(result.total, metrics.back());
+    } catch (const RiskRunCancelled&) {
+        throw;
+    } catch (const std::exception& e) {
+        throw std::runtime_error(std::string("Risk metrics calculation failed: ") + e.what());
     }
     
     return result;
 }
 
-PortfolioRiskResult RiskEngine::calculatePortfolioRisk(
-    const Portfolio& portfolio, 
-    const std::map<std::string, MarketData>& market_data_map
+PortfolioRiskResult RiskEngine::calculateIncrementalRisk(
+    const Portfolio& portfolio,
+    const AssetMarketData& asset_md,
+    const std::vector<uint64_t>& versions,
+    RiskRunCache& cache
 ) {
-    validateParameters();
-    
     PortfolioRiskResult result;
     result.reset();
+    last_approximation_report_ = VaRApproximationReport();
+    last_contribution_report_ = VaRContributionReport();
+    last_sampling_report_ = VaRSamplingReport();
+    last_sampling_report_.sampling_method = sampling_method_;
+    last_sampling_report_.historical = historical_returns_ != nullptr;
     
     if (portfolio.empty()) {
+        cache.clear();
         return result;
     }
     
-    validateMarketData(portfolio, market_data_map);
+    RunStats::PhaseTimer validation(phaseClock(&RiskRunStats::validation_ms));
+    validateMarketData(portfolio, asset_md);
+    validation.stop();
     
     const auto& instruments = portfolio.getInstruments();
+    const std::vector<uint32_t>& line_asset = portfolio.getColumns().lineAssets();
+    const size_t num_assets = asset_md.size();
+    const size_t num_lines = instruments.size();
+    const size_t num_paths = scenarioCount();
+    const bool control_variate = use_control_variate_ && !historical_returns_;
+    const bool approximate = var_method_ != VaRMethod::FullRevaluation;
+    const size_t validation_paths = approximate
+        ? std::min(num_paths, static_cast<size_t>(approximation_check_paths_))
+        : 0;
     
-    for (const auto& [instrument, quantity] : instruments) {
-        std::string asset_id = instrument->getAssetId();
-        const MarketData& md = market_data_map.at(asset_id);
+    const bool reusable = cache.valid_ &&
+        cache.portfolio_revision_ == portfolio.structureRevision() &&
+        cache.line_quantity_.size() == num_lines &&
+        cache.asset_version_.size() == num_assets &&
+        cache.simulations_ == var_simulations_ &&
+        cache.time_horizon_days_ == time_horizon_days_ &&
+        cache.fixed_seed_ == use_fixed_seed_ &&
+        (!use_fixed_seed_ || cache.run_seed_ == random_seed_) &&
+        cache.var_method_ == var_method_ &&
+        cache.vol_of_vol_ == vol_of_vol_ &&
+        cache.vol_surface_dynamics_ == vol_surface_dynamics_ &&
+        cache.validation_paths_ == validation_paths &&
+        cache.sampling_method_ == sampling_method_ &&
+        cache.control_variate_ == control_variate &&
+        cache.correlation_model_ == correlation_model_ &&
+        cache.historical_returns_ == historical_returns_ &&
+        cache.historical_lookback_days_ == historical_lookback_days_;
+    
+    if (!reusable) {
+        uint64_t run_seed = random_seed_;
+        if (!use_fixed_seed_) {
+            std::random_device rd;
+            run_seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+        }
         
-        result.total_pv += calculateSingleInstrumentMetric(instrument, quantity, md, "price");
-        result.total_delta += calculateSingleInstrumentMetric(instrument, quantity, md, "delta");
-        result.total_gamma += calculateSingleInstrumentMetric(instrument, quantity, md, "gamma");
-        result.total_vega += calculateSingleInstrumentMetric(instrument, quantity, md, "vega");
-        result.total_theta += calculateSingleInstrumentMetric(instrument, quantity, md, "theta");
+        cache.clear();
+        cache.portfolio_revision_ = portfolio.structureRevision();
+        cache.simulations_ = var_simulations_;
+        cache.time_horizon_days_ = time_horizon_days_;
+        cache.fixed_seed_ = use_fixed_seed_;
+        cache.run_seed_ = run_seed;
+        cache.var_method_ = var_method_;
+        cache.vol_of_vol_ = vol_of_vol_;
+        cache.vol_surface_dynamics_ = vol_surface_dynamics_;
+        cache.validation_paths_ = validation_paths;
+        cache.sampling_method_ = sampling_method_;
+        cache.control_variate_ = control_variate;
+        cache.correlation_model_ = correlation_model_;
+        cache.historical_returns_ = historical_returns_;
+        cache.historical_lookback_days_ = historical_lookback_days_;
+        cache.scenarios_ = num_paths;
+        cache.line_quantity_.assign(num_lines, 0);
+        // No snapshot hands out version 0, so every asset starts stale.
+        cache.asset_version_.assign(num_assets, 0);
+        cache.asset_surface_revision_.assign(num_assets, 0);
+        cache.asset_greeks_.assign(num_assets, Greeks());
+        cache.asset_base_value_.assign(num_assets, 0.0);
+        cache.asset_pnl_.assign(num_assets, std::vector<double>());
+        cache.asset_validation_pnl_.assign(num_assets, std::vector<double>());
+        cache.asset_control_scale_.assign(num_assets, 0.0);
+        cache.asset_control_.assign(num_assets, std::vector<double>());
+    }
+    
+    // A surface shared with the caller can change without a new version.
+    std::vector<uint64_t> surface_revisions(num_assets, 0);
+    std::vector<uint8_t> stale(num_assets, 0);
+    for (size_t a = 0; a < num_assets; ++a) {
+        if (asset_md[a]->vol_surface) {
+            surface_revisions[a] = asset_md[a]->vol_surface->revision();
+        }
+        stale[a] = versions[a] != cache.asset_version_[a] ||
+                   surface_revisions[a] != cache.asset_surface_revision_[a];
+    }
+    for (size_t line = 0; line < num_lines; ++line) {
+        if (instruments[line].second != cache.line_quantity_[line]) {
+            stale[line_asset[line]] = 1;
+        }
+    }
+    
+    cache.last_repriced_assets_ = static_cast<size_t>(std::count(stale.begin(), stale.end(), 1));
+    if (cache.last_repriced_assets_ > 0) {
+        RunStats::PhaseTimer simulation(phaseClock(&RiskRunStats::simulation_ms));
+        refreshCachedAssets(portfolio, asset_md, stale, cache);
+    }
+    
+    for (size_t line = 0; line < num_lines; ++line) {
+        cache.line_quantity_[line] = instruments[line].second;
+    }
+    cache.asset_version_ = versions;
+    cache.asset_surface_revision_ = std::move(surface_revisions);
+    cache.valid_ = true;
+    
+    // Recombine in asset order, so the result only depends on the current
+    // inputs and not on which assets happened to be refreshed.
+    double initial_portfolio_value = 0.0;
+    for (size_t a = 0; a < num_assets; ++a) {
+        const Greeks& asset = cache.asset_greeks_[a];
+        result.total_pv += asset.price;
+        result.total_delta += asset.delta;
+        result.total_gamma += asset.gamma;
+        result.total_vega += asset.vega;
+        result.total_theta += asset.theta;
+        initial_portfolio_value += cache.asset_base_value_[a];
     }
     
     if (!result.isValid()) {
         throw std::runtime_error("Portfolio risk calculation produced invalid results");
     }
     
+    if (std::abs(initial_portfolio_value) < 1e-10) {
+        return result;  // Zero risk metrics, as for a worthless portfolio
+    }
+    
+    RunStats::PhaseTimer tail(phaseClock(&RiskRunStats::tail_ms));
+    last_run_stats_.paths = num_paths;
+    std::vector<double> pnl_distribution(num_paths, 0.0);
+    std::vector<double> validation_full_pnl(validation_paths, 0.0);
+    for (size_t a = 0; a < num_assets; ++a) {
+        const std::vector<double>& asset_pnl = cache.asset_pnl_[a];
+        for (size_t p = 0; p < num_paths; ++p) {
+            pnl_distribution[p] += asset_pnl[p];
+        }
+        const std::vector<double>& asset_validation = cache.asset_validation_pnl_[a];
+        for (size_t p = 0; p < validation_paths; ++p) {
+            validation_full_pnl[p] += asset_validation[p];
+        }
+    }
+    
+    if (validation_paths > 0) {
+        last_approximation_report_ = buildApproximationReport(
+            std::vector<double>(pnl_distribution.begin(), pnl_distribution.begin() + validation_paths),
+            std::move(validation_full_pnl)
+        );
+    }
+    
+    if (pnl_sink_) {
+        streamCachedPnL(portfolio.getColumns(), cache, pnl_distribution);
+    }
+    
+    std::vector<double> control;
+    const double control_sd = controlStandardDeviation(
+        cache.asset_control_scale_, shockFactor(portfolio.getColumns()).get());
+    const bool use_control = cache.control_variate_ && control_sd > 0.0 && std::isfinite(control_sd);
+    if (use_control) {
+        control.assign(num_paths, 0.0);
+        for (size_t a = 0; a < num_assets; ++a) {
+            const std::vector<double>& asset_control = cache.asset_control_[a];
+            for (size_t p = 0; p < num_paths; ++p) {
+                control[p] += asset_control[p];
+            }
+        }
+    }
+    
+    RiskMetrics metrics = tailMetrics(
+        pnl_distribution, confidence_levels_,
+        historical_returns_ ? std::vector<size_t>{0, num_paths} : samplingBatches(num_paths),
+        use_control ? control.data() : nullptr, control_sd, last_sampling_report_);
+    result.value_at_risk_95 = metrics.var_95;
+    result.value_at_risk_99 = metrics.var_99;
+    result.expected_shortfall_95 = metrics.es_95;
+    result.expected_shortfall_99 = metrics.es_99;
+    result.tail_measures = std::move(metrics.tail_measures);
+    
+    return result;
+}
+
+void RiskEngine::refreshCachedAssets(
+    const Portfolio& portfolio,
+    const AssetMarketData& asset_md,
+    const std::vector<uint8_t>& selected,
+    RiskRunCache& cache
+) {
+    const auto& instruments = portfolio.getInstruments();
+    const PortfolioColumns& columns = portfolio.getColumns();
+    const std::vector<uint32_t>& line_asset = columns.lineAssets();
+    const size_t num_assets = asset_md.size();
+    const size_t num_lines = instruments.size();
+    const size_t num_paths = cache.scenarios_;
+    const size_t validation_paths = cache.validation_paths_;
+    const bool approximate = var_method_ != VaRMethod::FullRevaluation;
+    const bool use_vega = var_method_ == VaRMethod::DeltaGammaVega;
+    
+    std::vector<uint32_t> refreshed;
+    for (uint32_t a = 0; a < num_assets; ++a) {
+        if (selected[a]) {
+            refreshed.push_back(a);
+        }
+    }
+    
+    std::vector<MarketData> base_md;
+    std::vector<double> base_spot(num_assets);
+    std::vector<double> base_vol(num_assets);
+    std::vector<double> asset_rate(num_assets);
+    base_md.reserve(num_assets);
+    for (size_t a = 0; a < num_assets; ++a) {
+        base_md.push_back(*asset_md[a]);
+        base_spot[a] = asset_md[a]->spot_price;
+        base_vol[a] = asset_md[a]->volatility;
+        asset_rate[a] = asset_md[a]->risk_free_rate;
+    }
+    
+    const LineVols line_vols = resolveLineVols(
+        columns, asset_md, vol_surface_dynamics_, selected.data());
+    
+    // Greeks of the refreshed assets, summed per asset as the Taylor modes
+    // need them.
+    std::vector<double> line_vol(num_lines, 0.0);
+    for (size_t line = 0; line < num_lines; ++line) {
+        line_vol[line] = base_vol[line_asset[line]];
+    }
+    const std::vector<InstrumentGroup>& groups = columns.groups();
+    for (size_t g = 0; g < groups.size(); ++g) {
+        for (size_t k = 0; k < groups[g].size(); ++k) {
+            if (selected[groups[g].asset[k]]) {
+                line_vol[groups[g].line[k]] = line_vols.vol[g][k];
+            }
+        }
+    }
+    
+    std::vector<double> asset_vol_vega(num_assets, 0.0);  // sum of vega * line vol
+    for (uint32_t a : refreshed) {
+        cache.asset_greeks_[a] = Greeks();
+    }
+    for (size_t line = 0; line < num_lines; ++line) {
+        const uint32_t asset = line_asset[line];
+        if (!selected[asset]) {
+            continue;
+        }
+        const auto& [instrument, quantity] = instruments[line];
+        const Greeks greeks = calculateInstrumentGreeks(instrument, quantity, *asset_md[asset]);
+        
+        Greeks& total = cache.asset_greeks_[asset];
+        total.price += greeks.price;
+        total.delta += greeks.delta;
+        total.gamma += greeks.gamma;
+        total.vega += greeks.vega;
+        total.theta += greeks.theta;
+        asset_vol_vega[asset] += greeks.vega * line_vol[line];
+    }
+    
     try {
-        RiskMetrics metrics = calculateRiskMetrics(portfolio, market_data_map);
-        result.value_at_risk_95 = metrics.var_95;
-        result.value_at_risk_99 = metrics.var_99;
-        result.expected_shortfall_95 = metrics.es_95;
-        result.expected_shortfall_99 = metrics.es_99;
+        const MertonLines merton = prepareMertonLines(
+            columns, line_vols, asset_rate.data(), selected.data());
+        const ScenarioModel model{
+            columns, instruments, line_vols, merton,
+            base_spot.data(), base_vol.data(), asset_rate.data()
+        };
+        const std::vector<double> unit_factors(num_assets, 1.0);
+        const AssetSplit base_split{selected.data(), cache.asset_base_value_.data()};
+        
+        for (uint32_t a : refreshed) {
+            cache.asset_base_value_[a] = 0.0;
+            cache.asset_pnl_[a].assign(num_paths, 0.0);
+            cache.asset_validation_pnl_[a].assign(validation_paths, 0.0);
+            cache.asset_control_[a].assign(cache.control_variate_ ? num_paths : 0, 0.0);
+        }
+        
+        GroupScratch base_scratch(&run_arenas_.caller());
+        portfolioValue(model, base_spot.data(), unit_factors.data(), base_md, base_scratch,
+                       &base_split, pricing_cache_.get());
+        for (uint32_t a : refreshed) {
+            if (std::isnan(cache.asset_base_value_[a]) || std::isinf(cache.asset_base_value_[a])) {
+                throw std::runtime_error("Invalid price in risk metrics calculation");
+            }
+        }
+        
+        ScenarioDraws draws = makeScenarioDraws(
+            asset_md, base_spot.data(), time_horizon_days_, vol_of_vol_,
+            shockFactor(columns), selected.data());
+        if (cache.historical_returns_) {
+            const size_t horizon = static_cast<size_t>(cache.time_horizon_days_);
+            attachHistory(draws, *cache.historical_returns_, columns.assets(),
+                          cache.historical_returns_->dateCount() - (num_paths - 1 + horizon), horizon);
+        }
+        const ScenarioSampler sampler = makeScenarioSampler(
+            cache.sampling_method_, cache.run_seed_, num_paths, draws);
+        for (uint32_t a : refreshed) {
+            cache.asset_control_scale_[a] = cache.control_variate_
+                ? cache.asset_greeks_[a].delta * base_spot[a] * draws.diffusion[a]
+                : 0.0;
+        }
+        
+        const size_t num_blocks = (num_paths + kPathsPerBlock - 1) / kPathsPerBlock;
+        const size_t num_workers = std::min(
+            num_blocks, static_cast<size_t>(Parallel::resolveThreadCount(num_threads_))
+        );
+        std::vector<std::vector<MarketData>> worker_market_data(num_workers, base_md);
+        std::vector<GroupScratch> worker_scratch = perWorker<GroupScratch>(run_arenas_, num_workers);
+        std::vector<ScenarioBlock> worker_blocks = perWorker<ScenarioBlock>(run_arenas_, num_workers);
+        std::vector<std::pmr::vector<double>> worker_values = workerBuffers(
+            run_arenas_, num_workers, num_assets);
+        WorkerCounters worker_counters(num_workers);
+        
+        // The same blocks and streams as calculateRiskMetrics, seeded with
+        // the cached run seed, so every asset's P&L is on common scenarios.
+        auto simulate_block = [&](size_t block, int worker) {
+            if (run_control_) {
+                run_control_->checkpoint();
+            }
+            RunStats::Scope counting(worker_counters.at(worker));
+            const size_t begin = block * kPathsPerBlock;
+            const size_t end = std::min(num_paths, begin + kPathsPerBlock);
+            const size_t block_paths = end - begin;
+            
+            ScenarioBlock& scenario = worker_blocks[worker];
+            drawScenarios(draws, sampler, block, block_paths, selected.data(), scenario);
+            const std::pmr::vector<double>& spots = scenario.spots;
+            const std::pmr::vector<double>& vols = scenario.vols;
+            const std::pmr::vector<double>& shocks = scenario.shocks;
+            if (cache.control_variate_) {
+                for (size_t p = 0; p < block_paths; ++p) {
+                    for (uint32_t a : refreshed) {
+                        cache.asset_control_[a][begin + p] =
+                            cache.asset_control_scale_[a] * shocks[p * num_assets + a];
+                    }
+                }
+            }
+            
+            std::vector<MarketData>& scenario_md = worker_market_data[worker];
+            GroupScratch& scratch = worker_scratch[worker];
+            std::pmr::vector<double>& values = worker_values[worker];
+            
+            auto full_revaluation_pnl = [&](size_t p, std::vector<std::vector<double>>& out, size_t path) {
+                const double* row = &spots[p * num_assets];
+                const double* vol_row = draws.shock_volatility ? &vols[p * num_assets] : unit_factors.data();
+                for (uint32_t a : refreshed) {
+                    values[a] = 0.0;
+                }
+                const AssetSplit split{selected.data(), values.data()};
+                portfolioValue(model, row, vol_row, scenario_md, scratch, &split);
+                
+                for (uint32_t a : refreshed) {
+                    if (std::isnan(values[a]) || std::isinf(values[a])) {
+                        throw std::runtime_error("Invalid simulated portfolio value");
+                    }
+                    out[a][path] = values[a] - cache.asset_base_value_[a];
+                }
+            };
+            
+            for (size_t p = 0; p < block_paths; ++p) {
+                const size_t path = begin + p;
+                
+                if (!approximate) {
+                    full_revaluation_pnl(p, cache.asset_pnl_, path);
+                    continue;
+                }
+                
+                const double* row = &spots[p * num_assets];
+                for (uint32_t a : refreshed) {
+                    const Greeks& asset = cache.asset_greeks_[a];
+                    const double dS = row[a] - base_spot[a];
+                    double pnl = asset.delta * dS + 0.5 * asset.gamma * dS * dS;
+                    if (use_vega && draws.shock_volatility) {
+                        pnl += asset_vol_vega[a] * (vols[p * num_assets + a] - 1.0);
+                    }
+                    cache.asset_pnl_[a][path] = pnl;
+                }
+                if (path < validation_paths) {
+                    full_revaluation_pnl(p, cache.asset_validation_pnl_, path);
+                }
+            }
+            if (run_control_) {
+                run_control_->addPaths(block_paths);
+            }
+        };
+        
+        if (run_control_) {
+            run_control_->begin(num_paths);
+        }
+        Parallel::forEachBlock(num_blocks, static_cast<int>(num_workers), simulate_block);
+    } catch (const RiskRunCancelled&) {
+        throw;
     } catch (const std::exception& e) {
         throw std::runtime_error(std::string("Risk metrics calculation failed: ") + e.what());
     }
-    
-    return result;
 }
 
 RiskMetrics RiskEngine::calculateRiskMetrics(
     const Portfolio& portfolio, 
-    const std::map<std::string, MarketData>& market_data_map
+    const AssetMarketData& asset_md,
+    const LineSensitivities& sensitivities
 ) {
     RiskMetrics metrics;
+    RunStats::PhaseTimer base_value(phaseClock(&RiskRunStats::base_value_ms));
     
-    // Calculate initial portfolio value
-    double initial_portfolio_value = 0.0;
     const auto& instruments = portfolio.getInstruments();
+    const PortfolioColumns& columns = portfolio.getColumns();
+    const size_t num_assets = asset_md.size();
+    const size_t num_lines = instruments.size();
     
-    for (const auto& [instrument, quantity] : instruments) {
-        const MarketData& md = market_data_map.at(instrument->getAssetId());
-        double price = instrument->price(md);
-        
-        if (std::isnan(price) || std::isinf(price)) {
-            throw std::runtime_error("Invalid price in risk metrics calculation");
-        }
-        
-        initial_portfolio_value += price * quantity;
+    std::vector<MarketData> base_md;
+    std::vector<double> base_spot(num_assets);
+    std::vector<double> base_vol(num_assets);
+    std::vector<double> asset_rate(num_assets);
+    base_md.reserve(num_assets);
+    for (size_t a = 0; a < num_assets; ++a) {
+        base_md.push_back(*asset_md[a]);
+        base_spot[a] = asset_md[a]->spot_price;
+        base_vol[a] = asset_md[a]->volatility;
+        asset_rate[a] = asset_md[a]->risk_free_rate;
+    }
+    
+    const LineVols line_vols = resolveLineVols(columns, asset_md, vol_surface_dynamics_);
+    const MertonLines merton = prepareMertonLines(columns, line_vols, asset_rate.data());
+    const ScenarioModel model{
+        columns, instruments, line_vols, merton,
+        base_spot.data(), base_vol.data(), asset_rate.data()
+    };
+    const std::vector<double> unit_factors(num_assets, 1.0);
+    
+    // A sink that wants the asset breakdown gets today's value per asset
+    // from the same pass, and the risk contributions today's value per line.
+    const bool breakdown = pnl_sink_ && pnl_sink_->wantsAssetBreakdown();
+    const bool split_lines = compute_contributions_;
+    const bool split = breakdown || split_lines;
+    const std::vector<uint8_t> all_assets(split ? num_assets : 0, 1);
+    std::vector<double> base_asset_value(split ? num_assets : 0, 0.0);
+    std::vector<double> base_line_value(split_lines ? num_lines : 0, 0.0);
+    const AssetSplit base_split{
+        all_assets.data(), base_asset_value.data(), split_lines ? base_line_value.data() : nullptr
+    };
+    
+    // Today's value goes through the same pricers as the scenarios, so an
+    // unchanged market gives exactly zero P&L.
+    GroupScratch base_scratch(&run_arenas_.caller());
+    const double initial_portfolio_value = portfolioValue(
+        model, base_spot.data(), unit_factors.data(), base_md, base_scratch,
+        split ? &base_split : nullptr, pricing_cache_.get());
+    
+    if (std::isnan(initial_portfolio_value) || std::isinf(initial_portfolio_value)) {
+        throw std::runtime_error("Invalid price in risk metrics calculation");
     }
     
     if (std::abs(initial_portfolio_value) < 1e-10) {
@@ -229,99 +2406,528 @@ RiskMetrics RiskEngine::calculateRiskMetrics(
     }
     
     // Run Monte Carlo simulations
-    std::vector<double> pnl_distribution;
-    pnl_distribution.reserve(var_simulations_);
-    
-    std::mt19937 generator;
-    if (use_fixed_seed_) {
-        generator.seed(random_seed_);
-    } else {
+    uint64_t run_seed = random_seed_;
+    if (!use_fixed_seed_) {
         std::random_device rd;
-        generator.seed(rd());
+        run_seed = (static_cast<uint64_t>(rd()) << 32) | rd();
     }
     
-    std::normal_distribution<double> distribution(0.0, 1.0);
-    const double dt = time_horizon_days_ / 252.0;
-    const double sqrt_dt = std::sqrt(dt);
+    const size_t num_paths = scenarioCount();
+    const size_t num_blocks = (num_paths + kPathsPerBlock - 1) / kPathsPerBlock;
+    last_run_stats_.paths = num_paths;
+    
+    const std::vector<uint32_t>& line_asset = columns.lineAssets();
+    
+    ScenarioDraws draws = makeScenarioDraws(
+        asset_md, base_spot.data(), time_horizon_days_, vol_of_vol_, shockFactor(columns));
+    if (historical_returns_) {
+        const size_t horizon = static_cast<size_t>(time_horizon_days_);
+        attachHistory(draws, *historical_returns_, columns.assets(),
+                      historical_returns_->dateCount() - (num_paths - 1 + horizon), horizon);
+    }
+    const bool use_control_variate = use_control_variate_ && !historical_returns_;
+    const bool shock_volatility = draws.shock_volatility;
+    const ScenarioSampler sampler = makeScenarioSampler(sampling_method_, run_seed, num_paths, draws);
+    
+    // The Taylor modes collapse line Greeks into one delta/gamma/vega per
+    // asset, so a path costs O(assets) regardless of the pricing model.
+    // The control variate needs the per-asset deltas too, and the risk
+    // contributions of a Taylor run expand each line on its own.
+    const bool approximate = var_method_ != VaRMethod::FullRevaluation;
+    const bool use_vega = var_method_ == VaRMethod::DeltaGammaVega;
+    const bool line_taylor = approximate && split_lines;
+    std::vector<double> asset_delta(num_assets, 0.0);
+    std::vector<double> asset_gamma(num_assets, 0.0);
+    std::vector<double> asset_vol_vega(num_assets, 0.0);  // sum of vega * line vol
+    std::vector<double> line_vol_vega(line_taylor ? num_lines : 0, 0.0);
+    if (approximate || use_control_variate) {
+        if (sensitivities.delta.size() != num_lines ||
+            sensitivities.gamma.size() != num_lines ||
+            sensitivities.vega.size() != num_lines) {
+            throw std::runtime_error("Approximate VaR requires Greeks for every portfolio line");
+        }
+        std::vector<double> line_vol(num_lines);
+        for (size_t line = 0; line < num_lines; ++line) {
+            line_vol[line] = base_vol[line_asset[line]];
+        }
+        const std::vector<InstrumentGroup>& groups = columns.groups();
+        for (size_t g = 0; g < groups.size(); ++g) {
+            for (size_t k = 0; k < groups[g].size(); ++k) {
+                line_vol[groups[g].line[k]] = line_vols.vol[g][k];
+            }
+        }
+        
+        for (size_t line = 0; line < num_lines; ++line) {
+            const size_t asset = line_asset[line];
+            asset_delta[asset] += sensitivities.delta[line];
+            asset_gamma[asset] += sensitivities.gamma[line];
+            asset_vol_vega[asset] += sensitivities.vega[line] * line_vol[line];
+            if (line_taylor) {
+                line_vol_vega[line] = sensitivities.vega[line] * line_vol[line];
+            }
+        }
+    }
+    
+    std::vector<double> control_scale(num_assets, 0.0);
+    if (use_control_variate) {
+        for (size_t a = 0; a < num_assets; ++a) {
+            control_scale[a] = asset_delta[a] * base_spot[a] * draws.diffusion[a];
+        }
+    }
+    const double control_sd = controlStandardDeviation(control_scale, draws.correlation.get());
+    const bool use_control = use_control_variate && control_sd > 0.0 && std::isfinite(control_sd);
+    std::vector<double> control(use_control ? num_paths : 0);
+    
+    // The control variate reweights the whole distribution, so only then
+    // is every path's P&L kept; otherwise each block's P&L is folded into
+    // the tails (and handed to the sink) as soon as it is done.
+    std::vector<double> pnl_distribution(use_control ? num_paths : 0);
+    std::unique_ptr<StreamingTails> tails;
+    if (!use_control) {
+        tails = std::make_unique<StreamingTails>(confidence_levels_, sampler.batch_begin);
+    }
+    std::unique_ptr<ContributionTails> contributions;
+    if (split_lines) {
+        contributions = std::make_unique<ContributionTails>(tailLevels(confidence_levels_), num_paths, num_lines);
+    }
+    std::mutex chunk_mutex;  // guards tails, contributions and the sink
+    
+    // In the Taylor modes the first validation paths are also fully
+    // revalued, on the same scenarios, to measure the approximation error.
+    const size_t validation_paths = approximate
+        ? std::min(num_paths, static_cast<size_t>(approximation_check_paths_))
+        : 0;
+    std::vector<double> validation_full_pnl(validation_paths);
+    std::vector<double> validation_approx_pnl(validation_paths);
+    
+    std::vector<std::string> asset_ids;
+    if (pnl_sink_) {
+        for (uint32_t a = 0; a < num_assets; ++a) {
+            asset_ids.push_back(columns.assets().symbol(a));
+        }
+    }
+    SinkRun sink(pnl_sink_.get(), num_paths, asset_ids);
+    
+    // Each worker has its own gather buffers and its own copy of the
+    // per-asset market data for lines priced through the virtual
+    // interface, so nothing is allocated or copied per path.
+    const size_t num_workers = std::min(
+        num_blocks, static_cast<size_t>(Parallel::resolveThreadCount(num_threads_))
+    );
+    std::vector<std::vector<MarketData>> worker_market_data(num_workers, base_md);
+    std::vector<GroupScratch> worker_scratch = perWorker<GroupScratch>(run_arenas_, num_workers);
+    std::vector<ScenarioBlock> worker_blocks = perWorker<ScenarioBlock>(run_arenas_, num_workers);
+    std::vector<std::pmr::vector<double>> worker_pnl = workerBuffers(
+        run_arenas_, num_workers, kPathsPerBlock);
+    std::vector<std::pmr::vector<double>> worker_asset_pnl = workerBuffers(
+        run_arenas_, num_workers, breakdown ? kPathsPerBlock * num_assets : 0);
+    std::vector<std::pmr::vector<double>> worker_line_pnl = workerBuffers(
+        run_arenas_, num_workers, split_lines ? kPathsPerBlock * num_lines : 0);
+    std::vector<std::pmr::vector<double>> worker_values = workerBuffers(
+        run_arenas_, num_workers, split ? num_assets : 0);
+    std::vector<std::pmr::vector<double>> worker_line_values = workerBuffers(
+        run_arenas_, num_workers, split_lines ? num_lines : 0);
+    WorkerCounters worker_counters(num_workers);
     
-    for (int i = 0; i < var_simulations_; ++i) {
-        double simulated_portfolio_value = 0.0;
+    // Each block's P&L is computed into its worker's buffers and only then
+    // handed on under the lock, so workers never wait on each other while
+    // pricing.
+    auto simulate_block = [&](size_t block, int worker) {
+        if (run_control_) {
+            run_control_->checkpoint();
+        }
+        RunStats::Scope counting(worker_counters.at(worker));
+        const size_t begin = block * kPathsPerBlock;
+        const size_t end = std::min(num_paths, begin + kPathsPerBlock);
+        const size_t block_paths = end - begin;
+        
+        ScenarioBlock& scenario = worker_blocks[worker];
+        drawScenarios(draws, sampler, block, block_paths, nullptr, scenario);
+        const std::pmr::vector<double>& spots = scenario.spots;
+        const std::pmr::vector<double>& vols = scenario.vols;
+        const std::pmr::vector<double>& shocks = scenario.shocks;
+        if (use_control) {
+            for (size_t p = 0; p < block_paths; ++p) {
+                double value = 0.0;
+                for (size_t a = 0; a < num_assets; ++a) {
+                    value += control_scale[a] * shocks[p * num_assets + a];
+                }
+                control[begin + p] = value;
+            }
+        }
         
-        for (const auto& [instrument, quantity] : instruments) {
-            const std::string& asset_id = instrument->getAssetId();
-            const MarketData& md = market_data_map.at(asset_id);
+        std::vector<MarketData>& scenario_md = worker_market_data[worker];
+        GroupScratch& scratch = worker_scratch[worker];
+        std::pmr::vector<double>& values = worker_values[worker];
+        double* block_pnl = worker_pnl[worker].data();
+        std::pmr::vector<double>& line_values = worker_line_values[worker];
+        double* block_asset_pnl = breakdown ? worker_asset_pnl[worker].data() : nullptr;
+        double* block_line_pnl = split_lines ? worker_line_pnl[worker].data() : nullptr;
+        
+        // asset_pnl and line_pnl, when given, receive each asset's and
+        // each line's share.
+        auto full_revaluation_pnl = [&](size_t p, double* asset_pnl, double* line_pnl) {
+            const double* row = &spots[p * num_assets];
+            const double* vol_row = shock_volatility ? &vols[p * num_assets] : unit_factors.data();
+            
+            double simulated_portfolio_value = 0.0;
+            if (asset_pnl || line_pnl) {
+                std::fill(values.begin(), values.end(), 0.0);
+                const AssetSplit path_split{all_assets.data(), values.data(), line_pnl ? line_values.data() : nullptr};
+                simulated_portfolio_value = portfolioValue(model, row, vol_row, scenario_md, scratch, &path_split);
+                if (asset_pnl) {
+                    for (size_t a = 0; a < num_assets; ++a) {
+                        asset_pnl[a] = values[a] - base_asset_value[a];
+                    }
+                }
+                if (line_pnl) {
+                    for (size_t line = 0; line < num_lines; ++line) {
+                        line_pnl[line] = line_values[line] - base_line_value[line];
+                    }
+                }
+            } else {
+                simulated_portfolio_value = portfolioValue(model, row, vol_row, scenario_md, scratch);
+            }
+            
+            if (std::isnan(simulated_portfolio_value) || std::isinf(simulated_portfolio_value)) {
+                throw std::runtime_error("Invalid simulated portfolio value");
+            }
             
-            const double random_shock = distribution(generator);
-            const double drift = (md.risk_free_rate - 0.5 * md.volatility * md.volatility) * dt;
-            const double diffusion = md.volatility * sqrt_dt * random_shock;
-            const double simulated_spot = md.spot_price * std::exp(drift + diffusion);
+            return simulated_portfolio_value - initial_portfolio_value;
+        };
+        
+        auto taylor_pnl = [&](size_t p, double* asset_pnl, double* line_pnl) {
+            const double* row = &spots[p * num_assets];
+            double pnl = 0.0;
             
-            if (std::isnan(simulated_spot) || std::isinf(simulated_spot) || simulated_spot <= 0.0) {
-                throw std::runtime_error("Invalid simulated spot price in risk metrics calculation");
+            if (line_pnl) {
+                for (size_t line = 0; line < num_lines; ++line) {
+                    const size_t a = line_asset[line];
+                    const double dS = row[a] - base_spot[a];
+                    double move = sensitivities.delta[line] * dS + 0.5 * sensitivities.gamma[line] * dS * dS;
+                    if (use_vega && shock_volatility) {
+                        move += line_vol_vega[line] * (vols[p * num_assets + a] - 1.0);
+                    }
+                    line_pnl[line] = move;
+                }
             }
             
-            MarketData simulated_md = md;
-            simulated_md.spot_price = simulated_spot;
+            for (size_t a = 0; a < num_assets; ++a) {
+                const double dS = row[a] - base_spot[a];
+                double move = asset_delta[a] * dS + 0.5 * asset_gamma[a] * dS * dS;
+                if (use_vega && shock_volatility) {
+                    move += asset_vol_vega[a] * (vols[p * num_assets + a] - 1.0);
+                }
+                if (asset_pnl) {
+                    asset_pnl[a] = move;
+                }
+                pnl += move;
+            }
             
-            double simulated_price = instrument->price(simulated_md);
+            return pnl;
+        };
+        
+        // Revaluation stage: reprice every line against its asset's column,
+        // or expand around today's Greeks in the approximate modes.
+        for (size_t p = 0; p < block_paths; ++p) {
+            const size_t path = begin + p;
+            double* asset_pnl = breakdown ? block_asset_pnl + p * num_assets : nullptr;
+            double* line_pnl = split_lines ? block_line_pnl + p * num_lines : nullptr;
             
-            if (std::isnan(simulated_price) || std::isinf(simulated_price)) {
-                throw std::runtime_error("Invalid simulated price in risk metrics calculation");
+            if (!approximate) {
+                block_pnl[p] = full_revaluation_pnl(p, asset_pnl, line_pnl);
+                continue;
             }
             
-            simulated_portfolio_value += simulated_price * quantity;
+            block_pnl[p] = taylor_pnl(p, asset_pnl, line_pnl);
+            if (path < validation_paths) {
+                validation_approx_pnl[path] = block_pnl[p];
+                validation_full_pnl[path] = full_revaluation_pnl(p, nullptr, nullptr);
+            }
         }
         
-        if (std::isnan(simulated_portfolio_value) || std::isinf(simulated_portfolio_value)) {
-            throw std::runtime_error("Invalid simulated portfolio value");
+        if (use_control) {
+            std::copy(block_pnl, block_pnl + block_paths, pnl_distribution.begin() + begin);
         }
-        
-        pnl_distribution.push_back(simulated_portfolio_value - initial_portfolio_value);
+        if (tails || contributions || pnl_sink_) {
+            std::lock_guard<std::mutex> lock(chunk_mutex);
+            if (tails) {
+                tails->add(begin, block_paths, block_pnl);
+            }
+            if (contributions) {
+                contributions->add(begin, block_paths, block_pnl, block_line_pnl);
+            }
+            if (pnl_sink_) {
+                PnLChunk chunk;
+                chunk.first_path = begin;
+                chunk.paths = block_paths;
+                chunk.pnl = block_pnl;
+                chunk.assets = breakdown ? num_assets : 0;
+                chunk.asset_pnl = block_asset_pnl;
+                pnl_sink_->write(chunk);
+            }
+        }
+        if (run_control_) {
+            run_control_->addPaths(block_paths);
+        }
+    };
+    
+    base_value.stop();
+    RunStats::PhaseTimer simulation(phaseClock(&RiskRunStats::simulation_ms));
+    if (run_control_) {
+        run_control_->begin(num_paths);
+    }
+    Parallel::forEachBlock(num_blocks, static_cast<int>(num_workers), simulate_block);
+    
+    sink.finish();
+    simulation.stop();
+    
+    RunStats::PhaseTimer tail(phaseClock(&RiskRunStats::tail_ms));
+    if (validation_paths > 0) {
+        last_approximation_report_ = buildApproximationReport(
+            std::move(validation_approx_pnl), std::move(validation_full_pnl));
+    }
+    if (contributions) {
+        std::vector<int> quantities(num_lines);
+        for (size_t line = 0; line < num_lines; ++line) {
+            quantities[line] = instruments[line].second;
+        }
+        last_contribution_report_ = contributions->report(quantities);
+    }
+    
+    if (tails) {
+        return tails->metrics(last_sampling_report_);
     }
+    return tailMetrics(
+        pnl_distribution, confidence_levels_, sampler.batch_begin,
+        control.data(), control_sd, last_sampling_report_);
+}
+
+std::vector<RiskMetrics> RiskEngine::calculateBatchMetrics(
+    const Portfolio& merged,
+    const std::vector<BookPositions>& books,
+    const AssetMarketData& asset_md,
+    const LineSensitivities& unit_sensitivities
+) {
+    const size_t num_books = books.size();
+    const size_t firm = num_books;  // index of the firm total
+    std::vector<RiskMetrics> metrics(num_books + 1);
+    RunStats::PhaseTimer base_value(phaseClock(&RiskRunStats::base_value_ms));
     
-    if (pnl_distribution.empty()) {
-        throw std::runtime_error("Risk metrics calculation produced no results");
+    const PortfolioColumns& columns = merged.getColumns();
+    const size_t num_assets = asset_md.size();
+    const size_t num_lines = merged.size();
+    
+    std::vector<MarketData> base_md;
+    std::vector<double> base_spot(num_assets);
+    std::vector<double> base_vol(num_assets);
+    std::vector<double> asset_rate(num_assets);
+    base_md.reserve(num_assets);
+    for (size_t a = 0; a < num_assets; ++a) {
+        base_md.push_back(*asset_md[a]);
+        base_spot[a] = asset_md[a]->spot_price;
+        base_vol[a] = asset_md[a]->volatility;
+        asset_rate[a] = asset_md[a]->risk_free_rate;
     }
     
-    // Sort the P&L distribution (ascending order: worst losses first)
-    std::sort(pnl_distribution.begin(), pnl_distribution.end());
+    const LineVols line_vols = resolveLineVols(columns, asset_md, vol_surface_dynamics_);
+    const MertonLines merton = prepareMertonLines(columns, line_vols, asset_rate.data());
+    const ScenarioModel model{
+        columns, merged.getInstruments(), line_vols, merton,
+        base_spot.data(), base_vol.data(), asset_rate.data()
+    };
+    const std::vector<double> unit_factors(num_assets, 1.0);
+    
+    // Today's value of one unit of every line, through the same pricers
+    // as the scenarios.
+    const std::vector<uint8_t> all_assets(num_assets, 1);
+    std::vector<double> base_asset_value(num_assets, 0.0);
+    std::vector<double> base_line_value(num_lines, 0.0);
+    const AssetSplit base_split{all_assets.data(), base_asset_value.data(), base_line_value.data()};
+    GroupScratch base_scratch(&run_arenas_.caller());
+    const double merged_value = portfolioValue(
+        model, base_spot.data(), unit_factors.data(), base_md, base_scratch,
+        &base_split, pricing_cache_.get());
+    if (std::isnan(merged_value) || std::isinf(merged_value)) {
+        throw std::runtime_error("Invalid price in risk metrics calculation");
+    }
     
-    // Calculate VaR at 95% confidence level
-    const int index_95 = static_cast<int>((1.0 - 0.95) * var_simulations_);
-    if (index_95 < 0 || index_95 >= var_simulations_) {
-        throw std::runtime_error("Invalid VaR 95% index calculation");
+    // A book worth nothing gets zero metrics, as it would from
+    // calculatePortfolioRisk, but its P&L still counts towards the firm.
+    std::vector<uint8_t> measured(num_books + 1, 0);
+    double firm_value = 0.0;
+    for (size_t b = 0; b < num_books; ++b) {
+        double value = 0.0;
+        for (const auto& [line, quantity] : books[b]) {
+            value += base_line_value[line] * quantity;
+        }
+        measured[b] = std::abs(value) >= 1e-10;
+        firm_value += value;
+    }
+    measured[firm] = std::abs(firm_value) >= 1e-10;
+    if (std::none_of(measured.begin(), measured.end(), [](uint8_t m) { return m != 0; })) {
+        return metrics;
     }
-    metrics.var_95 = -pnl_distribution[index_95];
     
-    // Calculate VaR at 99% confidence level
-    const int index_99 = static_cast<int>((1.0 - 0.99) * var_simulations_);
-    if (index_99 < 0 || index_99 >= var_simulations_) {
-        throw std::runtime_error("Invalid VaR 99% index calculation");
+    uint64_t run_seed = random_seed_;
+    if (!use_fixed_seed_) {
+        std::random_device rd;
+        run_seed = (static_cast<uint64_t>(rd()) << 32) | rd();
     }
-    metrics.var_99 = -pnl_distribution[index_99];
     
-    // Calculate Expected Shortfall (CVaR) at 95%
-    // ES is the average of losses beyond VaR
-    double sum_95 = 0.0;
-    int count_95 = 0;
-    for (int i = 0; i <= index_95; ++i) {
-        sum_95 += pnl_distribution[i];
-        count_95++;
+    const size_t num_paths = scenarioCount();
+    const size_t num_blocks = (num_paths + kPathsPerBlock - 1) / kPathsPerBlock;
+    last_run_stats_.paths = num_paths;
+    
+    const std::vector<uint32_t>& line_asset = columns.lineAssets();
+    
+    ScenarioDraws draws = makeScenarioDraws(
+        asset_md, base_spot.data(), time_horizon_days_, vol_of_vol_, shockFactor(columns));
+    if (historical_returns_) {
+        const size_t horizon = static_cast<size_t>(time_horizon_days_);
+        attachHistory(draws, *historical_returns_, columns.assets(),
+                      historical_returns_->dateCount() - (num_paths - 1 + horizon), horizon);
     }
-    if (count_95 > 0) {
-        metrics.es_95 = -sum_95 / count_95;
+    const bool shock_volatility = draws.shock_volatility;
+    const ScenarioSampler sampler = makeScenarioSampler(sampling_method_, run_seed, num_paths, draws);
+    
+    // The Taylor modes expand each unit line around its own Greeks.
+    const bool approximate = var_method_ != VaRMethod::FullRevaluation;
+    const bool use_vega = var_method_ == VaRMethod::DeltaGammaVega;
+    std::vector<double> line_vol_vega(approximate ? num_lines : 0, 0.0);
+    if (approximate) {
+        if (unit_sensitivities.delta.size() != num_lines ||
+            unit_sensitivities.gamma.size() != num_lines ||
+            unit_sensitivities.vega.size() != num_lines) {
+            throw std::runtime_error("Approximate VaR requires Greeks for every portfolio line");
+        }
+        std::vector<double> line_vol(num_lines);
+        for (size_t line = 0; line < num_lines; ++line) {
+            line_vol[line] = base_vol[line_asset[line]];
+        }
+        const std::vector<InstrumentGroup>& groups = columns.groups();
+        for (size_t g = 0; g < groups.size(); ++g) {
+            for (size_t k = 0; k < groups[g].size(); ++k) {
+                line_vol[groups[g].line[k]] = line_vols.vol[g][k];
+            }
+        }
+        for (size_t line = 0; line < num_lines; ++line) {
+            line_vol_vega[line] = unit_sensitivities.vega[line] * line_vol[line];
+        }
     }
     
-    // Calculate Expected Shortfall (CVaR) at 99%
-    double sum_99 = 0.0;
-    int count_99 = 0;
-    for (int i = 0; i <= index_99; ++i) {
-        sum_99 += pnl_distribution[i];
-        count_99++;
+    std::vector<std::unique_ptr<StreamingTails>> tails(num_books + 1);
+    for (size_t b = 0; b <= num_books; ++b) {
+        if (measured[b]) {
+            tails[b] = std::make_unique<StreamingTails>(confidence_levels_, sampler.batch_begin);
+        }
     }
-    if (count_99 > 0) {
-        metrics.es_99 = -sum_99 / count_99;
+    std::mutex chunk_mutex;  // guards tails
+    
+    const size_t num_workers = std::min(
+        num_blocks, static_cast<size_t>(Parallel::resolveThreadCount(num_threads_))
+    );
+    std::vector<std::vector<MarketData>> worker_market_data(num_workers, base_md);
+    std::vector<GroupScratch> worker_scratch = perWorker<GroupScratch>(run_arenas_, num_workers);
+    std::vector<ScenarioBlock> worker_blocks = perWorker<ScenarioBlock>(run_arenas_, num_workers);
+    std::vector<std::pmr::vector<double>> worker_values = workerBuffers(
+        run_arenas_, num_workers, num_assets);
+    std::vector<std::pmr::vector<double>> worker_line_values = workerBuffers(
+        run_arenas_, num_workers, num_lines);
+    std::vector<std::pmr::vector<double>> worker_line_pnl = workerBuffers(
+        run_arenas_, num_workers, num_lines);
+    // [book][path in block], the firm total last
+    std::vector<std::pmr::vector<double>> worker_book_pnl = workerBuffers(
+        run_arenas_, num_workers, (num_books + 1) * kPathsPerBlock);
+    WorkerCounters worker_counters(num_workers);
+    
+    // Every distinct line's unit P&L is computed once per scenario, then
+    // weighted into each book holding it.
+    auto simulate_block = [&](size_t block, int worker) {
+        if (run_control_) {
+            run_control_->checkpoint();
+        }
+        RunStats::Scope counting(worker_counters.at(worker));
+        const size_t begin = block * kPathsPerBlock;
+        const size_t end = std::min(num_paths, begin + kPathsPerBlock);
+        const size_t block_paths = end - begin;
+        
+        ScenarioBlock& scenario = worker_blocks[worker];
+        drawScenarios(draws, sampler, block, block_paths, nullptr, scenario);
+        const std::pmr::vector<double>& spots = scenario.spots;
+        const std::pmr::vector<double>& vols = scenario.vols;
+        
+        std::vector<MarketData>& scenario_md = worker_market_data[worker];
+        GroupScratch& scratch = worker_scratch[worker];
+        std::pmr::vector<double>& values = worker_values[worker];
+        std::pmr::vector<double>& line_values = worker_line_values[worker];
+        double* line_pnl = worker_line_pnl[worker].data();
+        double* book_pnl = worker_book_pnl[worker].data();
+        
+        for (size_t p = 0; p < block_paths; ++p) {
+            const double* row = &spots[p * num_assets];
+            if (!approximate) {
+                const double* vol_row = shock_volatility ? &vols[p * num_assets] : unit_factors.data();
+                std::fill(values.begin(), values.end(), 0.0);
+                const AssetSplit split{all_assets.data(), values.data(), line_values.data()};
+                const double value = portfolioValue(model, row, vol_row, scenario_md, scratch, &split);
+                if (std::isnan(value) || std::isinf(value)) {
+                    throw std::runtime_error("Invalid simulated portfolio value");
+                }
+                for (size_t line = 0; line < num_lines; ++line) {
+                    line_pnl[line] = line_values[line] - base_line_value[line];
+                }
+            } else {
+                for (size_t line = 0; line < num_lines; ++line) {
+                    const size_t a = line_asset[line];
+                    const double dS = row[a] - base_spot[a];
+                    double move = unit_sensitivities.delta[line] * dS +
+                                  0.5 * unit_sensitivities.gamma[line] * dS * dS;
+                    if (use_vega && shock_volatility) {
+                        move += line_vol_vega[line] * (vols[p * num_assets + a] - 1.0);
+                    }
+                    line_pnl[line] = move;
+                }
+            }
+            
+            double firm_pnl = 0.0;
+            for (size_t b = 0; b < num_books; ++b) {
+                double pnl = 0.0;
+                for (const auto& [line, quantity] : books[b]) {
+                    pnl += line_pnl[line] * quantity;
+                }
+                book_pnl[b * kPathsPerBlock + p] = pnl;
+                firm_pnl += pnl;
+            }
+            book_pnl[firm * kPathsPerBlock + p] = firm_pnl;
+        }
+        
+        std::lock_guard<std::mutex> lock(chunk_mutex);
+        for (size_t b = 0; b <= num_books; ++b) {
+            if (tails[b]) {
+                tails[b]->add(begin, block_paths, book_pnl + b * kPathsPerBlock);
+            }
+        }
+        if (run_control_) {
+            run_control_->addPaths(block_paths);
+        }
+    };
+    
+    base_value.stop();
+    RunStats::PhaseTimer simulation(phaseClock(&RiskRunStats::simulation_ms));
+    if (run_control_) {
+        run_control_->begin(num_paths);
     }
+    Parallel::forEachBlock(num_blocks, static_cast<int>(num_workers), simulate_block);
+    simulation.stop();
     
+    RunStats::PhaseTimer tail(phaseClock(&RiskRunStats::tail_ms));
+    // The sampling report describes the firm total.
+    for (size_t b = 0; b <= num_books; ++b) {
+        if (tails[b]) {
+            VaRSamplingReport book_report = last_sampling_report_;
+            metrics[b] = tails[b]->metrics(b == firm ? last_sampling_report_ : book_report);
+        }
+    }
     return metrics;
 }
@@ -0,0 +1,325 @@
+#include "RiskJobQueue.h"
+#include "Parallel.h"
+#include "PnLSink.h"
+#include <stdexcept>
+#include <utility>
+
+// Keeps every scenario's P&L of a job's run so its tails can be estimated
+// while the run is still going. Chunks arrive out of path order, which
+// the tail measures do not care about.
+class PnLCollector : public PnLSink {
+public:
+    void begin(size_t paths, const std::vector<std::string>&) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pnl_.clear();
+        pnl_.reserve(paths);
+    }
+
+    void write(const PnLChunk& chunk) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pnl_.insert(pnl_.end(), chunk.pnl, chunk.pnl + chunk.paths);
+    }
+
+    std::vector<double> snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return pnl_;
+    }
+
+    void release() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<double>().swap(pnl_);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<double> pnl_;
+};
+
+namespace {
+
+bool isFinished(RiskJobStatus status) {
+    return status == RiskJobStatus::Completed || status == RiskJobStatus::Cancelled ||
+           status == RiskJobStatus::Failed;
+}
+
+std::vector<TailEstimate> estimatesOf(std::vector<double> pnl, const std::vector<double>& levels) {
+    if (pnl.empty()) {
+        return {};
+    }
+    return TailStatistics::estimateTailMeasures(pnl, levels);
+}
+
+}
+
+RiskJob::RiskJob(JobId id, int priority, const RiskEngine& engine, Portfolio portfolio,
+                 std::map<std::string, MarketData> market_data)
+    : id_(id),
+      priority_(priority),
+      engine_(engine),
+      portfolio_(std::move(portfolio)),
+      market_data_(std::move(market_data)),
+      control_(std::make_shared<RunControl>()),
+      collector_(std::make_shared<PnLCollector>()) {
+    engine_.setRunControl(control_);
+    engine_.setPnLSink(collector_);
+}
+
+RiskJob::JobId RiskJob::id() const {
+    return id_;
+}
+
+int RiskJob::priority() const {
+    return priority_;
+}
+
+RiskJobStatus RiskJob::status() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return status_;
+}
+
+RiskJobProgress RiskJob::progress() const {
+    RiskJobProgress progress;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        progress.status = status_;
+        progress.paths_done = control_->pathsDone();
+        progress.paths_total = control_->pathsTotal();
+        if (isFinished(status_)) {
+            progress.estimates = final_estimates_;
+            return progress;
+        }
+    }
+    // Sorting a copy keeps the workers from waiting on the estimate.
+    progress.estimates = estimatesOf(collector_->snapshot(), engine_.getConfidenceLevels());
+    return progress;
+}
+
+bool RiskJob::cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (status_ == RiskJobStatus::Queued) {
+        status_ = RiskJobStatus::Cancelled;
+        done_.notify_all();
+        return true;
+    }
+    if (status_ == RiskJobStatus::Running) {
+        control_->cancel();
+        return true;
+    }
+    return false;
+}
+
+bool RiskJob::finished() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return isFinished(status_);
+}
+
+PortfolioRiskResult RiskJob::wait() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return isFinished(status_); });
+    if (status_ == RiskJobStatus::Cancelled) {
+        throw RiskRunCancelled();
+    }
+    if (status_ == RiskJobStatus::Failed) {
+        throw std::runtime_error(error_);
+    }
+    return result_;
+}
+
+bool RiskJob::waitFor(std::chrono::milliseconds timeout) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return done_.wait_for(lock, timeout, [this] { return isFinished(status_); });
+}
+
+std::string RiskJob::error() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return error_;
+}
+
+const RiskEngine& RiskJob::engine() const {
+    return engine_;
+}
+
+bool RiskJob::start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (status_ != RiskJobStatus::Queued) {
+        return false;
+    }
+    status_ = RiskJobStatus::Running;
+    return true;
+}
+
+void RiskJob::run() {
+    RiskJobStatus status = RiskJobStatus::Completed;
+    PortfolioRiskResult result;
+    std::string error;
+    try {
+        control_->checkpoint();
+        result = engine_.calculatePortfolioRisk(portfolio_, market_data_);
+    } catch (const RiskRunCancelled&) {
+        status = RiskJobStatus::Cancelled;
+    } catch (const std::exception& e) {
+        status = RiskJobStatus::Failed;
+        error = e.what();
+    }
+
+    std::vector<TailEstimate> estimates = estimatesOf(collector_->snapshot(), engine_.getConfidenceLevels());
+    collector_->release();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    status_ = status;
+    result_ = std::move(result);
+    error_ = std::move(error);
+    final_estimates_ = std::move(estimates);
+    done_.notify_all();
+}
+
+bool RiskJobQueue::PendingOrder::operator()(const Pending& a, const Pending& b) const {
+    if (a.priority != b.priority) {
+        return a.priority < b.priority;
+    }
+    return a.sequence > b.sequence;
+}
+
+RiskJobQueue::RiskJobQueue(int workers, size_t max_queued) : max_queued_(max_queued) {
+    if (workers < 0) {
+        throw std::invalid_argument("Number of workers must be non-negative");
+    }
+    const int count = Parallel::resolveThreadCount(workers);
+    workers_.reserve(count);
+    try {
+        for (int w = 0; w < count; ++w) {
+            workers_.emplace_back(&RiskJobQueue::workerLoop, this);
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        work_.notify_all();
+        for (auto& t : workers_) {
+            t.join();
+        }
+        throw std::runtime_error("Failed to start worker threads");
+    }
+}
+
+RiskJobQueue::~RiskJobQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        for (const auto& [id, job] : jobs_) {
+            job->cancel();
+        }
+    }
+    work_.notify_all();
+    for (auto& t : workers_) {
+        t.join();
+    }
+}
+
+std::shared_ptr<RiskJob> RiskJobQueue::submit(
+    const RiskEngine& engine,
+    Portfolio portfolio,
+    std::map<std::string, MarketData> market_data,
+    int priority
+) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (max_queued_ > 0 && pending_.size() >= max_queued_) {
+        purgeCancelled();
+        if (pending_.size() >= max_queued_) {
+            throw std::runtime_error("Risk job queue is full");
+        }
+    }
+
+    const JobId id = next_id_++;
+    std::shared_ptr<RiskJob> job(
+        new RiskJob(id, priority, engine, std::move(portfolio), std::move(market_data)));
+    pending_.push(Pending{priority, id, job});
+    jobs_.emplace(id, job);
+    work_.notify_one();
+    return job;
+}
+
+std::shared_ptr<RiskJob> RiskJobQueue::job(JobId id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = jobs_.find(id);
+    if (it == jobs_.end()) {
+        throw std::out_of_range("Unknown job ID: " + std::to_string(id));
+    }
+    return it->second;
+}
+
+bool RiskJobQueue::contains(JobId id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jobs_.count(id) != 0;
+}
+
+std::vector<std::shared_ptr<RiskJob>> RiskJobQueue::jobs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::shared_ptr<RiskJob>> result;
+    result.reserve(jobs_.size());
+    for (const auto& [id, job] : jobs_) {
+        result.push_back(job);
+    }
+    return result;
+}
+
+bool RiskJobQueue::release(JobId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto it = jobs_.find(id);
+    if (it == jobs_.end()) {
+        throw std::out_of_range("Unknown job ID: " + std::to_string(id));
+    }
+    if (!it->second->finished()) {
+        return false;
+    }
+    jobs_.erase(it);
+    return true;
+}
+
+size_t RiskJobQueue::queuedCount() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t queued = 0;
+    for (const auto& [id, job] : jobs_) {
+        if (job->status() == RiskJobStatus::Queued) {
+            ++queued;
+        }
+    }
+    return queued;
+}
+
+int RiskJobQueue::workerCount() const {
+    return static_cast<int>(workers_.size());
+}
+
+void RiskJobQueue::purgeCancelled() {
+    std::vector<Pending> kept;
+    kept.reserve(pending_.size());
+    while (!pending_.empty()) {
+        if (pending_.top().job->status() == RiskJobStatus::Queued) {
+            kept.push_back(pending_.top());
+        }
+        pending_.pop();
+    }
+    for (Pending& entry : kept) {
+        pending_.push(std::move(entry));
+    }
+}
+
+void RiskJobQueue::workerLoop() {
+    while (true) {
+        std::shared_ptr<RiskJob> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            if (stopping_) {
+                return;
+            }
+            job = pending_.top().job;
+            pending_.pop();
+        }
+        if (job->start()) {
+            job->run();
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#include "RunArena.h"
+#include <algorithm>
+
+namespace {
+
+uintptr_t alignUp(uintptr_t address, size_t alignment) {
+    return (address + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+}
+
+std::unique_ptr<std::byte[]> heapBlock(size_t bytes) {
+    // Not make_unique, which would zero the block.
+    return std::unique_ptr<std::byte[]>(new std::byte[bytes]);
+}
+
+}
+
+RunArena::RunArena(size_t initial_bytes) {
+    if (initial_bytes > 0) {
+        block_ = heapBlock(initial_bytes);
+        capacity_ = initial_bytes;
+    }
+}
+
+void RunArena::reset() {
+    const size_t needed = offset_ + spill_bytes_;
+    if (!spill_.empty() && needed > capacity_) {
+        block_.reset();
+        block_ = heapBlock(needed);
+        capacity_ = needed;
+    }
+    spill_.clear();
+    spill_bytes_ = 0;
+    offset_ = 0;
+    heap_allocations_ = 0;
+}
+
+void RunArena::reserve(size_t bytes) {
+    if (bytes > capacity_) {
+        block_.reset();
+        block_ = heapBlock(bytes);
+        capacity_ = bytes;
+    }
+}
+
+size_t RunArena::used() const {
+    return offset_ + spill_bytes_;
+}
+
+size_t RunArena::capacity() const {
+    return capacity_;
+}
+
+uint64_t RunArena::heapAllocations() const {
+    return heap_allocations_;
+}
+
+void* RunArena::do_allocate(size_t bytes, size_t alignment) {
+    bytes = std::max<size_t>(bytes, 1);
+    if (block_) {
+        const uintptr_t base = reinterpret_cast<uintptr_t>(block_.get());
+        const size_t start = alignUp(base + offset_, alignment) - base;
+        if (start <= capacity_ && bytes <= capacity_ - start) {
+            offset_ = start + bytes;
+            return block_.get() + start;
+        }
+    }
+
+    // Room for the worst-case padding as well.
+    const size_t size = bytes + alignment;
+    spill_.push_back(heapBlock(size));
+    spill_bytes_ += size;
+    ++heap_allocations_;
+    return reinterpret_cast<void*>(alignUp(reinterpret_cast<uintptr_t>(spill_.back().get()), alignment));
+}
+
+void RunArena::do_deallocate(void*, size_t, size_t) {
+}
+
+bool RunArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept {
+    return this == &other;
+}
+
+RunArenas::RunArenas(const RunArenas&) {
+}
+
+RunArenas& RunArenas::operator=(const RunArenas&) {
+    return *this;
+}
+
+void RunArenas::reset() {
+    caller_->reset();
+    size_t largest = 0;
+    for (const std::unique_ptr<RunArena>& arena : workers_) {
+        arena->reset();
+        largest = std::max(largest, arena->capacity());
+    }
+    for (const std::unique_ptr<RunArena>& arena : workers_) {
+        arena->reserve(largest);
+    }
+}
+
+void RunArenas::reserveWorkers(size_t workers) {
+    const size_t capacity = workers_.empty() ? 0 : workers_.front()->capacity();
+    while (workers_.size() < workers) {
+        workers_.push_back(std::make_unique<RunArena>(capacity));
+    }
+}
+
+RunArena& RunArenas::caller() {
+    return *caller_;
+}
+
+RunArena& RunArenas::worker(size_t worker) {
+    return *workers_.at(worker);
+}
+
+size_t RunArenas::used() const {
+    size_t total = caller_->used();
+    for (const std::unique_ptr<RunArena>& arena : workers_) {
+        total += arena->used();
+    }
+    return total;
+}
+
+uint64_t RunArenas::heapAllocations() const {
+    uint64_t total = caller_->heapAllocations();
+    for (const std::unique_ptr<RunArena>& arena : workers_) {
+        total += arena->heapAllocations();
+    }
+    return total;
+}
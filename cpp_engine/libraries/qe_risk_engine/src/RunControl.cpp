@@ -0,0 +1,36 @@
+#include "RunControl.h"
+
+RiskRunCancelled::RiskRunCancelled()
+    : std::runtime_error("Risk run cancelled") {
+}
+
+void RunControl::cancel() {
+    cancelled_.store(true, std::memory_order_relaxed);
+}
+
+bool RunControl::cancelled() const {
+    return cancelled_.load(std::memory_order_relaxed);
+}
+
+uint64_t RunControl::pathsDone() const {
+    return paths_done_.load(std::memory_order_relaxed);
+}
+
+uint64_t RunControl::pathsTotal() const {
+    return paths_total_.load(std::memory_order_relaxed);
+}
+
+void RunControl::begin(uint64_t paths_total) {
+    paths_done_.store(0, std::memory_order_relaxed);
+    paths_total_.store(paths_total, std::memory_order_relaxed);
+}
+
+void RunControl::addPaths(uint64_t paths) {
+    paths_done_.fetch_add(paths, std::memory_order_relaxed);
+}
+
+void RunControl::checkpoint() const {
+    if (cancelled()) {
+        throw RiskRunCancelled();
+    }
+}
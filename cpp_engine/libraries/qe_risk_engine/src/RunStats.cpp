@@ -0,0 +1,45 @@
+#include "RunStats.h"
+
+RunCounters& RunCounters::operator+=(const RunCounters& other) {
+    black_scholes_prices += other.black_scholes_prices;
+    lattice_prices += other.lattice_prices;
+    lattice_nodes += other.lattice_nodes;
+    merton_prices += other.merton_prices;
+    rng_draws += other.rng_draws;
+    scratch_allocations += other.scratch_allocations;
+    scratch_bytes += other.scratch_bytes;
+    return *this;
+}
+
+namespace RunStats {
+
+thread_local RunCounters* active = nullptr;
+
+Scope::Scope(RunCounters* counters) : previous_(active) {
+    active = counters;
+}
+
+Scope::~Scope() {
+    active = previous_;
+}
+
+PhaseTimer::PhaseTimer(double* elapsed_ms) : elapsed_ms_(kCompiled ? elapsed_ms : nullptr) {
+    if (elapsed_ms_) {
+        start_ = std::chrono::steady_clock::now();
+    }
+}
+
+PhaseTimer::~PhaseTimer() {
+    stop();
+}
+
+void PhaseTimer::stop() {
+    if (!elapsed_ms_) {
+        return;
+    }
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_;
+    *elapsed_ms_ += elapsed.count();
+    elapsed_ms_ = nullptr;
+}
+
+}
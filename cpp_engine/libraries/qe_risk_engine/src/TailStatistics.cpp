@@ -0,0 +1,286 @@
+#include "TailStatistics.h"
+#include "QuasiRandom.h"
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+namespace TailStatistics {
+
+size_t tailIndex(double confidence, size_t n) {
+    if (n == 0) {
+        throw std::invalid_argument("Cannot compute tail index of an empty sample");
+    }
+    const size_t index = static_cast<size_t>((1.0 - confidence) * static_cast<double>(n));
+    return std::min(index, n - 1);
+}
+
+void validateConfidenceLevels(const std::vector<double>& confidence_levels) {
+    if (confidence_levels.empty()) {
+        throw std::invalid_argument("At least one confidence level is required");
+    }
+    for (double level : confidence_levels) {
+        if (std::isnan(level) || level <= 0.0 || level >= 1.0) {
+            throw std::invalid_argument("Confidence levels must be between 0 and 1");
+        }
+    }
+}
+
+std::vector<TailMeasure> computeTailMeasures(
+    std::vector<double>& pnl,
+    const std::vector<double>& confidence_levels
+) {
+    validateConfidenceLevels(confidence_levels);
+    if (pnl.empty()) {
+        throw std::invalid_argument("Cannot compute tail measures of an empty sample");
+    }
+    
+    const size_t n_levels = confidence_levels.size();
+    std::vector<size_t> indices(n_levels);
+    for (size_t i = 0; i < n_levels; ++i) {
+        indices[i] = tailIndex(confidence_levels[i], pnl.size());
+    }
+    
+    // Visit levels from the shallowest tail (largest index) to the
+    // deepest. Each nth_element only has to look at the prefix left of
+    // the previous pivot, which already holds every smaller value.
+    std::vector<size_t> order(n_levels);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return indices[a] > indices[b];
+    });
+    
+    size_t prefix_end = pnl.size();
+    for (size_t k : order) {
+        const size_t index = indices[k];
+        if (index < prefix_end) {
+            std::nth_element(pnl.begin(), pnl.begin() + index, pnl.begin() + prefix_end);
+            prefix_end = index;
+        }
+    }
+    
+    // pnl[0..index] now holds the index + 1 worst outcomes for every
+    // level, so ES is a running sum over the tail walked once from the
+    // worst end.
+    std::vector<TailMeasure> measures(n_levels);
+    double tail_sum = 0.0;
+    size_t summed = 0;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        const size_t k = *it;
+        const size_t index = indices[k];
+        for (; summed <= index; ++summed) {
+            tail_sum += pnl[summed];
+        }
+        
+        measures[k].confidence = confidence_levels[k];
+        measures[k].value_at_risk = -pnl[index];
+        measures[k].expected_shortfall = -tail_sum / static_cast<double>(index + 1);
+    }
+    
+    return measures;
+}
+
+std::vector<TailEstimate> estimateTailMeasures(
+    std::vector<double>& pnl,
+    const std::vector<double>& confidence_levels,
+    double interval_level
+) {
+    validateConfidenceLevels(confidence_levels);
+    if (std::isnan(interval_level) || interval_level <= 0.0 || interval_level >= 1.0) {
+        throw std::invalid_argument("Interval level must be between 0 and 1");
+    }
+    if (pnl.empty()) {
+        throw std::invalid_argument("Cannot compute tail measures of an empty sample");
+    }
+    
+    const size_t n = pnl.size();
+    const double z = QuasiRandom::inverseNormal(0.5 + 0.5 * interval_level);
+    
+    // Order statistics bracketing each level's VaR; the deepest upper one
+    // bounds the prefix that has to be sorted.
+    const size_t n_levels = confidence_levels.size();
+    std::vector<size_t> indices(n_levels), lower(n_levels), upper(n_levels);
+    size_t prefix_end = 0;
+    for (size_t k = 0; k < n_levels; ++k) {
+        const double tail = 1.0 - confidence_levels[k];
+        const double spread = z * std::sqrt(static_cast<double>(n) * tail * (1.0 - tail));
+        const double centre = tail * static_cast<double>(n);
+        indices[k] = tailIndex(confidence_levels[k], n);
+        lower[k] = static_cast<size_t>(std::max(0.0, std::floor(centre - spread)));
+        upper[k] = std::min(n - 1, static_cast<size_t>(std::ceil(centre + spread)));
+        lower[k] = std::min(lower[k], indices[k]);
+        upper[k] = std::max(upper[k], indices[k]);
+        prefix_end = std::max(prefix_end, upper[k] + 1);
+    }
+    if (prefix_end < n) {
+        std::nth_element(pnl.begin(), pnl.begin() + prefix_end, pnl.end());
+    }
+    std::sort(pnl.begin(), pnl.begin() + prefix_end);
+    
+    std::vector<TailEstimate> estimates(n_levels);
+    for (size_t k = 0; k < n_levels; ++k) {
+        const size_t index = indices[k];
+        const double var = -pnl[index];
+        const double tail_size = static_cast<double>(index + 1);
+        double tail_sum = 0.0;
+        for (size_t i = 0; i <= index; ++i) {
+            tail_sum += pnl[i];
+        }
+        const double es = -tail_sum / tail_size;
+        double tail_variance = 0.0;
+        for (size_t i = 0; i <= index; ++i) {
+            const double d = -pnl[i] - es;
+            tail_variance += d * d;
+        }
+        tail_variance /= tail_size;
+        const double c = confidence_levels[k];
+        const double es_error = std::sqrt((tail_variance + c * (es - var) * (es - var)) / tail_size);
+        
+        TailEstimate& estimate = estimates[k];
+        estimate.confidence = c;
+        estimate.value_at_risk = var;
+        estimate.var_lower = -pnl[upper[k]];
+        estimate.var_upper = -pnl[lower[k]];
+        estimate.expected_shortfall = es;
+        estimate.es_lower = es - z * es_error;
+        estimate.es_upper = es + z * es_error;
+    }
+    
+    return estimates;
+}
+
+std::vector<TailMeasure> computeControlledTailMeasures(
+    const double* pnl,
+    const double* control,
+    size_t n,
+    double control_sd,
+    const std::vector<double>& confidence_levels
+) {
+    validateConfidenceLevels(confidence_levels);
+    if (n == 0) {
+        throw std::invalid_argument("Cannot compute tail measures of an empty sample");
+    }
+    if (!(control_sd > 0.0) || std::isinf(control_sd)) {
+        throw std::invalid_argument("Control standard deviation must be positive");
+    }
+    
+    std::vector<std::pair<double, double>> sample(n);
+    for (size_t i = 0; i < n; ++i) {
+        sample[i] = {pnl[i], control[i]};
+    }
+    std::sort(sample.begin(), sample.end());
+    
+    std::vector<TailMeasure> measures(confidence_levels.size());
+    for (size_t k = 0; k < confidence_levels.size(); ++k) {
+        const double alpha = 1.0 - confidence_levels[k];
+        const double threshold = control_sd * QuasiRandom::inverseNormal(alpha);
+        
+        size_t in_tail = 0;
+        for (const auto& path : sample) {
+            in_tail += path.second <= threshold;
+        }
+        double weight_in = 1.0 / static_cast<double>(n);
+        double weight_out = weight_in;
+        if (in_tail > 0 && in_tail < n) {
+            weight_in = alpha / static_cast<double>(in_tail);
+            weight_out = (1.0 - alpha) / static_cast<double>(n - in_tail);
+        }
+        
+        // VaR is the first outcome that takes the cumulative weight past
+        // alpha, matching tailIndex for equal weights; the tolerance keeps
+        // rounding in the running sum from stopping one path early.
+        double weight = 0.0;
+        double tail_sum = 0.0;
+        size_t index = 0;
+        for (; index < n; ++index) {
+            const auto& path = sample[index];
+            const double w = path.second <= threshold ? weight_in : weight_out;
+            weight += w;
+            tail_sum += w * path.first;
+            if (weight > alpha * (1.0 + 1e-12)) {
+                break;
+            }
+        }
+        index = std::min(index, n - 1);
+        
+        measures[k].confidence = confidence_levels[k];
+        measures[k].value_at_risk = -sample[index].first;
+        measures[k].expected_shortfall = -tail_sum / weight;
+    }
+    
+    return measures;
+}
+
+TailAccumulator::TailAccumulator(const std::vector<double>& confidence_levels, size_t sample_size)
+    : confidence_levels_(confidence_levels), sample_size_(sample_size) {
+    validateConfidenceLevels(confidence_levels);
+    if (sample_size == 0) {
+        throw std::invalid_argument("Cannot compute tail measures of an empty sample");
+    }
+    indices_.resize(confidence_levels.size());
+    for (size_t i = 0; i < indices_.size(); ++i) {
+        indices_[i] = tailIndex(confidence_levels[i], sample_size);
+        keep_ = std::max(keep_, indices_[i] + 1);
+    }
+    kept_.reserve(std::min(sample_size, 2 * keep_));
+}
+
+void TailAccumulator::add(const double* pnl, size_t n) {
+    if (n > sample_size_ - count_) {
+        throw std::invalid_argument("Tail accumulator received more values than its sample size");
+    }
+    for (size_t i = 0; i < n; ++i) {
+        // A value no smaller than the keep_-th worst seen so far can no
+        // longer change any tail.
+        if (full_ && !(pnl[i] < threshold_)) {
+            continue;
+        }
+        kept_.push_back(pnl[i]);
+        if (kept_.size() == 2 * keep_) {
+            compact();
+        }
+    }
+    count_ += n;
+}
+
+size_t TailAccumulator::count() const {
+    return count_;
+}
+
+void TailAccumulator::compact() {
+    std::nth_element(kept_.begin(), kept_.begin() + (keep_ - 1), kept_.end());
+    kept_.resize(keep_);
+    threshold_ = kept_[keep_ - 1];
+    full_ = true;
+}
+
+std::vector<TailMeasure> TailAccumulator::measures() const {
+    if (count_ != sample_size_) {
+        throw std::runtime_error("Tail accumulator has not received its whole sample");
+    }
+    std::vector<double> tail = kept_;
+    std::nth_element(tail.begin(), tail.begin() + (keep_ - 1), tail.end());
+    std::sort(tail.begin(), tail.begin() + keep_);
+    
+    std::vector<size_t> order(indices_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return indices_[a] < indices_[b];
+    });
+    
+    std::vector<TailMeasure> measures(indices_.size());
+    double tail_sum = 0.0;
+    size_t summed = 0;
+    for (size_t k : order) {
+        const size_t index = indices_[k];
+        for (; summed <= index; ++summed) {
+            tail_sum += tail[summed];
+        }
+        measures[k].confidence = confidence_levels_[k];
+        measures[k].value_at_risk = -tail[index];
+        measures[k].expected_shortfall = -tail_sum / static_cast<double>(index + 1);
+    }
+    return measures;
+}
+
+}
@@ -1,4 +1,10 @@
 #include "BlackScholes.h"
+#include "BlackScholesBatch.h"
+#include "ImpliedVolatilityBatch.h"
+#include "ImpliedVolatilitySurface.h"
+#include "JumpDiffusion.h"
+#include "PricingKernel.h"
+#include "QuasiRandom.h"
 #include "simple_test.h"
 #include <cmath>
 
@@ -171,6 +177,426 @@ void test_theta(TestSuite &suite) {
   });
 }
 
+void test_batch_pricing(TestSuite &suite) {
+  const std::vector<double> S = {100.0, 110.0, 90.0, 100.0, 100.0, 120.0, 80.0};
+  const std::vector<double> K = {100.0, 100.0, 100.0, 100.0, 100.0, 100.0, 100.0};
+  const std::vector<double> r = {0.05, 0.03, 0.05, 0.05, 0.05, 0.05, 0.0};
+  const std::vector<double> T = {1.0, 0.5, 2.0, 0.0, 1.0, 0.25, 5.0};
+  const std::vector<double> sigma = {0.2, 0.3, 0.25, 0.2, 0.0, 0.8, 0.05};
+  const std::vector<uint8_t> is_call = {1, 0, 1, 0, 1, 0, 0};
+
+  suite.run_test("Batch prices and Greeks match scalar functions", [&]() {
+    BlackScholes::BatchGreeks batch = BlackScholes::priceBatch(S, K, r, T, sigma, is_call);
+
+    for (size_t i = 0; i < S.size(); ++i) {
+      const bool call = is_call[i] != 0;
+      double price = call ? BlackScholes::callPrice(S[i], K[i], r[i], T[i], sigma[i])
+                          : BlackScholes::putPrice(S[i], K[i], r[i], T[i], sigma[i]);
+      double delta = call ? BlackScholes::callDelta(S[i], K[i], r[i], T[i], sigma[i])
+                          : BlackScholes::putDelta(S[i], K[i], r[i], T[i], sigma[i]);
+      double theta = call ? BlackScholes::callTheta(S[i], K[i], r[i], T[i], sigma[i])
+                          : BlackScholes::putTheta(S[i], K[i], r[i], T[i], sigma[i]);
+      double rho = call ? BlackScholes::callRho(S[i], K[i], r[i], T[i], sigma[i])
+                        : BlackScholes::putRho(S[i], K[i], r[i], T[i], sigma[i]);
+
+      suite.assert_equal(price, batch.price[i], 1e-10, "price");
+      suite.assert_equal(delta, batch.delta[i], 1e-10, "delta");
+      suite.assert_equal(BlackScholes::gamma(S[i], K[i], r[i], T[i], sigma[i]), batch.gamma[i], 1e-10, "gamma");
+      suite.assert_equal(BlackScholes::vega(S[i], K[i], r[i], T[i], sigma[i]), batch.vega[i], 1e-10, "vega");
+      suite.assert_equal(theta, batch.theta[i], 1e-10, "theta");
+      suite.assert_equal(rho, batch.rho[i], 1e-10, "rho");
+    }
+  });
+
+  suite.run_test("Batch pricing skips null outputs", [&]() {
+    std::vector<double> price(S.size());
+    BlackScholes::BatchInputs inputs;
+    inputs.spot = S.data();
+    inputs.strike = K.data();
+    inputs.rate = r.data();
+    inputs.expiry = T.data();
+    inputs.volatility = sigma.data();
+    inputs.is_call = is_call.data();
+    inputs.size = S.size();
+
+    BlackScholes::BatchOutputs outputs;
+    outputs.price = price.data();
+    BlackScholes::priceBatch(inputs, outputs);
+
+    suite.assert_equal(BlackScholes::callPrice(100.0, 100.0, 0.05, 1.0, 0.2), price[0], 1e-10);
+  });
+
+  suite.run_test("Batch pricing rejects invalid inputs", [&]() {
+    std::vector<double> bad_spot = S;
+    bad_spot[2] = -1.0;
+    try {
+      BlackScholes::priceBatch(bad_spot, K, r, T, sigma, is_call);
+    } catch (const std::invalid_argument &) {
+      return;
+    }
+    throw std::runtime_error("Expected invalid_argument for negative spot");
+  });
+
+  suite.run_test("Single-type batches match the mixed kernel", [&]() {
+    for (const uint8_t call : {uint8_t(1), uint8_t(0)}) {
+      const std::vector<uint8_t> mask(S.size(), call);
+      const BlackScholes::BatchGreeks mixed = BlackScholes::priceBatch(S, K, r, T, sigma, mask);
+
+      BlackScholes::BatchGreeks single = mixed;
+      BlackScholes::BatchInputs inputs;
+      inputs.spot = S.data();
+      inputs.strike = K.data();
+      inputs.rate = r.data();
+      inputs.expiry = T.data();
+      inputs.volatility = sigma.data();
+      inputs.size = S.size();
+      inputs.types = call ? BlackScholes::BatchOptionTypes::Calls
+                          : BlackScholes::BatchOptionTypes::Puts;
+
+      BlackScholes::BatchOutputs outputs;
+      outputs.price = single.price.data();
+      outputs.delta = single.delta.data();
+      outputs.gamma = single.gamma.data();
+      outputs.vega = single.vega.data();
+      outputs.theta = single.theta.data();
+      outputs.rho = single.rho.data();
+      BlackScholes::priceBatch(inputs, outputs);
+
+      for (size_t i = 0; i < S.size(); ++i) {
+        suite.assert_equal(mixed.price[i], single.price[i], 0.0, "price");
+        suite.assert_equal(mixed.delta[i], single.delta[i], 0.0, "delta");
+        suite.assert_equal(mixed.theta[i], single.theta[i], 0.0, "theta");
+        suite.assert_equal(mixed.rho[i], single.rho[i], 0.0, "rho");
+      }
+    }
+  });
+}
+
+void test_pricing_kernel(TestSuite &suite) {
+  const MarketData md("AAPL", 105.0, 0.04, 0.25);
+
+  suite.run_test("Kernel dispatch matches the option classes", [&]() {
+    const PricingModel models[] = {PricingModel::BlackScholes, PricingModel::Binomial,
+                                   PricingModel::MertonJumpDiffusion};
+    for (PricingModel model : models) {
+      for (OptionType type : {OptionType::Call, OptionType::Put}) {
+        EuropeanOption option(type, 100.0, 0.75, "AAPL", model);
+        option.setJumpParameters(0.5, -0.05, 0.15);
+        ContractTerms terms;
+        option.getContractTerms(terms);
+
+        const Greeks kernel = PricingKernel::dispatch(terms, [&](auto pricer) {
+          return decltype(pricer)::greeks(terms, md);
+        });
+        const Greeks greeks = option.computeAll(md);
+        suite.assert_equal(option.price(md), kernel.price, 0.0, "price");
+        suite.assert_equal(greeks.delta, kernel.delta, 0.0, "delta");
+        suite.assert_equal(greeks.vega, kernel.vega, 0.0, "vega");
+        suite.assert_equal(greeks.theta, kernel.theta, 0.0, "theta");
+      }
+    }
+
+    AmericanOption american(OptionType::Put, 100.0, 0.75, "AAPL");
+    ContractTerms terms;
+    american.getContractTerms(terms);
+    // American terms take the lattice whatever model they carry.
+    terms.model = PricingModel::BlackScholes;
+    const double price = PricingKernel::dispatch(terms, [&](auto pricer) {
+      return decltype(pricer)::price(terms, md);
+    });
+    suite.assert_equal(american.price(md), price, 0.0, "American price");
+  });
+
+  suite.run_test("Kernel dispatch rejects an unknown model", [&]() {
+    ContractTerms terms;
+    terms.model = static_cast<PricingModel>(99);
+    try {
+      PricingKernel::dispatch(terms, [&](auto pricer) {
+        return decltype(pricer)::price(terms, md);
+      });
+    } catch (const std::runtime_error &) {
+      return;
+    }
+    throw std::runtime_error("Expected runtime_error for an unknown model");
+  });
+}
+
+void test_vol_surface(TestSuite &suite) {
+  using VolatilitySurface::ImpliedVolSurface;
+  using VolatilitySurface::VolPoint;
+
+  // Two expiry slices that do not share strikes, added out of order.
+  const std::vector<VolPoint> quotes = {
+      {110.0, 1.0, 0.22}, {90.0, 0.5, 0.30}, {90.0, 1.0, 0.28},
+      {100.0, 0.5, 0.25}, {110.0, 0.5, 0.21}, {100.0, 1.0, 0.24},
+      {95.0, 1.0, 0.26}};
+
+  suite.run_test("Surface interpolates within and between slices", [&]() {
+    ImpliedVolSurface surface;
+    surface.addPoints(quotes);
+
+    suite.assert_equal(0.25, surface.interpolate(100.0, 0.5), 1e-15, "Quote");
+    suite.assert_equal(0.275, surface.interpolate(95.0, 0.5), 1e-15,
+                       "Linear in strike");
+    suite.assert_equal(0.30, surface.interpolate(50.0, 0.5), 1e-15,
+                       "Flat below strikes");
+    suite.assert_equal(0.22, surface.interpolate(200.0, 2.0), 1e-15,
+                       "Flat beyond expiries");
+
+    // Halfway in time: total variance is the average of the slices.
+    const double w = 0.5 * (0.25 * 0.25 * 0.5 + 0.24 * 0.24 * 1.0);
+    suite.assert_equal(std::sqrt(w / 0.75), surface.interpolate(100.0, 0.75),
+                       1e-15, "Total variance in time");
+  });
+
+  suite.run_test("Batch lookup, skew and term structure use the index", [&]() {
+    ImpliedVolSurface surface;
+    for (const VolPoint &q : quotes) {
+      surface.addPoint(q.strike, q.expiry, q.implied_vol);
+    }
+
+    // The first lookup after addPoint builds the index.
+    if (surface.isBuilt()) {
+      throw std::runtime_error("addPoint should leave the index stale");
+    }
+    suite.assert_equal(0.25, surface.interpolate(100.0, 0.5), 1e-15, "Lookup before build()");
+    if (!surface.isBuilt()) {
+      throw std::runtime_error("The lookup should build the index");
+    }
+    surface.addPoint(100.0, 0.5, 0.27);
+    suite.assert_equal(0.27, surface.interpolate(100.0, 0.5), 1e-15, "Later quote replaces");
+    surface.addPoint(100.0, 0.5, 0.25);
+
+    surface.build();
+    const std::vector<double> strikes = {90.0, 105.0, 100.0, 120.0};
+    const std::vector<double> expiries = {0.5, 0.5, 0.8, 1.0};
+    const std::vector<double> vols = surface.interpolate(strikes, expiries);
+    for (size_t i = 0; i < strikes.size(); ++i) {
+      suite.assert_equal(surface.interpolate(strikes[i], expiries[i]), vols[i],
+                         0.0, "Batch matches scalar");
+    }
+
+    suite.assert_equal(VolatilitySurface::calculateSkew(quotes, 1.0),
+                       surface.skew(1.0), 1e-15, "Skew");
+    suite.assert_equal(VolatilitySurface::calculateTermStructure(quotes, 100.0),
+                       surface.termStructure(100.0), 1e-15, "Term structure");
+    suite.assert_equal(-0.06 / 20.0, surface.skew(1.0), 1e-15, "Skew value");
+    suite.assert_equal(-0.02, surface.termStructure(100.0), 1e-15,
+                       "Term value");
+  });
+}
+
+void test_implied_vol_batch(TestSuite &suite) {
+  using namespace BlackScholes;
+
+  // Calls and puts across moneyness, expiry and vol, priced by the scalar
+  // functions so the solver has to recover the vol it was given.
+  std::vector<double> price, S, K, r, T, sigma;
+  std::vector<uint8_t> is_call;
+  for (double strike : {50.0, 80.0, 100.0, 125.0, 200.0}) {
+    for (double expiry : {0.05, 0.5, 2.0}) {
+      for (double vol : {0.05, 0.2, 0.6, 1.5}) {
+        for (uint8_t call : {uint8_t(1), uint8_t(0)}) {
+          const double p = call ? callPrice(100.0, strike, 0.03, expiry, vol)
+                                : putPrice(100.0, strike, 0.03, expiry, vol);
+          // Quotes with no time value to speak of cannot pin down a vol.
+          if (p - (call ? std::max(0.0, 100.0 - strike * std::exp(-0.03 * expiry))
+                        : std::max(0.0, strike * std::exp(-0.03 * expiry) - 100.0)) < 1e-8) {
+            continue;
+          }
+          price.push_back(p);
+          S.push_back(100.0);
+          K.push_back(strike);
+          r.push_back(0.03);
+          T.push_back(expiry);
+          sigma.push_back(vol);
+          is_call.push_back(call);
+        }
+      }
+    }
+  }
+
+  suite.run_test("Batch implied vol recovers pricing vols", [&]() {
+    ImpliedVolBatch batch = impliedVolatilityBatch(price, S, K, r, T, is_call);
+    suite.assert_equal(static_cast<double>(price.size()),
+                       static_cast<double>(batch.convergedCount()), 0.0,
+                       "All quotes converge");
+    for (size_t i = 0; i < price.size(); ++i) {
+      suite.assert_equal(sigma[i], batch.vol[i], 1e-6, "Recovered vol");
+    }
+
+    const double scalar = impliedVolatility(price[10], S[10], K[10], r[10], T[10],
+                                            is_call[10] != 0, 0.3, 1e-10);
+    suite.assert_equal(scalar, batch.vol[10], 1e-7, "Matches scalar solver");
+  });
+
+  suite.run_test("Batch implied vol reports bad quotes", [&]() {
+    const std::vector<double> bad_price = {5.0, 0.5, 120.0, -1.0, 10.0, 20.0};
+    const std::vector<double> bad_S(6, 100.0);
+    const std::vector<double> bad_K = {100.0, 80.0, 100.0, 100.0, 100.0, 80.0};
+    const std::vector<double> bad_r(6, 0.0);
+    const std::vector<double> bad_T = {1.0, 1.0, 1.0, 1.0, 0.0, 1.0};
+    const std::vector<uint8_t> calls(6, 1);
+
+    ImpliedVolBatch batch =
+        impliedVolatilityBatch(bad_price, bad_S, bad_K, bad_r, bad_T, calls);
+    if (batch.status[0] != ImpliedVolStatus::Converged ||
+        batch.status[1] != ImpliedVolStatus::BelowIntrinsic ||
+        batch.status[2] != ImpliedVolStatus::AboveMaximum ||
+        batch.status[3] != ImpliedVolStatus::InvalidInput ||
+        batch.status[4] != ImpliedVolStatus::InvalidInput ||
+        batch.status[5] != ImpliedVolStatus::NoTimeValue) {
+      throw std::runtime_error("Unexpected implied vol status");
+    }
+    suite.assert_equal(0.0, batch.vol[1], 0.0, "Failed quotes report zero vol");
+
+    // A quote at intrinsic value does not become a zero-vol surface point.
+    const std::vector<VolatilitySurface::VolPoint> points =
+        convergedVolPoints(bad_K, bad_T, batch);
+    suite.assert_equal(1.0, static_cast<double>(points.size()), 0.0, "Surface points");
+    suite.assert_equal(100.0, points[0].strike, 0.0, "Surface point strike");
+  });
+
+  suite.run_test("Threaded batch feeds the surface", [&]() {
+    // Enough copies to span several blocks.
+    std::vector<double> big_price, big_S, big_K, big_r, big_T;
+    std::vector<uint8_t> big_call;
+    for (int copy = 0; copy < 20; ++copy) {
+      big_price.insert(big_price.end(), price.begin(), price.end());
+      big_S.insert(big_S.end(), S.begin(), S.end());
+      big_K.insert(big_K.end(), K.begin(), K.end());
+      big_r.insert(big_r.end(), r.begin(), r.end());
+      big_T.insert(big_T.end(), T.begin(), T.end());
+      big_call.insert(big_call.end(), is_call.begin(), is_call.end());
+    }
+
+    ImpliedVolSettings settings;
+    ImpliedVolBatch serial =
+        impliedVolatilityBatch(big_price, big_S, big_K, big_r, big_T, big_call, settings);
+    settings.num_threads = 4;
+    ImpliedVolBatch threaded =
+        impliedVolatilityBatch(big_price, big_S, big_K, big_r, big_T, big_call, settings);
+    for (size_t i = 0; i < big_price.size(); ++i) {
+      suite.assert_equal(serial.vol[i], threaded.vol[i], 0.0, "Thread count invariant");
+    }
+
+    VolatilitySurface::ImpliedVolSurface surface;
+    surface.addPoints(convergedVolPoints(K, T, impliedVolatilityBatch(price, S, K, r, T, is_call)));
+    suite.assert_equal(static_cast<double>(price.size()),
+                       static_cast<double>(surface.size()), 0.0, "Surface size");
+  });
+}
+
+void test_merton_series(TestSuite &suite) {
+  using JumpDiffusion::MertonSeries;
+
+  const double r = 0.04, T = 0.75, sigma = 0.2;
+  const double lambda = 1.5, jump_mean = -0.08, jump_vol = 0.12;
+  const MertonSeries series(r, T, sigma, lambda, jump_mean, jump_vol);
+
+  suite.run_test("Merton series matches the term-by-term sum", [&]() {
+    // The series written out with the validated scalar pricers.
+    const double k = std::exp(jump_mean + 0.5 * jump_vol * jump_vol) - 1.0;
+    double expected = 0.0;
+    for (size_t n = 0; n < series.termCount(); ++n) {
+      const double sigma_n = std::sqrt(sigma * sigma + n * jump_vol * jump_vol / T);
+      const double r_n = r - lambda * k + n * (jump_mean + 0.5 * jump_vol * jump_vol) / T;
+      expected += JumpDiffusion::poissonProbability(static_cast<int>(n), lambda * T) *
+                  BlackScholes::putPrice(100.0, 95.0, r_n, T, sigma_n);
+    }
+    suite.assert_equal(expected, series.price(100.0, 95.0, OptionType::Put), 1e-12,
+                       "Put price");
+    suite.assert_equal(JumpDiffusion::mertonCallPrice(110.0, 95.0, r, T, sigma, lambda,
+                                                      jump_mean, jump_vol),
+                       series.price(110.0, 95.0, OptionType::Call), 0.0,
+                       "Legacy entry point");
+
+    const MertonSeries no_jumps(r, T, sigma, 0.0, jump_mean, jump_vol);
+    suite.assert_equal(BlackScholes::callPrice(100.0, 100.0, r, T, sigma),
+                       no_jumps.price(100.0, 100.0, OptionType::Call), 1e-12,
+                       "No jumps is Black-Scholes");
+  });
+
+  suite.run_test("Merton series Greeks and batch pricing", [&]() {
+    const double S = 100.0, K = 105.0, h = 0.01;
+    const JumpDiffusion::MertonGreeks g = series.greeks(S, K, OptionType::Call);
+
+    const double up = series.price(S + h, K, OptionType::Call);
+    const double down = series.price(S - h, K, OptionType::Call);
+    suite.assert_equal((up - down) / (2.0 * h), g.delta, 1e-7, "Delta");
+    suite.assert_equal((up - 2.0 * g.price + down) / (h * h), g.gamma, 1e-5, "Gamma");
+    suite.assert_equal((series.price(S, K, OptionType::Call, sigma + 1e-5) -
+                        series.price(S, K, OptionType::Call, sigma - 1e-5)) / 2e-5,
+                       g.vega, 1e-6, "Vega");
+
+    const MertonSeries bumped(r + 1e-6, T, sigma, lambda, jump_mean, jump_vol);
+    suite.assert_equal((bumped.price(S, K, OptionType::Call) - g.price) / 1e-6 / 100.0,
+                       g.rho, 1e-5, "Rho");
+
+    const std::vector<double> spots = {80.0, 100.0, 120.0};
+    const std::vector<double> strikes = {90.0, 100.0, 110.0};
+    const std::vector<uint8_t> calls = {1, 0, 1};
+    std::vector<double> prices(3);
+    series.priceBatch(spots.data(), strikes.data(), calls.data(), prices.data(), 3);
+    for (size_t i = 0; i < 3; ++i) {
+      suite.assert_equal(series.price(spots[i], strikes[i],
+                                      calls[i] ? OptionType::Call : OptionType::Put),
+                         prices[i], 0.0, "Batch matches scalar");
+    }
+  });
+}
+
+void test_quasi_random(TestSuite &suite) {
+  suite.run_test("Inverse normal inverts the normal CDF", [&]() {
+    for (double p : {1e-10, 1e-4, 0.01, 0.025, 0.3, 0.5, 0.8, 0.975, 0.999999}) {
+      const double x = QuasiRandom::inverseNormal(p);
+      suite.assert_equal(p, BlackScholes::N(x), 1e-12 * std::max(p, 1e-3),
+                         "N(inverseNormal(p))");
+    }
+    suite.assert_equal(0.0, QuasiRandom::inverseNormal(0.5), 1e-15, "Median");
+    if (!std::isinf(QuasiRandom::inverseNormal(0.0)) ||
+        !std::isnan(QuasiRandom::inverseNormal(1.5))) {
+      throw std::runtime_error("Expected -inf at 0 and NaN outside [0, 1]");
+    }
+  });
+
+  suite.run_test("Sobol points stratify every dimension", [&]() {
+    const size_t dimensions = 40;
+    const uint32_t points = 1024;
+    QuasiRandom::SobolSequence sequence(dimensions);
+    std::vector<double> point(dimensions);
+    std::vector<std::vector<int>> counts(dimensions, std::vector<int>(points, 0));
+    for (uint32_t i = 0; i < points; ++i) {
+      sequence.point(i, 17, point.data());
+      for (size_t d = 0; d < dimensions; ++d) {
+        if (!(point[d] > 0.0 && point[d] < 1.0)) {
+          throw std::runtime_error("Coordinate outside (0, 1)");
+        }
+        ++counts[d][static_cast<size_t>(point[d] * points)];
+      }
+    }
+    // The first 2^m points of a (scrambled) Sobol sequence put exactly one
+    // point in each interval of width 2^-m in every coordinate.
+    for (size_t d = 0; d < dimensions; ++d) {
+      for (int count : counts[d]) {
+        if (count != 1) {
+          throw std::runtime_error("Dimension " + std::to_string(d) + " is not stratified");
+        }
+      }
+    }
+
+    bool threw = false;
+    try {
+      QuasiRandom::SobolSequence invalid(0);
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected invalid_argument for zero dimensions");
+    }
+  });
+}
+
 int main() {
   TestSuite suite;
 
@@ -186,6 +612,12 @@ int main() {
   test_gamma(suite);
   test_vega(suite);
   test_theta(suite);
+  test_batch_pricing(suite);
+  test_pricing_kernel(suite);
+  test_vol_surface(suite);
+  test_implied_vol_batch(suite);
+  test_merton_series(suite);
+  test_quasi_random(suite);
 
   suite.print_summary();
 
@@ -1,8 +1,12 @@
+#include "BinomialTree.h"
 #include "Instrument.h"
 #include "MarketData.h"
 #include "Portfolio.h"
 #include "simple_test.h"
+#include <cmath>
+#include <limits>
 #include <memory>
+#include <string>
 
 
 void test_empty_portfolio(TestSuite &suite) {
@@ -266,6 +270,245 @@ void test_instrument_pricing_in_portfolio(TestSuite &suite) {
   });
 }
 
+void test_compute_all_greeks(TestSuite &suite) {
+  MarketData md("AAPL", 100.0, 0.05, 0.2);
+
+  auto check_matches_accessors = [&](const Instrument &instrument) {
+    Greeks greeks = instrument.computeAll(md);
+    suite.assert_equal(instrument.price(md), greeks.price, 1e-12, "price");
+    suite.assert_equal(instrument.delta(md), greeks.delta, 1e-12, "delta");
+    suite.assert_equal(instrument.gamma(md), greeks.gamma, 1e-12, "gamma");
+    suite.assert_equal(instrument.vega(md), greeks.vega, 1e-12, "vega");
+    suite.assert_equal(instrument.theta(md), greeks.theta, 1e-12, "theta");
+  };
+
+  suite.run_test("computeAll matches accessors for every model", [&]() {
+    EuropeanOption black_scholes(OptionType::Call, 105.0, 1.0, "AAPL");
+    check_matches_accessors(black_scholes);
+
+    EuropeanOption binomial(OptionType::Put, 95.0, 0.5, "AAPL",
+                            PricingModel::Binomial);
+    check_matches_accessors(binomial);
+
+    EuropeanOption merton(OptionType::Call, 100.0, 1.0, "AAPL",
+                          PricingModel::MertonJumpDiffusion);
+    merton.setJumpParameters(1.0, -0.05, 0.1);
+    check_matches_accessors(merton);
+
+    AmericanOption american(OptionType::Put, 100.0, 1.0, "AAPL");
+    check_matches_accessors(american);
+  });
+
+  suite.run_test("Lattice delta and gamma converge to Black-Scholes", [&]() {
+    EuropeanOption analytic(OptionType::Call, 100.0, 1.0, "AAPL");
+    EuropeanOption lattice(OptionType::Call, 100.0, 1.0, "AAPL",
+                           PricingModel::Binomial);
+    lattice.setBinomialSteps(1000);
+
+    Greeks exact = analytic.computeAll(md);
+    Greeks approx = lattice.computeAll(md);
+    suite.assert_equal(exact.delta, approx.delta, 1e-3, "delta");
+    suite.assert_equal(exact.gamma, approx.gamma, 1e-3, "gamma");
+  });
+}
+
+void test_lattice_schemes(TestSuite &suite) {
+  MarketData md("AAPL", 100.0, 0.05, 0.25);
+
+  suite.run_test("Leisen-Reimer converges faster than CRR", [&]() {
+    EuropeanOption analytic(OptionType::Put, 100.0, 1.0, "AAPL");
+    EuropeanOption crr(OptionType::Put, 100.0, 1.0, "AAPL",
+                       PricingModel::Binomial);
+    EuropeanOption leisen_reimer(OptionType::Put, 100.0, 1.0, "AAPL",
+                                 PricingModel::Binomial);
+    crr.setBinomialSteps(51);
+    leisen_reimer.setBinomialSteps(51);
+    leisen_reimer.setLatticeScheme(LatticeScheme::LeisenReimer);
+
+    const double exact = analytic.price(md);
+    const double crr_error = std::abs(crr.price(md) - exact);
+    const double lr_error = std::abs(leisen_reimer.price(md) - exact);
+
+    suite.assert_equal(exact, leisen_reimer.price(md), 1e-3, "LR price");
+    if (lr_error * 10.0 > crr_error) {
+      throw std::runtime_error("Leisen-Reimer should be far closer than CRR");
+    }
+  });
+
+  suite.run_test("American lattice schemes agree", [&]() {
+    AmericanOption fine_crr(OptionType::Put, 100.0, 1.0, "AAPL", 2000);
+    AmericanOption coarse_lr(OptionType::Put, 100.0, 1.0, "AAPL", 201);
+    coarse_lr.setLatticeScheme(LatticeScheme::LeisenReimer);
+
+    suite.assert_equal(fine_crr.price(md), coarse_lr.price(md), 5e-3);
+    suite.assert_equal(coarse_lr.price(md), coarse_lr.computeAll(md).price,
+                       1e-12, "computeAll price");
+  });
+
+  suite.run_test("Unchecked lattice pricers match and report failures as NaN", [&]() {
+    for (LatticeScheme scheme :
+         {LatticeScheme::CoxRossRubinstein, LatticeScheme::LeisenReimer}) {
+      for (double T : {0.0, 0.75}) {
+        suite.assert_equal(
+            BinomialTree::europeanOptionPrice(100.0, 95.0, 0.05, T, 0.25,
+                                              OptionType::Call, 101, scheme),
+            BinomialTree::europeanOptionPriceUnchecked(
+                100.0, 95.0, 0.05, T, 0.25, OptionType::Call, 101, scheme),
+            0.0, "European");
+        suite.assert_equal(
+            BinomialTree::americanOptionPrice(100.0, 105.0, 0.05, T, 0.25,
+                                              OptionType::Put, 101, scheme),
+            BinomialTree::americanOptionPriceUnchecked(
+                100.0, 105.0, 0.05, T, 0.25, OptionType::Put, 101, scheme),
+            0.0, "American");
+      }
+    }
+
+    // Growth per step outruns the up move, so no probability fits.
+    bool threw = false;
+    try {
+      BinomialTree::americanOptionPrice(100.0, 100.0, 5.0, 1.0, 0.01,
+                                        OptionType::Put, 10);
+    } catch (const std::runtime_error &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Checked pricer should reject the lattice");
+    }
+    if (!std::isnan(BinomialTree::americanOptionPriceUnchecked(
+            100.0, 100.0, 5.0, 1.0, 0.01, OptionType::Put, 10))) {
+      throw std::runtime_error("Unchecked pricer should return NaN");
+    }
+  });
+}
+
+void test_flat_tree(TestSuite &suite) {
+  suite.run_test("Flat tree matches the lattice pricer", [&]() {
+    const auto tree = BinomialTree::buildFlatTree(100.0, 100.0, 0.05, 1.0, 0.25,
+                                                  OptionType::Put, 200, true);
+    const double price = BinomialTree::americanOptionPrice(
+        100.0, 100.0, 0.05, 1.0, 0.25, OptionType::Put, 200);
+
+    suite.assert_equal(price, tree.optionValue(0, 0), 1e-10, "Root value");
+    suite.assert_equal(100.0, tree.stockPrice(0, 0), 1e-12, "Root spot");
+    suite.assert_equal(static_cast<double>(201 * 202 / 2),
+                       static_cast<double>(tree.nodeCount()), 0.0, "Nodes");
+
+    const auto nested = BinomialTree::buildTree(100.0, 100.0, 0.05, 1.0, 0.25,
+                                                OptionType::Put, 200, true);
+    for (int step = 0; step <= 200; ++step) {
+      for (int i = 0; i <= step; ++i) {
+        const auto node = tree.node(step, i);
+        if (node.exercise_optimal != nested[step][i].exercise_optimal ||
+            node.option_value != nested[step][i].option_value) {
+          throw std::runtime_error("Nested tree disagrees with flat tree");
+        }
+      }
+    }
+  });
+
+  suite.run_test("Exercise boundary follows the tree flags", [&]() {
+    const int steps = 300;
+    const auto tree = BinomialTree::buildFlatTree(100.0, 100.0, 0.05, 1.0, 0.25,
+                                                  OptionType::Put, steps, true);
+    const auto boundary = BinomialTree::exerciseBoundary(
+        100.0, 100.0, 0.05, 1.0, 0.25, OptionType::Put, steps);
+
+    if (boundary.critical_spot.size() != steps + 1u) {
+      throw std::runtime_error("Expected one boundary point per step");
+    }
+    suite.assert_equal(1.0, boundary.time[steps], 1e-12, "Final time");
+    if (!std::isnan(boundary.critical_spot[steps])) {
+      throw std::runtime_error("No exercise decision at expiry");
+    }
+
+    for (int step = 0; step < steps; ++step) {
+      double highest = std::numeric_limits<double>::quiet_NaN();
+      for (int i = step; i >= 0; --i) {
+        if (tree.exerciseOptimal(step, i)) {
+          highest = tree.stockPrice(step, i);
+        }
+      }
+      if (std::isnan(highest) != std::isnan(boundary.critical_spot[step]) ||
+          (!std::isnan(highest) && highest != boundary.critical_spot[step])) {
+        throw std::runtime_error("Boundary disagrees with tree at step " +
+                                 std::to_string(step));
+      }
+    }
+
+    // Put boundary sits below the strike and rises towards it near expiry.
+    const double early = boundary.critical_spot[steps / 3];
+    const double late = boundary.critical_spot[steps - 1];
+    if (!(early < late && late < 100.0)) {
+      throw std::runtime_error("Put boundary should rise towards the strike");
+    }
+
+    const auto call = BinomialTree::exerciseBoundary(
+        100.0, 100.0, 0.05, 1.0, 0.25, OptionType::Call, steps);
+    for (double spot : call.critical_spot) {
+      if (!std::isnan(spot)) {
+        throw std::runtime_error("Call without dividends is never exercised early");
+      }
+    }
+  });
+}
+
+void test_portfolio_columns(TestSuite &suite) {
+  suite.run_test("Columns group lines by style, model and type", [&]() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        1);
+    portfolio.addInstrument(
+        std::make_unique<AmericanOption>(OptionType::Put, 90.0, 0.5, "MSFT"),
+        2);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 110.0, 2.0, "AAPL"),
+        3);
+
+    const PortfolioColumns &columns = portfolio.getColumns();
+    const auto &groups = columns.groups();
+
+    suite.assert_equal(2.0, static_cast<double>(columns.assets().size()), 0.0,
+                       "Distinct assets");
+    suite.assert_equal(3.0, static_cast<double>(groups.size()), 0.0, "Groups");
+    suite.assert_equal(1.0, static_cast<double>(groups[0].size()), 0.0,
+                       "European call rows");
+    if (groups[0].option_type != OptionType::Call ||
+        groups[2].option_type != OptionType::Put || groups[2].is_american) {
+      throw std::runtime_error("European calls and puts share a group");
+    }
+    suite.assert_equal(110.0, groups[2].strike[0], 0.0, "Strike column");
+    suite.assert_equal(2.0, static_cast<double>(groups[2].line[0]), 0.0,
+                       "Line index");
+    if (!groups[1].is_american || groups[1].is_call[0] != 0) {
+      throw std::runtime_error("American put not stored in its own group");
+    }
+    if (columns.assets().symbol(groups[1].asset[0]) != "MSFT") {
+      throw std::runtime_error("Asset index does not resolve to MSFT");
+    }
+
+    portfolio.updateQuantity(2, -5);
+    suite.assert_equal(-5.0, groups[2].quantity[0], 0.0, "Updated quantity");
+
+    // Removal rebuilds the columns, so groups follow first-seen order of
+    // the remaining lines.
+    portfolio.removeInstrument(0);
+    if (!groups[0].is_american || groups[1].is_american) {
+      throw std::runtime_error("Groups not rebuilt in line order");
+    }
+    suite.assert_equal(1.0, static_cast<double>(groups[1].size()), 0.0,
+                       "Rows after removal");
+    suite.assert_equal(1.0, static_cast<double>(groups[1].line[0]), 0.0,
+                       "Line index after removal");
+    suite.assert_equal(-5.0, groups[1].quantity[0], 0.0, "Quantity kept");
+
+    portfolio.clear();
+    suite.assert_equal(0.0, static_cast<double>(columns.lineCount()), 0.0,
+                       "Lines after clear");
+  });
+}
+
 void test_portfolio_ordering(TestSuite &suite) {
   suite.run_test("Instruments maintain insertion order", [&]() {
     Portfolio portfolio;
@@ -296,6 +539,81 @@ void test_portfolio_ordering(TestSuite &suite) {
   });
 }
 
+void test_option_line_arrays(TestSuite &suite) {
+  const std::vector<std::string> asset_ids = {"AAPL", "MSFT"};
+  const std::vector<uint8_t> is_call = {1, 0, 1};
+  const std::vector<double> strike = {100.0, 250.0, 110.0};
+  const std::vector<double> expiry = {1.0, 0.5, 0.25};
+  const std::vector<int> quantity = {10, -5, 3};
+  const std::vector<uint32_t> asset_index = {0, 1, 0};
+  const std::vector<uint8_t> is_american = {0, 1, 0};
+
+  OptionLineArrays lines;
+  lines.is_call = is_call.data();
+  lines.strike = strike.data();
+  lines.expiry = expiry.data();
+  lines.quantity = quantity.data();
+  lines.asset_index = asset_index.data();
+  lines.is_american = is_american.data();
+  lines.size = is_call.size();
+
+  suite.run_test("Option arrays build the same lines", [&]() {
+    Portfolio portfolio;
+    portfolio.addOptionLines(lines, asset_ids);
+
+    suite.assert_equal(3.0, static_cast<double>(portfolio.size()), 0.0, "Size");
+    suite.assert_equal(13.0, portfolio.getTotalQuantityForAsset("AAPL"), 0.0,
+                       "AAPL quantity");
+    if (portfolio.getInstruments()[1].first->getInstrumentType() !=
+        AmericanOption(OptionType::Put, 250.0, 0.5, "MSFT").getInstrumentType()) {
+      throw std::runtime_error("Expected an American line");
+    }
+
+    MarketData md("MSFT", 240.0, 0.05, 0.3);
+    suite.assert_equal(AmericanOption(OptionType::Put, 250.0, 0.5, "MSFT").price(md),
+                       portfolio.getInstruments()[1].first->price(md), 0.0,
+                       "Same option as constructed directly");
+    suite.assert_equal(2.0, static_cast<double>(portfolio.getColumns().groups().size()),
+                       0.0, "Columns kept in sync");
+  });
+
+  suite.run_test("Invalid option line leaves the portfolio unchanged", [&]() {
+    Portfolio portfolio;
+    portfolio.addOptionLines(lines, asset_ids);
+
+    const std::vector<double> bad_strike = {100.0, -1.0, 110.0};
+    OptionLineArrays bad = lines;
+    bad.strike = bad_strike.data();
+
+    bool threw = false;
+    try {
+      portfolio.addOptionLines(bad, asset_ids);
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected invalid strike to throw");
+    }
+
+    const std::vector<uint32_t> bad_index = {0, 2, 0};
+    bad = lines;
+    bad.asset_index = bad_index.data();
+    threw = false;
+    try {
+      portfolio.addOptionLines(bad, asset_ids);
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected out-of-range asset index to throw");
+    }
+
+    suite.assert_equal(3.0, static_cast<double>(portfolio.size()), 0.0, "Size");
+    suite.assert_equal(3.0, static_cast<double>(portfolio.getColumns().lineCount()),
+                       0.0, "Column lines");
+  });
+}
+
 int main() {
   TestSuite suite;
 
@@ -313,6 +631,11 @@ int main() {
   test_large_portfolio(suite);
   test_instrument_pricing_in_portfolio(suite);
   test_portfolio_ordering(suite);
+  test_compute_all_greeks(suite);
+  test_lattice_schemes(suite);
+  test_flat_tree(suite);
+  test_portfolio_columns(suite);
+  test_option_line_arrays(suite);
 
   suite.print_summary();
 
@@ -1,11 +1,32 @@
+#include "BlackScholes.h"
+#include "CorrelationModel.h"
 #include "Instrument.h"
 #include "MarketData.h"
+#include "PnLSink.h"
 #include "Portfolio.h"
+#include "PortfolioRegistry.h"
+#include "PricingCache.h"
+#include "ReturnsStore.h"
 #include "RiskEngine.h"
+#include "RiskJobQueue.h"
+#include "RunArena.h"
+#include "RunStats.h"
+#include "TailStatistics.h"
 #include "simple_test.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
 #include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <map>
 #include <memory>
+#include <numeric>
+#include <random>
+#include <thread>
 
 
 // Helper function to create market data
@@ -482,6 +503,2255 @@ void test_theta_time_decay(TestSuite &suite) {
   });
 }
 
+void test_parallel_simulation(TestSuite &suite) {
+  suite.run_test("Seeded VaR is identical across thread counts", [&]() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        3);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 95.0, 0.5, "AAPL"),
+        -2);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 150.0, 0.5, "GOOGL"),
+        4);
+
+    std::map<std::string, MarketData> market_data_map;
+    market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+    market_data_map["GOOGL"] = createMarketData("GOOGL", 150.0, 0.05, 0.25);
+
+    RiskEngine engine(5000);
+    engine.setRandomSeed(7);
+
+    engine.setNumThreads(1);
+    PortfolioRiskResult serial =
+        engine.calculatePortfolioRisk(portfolio, market_data_map);
+
+    engine.setNumThreads(4);
+    PortfolioRiskResult parallel =
+        engine.calculatePortfolioRisk(portfolio, market_data_map);
+
+    suite.assert_equal(serial.value_at_risk_95, parallel.value_at_risk_95, 0.0,
+                       "VaR 95%");
+    suite.assert_equal(serial.value_at_risk_99, parallel.value_at_risk_99, 0.0,
+                       "VaR 99%");
+    suite.assert_equal(serial.expected_shortfall_95,
+                       parallel.expected_shortfall_95, 0.0, "ES 95%");
+    suite.assert_equal(serial.expected_shortfall_99,
+                       parallel.expected_shortfall_99, 0.0, "ES 99%");
+  });
+
+  suite.run_test("Invalid thread count is rejected", [&]() {
+    RiskEngine engine;
+    bool threw = false;
+    try {
+      engine.setNumThreads(-1);
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Negative thread count should be rejected");
+    }
+  });
+}
+
+void test_shared_underlying_scenarios(TestSuite &suite) {
+  suite.run_test("Instruments on the same asset share scenario spots", [&]() {
+    Portfolio split_portfolio;
+    split_portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        1);
+    split_portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        1);
+
+    Portfolio merged_portfolio;
+    merged_portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        2);
+
+    std::map<std::string, MarketData> market_data_map;
+    market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+
+    RiskEngine engine;
+    engine.setRandomSeed(11);
+    PortfolioRiskResult split =
+        engine.calculatePortfolioRisk(split_portfolio, market_data_map);
+    PortfolioRiskResult merged =
+        engine.calculatePortfolioRisk(merged_portfolio, market_data_map);
+
+    // With one draw per underlying, two identical lines move together and
+    // give exactly the risk of a single line with the combined quantity.
+    suite.assert_equal(merged.value_at_risk_95, split.value_at_risk_95, 1e-9,
+                       "VaR 95%");
+    suite.assert_equal(merged.value_at_risk_99, split.value_at_risk_99, 1e-9,
+                       "VaR 99%");
+    suite.assert_equal(merged.expected_shortfall_99,
+                       split.expected_shortfall_99, 1e-9, "ES 99%");
+  });
+}
+
+// Forwards to a wrapped instrument without exposing ContractTerms, so the
+// engine has to price it through the virtual interface.
+class OpaqueInstrument : public Instrument {
+public:
+  explicit OpaqueInstrument(std::unique_ptr<Instrument> inner)
+      : inner_(std::move(inner)) {}
+
+  double price(const MarketData &md) const override { return inner_->price(md); }
+  double delta(const MarketData &md) const override { return inner_->delta(md); }
+  double gamma(const MarketData &md) const override { return inner_->gamma(md); }
+  double vega(const MarketData &md) const override { return inner_->vega(md); }
+  double theta(const MarketData &md) const override { return inner_->theta(md); }
+  std::string getAssetId() const override { return inner_->getAssetId(); }
+  std::string getInstrumentType() const override { return "Opaque"; }
+  bool isValid() const override { return inner_->isValid(); }
+
+private:
+  std::unique_ptr<Instrument> inner_;
+};
+
+void test_columnar_revaluation(TestSuite &suite) {
+  suite.run_test("Columnar pricing matches virtual pricing", [&]() {
+    auto make_lines = []() {
+      std::vector<std::pair<std::unique_ptr<Instrument>, int>> lines;
+      lines.emplace_back(
+          std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+          3);
+      auto binomial = std::make_unique<EuropeanOption>(
+          OptionType::Put, 95.0, 0.5, "MSFT", PricingModel::Binomial);
+      binomial->setBinomialSteps(25);
+      lines.emplace_back(std::move(binomial), -2);
+      auto merton = std::make_unique<EuropeanOption>(
+          OptionType::Call, 105.0, 0.75, "AAPL", PricingModel::MertonJumpDiffusion);
+      merton->setJumpParameters(0.5, -0.1, 0.15);
+      lines.emplace_back(std::move(merton), 1);
+      lines.emplace_back(
+          std::make_unique<AmericanOption>(OptionType::Put, 100.0, 1.0, "MSFT", 25),
+          4);
+      return lines;
+    };
+
+    Portfolio columnar;
+    for (auto &line : make_lines()) {
+      columnar.addInstrument(std::move(line.first), line.second);
+    }
+    Portfolio opaque;
+    for (auto &line : make_lines()) {
+      opaque.addInstrument(
+          std::make_unique<OpaqueInstrument>(std::move(line.first)), line.second);
+    }
+
+    if (columnar.getColumns().genericLines().size() != 0 ||
+        opaque.getColumns().genericLines().size() != 4) {
+      throw std::runtime_error("Unexpected generic line count");
+    }
+
+    std::map<std::string, MarketData> market_data_map;
+    market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+    market_data_map["MSFT"] = createMarketData("MSFT", 100.0, 0.03, 0.3);
+
+    RiskEngine engine(2000);
+    engine.setRandomSeed(19);
+    engine.setNumThreads(2);
+    PortfolioRiskResult fast =
+        engine.calculatePortfolioRisk(columnar, market_data_map);
+    PortfolioRiskResult slow =
+        engine.calculatePortfolioRisk(opaque, market_data_map);
+
+    suite.assert_equal(slow.total_pv, fast.total_pv, 1e-10, "PV");
+    suite.assert_equal(slow.value_at_risk_95, fast.value_at_risk_95, 1e-8,
+                       "VaR 95%");
+    suite.assert_equal(slow.value_at_risk_99, fast.value_at_risk_99, 1e-8,
+                       "VaR 99%");
+    suite.assert_equal(slow.expected_shortfall_99, fast.expected_shortfall_99,
+                       1e-8, "ES 99%");
+  });
+}
+
+void test_market_data_snapshot(TestSuite &suite) {
+  suite.run_test("Handles stay stable across removal", [&]() {
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", createMarketData("AAPL", 100.0, 0.05, 0.2));
+    manager.addMarketData("MSFT", createMarketData("MSFT", 250.0, 0.05, 0.3));
+
+    const uint32_t msft = manager.getHandle("MSFT");
+    suite.assert_equal(250.0, manager.getMarketDataByHandle(msft).spot_price,
+                       0.0, "Spot by handle");
+
+    manager.removeMarketData("AAPL");
+    if (manager.getHandle("AAPL") != AssetSymbolTable::npos ||
+        manager.hasMarketData("AAPL") || manager.size() != 1) {
+      throw std::runtime_error("Removed asset still visible");
+    }
+    suite.assert_equal(static_cast<double>(msft),
+                       static_cast<double>(manager.getHandle("MSFT")), 0.0,
+                       "MSFT handle");
+
+    manager.addMarketData("AAPL", createMarketData("AAPL", 101.0, 0.05, 0.2));
+    suite.assert_equal(101.0, manager.getMarketData("AAPL").spot_price, 0.0,
+                       "Re-added spot");
+    suite.assert_equal(2.0, static_cast<double>(manager.getAllMarketData().size()),
+                       0.0, "Map size");
+  });
+
+  suite.run_test("Snapshot overload matches the map overload", [&]() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        5);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"),
+        -3);
+
+    MarketDataManager manager;
+    manager.addMarketData("MSFT", createMarketData("MSFT", 250.0, 0.04, 0.3));
+    manager.addMarketData("AAPL", createMarketData("AAPL", 100.0, 0.05, 0.2));
+    manager.addMarketData("GOOG", createMarketData("GOOG", 140.0, 0.05, 0.25));
+
+    RiskEngine engine(4000);
+    engine.setRandomSeed(23);
+    PortfolioRiskResult by_map =
+        engine.calculatePortfolioRisk(portfolio, manager.getAllMarketData());
+    PortfolioRiskResult by_handle =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot());
+
+    suite.assert_equal(by_map.total_pv, by_handle.total_pv, 0.0, "PV");
+    suite.assert_equal(by_map.value_at_risk_99, by_handle.value_at_risk_99, 0.0,
+                       "VaR 99%");
+
+    manager.removeMarketData("MSFT");
+    bool threw = false;
+    try {
+      engine.calculatePortfolioRisk(portfolio, manager.getSnapshot());
+    } catch (const std::runtime_error &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected missing market data to throw");
+    }
+  });
+}
+
+void test_portfolio_registry(TestSuite &suite) {
+  auto two_line_portfolio = []() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        5);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"),
+        -3);
+    return portfolio;
+  };
+
+  suite.run_test("Registered portfolio tracks quantity and market updates", [&]() {
+    std::map<std::string, MarketData> market_data;
+    market_data["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+    market_data["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+
+    PortfolioRegistry registry;
+    const PortfolioRegistry::PortfolioId id =
+        registry.registerPortfolio(two_line_portfolio(), market_data);
+    registry.adjustQuantity(id, 0, 2);
+    registry.setQuantity(id, 1, -1);
+    registry.updateMarketData(id, createMarketData("AAPL", 104.0, 0.05, 0.22));
+
+    Portfolio expected;
+    expected.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        7);
+    expected.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"),
+        -1);
+    market_data["AAPL"] = createMarketData("AAPL", 104.0, 0.05, 0.22);
+
+    RiskEngine engine(4000);
+    engine.setRandomSeed(31);
+    PortfolioRiskResult direct = engine.calculatePortfolioRisk(expected, market_data);
+    PortfolioRiskResult warm = registry.calculateRisk(id, engine);
+
+    suite.assert_equal(direct.total_pv, warm.total_pv, 1e-9, "PV");
+    suite.assert_equal(direct.total_delta, warm.total_delta, 1e-9, "Delta");
+    suite.assert_equal(direct.value_at_risk_99, warm.value_at_risk_99, 1e-9,
+                       "VaR 99%");
+    suite.assert_equal(2.0, static_cast<double>(registry.lineCount(id)), 0.0,
+                       "Line count");
+  });
+
+  suite.run_test("Removed and unknown IDs are rejected", [&]() {
+    PortfolioRegistry registry;
+    std::map<std::string, MarketData> market_data;
+    market_data["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+    market_data["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+
+    const PortfolioRegistry::PortfolioId first =
+        registry.registerPortfolio(two_line_portfolio(), market_data);
+    registry.removePortfolio(first);
+    const PortfolioRegistry::PortfolioId second =
+        registry.registerPortfolio(two_line_portfolio(), market_data);
+    if (first == second || registry.contains(first) || registry.size() != 1) {
+      throw std::runtime_error("Removed ID should not be reused");
+    }
+
+    bool threw = false;
+    try {
+      registry.adjustQuantity(first, 0, 1);
+    } catch (const std::out_of_range &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected unknown ID to throw");
+    }
+
+    threw = false;
+    try {
+      registry.adjustQuantity(second, 2, 1);
+    } catch (const std::out_of_range &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected out-of-range line to throw");
+    }
+  });
+
+  suite.run_test("Quantity updates apply all or none", [&]() {
+    PortfolioRegistry registry;
+    std::map<std::string, MarketData> market_data;
+    market_data["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+    market_data["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+    const PortfolioRegistry::PortfolioId id =
+        registry.registerPortfolio(two_line_portfolio(), market_data);
+    RiskEngine engine(1000);
+    engine.setRandomSeed(3);
+    const double before = registry.calculateRisk(id, engine).total_pv;
+
+    // The second update overflows only after the first, so neither lands.
+    bool threw = false;
+    try {
+      registry.updateQuantities(id, {{0, INT_MAX - 10, false}, {0, 20, true}});
+    } catch (const std::overflow_error &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected the overflowing update to throw");
+    }
+    threw = false;
+    try {
+      registry.updateQuantities(id, {{1, 3, false}, {2, 1, true}});
+    } catch (const std::out_of_range &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected the out-of-range line to throw");
+    }
+    suite.assert_equal(before, registry.calculateRisk(id, engine).total_pv, 0.0,
+                       "Failed batches leave the portfolio alone");
+
+    PortfolioRegistry reference;
+    const PortfolioRegistry::PortfolioId ref_id =
+        reference.registerPortfolio(two_line_portfolio(), market_data);
+    reference.setQuantity(ref_id, 1, 4);
+    reference.adjustQuantity(ref_id, 0, 2);
+    reference.adjustQuantity(ref_id, 1, -1);
+    registry.updateQuantities(id, {{1, 4, false}, {0, 2, true}, {1, -1, true}});
+    suite.assert_equal(reference.calculateRisk(ref_id, engine).total_pv,
+                       registry.calculateRisk(id, engine).total_pv, 1e-9, "Updates apply in order");
+  });
+}
+
+void test_incremental_risk(TestSuite &suite) {
+  auto three_asset_portfolio = []() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        10);
+    portfolio.addInstrument(
+        std::make_unique<AmericanOption>(OptionType::Put, 95.0, 0.5, "AAPL"),
+        -4);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"),
+        6);
+    auto merton = std::make_unique<EuropeanOption>(OptionType::Call, 140.0,
+                                                   0.75, "GOOG");
+    merton->setPricingModel(PricingModel::MertonJumpDiffusion);
+    portfolio.addInstrument(std::move(merton), 3);
+    return portfolio;
+  };
+
+  auto check_matches = [&](const PortfolioRiskResult &expected,
+                           const PortfolioRiskResult &actual,
+                           const std::string &label) {
+    suite.assert_equal(expected.total_pv, actual.total_pv, 1e-9, label + " PV");
+    suite.assert_equal(expected.total_delta, actual.total_delta, 1e-9,
+                       label + " delta");
+    suite.assert_equal(expected.total_vega, actual.total_vega, 1e-9,
+                       label + " vega");
+    suite.assert_equal(expected.value_at_risk_95, actual.value_at_risk_95, 1e-9,
+                       label + " VaR 95%");
+    suite.assert_equal(expected.expected_shortfall_99,
+                       actual.expected_shortfall_99, 1e-9, label + " ES 99%");
+  };
+
+  suite.run_test("Only changed assets are repriced", [&]() {
+    Portfolio portfolio = three_asset_portfolio();
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", createMarketData("AAPL", 100.0, 0.05, 0.2));
+    manager.addMarketData("MSFT", createMarketData("MSFT", 250.0, 0.04, 0.3));
+    manager.addMarketData("GOOG", createMarketData("GOOG", 140.0, 0.05, 0.25));
+
+    RiskEngine engine(3000);
+    engine.setRandomSeed(17);
+    RiskRunCache cache;
+
+    PortfolioRiskResult first =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    check_matches(engine.calculatePortfolioRisk(portfolio, manager.getSnapshot()),
+                  first, "Cold");
+    suite.assert_equal(3.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Cold run reprices every asset");
+
+    manager.updateMarketData("MSFT", createMarketData("MSFT", 255.0, 0.04, 0.31));
+    PortfolioRiskResult tick =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    suite.assert_equal(1.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Tick reprices one asset");
+    check_matches(engine.calculatePortfolioRisk(portfolio, manager.getSnapshot()),
+                  tick, "After tick");
+
+    portfolio.updateQuantity(0, 12);
+    PortfolioRiskResult resized =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    suite.assert_equal(1.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Quantity change reprices its asset");
+    check_matches(engine.calculatePortfolioRisk(portfolio, manager.getSnapshot()),
+                  resized, "After quantity change");
+
+    engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    suite.assert_equal(0.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Unchanged inputs reprice nothing");
+  });
+
+  suite.run_test("Structure and settings changes rebuild the cache", [&]() {
+    Portfolio portfolio = three_asset_portfolio();
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", createMarketData("AAPL", 100.0, 0.05, 0.2));
+    manager.addMarketData("MSFT", createMarketData("MSFT", 250.0, 0.04, 0.3));
+    manager.addMarketData("GOOG", createMarketData("GOOG", 140.0, 0.05, 0.25));
+
+    RiskEngine engine(2000);
+    engine.setRandomSeed(5);
+    RiskRunCache cache;
+    engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+
+    engine.setVaRMethod(VaRMethod::DeltaGamma);
+    PortfolioRiskResult approx =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    suite.assert_equal(3.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Method change rebuilds");
+    const VaRApproximationReport cached_report = engine.getLastApproximationReport();
+    check_matches(engine.calculatePortfolioRisk(portfolio, manager.getSnapshot()),
+                  approx, "Delta-gamma");
+    suite.assert_equal(engine.getLastApproximationReport().full_var_99,
+                       cached_report.full_var_99, 1e-9, "Report full VaR 99%");
+
+    portfolio.removeInstrument(2);
+    PortfolioRiskResult smaller =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    suite.assert_equal(2.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Removing a line rebuilds");
+    check_matches(engine.calculatePortfolioRisk(portfolio, manager.getSnapshot()),
+                  smaller, "After removal");
+  });
+
+  suite.run_test("Editing a shared surface reprices its asset", [&]() {
+    Portfolio portfolio = three_asset_portfolio();
+    auto surface = std::make_shared<VolatilitySurface::ImpliedVolSurface>();
+    surface->addPoints({{200.0, 0.25, 0.32}, {280.0, 0.25, 0.28},
+                        {200.0, 1.0, 0.30}, {280.0, 1.0, 0.27}});
+    MarketData msft = createMarketData("MSFT", 250.0, 0.04, 0.3);
+    msft.vol_surface = surface;
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", createMarketData("AAPL", 100.0, 0.05, 0.2));
+    manager.addMarketData("MSFT", msft);
+    manager.addMarketData("GOOG", createMarketData("GOOG", 140.0, 0.05, 0.25));
+
+    RiskEngine engine(3000);
+    engine.setRandomSeed(17);
+    RiskRunCache cache;
+    engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+
+    const uint64_t before = surface->revision();
+    surface->addPoints({{240.0, 0.5, 0.45}});
+    if (surface->revision() == before) {
+      throw std::runtime_error("Adding quotes should change the revision");
+    }
+    PortfolioRiskResult edited =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    suite.assert_equal(1.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Surface edit reprices its asset");
+    check_matches(engine.calculatePortfolioRisk(portfolio, manager.getSnapshot()),
+                  edited, "After surface edit");
+  });
+}
+
+void test_pricing_cache(TestSuite &suite) {
+  auto duplicated_book = []() {
+    Portfolio portfolio;
+    for (int book = 0; book < 3; ++book) {
+      portfolio.addInstrument(
+          std::make_unique<AmericanOption>(OptionType::Put, 100.0, 0.5, "AAPL"),
+          5 + book);
+    }
+    portfolio.addInstrument(
+        std::make_unique<AmericanOption>(OptionType::Call, 110.0, 0.5, "AAPL"),
+        -2);
+    return portfolio;
+  };
+
+  suite.run_test("Duplicate lines and repeat calls hit the cache", [&]() {
+    Portfolio portfolio = duplicated_book();
+    std::map<std::string, MarketData> market_data;
+    market_data["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+
+    RiskEngine plain(2000);
+    plain.setRandomSeed(9);
+    PortfolioRiskResult expected = plain.calculatePortfolioRisk(portfolio, market_data);
+
+    auto cache = std::make_shared<PricingCache>();
+    RiskEngine engine(2000);
+    engine.setRandomSeed(9);
+    engine.setPricingCache(cache);
+    PortfolioRiskResult cold = engine.calculatePortfolioRisk(portfolio, market_data);
+
+    suite.assert_equal(expected.total_pv, cold.total_pv, 0.0, "PV");
+    suite.assert_equal(expected.total_gamma, cold.total_gamma, 0.0, "Gamma");
+    suite.assert_equal(expected.value_at_risk_99, cold.value_at_risk_99, 0.0,
+                       "VaR 99%");
+
+    // Two distinct contracts, each priced once for Greeks and once for
+    // today's scenario value.
+    PricingCacheStats stats = cache->stats();
+    suite.assert_equal(4.0, static_cast<double>(stats.misses), 0.0, "Cold misses");
+    suite.assert_equal(4.0, static_cast<double>(stats.hits), 0.0, "Cold hits");
+
+    PortfolioRiskResult warm = engine.calculatePortfolioRisk(portfolio, market_data);
+    stats = cache->stats();
+    suite.assert_equal(4.0, static_cast<double>(stats.misses), 0.0, "Warm misses");
+    suite.assert_equal(12.0, static_cast<double>(stats.hits), 0.0, "Warm hits");
+    suite.assert_equal(cold.total_pv, warm.total_pv, 0.0, "Warm PV");
+
+    market_data["AAPL"] = createMarketData("AAPL", 101.0, 0.05, 0.2);
+    engine.calculatePortfolioRisk(portfolio, market_data);
+    suite.assert_equal(8.0, static_cast<double>(cache->stats().misses), 0.0,
+                       "New spot misses");
+  });
+
+  suite.run_test("Capacity bounds the cache and quantum merges states", [&]() {
+    PricingCache bounded(32);
+    ContractTerms terms;
+    terms.strike = 100.0;
+    terms.time_to_expiry = 1.0;
+    PricingState state;
+    state.rate = 0.05;
+    state.vol = 0.2;
+    Greeks greeks;
+    for (int i = 0; i < 500; ++i) {
+      state.spot = 50.0 + i;
+      greeks.price = i;
+      bounded.insert(terms, state, PricingCache::Kind::Greeks, greeks);
+    }
+    const PricingCacheStats stats = bounded.stats();
+    if (stats.size > 32 || stats.evictions < 468) {
+      throw std::runtime_error("Cache grew past its capacity");
+    }
+
+    PricingCache quantized(1024, 0.01);
+    state.spot = 100.001;
+    greeks.price = 7.0;
+    quantized.insert(terms, state, PricingCache::Kind::Greeks, greeks);
+    state.spot = 100.004;
+    Greeks found;
+    if (!quantized.lookup(terms, state, PricingCache::Kind::Greeks, found)) {
+      throw std::runtime_error("Nearby state should share the quantized entry");
+    }
+    suite.assert_equal(7.0, found.price, 0.0, "Quantized price");
+    if (quantized.lookup(terms, state, PricingCache::Kind::ScenarioPrice, found)) {
+      throw std::runtime_error("Pricer kinds must not share entries");
+    }
+  });
+
+  suite.run_test("Quantized cache keeps today's value exact", [&]() {
+    Portfolio portfolio = duplicated_book();
+    std::map<std::string, MarketData> nearby;
+    nearby["AAPL"] = createMarketData("AAPL", 100.4, 0.05, 0.2);
+    std::map<std::string, MarketData> market_data;
+    market_data["AAPL"] = createMarketData("AAPL", 99.6, 0.05, 0.2);
+
+    RiskEngine plain(2000);
+    plain.setRandomSeed(9);
+    PortfolioRiskResult expected = plain.calculatePortfolioRisk(portfolio, market_data);
+
+    // Both spots round to 100, so only the Greeks may come from the warm-up.
+    auto cache = std::make_shared<PricingCache>(1024, 1.0);
+    RiskEngine engine(2000);
+    engine.setRandomSeed(9);
+    engine.setPricingCache(cache);
+    engine.calculatePortfolioRisk(portfolio, nearby);
+    PortfolioRiskResult result = engine.calculatePortfolioRisk(portfolio, market_data);
+
+    suite.assert_equal(expected.value_at_risk_95, result.value_at_risk_95, 0.0,
+                       "VaR 95%");
+    suite.assert_equal(expected.value_at_risk_99, result.value_at_risk_99, 0.0,
+                       "VaR 99%");
+    suite.assert_equal(expected.expected_shortfall_99, result.expected_shortfall_99,
+                       0.0, "ES 99%");
+  });
+}
+
+void test_vol_surface_pricing(TestSuite &suite) {
+  auto skewed_surface = []() {
+    auto surface = std::make_shared<VolatilitySurface::ImpliedVolSurface>();
+    surface->addPoints({{80.0, 0.5, 0.30}, {100.0, 0.5, 0.22}, {120.0, 0.5, 0.18},
+                        {80.0, 1.0, 0.28}, {100.0, 1.0, 0.21}, {120.0, 1.0, 0.17}});
+    return surface;
+  };
+
+  suite.run_test("Instruments price off the surface at their strike", [&]() {
+    MarketData md = createMarketData("AAPL", 100.0, 0.05, 0.2);
+    md.vol_surface = skewed_surface();
+
+    EuropeanOption low(OptionType::Put, 90.0, 0.75, "AAPL");
+    EuropeanOption high(OptionType::Call, 110.0, 0.75, "AAPL");
+
+    MarketData flat_low = createMarketData("AAPL", 100.0, 0.05,
+                                           md.volatilityFor(90.0, 0.75));
+    MarketData flat_high = createMarketData("AAPL", 100.0, 0.05,
+                                            md.volatilityFor(110.0, 0.75));
+
+    suite.assert_equal(low.price(flat_low), low.price(md), 0.0, "Low strike");
+    suite.assert_equal(high.price(flat_high), high.price(md), 0.0, "High strike");
+    suite.assert_equal(low.computeAll(flat_low).vega, low.computeAll(md).vega,
+                       0.0, "Greeks use the surface vol");
+  });
+
+  suite.run_test("Flat surface matches flat volatility", [&]() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 95.0, 1.0, "AAPL"), 10);
+    portfolio.addInstrument(
+        std::make_unique<AmericanOption>(OptionType::Put, 105.0, 0.5, "AAPL"), -4);
+
+    std::map<std::string, MarketData> flat_map;
+    flat_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.25);
+
+    auto surface = std::make_shared<VolatilitySurface::ImpliedVolSurface>();
+    surface->addPoints({{90.0, 0.5, 0.25}, {110.0, 0.5, 0.25},
+                        {90.0, 1.0, 0.25}, {110.0, 1.0, 0.25}});
+    std::map<std::string, MarketData> surface_map = flat_map;
+    surface_map["AAPL"].vol_surface = surface;
+
+    RiskEngine engine(3000);
+    engine.setRandomSeed(31);
+    engine.setVolOfVol(0.8);
+    PortfolioRiskResult flat = engine.calculatePortfolioRisk(portfolio, flat_map);
+    PortfolioRiskResult with_surface =
+        engine.calculatePortfolioRisk(portfolio, surface_map);
+
+    suite.assert_equal(flat.total_pv, with_surface.total_pv, 1e-12, "PV");
+    suite.assert_equal(flat.value_at_risk_99, with_surface.value_at_risk_99,
+                       1e-9, "VaR 99%");
+  });
+
+  suite.run_test("Skewed surface revalues each strike", [&]() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 85.0, 1.0, "AAPL"), 10);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 115.0, 1.0, "AAPL"), 10);
+
+    std::map<std::string, MarketData> market_data_map;
+    market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+    market_data_map["AAPL"].vol_surface = skewed_surface();
+    const MarketData &md = market_data_map["AAPL"];
+
+    double expected_pv = 0.0;
+    for (const auto &entry : portfolio.getInstruments()) {
+      expected_pv += entry.first->price(md) * entry.second;
+    }
+
+    RiskEngine engine(3000);
+    engine.setRandomSeed(5);
+    PortfolioRiskResult sticky_strike =
+        engine.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(expected_pv, sticky_strike.total_pv, 1e-10, "PV");
+
+    engine.setVolSurfaceDynamics(VolSurfaceDynamics::StickyMoneyness);
+    PortfolioRiskResult sticky_moneyness =
+        engine.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(sticky_strike.total_pv, sticky_moneyness.total_pv, 0.0,
+                       "Today's PV does not depend on dynamics");
+    if (sticky_strike.value_at_risk_99 == sticky_moneyness.value_at_risk_99) {
+      throw std::runtime_error("Sticky moneyness should move vols with spot");
+    }
+  });
+
+  suite.run_test("Unbuilt surface builds on first lookup", [&]() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"), 1);
+
+    auto surface = std::make_shared<VolatilitySurface::ImpliedVolSurface>();
+    surface->addPoint(100.0, 1.0, 0.2);
+    std::map<std::string, MarketData> market_data_map;
+    market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+    market_data_map["AAPL"].vol_surface = surface;
+
+    RiskEngine engine(100);
+    engine.setNumThreads(4);
+    const PortfolioRiskResult result = engine.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(BlackScholes::callPrice(100.0, 100.0, 0.05, 1.0, 0.2), result.total_pv,
+                       1e-12, "Priced off the surface");
+    if (!surface->isBuilt()) {
+      throw std::runtime_error("The lookup should have built the surface");
+    }
+
+    // A surface without data is still rejected.
+    market_data_map["AAPL"].vol_surface = std::make_shared<VolatilitySurface::ImpliedVolSurface>();
+    bool threw = false;
+    try {
+      engine.calculatePortfolioRisk(portfolio, market_data_map);
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected an empty surface to throw");
+    }
+  });
+}
+
+void test_approximate_var(TestSuite &suite) {
+  Portfolio portfolio;
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+      10);
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Put, 95.0, 0.5, "AAPL"),
+      -5);
+  portfolio.addInstrument(
+      std::make_unique<AmericanOption>(OptionType::Put, 150.0, 0.5, "GOOGL"),
+      8);
+
+  std::map<std::string, MarketData> market_data_map;
+  market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+  market_data_map["GOOGL"] = createMarketData("GOOGL", 150.0, 0.05, 0.25);
+
+  suite.run_test("Delta-gamma VaR tracks full revaluation", [&]() {
+    RiskEngine engine(20000);
+    engine.setRandomSeed(42);
+    PortfolioRiskResult full =
+        engine.calculatePortfolioRisk(portfolio, market_data_map);
+    if (engine.getLastApproximationReport().computed) {
+      throw std::runtime_error("Full revaluation should not fill the report");
+    }
+
+    engine.setVaRMethod(VaRMethod::DeltaGamma);
+    PortfolioRiskResult approx =
+        engine.calculatePortfolioRisk(portfolio, market_data_map);
+    const VaRApproximationReport &report = engine.getLastApproximationReport();
+
+    suite.assert_equal(full.value_at_risk_99, approx.value_at_risk_99,
+                       0.05 * full.value_at_risk_99, "VaR 99%");
+    suite.assert_equal(full.total_pv, approx.total_pv, 1e-10, "PV");
+    if (!report.computed || report.validation_paths != 1000) {
+      throw std::runtime_error("Approximation report should cover 1000 paths");
+    }
+    if (report.relative_rms_error > 0.05) {
+      throw std::runtime_error("Delta-gamma error too large: " +
+                               std::to_string(report.relative_rms_error));
+    }
+  });
+
+  suite.run_test("Vega term reduces error under vol shocks", [&]() {
+    RiskEngine engine(5000);
+    engine.setRandomSeed(3);
+    engine.setVolOfVol(1.5);
+
+    engine.setVaRMethod(VaRMethod::DeltaGamma);
+    engine.calculatePortfolioRisk(portfolio, market_data_map);
+    const double delta_gamma_error =
+        engine.getLastApproximationReport().relative_rms_error;
+
+    engine.setVaRMethod(VaRMethod::DeltaGammaVega);
+    engine.calculatePortfolioRisk(portfolio, market_data_map);
+    const double delta_gamma_vega_error =
+        engine.getLastApproximationReport().relative_rms_error;
+
+    if (delta_gamma_vega_error >= delta_gamma_error) {
+      throw std::runtime_error("Vega term should reduce approximation error");
+    }
+  });
+
+  suite.run_test("Approximation check can be disabled", [&]() {
+    RiskEngine engine(5000);
+    engine.setRandomSeed(3);
+    engine.setVaRMethod(VaRMethod::DeltaGamma);
+    engine.setApproximationCheckPaths(0);
+    engine.calculatePortfolioRisk(portfolio, market_data_map);
+    if (engine.getLastApproximationReport().computed) {
+      throw std::runtime_error("Report should be empty when checks are off");
+    }
+  });
+}
+
+void test_tail_measures(TestSuite &suite) {
+  suite.run_test("Tail measures match a fully sorted sample", [&]() {
+    std::mt19937 generator(5);
+    std::student_t_distribution<double> distribution(4.0);
+    std::vector<double> pnl(10007);
+    for (double &value : pnl) {
+      value = distribution(generator);
+    }
+
+    std::vector<double> sorted = pnl;
+    std::sort(sorted.begin(), sorted.end());
+
+    const std::vector<double> levels = {0.999, 0.95, 0.975, 0.99, 0.995};
+    std::vector<TailMeasure> measures =
+        TailStatistics::computeTailMeasures(pnl, levels);
+
+    for (size_t i = 0; i < levels.size(); ++i) {
+      const size_t index = TailStatistics::tailIndex(levels[i], sorted.size());
+      double tail_sum = 0.0;
+      for (size_t j = 0; j <= index; ++j) {
+        tail_sum += sorted[j];
+      }
+      suite.assert_equal(levels[i], measures[i].confidence, 0.0, "level");
+      suite.assert_equal(-sorted[index], measures[i].value_at_risk, 0.0, "VaR");
+      suite.assert_equal(-tail_sum / (index + 1),
+                         measures[i].expected_shortfall, 1e-12, "ES");
+    }
+  });
+
+  suite.run_test("Streamed tails match the whole sample", [&]() {
+    std::mt19937 generator(9);
+    std::student_t_distribution<double> distribution(3.0);
+    std::vector<double> pnl(10007);
+    for (double &value : pnl) {
+      value = distribution(generator);
+    }
+
+    const std::vector<double> levels = {0.95, 0.99, 0.9, 0.999};
+    std::vector<double> copy = pnl;
+    const std::vector<TailMeasure> expected = TailStatistics::computeTailMeasures(copy, levels);
+
+    // Feed the sample in uneven pieces, last piece first.
+    TailStatistics::TailAccumulator tails(levels, pnl.size());
+    std::vector<std::pair<size_t, size_t>> pieces;
+    for (size_t begin = 0; begin < pnl.size();) {
+      const size_t size = std::min(pnl.size() - begin, 1 + begin % 977);
+      pieces.emplace_back(begin, size);
+      begin += size;
+    }
+    for (auto it = pieces.rbegin(); it != pieces.rend(); ++it) {
+      tails.add(&pnl[it->first], it->second);
+    }
+
+    const std::vector<TailMeasure> streamed = tails.measures();
+    for (size_t i = 0; i < levels.size(); ++i) {
+      suite.assert_equal(expected[i].value_at_risk, streamed[i].value_at_risk, 0.0, "VaR");
+      suite.assert_equal(expected[i].expected_shortfall, streamed[i].expected_shortfall, 1e-12,
+                         "ES");
+    }
+
+    bool threw = false;
+    try {
+      tails.add(pnl.data(), 1);
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Values past the sample size should be rejected");
+    }
+  });
+
+  suite.run_test("Requested confidence levels are reported", [&]() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"),
+        5);
+
+    std::map<std::string, MarketData> market_data_map;
+    market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+
+    RiskEngine engine;
+    engine.setRandomSeed(42);
+    engine.setConfidenceLevels({0.99, 0.975, 0.999});
+    PortfolioRiskResult result =
+        engine.calculatePortfolioRisk(portfolio, market_data_map);
+
+    if (result.tail_measures.size() != 3) {
+      throw std::runtime_error("Expected one tail measure per level");
+    }
+    suite.assert_equal(result.value_at_risk_99,
+                       result.tail_measures[0].value_at_risk, 0.0, "VaR 99%");
+    suite.assert_equal(result.expected_shortfall_99,
+                       result.tail_measures[0].expected_shortfall, 1e-9,
+                       "ES 99%");
+    if (!(result.tail_measures[1].value_at_risk < result.value_at_risk_99 &&
+          result.tail_measures[2].value_at_risk > result.value_at_risk_99)) {
+      throw std::runtime_error("VaR should increase with confidence");
+    }
+  });
+
+  suite.run_test("Invalid confidence levels are rejected", [&]() {
+    RiskEngine engine;
+    bool threw = false;
+    try {
+      engine.setConfidenceLevels({0.95, 1.0});
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Confidence level of 1.0 should be rejected");
+    }
+  });
+}
+
+void test_variance_reduction(TestSuite &suite) {
+  auto two_asset_portfolio = []() {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 0.5, "AAPL"),
+        10);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 95.0, 0.25, "AAPL"),
+        -5);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 250.0, 0.5, "MSFT"),
+        4);
+    return portfolio;
+  };
+
+  suite.run_test("Sampling methods agree within their standard errors", [&]() {
+    Portfolio portfolio = two_asset_portfolio();
+    std::map<std::string, MarketData> market_data_map;
+    market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+    market_data_map["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+
+    auto run = [&](SamplingMethod method, bool control, int threads,
+                   VaRSamplingReport &report) {
+      RiskEngine engine(16384);
+      engine.setVaRTimeHorizonDays(10.0);
+      engine.setRandomSeed(3);
+      engine.setNumThreads(threads);
+      engine.setSamplingMethod(method);
+      engine.setUseControlVariate(control);
+      PortfolioRiskResult result =
+          engine.calculatePortfolioRisk(portfolio, market_data_map);
+      report = engine.getLastSamplingReport();
+      return result;
+    };
+
+    VaRSamplingReport base_report;
+    const PortfolioRiskResult base =
+        run(SamplingMethod::PseudoRandom, false, 1, base_report);
+    if (!base_report.computed || base_report.batches != 16 ||
+        !(base_report.var_99_standard_error > 0.0) ||
+        !(base_report.es_99_standard_error > 0.0)) {
+      throw std::runtime_error("Expected standard errors from 16 batches");
+    }
+
+    for (SamplingMethod method :
+         {SamplingMethod::PseudoRandom, SamplingMethod::Antithetic,
+          SamplingMethod::Sobol}) {
+      for (bool control : {false, true}) {
+        VaRSamplingReport report;
+        const PortfolioRiskResult result = run(method, control, 1, report);
+        if (report.control_variate != control || report.sampling_method != method) {
+          throw std::runtime_error("Report should describe the run");
+        }
+        const double var_tolerance =
+            5.0 * std::hypot(base_report.var_99_standard_error,
+                             report.var_99_standard_error);
+        const double es_tolerance =
+            5.0 * std::hypot(base_report.es_99_standard_error,
+                             report.es_99_standard_error);
+        suite.assert_equal(base.value_at_risk_99, result.value_at_risk_99,
+                           var_tolerance, "VaR 99%");
+        suite.assert_equal(base.expected_shortfall_99,
+                           result.expected_shortfall_99, es_tolerance, "ES 99%");
+      }
+    }
+
+    VaRSamplingReport serial_report;
+    VaRSamplingReport threaded_report;
+    const PortfolioRiskResult serial =
+        run(SamplingMethod::Sobol, true, 1, serial_report);
+    const PortfolioRiskResult threaded =
+        run(SamplingMethod::Sobol, true, 4, threaded_report);
+    suite.assert_equal(serial.value_at_risk_99, threaded.value_at_risk_99, 0.0,
+                       "Sobol VaR is independent of thread count");
+    suite.assert_equal(serial_report.es_99_standard_error,
+                       threaded_report.es_99_standard_error, 0.0,
+                       "Sobol standard error is independent of thread count");
+  });
+
+  suite.run_test("Controlled tail measures reweight to the control's tail", [&]() {
+    std::mt19937 generator(11);
+    std::normal_distribution<double> distribution(0.0, 2.0);
+    std::vector<double> pnl(20000);
+    for (double &value : pnl) {
+      value = distribution(generator);
+    }
+    const std::vector<double> levels = {0.95, 0.99};
+
+    // A control never in its own tail leaves the plain estimator.
+    const std::vector<double> far(pnl.size(), 1e9);
+    std::vector<double> copy = pnl;
+    const std::vector<TailMeasure> plain =
+        TailStatistics::computeTailMeasures(copy, levels);
+    const std::vector<TailMeasure> unweighted =
+        TailStatistics::computeControlledTailMeasures(pnl.data(), far.data(),
+                                                      pnl.size(), 2.0, levels);
+    for (size_t k = 0; k < levels.size(); ++k) {
+      suite.assert_equal(plain[k].value_at_risk, unweighted[k].value_at_risk,
+                         0.0, "Equal weights VaR");
+      suite.assert_equal(plain[k].expected_shortfall,
+                         unweighted[k].expected_shortfall, 1e-12,
+                         "Equal weights ES");
+    }
+
+    // With the P&L as its own control, VaR lands on the exact quantile
+    // and ES on the exact normal tail mean up to sampling noise of the
+    // tail's shape alone.
+    const std::vector<TailMeasure> exact =
+        TailStatistics::computeControlledTailMeasures(pnl.data(), pnl.data(),
+                                                      pnl.size(), 2.0, levels);
+    const double z95 = 1.6448536269514722;
+    const double z99 = 2.3263478740408408;
+    suite.assert_equal(2.0 * z95, exact[0].value_at_risk, 2e-3, "VaR 95%");
+    suite.assert_equal(2.0 * z99, exact[1].value_at_risk, 5e-3, "VaR 99%");
+    const double density95 = std::exp(-0.5 * z95 * z95) / std::sqrt(2.0 * M_PI);
+    suite.assert_equal(2.0 * density95 / 0.05, exact[0].expected_shortfall, 0.05,
+                       "ES 95%");
+  });
+
+  suite.run_test("Incremental risk matches under Sobol with a control variate", [&]() {
+    Portfolio portfolio = two_asset_portfolio();
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", createMarketData("AAPL", 100.0, 0.05, 0.2));
+    manager.addMarketData("MSFT", createMarketData("MSFT", 250.0, 0.04, 0.3));
+
+    RiskEngine engine(4000);
+    engine.setRandomSeed(23);
+    engine.setUseFixedSeed(true);
+    engine.setSamplingMethod(SamplingMethod::Sobol);
+    engine.setUseControlVariate(true);
+    RiskRunCache cache;
+
+    engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    manager.updateMarketData("MSFT", createMarketData("MSFT", 252.0, 0.04, 0.31));
+    const PortfolioRiskResult tick =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    suite.assert_equal(1.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Tick reprices one asset");
+    const double incremental_se = engine.getLastSamplingReport().var_99_standard_error;
+
+    const PortfolioRiskResult full =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot());
+    suite.assert_equal(full.value_at_risk_99, tick.value_at_risk_99, 1e-9, "VaR 99%");
+    suite.assert_equal(full.expected_shortfall_95, tick.expected_shortfall_95, 1e-9,
+                       "ES 95%");
+    suite.assert_equal(engine.getLastSamplingReport().var_99_standard_error,
+                       incremental_se, 1e-9, "Standard error");
+  });
+}
+
+void test_correlation(TestSuite &suite) {
+  auto expect_invalid = [](const std::function<void()> &build, const std::string &what) {
+    bool threw = false;
+    try {
+      build();
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("Expected invalid_argument for " + what);
+    }
+  };
+
+  suite.run_test("Shock factors reproduce their correlation", [&]() {
+    // Large enough that every tile of the block product has a ragged edge.
+    const size_t n = 150;
+    const size_t k = 3;
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<double> uniform(-0.55, 0.55);
+    std::vector<std::string> ids;
+    std::vector<double> loadings(n * k);
+    for (size_t i = 0; i < n; ++i) {
+      ids.push_back("A" + std::to_string(i));
+      for (size_t f = 0; f < k; ++f) {
+        loadings[i * k + f] = uniform(generator);
+      }
+    }
+    const CorrelationModel factor_model(ids, loadings, k);
+    std::vector<double> implied(n * n);
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        implied[i * n + j] = factor_model.correlation(i, j);
+      }
+    }
+    const CorrelationModel full_model(ids, implied);
+
+    // Unit draws make each path one column of the map, so summing
+    // products over paths gives back the correlation.
+    auto gram = [&](const ShockFactor &factor, size_t i, size_t j) {
+      const size_t draws = factor.draws();
+      const size_t stride = draws + 2;
+      std::vector<double> unit(draws * stride, 0.0);
+      for (size_t p = 0; p < draws; ++p) {
+        unit[p * stride + p] = 1.0;
+      }
+      std::vector<double> out(draws * factor.outputs());
+      factor.correlate(unit.data(), stride, draws, out.data());
+      double sum = 0.0;
+      for (size_t p = 0; p < draws; ++p) {
+        sum += out[p * factor.outputs() + i] * out[p * factor.outputs() + j];
+      }
+      return sum;
+    };
+
+    const auto full = full_model.factorFor(ids);
+    const auto factor = factor_model.factorFor(ids);
+    suite.assert_equal(0.0, static_cast<double>(full->factors()), 0.0, "Full matrix has no factors");
+    suite.assert_equal(static_cast<double>(k), static_cast<double>(factor->factors()), 0.0, "Factors");
+    for (auto [i, j] : {std::pair<size_t, size_t>{0, 0}, {3, 149}, {77, 12}, {128, 129}, {149, 149}}) {
+      const double expected = full_model.correlation(i, j);
+      suite.assert_equal(expected, gram(*full, i, j), 1e-12, "Cholesky correlation");
+      suite.assert_equal(expected, gram(*factor, i, j), 1e-12, "Factor correlation");
+    }
+
+    const std::vector<uint32_t> outputs = {140, 5, 70};
+    const ShockFactor selected = full->selectOutputs(outputs);
+    suite.assert_equal(full_model.correlation(140, 70), gram(selected, 0, 2), 1e-12,
+                       "Selected outputs keep their correlation");
+
+    std::vector<double> weights(n);
+    for (double &w : weights) {
+      w = uniform(generator);
+    }
+    suite.assert_equal(full->standardDeviation(weights.data()),
+                       factor->standardDeviation(weights.data()), 1e-10,
+                       "Exposure standard deviation");
+  });
+
+  Portfolio portfolio;
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 0.5, "AAPL"), 10);
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Call, 250.0, 0.5, "MSFT"), 4);
+  std::map<std::string, MarketData> market_data_map;
+  market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+  market_data_map["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+
+  auto run = [&](std::shared_ptr<CorrelationModel> model) {
+    RiskEngine engine(20000);
+    engine.setRandomSeed(41);
+    engine.setCorrelationModel(model);
+    return engine.calculatePortfolioRisk(portfolio, market_data_map);
+  };
+  auto pair_model = [](double rho) {
+    return std::make_shared<CorrelationModel>(
+        std::vector<std::string>{"MSFT", "AAPL"}, std::vector<double>{1.0, rho, rho, 1.0});
+  };
+
+  suite.run_test("Identity correlation leaves scenarios unchanged", [&]() {
+    const PortfolioRiskResult independent = run(nullptr);
+    const PortfolioRiskResult identity = run(pair_model(0.0));
+    suite.assert_equal(independent.value_at_risk_99, identity.value_at_risk_99, 0.0, "VaR 99%");
+    suite.assert_equal(independent.expected_shortfall_95, identity.expected_shortfall_95, 0.0,
+                       "ES 95%");
+  });
+
+  suite.run_test("Correlation drives the VaR of a long book", [&]() {
+    const PortfolioRiskResult diversified = run(pair_model(-0.9));
+    const PortfolioRiskResult independent = run(nullptr);
+    const PortfolioRiskResult concentrated = run(pair_model(0.9));
+    if (!(diversified.value_at_risk_99 < independent.value_at_risk_99 &&
+          independent.value_at_risk_99 < concentrated.value_at_risk_99)) {
+      throw std::runtime_error("VaR should grow with correlation");
+    }
+
+    const double cov = 0.9 * 0.2 * 0.3;
+    const auto covariance = std::make_shared<CorrelationModel>(
+        std::vector<std::string>{"MSFT", "AAPL"}, std::vector<double>{0.09, cov, cov, 0.04},
+        CorrelationModel::MatrixType::Covariance);
+    suite.assert_equal(concentrated.value_at_risk_99, run(covariance).value_at_risk_99, 1e-9,
+                       "Covariance reduces to the same correlation");
+  });
+
+  suite.run_test("Correlation factors are built once per asset list", [&]() {
+    const auto model = std::make_shared<CorrelationModel>(
+        std::vector<std::string>{"GOOG", "MSFT", "AAPL"},
+        std::vector<double>{1.0, 0.5, 0.4, 0.5, 1.0, 0.6, 0.4, 0.6, 1.0});
+    suite.assert_equal(1.0, static_cast<double>(model->factorizations()), 0.0, "Model's own factor");
+
+    RiskEngine engine(2000);
+    engine.setRandomSeed(3);
+    engine.setCorrelationModel(model);
+    const PortfolioRiskResult first = engine.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(2.0, static_cast<double>(model->factorizations()), 0.0, "Portfolio subset");
+    const PortfolioRiskResult second = engine.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(2.0, static_cast<double>(model->factorizations()), 0.0, "Reused");
+    suite.assert_equal(first.value_at_risk_99, second.value_at_risk_99, 0.0, "Same scenarios");
+    model->factorFor({"GOOG", "MSFT", "AAPL"});
+    suite.assert_equal(2.0, static_cast<double>(model->factorizations()), 0.0, "Model order");
+  });
+
+  suite.run_test("Incremental risk matches under a factor model", [&]() {
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", createMarketData("AAPL", 100.0, 0.05, 0.2));
+    manager.addMarketData("MSFT", createMarketData("MSFT", 250.0, 0.04, 0.3));
+
+    RiskEngine engine(4000);
+    engine.setRandomSeed(8);
+    engine.setUseControlVariate(true);
+    engine.setCorrelationModel(std::make_shared<CorrelationModel>(
+        std::vector<std::string>{"AAPL", "MSFT"}, std::vector<double>{0.7, 0.2, 0.8, -0.1}, 2));
+    RiskRunCache cache;
+
+    engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    manager.updateMarketData("AAPL", createMarketData("AAPL", 97.0, 0.05, 0.22));
+    const PortfolioRiskResult tick =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    suite.assert_equal(1.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Tick reprices one asset");
+
+    const PortfolioRiskResult full =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot());
+    suite.assert_equal(full.value_at_risk_99, tick.value_at_risk_99, 1e-9, "VaR 99%");
+    suite.assert_equal(full.expected_shortfall_99, tick.expected_shortfall_99, 1e-9, "ES 99%");
+  });
+
+  suite.run_test("Invalid correlation inputs are rejected", [&]() {
+    const std::vector<std::string> three = {"A", "B", "C"};
+    expect_invalid([&]() {
+      CorrelationModel(three, {1.0, 0.9, 0.9, 0.9, 1.0, -0.9, 0.9, -0.9, 1.0});
+    }, "a matrix that is not positive semi-definite");
+    expect_invalid([&]() { CorrelationModel(three, {1.0, 0.0, 0.0, 1.0}); }, "a wrong size");
+    expect_invalid([&]() { CorrelationModel({"A", "B"}, {1.0, 0.3, 0.2, 1.0}); }, "asymmetry");
+    expect_invalid([&]() { CorrelationModel({"A", "B"}, {2.0, 0.3, 0.3, 1.0}); }, "a diagonal of 2");
+    expect_invalid([&]() { CorrelationModel({"A", "A"}, {1.0, 0.3, 0.3, 1.0}); }, "duplicate assets");
+    expect_invalid([&]() {
+      CorrelationModel({"A", "B"}, {0.0, 0.0, 0.0, 1.0}, CorrelationModel::MatrixType::Covariance);
+    }, "a zero variance");
+    expect_invalid([&]() { CorrelationModel({"A", "B"}, {0.8, 0.7, 0.1, 0.1}, 2); },
+                   "loadings above unit variance");
+    expect_invalid([&]() { CorrelationModel({"A"}, std::vector<double>{}, 0); }, "zero factors");
+
+    // Perfect correlation is semi-definite and allowed.
+    CorrelationModel perfect({"A", "B"}, {1.0, 1.0, 1.0, 1.0});
+    suite.assert_equal(1.0, perfect.correlation(0, 1), 0.0, "Perfect correlation");
+  });
+}
+
+void test_pnl_streaming(TestSuite &suite) {
+  Portfolio portfolio;
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"), 10);
+  portfolio.addInstrument(
+      std::make_unique<AmericanOption>(OptionType::Put, 95.0, 0.5, "AAPL"), -4);
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"), 6);
+  std::map<std::string, MarketData> market_data_map;
+  market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+  market_data_map["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+  const size_t paths = 5000;
+
+  auto streamed_run = [&](VaRMethod method, int threads, std::shared_ptr<PnLSink> sink) {
+    RiskEngine engine(static_cast<int>(paths));
+    engine.setRandomSeed(21);
+    engine.setNumThreads(threads);
+    engine.setVaRMethod(method);
+    engine.setPnLSink(std::move(sink));
+    return engine.calculatePortfolioRisk(portfolio, market_data_map);
+  };
+
+  suite.run_test("Buffer sink receives the distribution behind the VaR", [&]() {
+    for (VaRMethod method : {VaRMethod::FullRevaluation, VaRMethod::DeltaGamma}) {
+      std::vector<double> buffer(paths * 3, std::nan(""));
+      const PortfolioRiskResult result = streamed_run(
+          method, 3, std::make_shared<PnLBufferSink>(buffer.data(), paths, 3));
+
+      std::vector<double> totals(paths);
+      for (size_t p = 0; p < paths; ++p) {
+        totals[p] = buffer[p * 3];
+        suite.assert_equal(totals[p], buffer[p * 3 + 1] + buffer[p * 3 + 2], 1e-9,
+                           "Asset breakdown sums to the total");
+      }
+      std::vector<TailMeasure> expected =
+          TailStatistics::computeTailMeasures(totals, {0.95, 0.99});
+      suite.assert_equal(expected[0].value_at_risk, result.value_at_risk_95, 0.0, "VaR 95%");
+      suite.assert_equal(expected[1].expected_shortfall, result.expected_shortfall_99, 1e-9,
+                         "ES 99%");
+
+      // Streaming does not change the run.
+      const PortfolioRiskResult plain = streamed_run(method, 1, nullptr);
+      suite.assert_equal(plain.value_at_risk_99, result.value_at_risk_99, 0.0, "Unstreamed VaR 99%");
+      suite.assert_equal(plain.expected_shortfall_95, result.expected_shortfall_95, 1e-9,
+                         "Unstreamed ES 95%");
+    }
+  });
+
+  suite.run_test("File and callback sinks see every path once", [&]() {
+    const std::string path = std::filesystem::temp_directory_path().string() + "/qe_pnl.bin";
+    streamed_run(VaRMethod::FullRevaluation, 4, std::make_shared<PnLFileSink>(path));
+
+    std::vector<uint8_t> seen(paths, 0);
+    std::vector<double> from_callback(paths);
+    std::atomic<bool> inside{false};
+    auto callback = std::make_shared<PnLCallbackSink>([&](const PnLChunk &chunk) {
+      if (inside.exchange(true)) {
+        throw std::runtime_error("Sink called concurrently");
+      }
+      for (size_t p = 0; p < chunk.paths; ++p) {
+        seen[chunk.first_path + p] += 1;
+        from_callback[chunk.first_path + p] = chunk.pnl[p];
+      }
+      inside = false;
+    });
+    streamed_run(VaRMethod::FullRevaluation, 4, callback);
+    if (std::count(seen.begin(), seen.end(), 1) != static_cast<long>(paths)) {
+      throw std::runtime_error("Every path should be streamed exactly once");
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    char magic[8];
+    uint64_t header[3];
+    file.read(magic, sizeof(magic));
+    file.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (std::string(magic, 8) != "QEPNL001" || header[0] != paths || header[1] != 0) {
+      throw std::runtime_error("Unexpected P&L file header");
+    }
+    std::vector<double> from_file(paths);
+    file.seekg(static_cast<std::streamoff>(header[2]));
+    file.read(reinterpret_cast<char *>(from_file.data()), paths * sizeof(double));
+    if (!file || from_file != from_callback) {
+      throw std::runtime_error("P&L file should hold the run in path order");
+    }
+    std::remove(path.c_str());
+  });
+
+  suite.run_test("Runs that stop early abort their sink", [&]() {
+    // A file sink that calls back after each chunk and counts how runs end.
+    class EndingSink : public PnLFileSink {
+    public:
+      EndingSink(const std::string &path, std::function<void()> after_write)
+          : PnLFileSink(path), after_write_(std::move(after_write)) {}
+      void write(const PnLChunk &chunk) override {
+        PnLFileSink::write(chunk);
+        after_write_();
+      }
+      void finish() override {
+        ++finished;
+        PnLFileSink::finish();
+      }
+      void abort() noexcept override {
+        ++aborted;
+        PnLFileSink::abort();
+      }
+      int finished = 0;
+      int aborted = 0;
+
+    private:
+      std::function<void()> after_write_;
+    };
+
+    const std::string path = std::filesystem::temp_directory_path().string() + "/qe_pnl_aborted.bin";
+    auto control = std::make_shared<RunControl>();
+    auto cancelling = std::make_shared<EndingSink>(path, [&]() { control->cancel(); });
+    RiskEngine engine(static_cast<int>(paths));
+    engine.setRandomSeed(21);
+    engine.setRunControl(control);
+    engine.setPnLSink(cancelling);
+    bool cancelled = false;
+    try {
+      engine.calculatePortfolioRisk(portfolio, market_data_map);
+    } catch (const RiskRunCancelled &) {
+      cancelled = true;
+    }
+    if (!cancelled || cancelling->aborted != 1 || cancelling->finished != 0) {
+      throw std::runtime_error("A cancelled run should abort its sink");
+    }
+    if (std::filesystem::exists(path)) {
+      throw std::runtime_error("An aborted run should not leave a partial file");
+    }
+
+    // The cached overload streams its recombined distribution separately.
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", market_data_map["AAPL"]);
+    manager.addMarketData("MSFT", market_data_map["MSFT"]);
+    auto throwing = std::make_shared<EndingSink>(path, []() {
+      throw std::runtime_error("Sink failed");
+    });
+    RiskEngine cached_engine(static_cast<int>(paths));
+    cached_engine.setPnLSink(throwing);
+    RiskRunCache cache;
+    bool failed = false;
+    try {
+      cached_engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    } catch (const std::runtime_error &) {
+      failed = true;
+    }
+    if (!failed || throwing->aborted != 1 || throwing->finished != 0 ||
+        std::filesystem::exists(path)) {
+      throw std::runtime_error("A sink that throws should be aborted");
+    }
+  });
+
+  suite.run_test("Incremental runs stream the recombined distribution", [&]() {
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", market_data_map["AAPL"]);
+    manager.addMarketData("MSFT", market_data_map["MSFT"]);
+    std::vector<double> incremental(paths * 3);
+    std::vector<double> full(paths * 3);
+
+    RiskEngine engine(static_cast<int>(paths));
+    engine.setRandomSeed(21);
+    engine.setPnLSink(std::make_shared<PnLBufferSink>(incremental.data(), paths, 3));
+    RiskRunCache cache;
+    engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    manager.updateMarketData("MSFT", createMarketData("MSFT", 246.0, 0.04, 0.31));
+    engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+
+    engine.setPnLSink(std::make_shared<PnLBufferSink>(full.data(), paths, 3));
+    engine.calculatePortfolioRisk(portfolio, manager.getSnapshot());
+    for (size_t i = 0; i < full.size(); i += 997) {
+      suite.assert_equal(full[i], incremental[i], 1e-9, "Streamed P&L");
+    }
+
+    bool threw = false;
+    try {
+      engine.setPnLSink(std::make_shared<PnLBufferSink>(full.data(), paths - 1, 3));
+      engine.calculatePortfolioRisk(portfolio, manager.getSnapshot());
+    } catch (const std::exception &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("A buffer too small for the run should be rejected");
+    }
+  });
+}
+
+void test_historical_var(TestSuite &suite) {
+  const std::string dir = std::filesystem::temp_directory_path().string();
+  const std::vector<int32_t> dates = {20240102, 20240103, 20240104, 20240105,
+                                      20240108, 20240109, 20240110, 20240111};
+  // AAPL has no price on its first day.
+  const std::vector<double> returns = {
+      std::nan(""), 0.012, -0.031, 0.004, -0.018, 0.026, -0.007, -0.042,
+      0.003, -0.011, 0.021, -0.025, 0.008, 0.014, -0.019, 0.006};
+  const std::vector<std::string> ids = {"AAPL", "MSFT"};
+
+  Portfolio portfolio;
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"), 10);
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"), 4);
+  const MarketData aapl = createMarketData("AAPL", 100.0, 0.05, 0.2);
+  const MarketData msft = createMarketData("MSFT", 250.0, 0.04, 0.3);
+
+  suite.run_test("Returns files round-trip through the memory map", [&]() {
+    const std::string path = dir + "/qe_returns_f64.bin";
+    ReturnsStore::write(path, ids, dates, returns, ReturnsStore::ValueType::Float64);
+    ReturnsStore store(path);
+    suite.assert_equal(2.0, static_cast<double>(store.assetCount()), 0.0, "Assets");
+    suite.assert_equal(8.0, static_cast<double>(store.dateCount()), 0.0, "Dates");
+    suite.assert_equal(1.0, static_cast<double>(store.findAsset("MSFT")), 0.0, "Asset lookup");
+    if (store.findAsset("GOOG") != ReturnsStore::npos || store.assetId(0) != "AAPL") {
+      throw std::runtime_error("Unexpected asset table");
+    }
+    suite.assert_equal(20240110.0, static_cast<double>(store.date(6)), 0.0, "Date");
+    suite.assert_equal(0.021, store.value(1, 2), 0.0, "Float64 value");
+    if (!std::isnan(store.value(0, 0))) {
+      throw std::runtime_error("Missing day should read back as NaN");
+    }
+
+    std::vector<double> windows(6);
+    store.windowReturns(0, 0, 6, 3, windows.data());
+    suite.assert_equal(0.012 - 0.031, windows[0], 1e-15, "Window over a missing day");
+    suite.assert_equal(-0.018 + 0.026 - 0.007, windows[4], 1e-15, "Window");
+
+    const std::string path32 = dir + "/qe_returns_f32.bin";
+    ReturnsStore::write(path32, ids, dates, returns);
+    ReturnsStore store32(path32);
+    if (store32.valueType() != ReturnsStore::ValueType::Float32) {
+      throw std::runtime_error("Expected a float32 store");
+    }
+    suite.assert_equal(static_cast<double>(static_cast<float>(0.021)), store32.value(1, 2), 0.0,
+                       "Float32 value");
+    std::remove(path.c_str());
+    std::remove(path32.c_str());
+  });
+
+  suite.run_test("Historical VaR reprices every window", [&]() {
+    const std::string path = dir + "/qe_returns_var.bin";
+    ReturnsStore::write(path, ids, dates, returns, ReturnsStore::ValueType::Float64);
+    auto store = std::make_shared<ReturnsStore>(path);
+
+    RiskEngine engine;
+    engine.setVaRTimeHorizonDays(2.0);
+    engine.setHistoricalReturns(store, 7);
+    std::map<std::string, MarketData> market_data_map = {{"AAPL", aapl}, {"MSFT", msft}};
+    const PortfolioRiskResult result = engine.calculatePortfolioRisk(portfolio, market_data_map);
+
+    // The last 7 days give 6 overlapping two-day windows.
+    auto value = [&](double aapl_move, double msft_move) {
+      MarketData a = aapl;
+      MarketData m = msft;
+      a.spot_price *= std::exp(aapl_move);
+      m.spot_price *= std::exp(msft_move);
+      return 10.0 * portfolio.getInstruments()[0].first->price(a) +
+             4.0 * portfolio.getInstruments()[1].first->price(m);
+    };
+    const double today = value(0.0, 0.0);
+    std::vector<double> pnl;
+    for (size_t k = 1; k + 2 <= dates.size(); ++k) {
+      pnl.push_back(value(returns[k] + returns[k + 1], returns[8 + k] + returns[8 + k + 1]) - today);
+    }
+    const std::vector<TailMeasure> expected = TailStatistics::computeTailMeasures(pnl, {0.95, 0.99});
+    suite.assert_equal(expected[0].value_at_risk, result.value_at_risk_95, 1e-9, "VaR 95%");
+    suite.assert_equal(expected[1].expected_shortfall, result.expected_shortfall_99, 1e-9, "ES 99%");
+
+    const VaRSamplingReport &report = engine.getLastSamplingReport();
+    if (!report.historical || report.batches != 0 || report.control_variate) {
+      throw std::runtime_error("Historical runs report one batch and no control variate");
+    }
+    std::remove(path.c_str());
+  });
+
+  suite.run_test("Incremental risk matches under historical returns", [&]() {
+    const std::string path = dir + "/qe_returns_incremental.bin";
+    ReturnsStore::write(path, ids, dates, returns);
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", aapl);
+    manager.addMarketData("MSFT", msft);
+
+    RiskEngine engine;
+    engine.setVaRMethod(VaRMethod::DeltaGamma);
+    engine.setUseControlVariate(true);
+    engine.setHistoricalReturns(std::make_shared<ReturnsStore>(path));
+    RiskRunCache cache;
+
+    engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    manager.updateMarketData("MSFT", createMarketData("MSFT", 244.0, 0.04, 0.32));
+    const PortfolioRiskResult tick =
+        engine.calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    suite.assert_equal(1.0, static_cast<double>(cache.lastRepricedAssets()), 0.0,
+                       "Tick reprices one asset");
+
+    const PortfolioRiskResult full = engine.calculatePortfolioRisk(portfolio, manager.getSnapshot());
+    suite.assert_equal(full.value_at_risk_95, tick.value_at_risk_95, 1e-9, "VaR 95%");
+    suite.assert_equal(full.expected_shortfall_99, tick.expected_shortfall_99, 1e-9, "ES 99%");
+    std::remove(path.c_str());
+  });
+
+  suite.run_test("Invalid returns files and settings are rejected", [&]() {
+    auto expect_throw = [](const std::function<void()> &run, const std::string &what) {
+      bool threw = false;
+      try {
+        run();
+      } catch (const std::exception &) {
+        threw = true;
+      }
+      if (!threw) {
+        throw std::runtime_error("Expected an exception for " + what);
+      }
+    };
+
+    const std::string path = dir + "/qe_returns_corrupt.bin";
+    ReturnsStore::write(path, ids, dates, returns);
+    {
+      std::ofstream truncate(path, std::ios::binary | std::ios::in | std::ios::out);
+      truncate.seekp(24);
+      const uint64_t too_many_dates = 1000000;
+      truncate.write(reinterpret_cast<const char *>(&too_many_dates), sizeof(too_many_dates));
+    }
+    expect_throw([&]() { ReturnsStore store(path); }, "sections past the end of the file");
+    {
+      std::ofstream garbage(path, std::ios::binary | std::ios::trunc);
+      garbage << std::string(128, 'x');
+    }
+    expect_throw([&]() { ReturnsStore store(path); }, "a bad magic");
+    expect_throw([&]() { ReturnsStore store(dir + "/qe_returns_missing.bin"); }, "a missing file");
+    expect_throw([&]() { ReturnsStore::write(path, ids, {2, 1}, {0.0, 0.0, 0.0, 0.0}); },
+                 "descending dates");
+
+    ReturnsStore::write(path, {"AAPL"}, dates, std::vector<double>(returns.begin(), returns.begin() + 8));
+    auto store = std::make_shared<ReturnsStore>(path);
+    RiskEngine engine;
+    expect_throw([&]() { engine.setHistoricalReturns(store, 9); }, "a lookback beyond the store");
+    engine.setHistoricalReturns(store);
+    std::map<std::string, MarketData> market_data_map = {{"AAPL", aapl}, {"MSFT", msft}};
+    expect_throw([&]() { engine.calculatePortfolioRisk(portfolio, market_data_map); },
+                 "an asset without returns");
+    engine.setVaRTimeHorizonDays(1.5);
+    Portfolio single;
+    single.addInstrument(std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"), 1);
+    expect_throw([&]() { engine.calculatePortfolioRisk(single, market_data_map); },
+                 "a fractional horizon");
+    std::remove(path.c_str());
+  });
+}
+
+void test_risk_contributions(TestSuite &suite) {
+  // One line per asset, so a sink's asset breakdown is the line breakdown.
+  Portfolio portfolio;
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"), 10);
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"), -6);
+  std::map<std::string, MarketData> market_data_map;
+  market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+  market_data_map["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+  const size_t paths = 6000;
+
+  auto make_engine = [&](VaRMethod method, int threads) {
+    auto engine = std::make_unique<RiskEngine>(static_cast<int>(paths));
+    engine->setRandomSeed(33);
+    engine->setNumThreads(threads);
+    engine->setVaRMethod(method);
+    engine->setComputeContributions(true);
+    return engine;
+  };
+
+  suite.run_test("Components add up to the run's VaR and ES", [&]() {
+    for (VaRMethod method : {VaRMethod::FullRevaluation, VaRMethod::DeltaGamma}) {
+      std::vector<double> buffer(paths * 3);
+      auto engine = make_engine(method, 3);
+      engine->setPnLSink(std::make_shared<PnLBufferSink>(buffer.data(), paths, 3));
+      const PortfolioRiskResult result = engine->calculatePortfolioRisk(portfolio, market_data_map);
+      const VaRContributionReport &report = engine->getLastContributionReport();
+      if (!report.computed || report.levels.size() != 2) {
+        throw std::runtime_error("Expected contributions at 95% and 99%");
+      }
+
+      const RiskContribution &at_95 = report.levels[0];
+      const RiskContribution &at_99 = report.levels[1];
+      suite.assert_equal(result.value_at_risk_95, at_95.value_at_risk, 0.0, "VaR 95%");
+      suite.assert_equal(result.expected_shortfall_99, at_99.expected_shortfall, 1e-9, "ES 99%");
+      for (const RiskContribution &level : report.levels) {
+        suite.assert_equal(level.value_at_risk, level.component_var[0] + level.component_var[1],
+                           1e-6, "Component VaR sums to the VaR");
+        suite.assert_equal(level.expected_shortfall, level.component_es[0] + level.component_es[1],
+                           1e-6, "Component ES sums to the ES");
+        suite.assert_equal(level.component_es[1] / -6.0, level.marginal_es[1], 1e-12,
+                           "Marginal ES is per unit of quantity");
+      }
+
+      // Component ES is minus each line's mean P&L over the worst paths.
+      std::vector<size_t> order(paths);
+      std::iota(order.begin(), order.end(), 0);
+      std::sort(order.begin(), order.end(),
+                [&](size_t a, size_t b) { return buffer[a * 3] < buffer[b * 3]; });
+      const size_t tail = TailStatistics::tailIndex(0.99, paths) + 1;
+      double aapl_tail = 0.0;
+      for (size_t r = 0; r < tail; ++r) {
+        aapl_tail += buffer[order[r] * 3 + 1];
+      }
+      suite.assert_equal(-aapl_tail / tail, at_99.component_es[0], 1e-9, "AAPL component ES 99%");
+    }
+  });
+
+  suite.run_test("A single line carries the whole VaR", [&]() {
+    Portfolio single;
+    single.addInstrument(
+        std::make_unique<AmericanOption>(OptionType::Put, 95.0, 0.5, "AAPL"), 8);
+    auto engine = make_engine(VaRMethod::FullRevaluation, 2);
+    const PortfolioRiskResult result = engine->calculatePortfolioRisk(single, market_data_map);
+    const RiskContribution &at_95 = engine->getLastContributionReport().levels[0];
+    suite.assert_equal(result.value_at_risk_95, at_95.component_var[0], 1e-9, "Component VaR");
+    suite.assert_equal(result.expected_shortfall_95, at_95.component_es[0], 1e-9, "Component ES");
+    suite.assert_equal(at_95.component_var[0] / 8.0, at_95.marginal_var[0], 1e-12, "Marginal VaR");
+  });
+
+  suite.run_test("Contributions do not depend on the thread count", [&]() {
+    auto one = make_engine(VaRMethod::FullRevaluation, 1);
+    auto four = make_engine(VaRMethod::FullRevaluation, 4);
+    one->setConfidenceLevels({0.975});
+    four->setConfidenceLevels({0.975});
+    one->calculatePortfolioRisk(portfolio, market_data_map);
+    four->calculatePortfolioRisk(portfolio, market_data_map);
+    const VaRContributionReport &a = one->getLastContributionReport();
+    const VaRContributionReport &b = four->getLastContributionReport();
+    if (b.levels.size() != 3) {
+      throw std::runtime_error("Requested levels should be allocated too");
+    }
+    for (size_t i = 0; i < a.levels.size(); ++i) {
+      for (size_t line = 0; line < 2; ++line) {
+        suite.assert_equal(a.levels[i].component_var[line], b.levels[i].component_var[line], 0.0,
+                           "Component VaR");
+        suite.assert_equal(a.levels[i].component_es[line], b.levels[i].component_es[line], 0.0,
+                           "Component ES");
+      }
+    }
+
+    one->setComputeContributions(false);
+    one->calculatePortfolioRisk(portfolio, market_data_map);
+    if (one->getLastContributionReport().computed) {
+      throw std::runtime_error("Contributions are off once disabled");
+    }
+  });
+
+  suite.run_test("Cached runs fall back to a full run for contributions", [&]() {
+    MarketDataManager manager;
+    manager.addMarketData("AAPL", market_data_map["AAPL"]);
+    manager.addMarketData("MSFT", market_data_map["MSFT"]);
+    RiskRunCache cache;
+    auto cached = make_engine(VaRMethod::FullRevaluation, 2);
+    const PortfolioRiskResult result =
+        cached->calculatePortfolioRisk(portfolio, manager.getSnapshot(), cache);
+    auto plain = make_engine(VaRMethod::FullRevaluation, 2);
+    const PortfolioRiskResult expected = plain->calculatePortfolioRisk(portfolio, market_data_map);
+
+    const VaRContributionReport &report = cached->getLastContributionReport();
+    if (!report.computed || report.levels.size() != 2) {
+      throw std::runtime_error("A cached run should still compute contributions");
+    }
+    suite.assert_equal(expected.value_at_risk_99, result.value_at_risk_99, 0.0, "VaR 99%");
+    for (size_t line = 0; line < 2; ++line) {
+      suite.assert_equal(plain->getLastContributionReport().levels[1].component_es[line],
+                         report.levels[1].component_es[line], 0.0, "Component ES 99%");
+    }
+    if (!cache.empty()) {
+      throw std::runtime_error("A full run should leave the cache alone");
+    }
+  });
+}
+
+void test_batch_risk(TestSuite &suite) {
+  auto make_book = [](int scale) {
+    Portfolio book;
+    book.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"), 10 * scale);
+    book.addInstrument(
+        std::make_unique<AmericanOption>(OptionType::Put, 95.0, 0.5, "AAPL"), -4 * scale);
+    book.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"), 6);
+    return book;
+  };
+  Portfolio desk_a = make_book(1);
+  Portfolio desk_b = make_book(-2);
+  desk_b.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Call, 260.0, 0.25, "MSFT"), 3);
+  std::map<std::string, MarketData> market_data_map;
+  market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+  market_data_map["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+
+  auto make_engine = [](VaRMethod method, int threads) {
+    RiskEngine engine(4000);
+    engine.setRandomSeed(17);
+    engine.setNumThreads(threads);
+    engine.setVaRMethod(method);
+    engine.setConfidenceLevels({0.975});
+    return engine;
+  };
+
+  suite.run_test("A batch of one book matches its own run", [&]() {
+    for (VaRMethod method : {VaRMethod::FullRevaluation, VaRMethod::DeltaGamma}) {
+      RiskEngine engine = make_engine(method, 3);
+      const PortfolioRiskResult alone = engine.calculatePortfolioRisk(desk_a, market_data_map);
+      const BatchRiskResult batch = engine.calculateBatchRisk({&desk_a}, market_data_map);
+      const PortfolioRiskResult &book = batch.books.at(0);
+      suite.assert_equal(alone.total_pv, book.total_pv, 1e-9, "PV");
+      suite.assert_equal(alone.total_delta, book.total_delta, 1e-9, "Delta");
+      suite.assert_equal(alone.value_at_risk_95, book.value_at_risk_95, 1e-9, "VaR 95%");
+      suite.assert_equal(alone.expected_shortfall_99, book.expected_shortfall_99, 1e-9, "ES 99%");
+      suite.assert_equal(alone.tail_measures[0].value_at_risk, book.tail_measures[0].value_at_risk,
+                         1e-9, "VaR 97.5%");
+      suite.assert_equal(book.value_at_risk_99, batch.total.value_at_risk_99, 0.0,
+                         "One book is the firm");
+    }
+  });
+
+  suite.run_test("Shared contracts are priced once for the firm", [&]() {
+    RiskEngine engine = make_engine(VaRMethod::FullRevaluation, 2);
+    const BatchRiskResult batch = engine.calculateBatchRisk({&desk_a, &desk_b}, market_data_map);
+    suite.assert_equal(4.0, static_cast<double>(batch.distinct_lines), 0.0, "Distinct lines");
+    suite.assert_equal(batch.books[0].total_pv + batch.books[1].total_pv, batch.total.total_pv, 1e-9,
+                       "Firm PV");
+
+    // The firm is the book holding every line of both desks.
+    Portfolio firm = make_book(-1);
+    firm.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"), 6);
+    firm.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 260.0, 0.25, "MSFT"), 3);
+    const PortfolioRiskResult alone = engine.calculatePortfolioRisk(firm, market_data_map);
+    suite.assert_equal(alone.total_gamma, batch.total.total_gamma, 1e-9, "Firm gamma");
+    suite.assert_equal(alone.value_at_risk_99, batch.total.value_at_risk_99, 1e-8, "Firm VaR 99%");
+    suite.assert_equal(alone.expected_shortfall_95, batch.total.expected_shortfall_95, 1e-8,
+                       "Firm ES 95%");
+    if (!engine.getLastSamplingReport().computed) {
+      throw std::runtime_error("Batch runs report the firm's sampling");
+    }
+  });
+
+  suite.run_test("Batch results do not depend on the thread count", [&]() {
+    RiskEngine one = make_engine(VaRMethod::FullRevaluation, 1);
+    RiskEngine four = make_engine(VaRMethod::FullRevaluation, 4);
+    const BatchRiskResult a = one.calculateBatchRisk({&desk_a, &desk_b}, market_data_map);
+    const BatchRiskResult b = four.calculateBatchRisk({&desk_a, &desk_b}, market_data_map);
+    for (size_t k = 0; k < 2; ++k) {
+      suite.assert_equal(a.books[k].value_at_risk_95, b.books[k].value_at_risk_95, 0.0, "VaR 95%");
+      suite.assert_equal(a.books[k].expected_shortfall_99, b.books[k].expected_shortfall_99, 0.0,
+                         "ES 99%");
+    }
+    suite.assert_equal(a.total.value_at_risk_99, b.total.value_at_risk_99, 0.0, "Firm VaR 99%");
+  });
+
+  suite.run_test("Empty and missing books", [&]() {
+    RiskEngine engine = make_engine(VaRMethod::FullRevaluation, 2);
+    Portfolio empty;
+    const BatchRiskResult batch = engine.calculateBatchRisk({&empty, &desk_a}, market_data_map);
+    suite.assert_equal(0.0, batch.books[0].value_at_risk_95, 0.0, "Empty book has no VaR");
+    suite.assert_equal(batch.books[1].value_at_risk_95, batch.total.value_at_risk_95, 0.0,
+                       "Firm is the other book");
+
+    bool threw = false;
+    try {
+      engine.calculateBatchRisk({&desk_a, nullptr}, market_data_map);
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    if (!threw) {
+      throw std::runtime_error("A null book should be rejected");
+    }
+  });
+}
+
+void test_run_stats(TestSuite &suite) {
+  Portfolio portfolio;
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"), 5);
+  portfolio.addInstrument(
+      std::make_unique<AmericanOption>(OptionType::Put, 240.0, 0.5, "MSFT", 25), -2);
+  auto merton = std::make_unique<EuropeanOption>(
+      OptionType::Call, 105.0, 0.75, "AAPL", PricingModel::MertonJumpDiffusion);
+  merton->setJumpParameters(0.5, -0.1, 0.15);
+  portfolio.addInstrument(std::move(merton), 3);
+  std::map<std::string, MarketData> market_data_map;
+  market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+  market_data_map["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+  const int paths = 3000;
+
+  auto make_engine = [&](int threads, SamplingMethod sampling) {
+    RiskEngine engine(paths);
+    engine.setRandomSeed(17);
+    engine.setUseFixedSeed(true);
+    engine.setNumThreads(threads);
+    engine.setSamplingMethod(sampling);
+    engine.setCollectRunStats(true);
+    return engine;
+  };
+
+  suite.run_test("Run stats time the phases and count the hot paths", [&]() {
+    RiskEngine engine = make_engine(3, SamplingMethod::PseudoRandom);
+    engine.calculatePortfolioRisk(portfolio, market_data_map);
+    const RiskRunStats &stats = engine.getLastRunStats();
+    if (!RunStats::kCompiled) {
+      if (stats.collected) {
+        throw std::runtime_error("Stats collected without QE_RUN_STATS");
+      }
+      return;
+    }
+    if (!stats.collected) {
+      throw std::runtime_error("Expected run stats");
+    }
+    suite.assert_equal(paths, static_cast<double>(stats.paths), 0.0, "Paths");
+    for (double phase : {stats.validation_ms, stats.greeks_ms, stats.base_value_ms,
+                         stats.simulation_ms, stats.tail_ms}) {
+      if (phase < 0.0 || phase > stats.total_ms) {
+        throw std::runtime_error("Every phase lies within the run");
+      }
+    }
+    if (stats.simulation_ms <= 0.0) {
+      throw std::runtime_error("Simulation takes time");
+    }
+
+    // One price per line and path, plus today's values and Greeks.
+    const RunCounters &counters = stats.counters;
+    for (uint64_t prices : {counters.black_scholes_prices, counters.lattice_prices,
+                            counters.merton_prices}) {
+      if (prices <= static_cast<uint64_t>(paths)) {
+        throw std::runtime_error("Every model prices on every path");
+      }
+    }
+    suite.assert_equal(26.0 * 27.0 / 2.0 * counters.lattice_prices,
+                       static_cast<double>(counters.lattice_nodes), 0.0, "Nodes of 25-step lattices");
+    suite.assert_equal(2.0 * paths, static_cast<double>(counters.rng_draws), 0.0,
+                       "One draw per asset and path");
+  });
+
+  suite.run_test("Counters do not depend on the thread count", [&]() {
+    if (!RunStats::kCompiled) {
+      return;
+    }
+    RiskEngine serial = make_engine(1, SamplingMethod::PseudoRandom);
+    RiskEngine threaded = make_engine(4, SamplingMethod::PseudoRandom);
+    serial.calculatePortfolioRisk(portfolio, market_data_map);
+    threaded.calculatePortfolioRisk(portfolio, market_data_map);
+    const RunCounters &a = serial.getLastRunStats().counters;
+    const RunCounters &b = threaded.getLastRunStats().counters;
+    suite.assert_equal(static_cast<double>(a.black_scholes_prices),
+                       static_cast<double>(b.black_scholes_prices), 0.0, "Black-Scholes prices");
+    suite.assert_equal(static_cast<double>(a.lattice_nodes), static_cast<double>(b.lattice_nodes),
+                       0.0, "Lattice nodes");
+    suite.assert_equal(static_cast<double>(a.merton_prices), static_cast<double>(b.merton_prices),
+                       0.0, "Merton prices");
+    suite.assert_equal(static_cast<double>(a.rng_draws), static_cast<double>(b.rng_draws), 0.0,
+                       "RNG draws");
+
+    RiskEngine antithetic = make_engine(2, SamplingMethod::Antithetic);
+    antithetic.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(static_cast<double>(paths), static_cast<double>(
+                           antithetic.getLastRunStats().counters.rng_draws),
+                       0.0, "Mirrored paths draw nothing");
+  });
+
+  suite.run_test("Stats are off by default and leave results unchanged", [&]() {
+    RiskEngine plain(paths);
+    plain.setRandomSeed(17);
+    plain.setUseFixedSeed(true);
+    plain.setNumThreads(3);
+    const PortfolioRiskResult without = plain.calculatePortfolioRisk(portfolio, market_data_map);
+    if (plain.getCollectRunStats() || plain.getLastRunStats().collected) {
+      throw std::runtime_error("Stats should be off by default");
+    }
+
+    RiskEngine engine = make_engine(3, SamplingMethod::PseudoRandom);
+    const PortfolioRiskResult with = engine.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(without.value_at_risk_99, with.value_at_risk_99, 0.0, "VaR 99%");
+    suite.assert_equal(without.expected_shortfall_95, with.expected_shortfall_95, 0.0, "ES 95%");
+
+    // Every call starts afresh, the batch form included.
+    Portfolio empty;
+    engine.calculatePortfolioRisk(empty, market_data_map);
+    suite.assert_equal(0.0, static_cast<double>(engine.getLastRunStats().counters.rng_draws), 0.0,
+                       "An empty run counts nothing");
+    engine.calculateBatchRisk({&portfolio, &portfolio}, market_data_map);
+    if (RunStats::kCompiled) {
+      suite.assert_equal(paths, static_cast<double>(engine.getLastRunStats().paths), 0.0,
+                         "Batch paths");
+    }
+    engine.setCollectRunStats(false);
+    engine.calculatePortfolioRisk(portfolio, market_data_map);
+    if (engine.getLastRunStats().collected) {
+      throw std::runtime_error("A run without stats clears the last ones");
+    }
+  });
+}
+
+void test_run_arenas(TestSuite &suite) {
+  suite.run_test("A run arena hands out aligned memory and reuses it after reset", [&]() {
+    RunArena arena;
+    void *first = arena.allocate(24, alignof(double));
+    void *aligned = arena.allocate(100, 64);
+    if (reinterpret_cast<uintptr_t>(aligned) % 64 != 0) {
+      throw std::runtime_error("Allocation is not aligned");
+    }
+    if (first == aligned || arena.heapAllocations() == 0) {
+      throw std::runtime_error("A cold arena spills to the heap");
+    }
+    arena.reset();
+    if (arena.capacity() < 124) {
+      throw std::runtime_error("Reset keeps a block big enough for the last run");
+    }
+    void *warm_first = arena.allocate(24, alignof(double));
+    void *warm_aligned = arena.allocate(100, 64);
+    if (warm_first == nullptr || reinterpret_cast<uintptr_t>(warm_aligned) % 64 != 0) {
+      throw std::runtime_error("A warm arena hands out the same aligned memory");
+    }
+    suite.assert_equal(0.0, static_cast<double>(arena.heapAllocations()), 0.0,
+                       "A warm arena serves the same run from its block");
+  });
+
+  Portfolio portfolio;
+  portfolio.addInstrument(
+      std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"), 5);
+  portfolio.addInstrument(
+      std::make_unique<AmericanOption>(OptionType::Put, 240.0, 0.5, "MSFT", 25), -2);
+  std::map<std::string, MarketData> market_data_map;
+  market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+  market_data_map["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+
+  suite.run_test("A warm engine runs without growing its arenas", [&]() {
+    RiskEngine engine(4000);
+    engine.setRandomSeed(5);
+    engine.setUseFixedSeed(true);
+    engine.setNumThreads(2);
+    engine.setCollectRunStats(true);
+    const PortfolioRiskResult cold = engine.calculatePortfolioRisk(portfolio, market_data_map);
+    const PortfolioRiskResult warm = engine.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(cold.value_at_risk_99, warm.value_at_risk_99, 0.0, "VaR 99%");
+    suite.assert_equal(cold.expected_shortfall_95, warm.expected_shortfall_95, 0.0, "ES 95%");
+
+    // A copy gets arenas of its own and the same results.
+    RiskEngine copy = engine;
+    const PortfolioRiskResult copied = copy.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(cold.value_at_risk_95, copied.value_at_risk_95, 0.0, "Copied VaR 95%");
+
+    if (!RunStats::kCompiled) {
+      return;
+    }
+    const RiskRunStats &stats = engine.getLastRunStats();
+    if (stats.arena_bytes == 0) {
+      throw std::runtime_error("The run should take its scratch from the arenas");
+    }
+    suite.assert_equal(0.0, static_cast<double>(stats.arena_heap_blocks), 0.0,
+                       "Heap blocks of a warm run");
+  });
+}
+
+// Polls until ready() holds, failing the test rather than hanging if it
+// does not within a generous deadline.
+template <typename Ready>
+void waitUntil(Ready ready, const std::string &what) {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+  while (!ready()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      throw std::runtime_error("Timed out waiting until " + what);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+// A job that keeps its worker busy until it is cancelled.
+std::shared_ptr<RiskJob> submitBlocker(RiskJobQueue &queue,
+                                       const std::map<std::string, MarketData> &market_data) {
+  Portfolio slow;
+  slow.addInstrument(
+      std::make_unique<AmericanOption>(OptionType::Put, 100.0, 1.0, "AAPL", 400), 1);
+  RiskEngine engine(200000);
+  std::shared_ptr<RiskJob> job = queue.submit(engine, std::move(slow), market_data, 100);
+  waitUntil([&] { return job->status() != RiskJobStatus::Queued; }, "the blocker starts");
+  if (job->status() != RiskJobStatus::Running) {
+    throw std::runtime_error("The blocker job should still be running");
+  }
+  return job;
+}
+
+void test_risk_jobs(TestSuite &suite) {
+  std::map<std::string, MarketData> market_data_map;
+  market_data_map["AAPL"] = createMarketData("AAPL", 100.0, 0.05, 0.2);
+  market_data_map["MSFT"] = createMarketData("MSFT", 250.0, 0.04, 0.3);
+  auto make_portfolio = [] {
+    Portfolio portfolio;
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Call, 100.0, 1.0, "AAPL"), 10);
+    portfolio.addInstrument(
+        std::make_unique<EuropeanOption>(OptionType::Put, 240.0, 0.5, "MSFT"), -4);
+    return portfolio;
+  };
+
+  suite.run_test("Interval estimates match the tail measures", [&]() {
+    std::mt19937 rng(11);
+    std::normal_distribution<double> normal(0.0, 1.0);
+    std::vector<double> sample(20000);
+    for (double &x : sample) {
+      x = normal(rng);
+    }
+    const std::vector<double> levels = {0.9, 0.99};
+    std::vector<double> exact = sample;
+    const std::vector<TailMeasure> measures = TailStatistics::computeTailMeasures(exact, levels);
+    std::vector<double> partial = sample;
+    const std::vector<TailEstimate> estimates = TailStatistics::estimateTailMeasures(partial, levels);
+    std::vector<double> small(sample.begin(), sample.begin() + 2000);
+    const std::vector<TailEstimate> early = TailStatistics::estimateTailMeasures(small, levels);
+
+    for (size_t k = 0; k < levels.size(); ++k) {
+      const TailEstimate &e = estimates[k];
+      suite.assert_equal(measures[k].value_at_risk, e.value_at_risk, 0.0, "VaR");
+      suite.assert_equal(measures[k].expected_shortfall, e.expected_shortfall, 1e-12, "ES");
+      if (!(e.var_lower < e.value_at_risk && e.value_at_risk < e.var_upper) ||
+          !(e.es_lower < e.expected_shortfall && e.expected_shortfall < e.es_upper)) {
+        throw std::runtime_error("Estimates should lie inside their intervals");
+      }
+      // Standard normal: VaR 90% = 1.2816, ES 90% = 1.7550, VaR 99% =
+      // 2.3263, ES 99% = 2.6652.
+      const double var_true = k == 0 ? 1.2816 : 2.3263;
+      const double es_true = k == 0 ? 1.7550 : 2.6652;
+      if (var_true < e.var_lower || var_true > e.var_upper || es_true < e.es_lower ||
+          es_true > e.es_upper) {
+        throw std::runtime_error("Intervals should cover the true measures");
+      }
+      if (e.var_upper - e.var_lower >= early[k].var_upper - early[k].var_lower ||
+          e.es_upper - e.es_lower >= early[k].es_upper - early[k].es_lower) {
+        throw std::runtime_error("Intervals should narrow as the sample grows");
+      }
+    }
+  });
+
+  suite.run_test("A cancelled run control stops the run", [&]() {
+    RiskEngine engine(5000);
+    auto control = std::make_shared<RunControl>();
+    engine.setRunControl(control);
+    const Portfolio portfolio = make_portfolio();
+    engine.calculatePortfolioRisk(portfolio, market_data_map);
+    suite.assert_equal(5000.0, static_cast<double>(control->pathsDone()), 0.0, "Paths done");
+    suite.assert_equal(5000.0, static_cast<double>(control->pathsTotal()), 0.0, "Paths total");
+
+    control->cancel();
+    bool cancelled = false;
+    try {
+      engine.calculatePortfolioRisk(portfolio, market_data_map);
+    } catch (const RiskRunCancelled &) {
+      cancelled = true;
+    }
+    if (!cancelled) {
+      throw std::runtime_error("The run should throw RiskRunCancelled");
+    }
+    suite.assert_equal(0.0, static_cast<double>(control->pathsDone()), 0.0,
+                       "Paths done after cancelling");
+  });
+
+  suite.run_test("A job matches the synchronous run", [&]() {
+    RiskEngine engine(20000);
+    engine.setRandomSeed(21);
+    engine.setUseFixedSeed(true);
+    engine.setNumThreads(2);
+    const PortfolioRiskResult expected = engine.calculatePortfolioRisk(make_portfolio(), market_data_map);
+
+    RiskJobQueue queue(2);
+    std::shared_ptr<RiskJob> job = queue.submit(engine, make_portfolio(), market_data_map);
+    const PortfolioRiskResult result = job->wait();
+    suite.assert_equal(expected.total_pv, result.total_pv, 0.0, "PV");
+    suite.assert_equal(expected.value_at_risk_95, result.value_at_risk_95, 0.0, "VaR 95%");
+    suite.assert_equal(expected.expected_shortfall_99, result.expected_shortfall_99, 1e-9, "ES 99%");
+
+    const RiskJobProgress progress = job->progress();
+    if (progress.status != RiskJobStatus::Completed || !job->error().empty()) {
+      throw std::runtime_error("The job should have completed");
+    }
+    suite.assert_equal(20000.0, static_cast<double>(progress.paths_done), 0.0, "Paths done");
+    suite.assert_equal(20000.0, static_cast<double>(progress.paths_total), 0.0, "Paths total");
+    suite.assert_equal(2.0, static_cast<double>(progress.estimates.size()), 0.0, "Estimates");
+    const TailEstimate &var_99 = progress.estimates[1];
+    suite.assert_equal(expected.value_at_risk_99, var_99.value_at_risk, 1e-9, "Estimated VaR 99%");
+    if (!(var_99.var_lower <= var_99.value_at_risk && var_99.value_at_risk <= var_99.var_upper)) {
+      throw std::runtime_error("VaR should lie inside its interval");
+    }
+    suite.assert_equal(engine.getLastSamplingReport().var_99_standard_error,
+                       job->engine().getLastSamplingReport().var_99_standard_error, 0.0,
+                       "The job's engine keeps its reports");
+  });
+
+  suite.run_test("Jobs start by priority, then in submission order", [&]() {
+    RiskJobQueue queue(1);
+    RiskEngine engine(2000);
+    std::shared_ptr<RiskJob> blocker = submitBlocker(queue, market_data_map);
+    std::shared_ptr<RiskJob> low = queue.submit(engine, make_portfolio(), market_data_map, -1);
+    std::shared_ptr<RiskJob> first = queue.submit(engine, make_portfolio(), market_data_map, 0);
+    std::shared_ptr<RiskJob> second = queue.submit(engine, make_portfolio(), market_data_map, 0);
+    std::shared_ptr<RiskJob> high = queue.submit(engine, make_portfolio(), market_data_map, 5);
+    suite.assert_equal(4.0, static_cast<double>(queue.queuedCount()), 0.0, "Queued behind the blocker");
+
+    blocker->cancel();
+    low->wait();
+    // One worker, so every job that finished before low started ahead of it.
+    if (!high->finished() || !first->finished() || !second->finished()) {
+      throw std::runtime_error("The lowest priority job should start last");
+    }
+    second->wait();
+    if (!first->finished()) {
+      throw std::runtime_error("Equal priorities should start in submission order");
+    }
+    if (high->progress().status != RiskJobStatus::Completed) {
+      throw std::runtime_error("Jobs behind a cancelled one should still run");
+    }
+  });
+
+  suite.run_test("Queued and running jobs can be cancelled", [&]() {
+    RiskJobQueue queue(1, 1);
+    RiskEngine engine(2000);
+    std::shared_ptr<RiskJob> running = submitBlocker(queue, market_data_map);
+    std::shared_ptr<RiskJob> queued = queue.submit(engine, make_portfolio(), market_data_map);
+    bool full = false;
+    try {
+      queue.submit(engine, make_portfolio(), market_data_map);
+    } catch (const std::runtime_error &) {
+      full = true;
+    }
+    if (!full) {
+      throw std::runtime_error("The queue should be full");
+    }
+
+    // A cancelled job frees its place at once.
+    if (!queued->cancel() || queued->status() != RiskJobStatus::Cancelled) {
+      throw std::runtime_error("A queued job should cancel at once");
+    }
+    std::shared_ptr<RiskJob> next = queue.submit(engine, make_portfolio(), market_data_map);
+
+    waitUntil([&] { return running->finished() || running->progress().paths_done > 0; },
+              "the blocker reports paths");
+    if (running->finished()) {
+      throw std::runtime_error("The blocker job should still be running");
+    }
+    const RiskJobProgress started = running->progress();
+    if (started.estimates.empty()) {
+      throw std::runtime_error("A running job should report partial estimates");
+    }
+    if (!running->cancel()) {
+      throw std::runtime_error("A running job should accept the cancel");
+    }
+    bool cancelled = false;
+    try {
+      running->wait();
+    } catch (const RiskRunCancelled &) {
+      cancelled = true;
+    }
+    const RiskJobProgress stopped = running->progress();
+    if (!cancelled || stopped.status != RiskJobStatus::Cancelled ||
+        stopped.paths_done >= stopped.paths_total || stopped.estimates.empty()) {
+      throw std::runtime_error("A running job should stop early with its partial estimates");
+    }
+    if (running->cancel()) {
+      throw std::runtime_error("A finished job cannot be cancelled");
+    }
+
+    next->wait();
+    if (!queue.release(next->id()) || queue.contains(next->id())) {
+      throw std::runtime_error("A finished job should be released");
+    }
+    bool unknown = false;
+    try {
+      queue.job(next->id());
+    } catch (const std::out_of_range &) {
+      unknown = true;
+    }
+    if (!unknown) {
+      throw std::runtime_error("A released job should be unknown");
+    }
+    suite.assert_equal(2.0, static_cast<double>(queue.jobs().size()), 0.0, "Jobs kept");
+  });
+
+  suite.run_test("Failed jobs report their error", [&]() {
+    RiskJobQueue queue(1);
+    RiskEngine engine(2000);
+    std::shared_ptr<RiskJob> job = queue.submit(engine, make_portfolio(), {});
+    bool failed = false;
+    try {
+      job->wait();
+    } catch (const std::runtime_error &) {
+      failed = true;
+    }
+    if (!failed || job->status() != RiskJobStatus::Failed || job->error().empty()) {
+      throw std::runtime_error("A job without market data should fail");
+    }
+  });
+}
+
 int main() {
   TestSuite suite;
 
@@ -502,6 +2772,25 @@ int main() {
   test_expected_shortfall_properties(suite);
   test_expected_shortfall_scaling(suite);
   test_theta_time_decay(suite);
+  test_parallel_simulation(suite);
+  test_shared_underlying_scenarios(suite);
+  test_columnar_revaluation(suite);
+  test_market_data_snapshot(suite);
+  test_portfolio_registry(suite);
+  test_incremental_risk(suite);
+  test_pricing_cache(suite);
+  test_vol_surface_pricing(suite);
+  test_approximate_var(suite);
+  test_tail_measures(suite);
+  test_variance_reduction(suite);
+  test_correlation(suite);
+  test_historical_var(suite);
+  test_pnl_streaming(suite);
+  test_risk_contributions(suite);
+  test_batch_risk(suite);
+  test_run_stats(suite);
+  test_run_arenas(suite);
+  test_risk_jobs(suite);
 
   suite.print_summary();
 
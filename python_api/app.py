@@ -5,7 +5,9 @@ import traceback
 from typing import Dict, Any, Optional, List
 from datetime import datetime
 from market_data_fetcher import get_market_data_fetcher, MarketDataCache
+from collections import OrderedDict
 import os
+import threading
 
 app = Flask(__name__)
 CORS(app)
@@ -13,6 +15,83 @@ CORS(app)
 DEFAULT_VAR_SIMULATIONS = 10000
 DEFAULT_VAR_CONFIDENCE = 0.95
 DEFAULT_VAR_TIME_HORIZON = 1.0
+DEFAULT_VAR_THREADS = int(os.environ.get("VAR_THREADS", 1))
+DEFAULT_VAR_METHOD = 'full'
+DEFAULT_VAR_SAMPLING = 'pseudo_random'
+PRICING_CACHE_CAPACITY = int(os.environ.get("PRICING_CACHE_CAPACITY", 65536))
+CORRELATION_MODEL_CACHE_SIZE = 32
+MAX_CORRELATED_ASSETS = 2000
+MAX_BATCH_BOOKS = 1000
+INT32_MIN, INT32_MAX = -2**31, 2**31 - 1
+RETURNS_STORE_PATH = os.environ.get("RETURNS_STORE_PATH")
+COLLECT_RUN_STATS = os.environ.get("COLLECT_RUN_STATS", "1") != "0"
+JOB_WORKERS = int(os.environ.get("JOB_WORKERS", 1))
+JOB_QUEUE_LIMIT = int(os.environ.get("JOB_QUEUE_LIMIT", 64))
+
+LATTICE_SCHEMES = {
+    'crr': quant_risk_engine.LatticeScheme.CoxRossRubinstein,
+    'leisen_reimer': quant_risk_engine.LatticeScheme.LeisenReimer
+}
+
+VAR_METHODS = {
+    'full': quant_risk_engine.VaRMethod.FullRevaluation,
+    'delta_gamma': quant_risk_engine.VaRMethod.DeltaGamma,
+    'delta_gamma_vega': quant_risk_engine.VaRMethod.DeltaGammaVega
+}
+
+SAMPLING_METHODS = {
+    'pseudo_random': quant_risk_engine.SamplingMethod.PseudoRandom,
+    'antithetic': quant_risk_engine.SamplingMethod.Antithetic,
+    'sobol': quant_risk_engine.SamplingMethod.Sobol
+}
+
+# Portfolios registered through /portfolios stay in the engine between
+# requests, so follow-up calls only send quantity and market data changes.
+portfolio_registry = quant_risk_engine.PortfolioRegistry()
+
+# Shared by every engine the app creates, so identical contracts are
+# priced once across lines and requests.
+pricing_cache = quant_risk_engine.PricingCache(PRICING_CACHE_CAPACITY)
+
+# Correlation models by their request content. Each model caches its
+# factorization, so a repeated correlation skips it on later requests.
+correlation_models: 'OrderedDict[Any, Any]' = OrderedDict()
+correlation_models_lock = threading.Lock()
+
+# Historical returns file behind var_parameters 'historical', mapped on
+# first use and shared by every engine after that.
+returns_store = None
+returns_store_lock = threading.Lock()
+
+# Phase timings and hot-path counters of every risk run since start-up,
+# summed for /health, so live traffic can be profiled without attaching a
+# profiler.
+RUN_STATS_PHASES = ['validation_ms', 'greeks_ms', 'base_value_ms', 'simulation_ms', 'tail_ms', 'total_ms']
+RUN_STATS_COUNTERS = ['black_scholes_prices', 'lattice_prices', 'lattice_nodes', 'merton_prices',
+                      'rng_draws', 'scratch_allocations', 'scratch_bytes']
+run_stats_totals: Dict[str, Any] = {
+    'runs': 0, 'paths': 0,
+    **{key: 0.0 for key in RUN_STATS_PHASES},
+    **{key: 0 for key in RUN_STATS_COUNTERS}
+}
+run_stats_last: Optional[Dict[str, Any]] = None
+run_stats_lock = threading.Lock()
+
+# Risk runs submitted through /jobs, run in the background by a fixed pool
+# of workers. Each job's request settings are kept next to it for the
+# response, along with its result once it has been built, so a finished
+# job's run stats are recorded once however often it is polled.
+job_queue = quant_risk_engine.RiskJobQueue(JOB_WORKERS, JOB_QUEUE_LIMIT)
+job_requests: Dict[int, Dict[str, Any]] = {}
+job_requests_lock = threading.Lock()
+
+JOB_STATUSES = {
+    quant_risk_engine.RiskJobStatus.QUEUED: 'queued',
+    quant_risk_engine.RiskJobStatus.RUNNING: 'running',
+    quant_risk_engine.RiskJobStatus.COMPLETED: 'completed',
+    quant_risk_engine.RiskJobStatus.CANCELLED: 'cancelled',
+    quant_risk_engine.RiskJobStatus.FAILED: 'failed'
+}
 
 def validate_portfolio_item(item: Dict[str, Any], index: int) -> None:
     required_fields = ['type', 'strike', 'expiry', 'asset_id', 'quantity']
@@ -42,6 +121,10 @@ def validate_portfolio_item(item: Dict[str, Any], index: int) -> None:
     pricing_model = item.get('pricing_model', 'blackscholes').lower()
     if pricing_model not in ['blackscholes', 'binomial', 'jumpdiffusion']:
         raise ValueError(f"Portfolio item {index}: pricing_model must be 'blackscholes', 'binomial', or 'jumpdiffusion'")
+    
+    lattice_scheme = item.get('lattice_scheme', 'crr')
+    if not isinstance(lattice_scheme, str) or lattice_scheme.lower() not in LATTICE_SCHEMES:
+        raise ValueError(f"Portfolio item {index}: lattice_scheme must be 'crr' or 'leisen_reimer'")
 
 def validate_market_data(asset_id: str, md: Dict[str, Any]) -> None:
     required_fields = ['spot', 'rate', 'vol']
@@ -66,8 +149,15 @@ def validate_var_parameters(params: Optional[Dict[str, Any]]) -> Dict[str, Any]:
     validated = {
         'simulations': DEFAULT_VAR_SIMULATIONS,
         'confidence': DEFAULT_VAR_CONFIDENCE,
+        'confidence_levels': [DEFAULT_VAR_CONFIDENCE],
         'time_horizon': DEFAULT_VAR_TIME_HORIZON,
-        'seed': None
+        'seed': None,
+        'threads': DEFAULT_VAR_THREADS,
+        'method': DEFAULT_VAR_METHOD,
+        'vol_of_vol': 0.0,
+        'sampling_method': DEFAULT_VAR_SAMPLING,
+        'control_variate': False,
+        'contributions': False
     }
     
     if params is None:
@@ -84,6 +174,16 @@ def validate_var_parameters(params: Optional[Dict[str, Any]]) -> Dict[str, Any]:
         if not isinstance(conf, (int, float)) or conf <= 0.0 or conf >= 1.0:
             raise ValueError("VaR confidence must be between 0 and 1")
         validated['confidence'] = float(conf)
+        validated['confidence_levels'] = [float(conf)]
+    
+    if 'confidence_levels' in params:
+        levels = params['confidence_levels']
+        if not isinstance(levels, list) or len(levels) == 0 or len(levels) > 64:
+            raise ValueError("VaR confidence_levels must be a list of 1 to 64 levels")
+        for level in levels:
+            if not isinstance(level, (int, float)) or level <= 0.0 or level >= 1.0:
+                raise ValueError("Each VaR confidence level must be between 0 and 1")
+        validated['confidence_levels'] = [float(level) for level in levels]
     
     if 'time_horizon' in params:
         horizon = params['time_horizon']
@@ -98,8 +198,129 @@ def validate_var_parameters(params: Optional[Dict[str, Any]]) -> Dict[str, Any]:
                 raise ValueError("Random seed must be a non-negative integer")
             validated['seed'] = seed
     
+    if 'threads' in params:
+        threads = params['threads']
+        if not isinstance(threads, int) or threads < 0 or threads > 256:
+            raise ValueError("VaR threads must be an integer between 0 and 256 (0 = all cores)")
+        validated['threads'] = threads
+    
+    if 'method' in params:
+        method = params['method']
+        if not isinstance(method, str) or method.lower() not in VAR_METHODS:
+            raise ValueError("VaR method must be 'full', 'delta_gamma', or 'delta_gamma_vega'")
+        validated['method'] = method.lower()
+    
+    if 'vol_of_vol' in params:
+        vol_of_vol = params['vol_of_vol']
+        if not isinstance(vol_of_vol, (int, float)) or vol_of_vol < 0.0 or vol_of_vol > 5.0:
+            raise ValueError("VaR vol_of_vol must be between 0 and 5")
+        validated['vol_of_vol'] = float(vol_of_vol)
+    
+    if 'sampling_method' in params:
+        sampling = params['sampling_method']
+        if not isinstance(sampling, str) or sampling.lower() not in SAMPLING_METHODS:
+            raise ValueError("VaR sampling_method must be 'pseudo_random', 'antithetic', or 'sobol'")
+        validated['sampling_method'] = sampling.lower()
+    
+    if 'control_variate' in params:
+        control_variate = params['control_variate']
+        if not isinstance(control_variate, bool):
+            raise ValueError("VaR control_variate must be a boolean")
+        validated['control_variate'] = control_variate
+    
+    if 'contributions' in params:
+        contributions = params['contributions']
+        if not isinstance(contributions, bool):
+            raise ValueError("VaR contributions must be a boolean")
+        validated['contributions'] = contributions
+    
+    if 'correlation' in params and params['correlation'] is not None:
+        validated['correlation'] = validate_correlation(params['correlation'])
+    
+    if 'historical' in params and params['historical'] is not None:
+        validated['historical'] = validate_historical(params['historical'], validated['time_horizon'])
+    
     return validated
 
+def get_returns_store() -> Any:
+    global returns_store
+    if not RETURNS_STORE_PATH:
+        raise ValueError("Historical VaR is not available: RETURNS_STORE_PATH is not configured")
+    with returns_store_lock:
+        if returns_store is None:
+            returns_store = quant_risk_engine.ReturnsStore(RETURNS_STORE_PATH)
+        return returns_store
+
+def validate_historical(historical: Any, time_horizon: float) -> Dict[str, Any]:
+    if not isinstance(historical, dict):
+        raise ValueError("VaR historical must be an object")
+    store = get_returns_store()
+    lookback = historical.get('lookback_days', 0)
+    if not isinstance(lookback, int) or isinstance(lookback, bool) or lookback < 0 \
+            or lookback > store.date_count():
+        raise ValueError(f"VaR historical lookback_days must be an integer between 0 and "
+                         f"{store.date_count()} (0 = all history)")
+    if time_horizon != int(time_horizon):
+        raise ValueError("Historical VaR needs a whole number of days as time horizon")
+    if (lookback or store.date_count()) < time_horizon:
+        raise ValueError("VaR historical lookback_days must cover the time horizon")
+    return {'lookback_days': lookback}
+
+def validate_correlation(correlation: Any) -> Dict[str, Any]:
+    if not isinstance(correlation, dict):
+        raise ValueError("VaR correlation must be an object")
+    
+    assets = correlation.get('assets')
+    if (not isinstance(assets, list) or len(assets) == 0 or len(assets) > MAX_CORRELATED_ASSETS or
+            not all(isinstance(asset, str) and asset for asset in assets)):
+        raise ValueError(f"VaR correlation assets must be a list of 1 to {MAX_CORRELATED_ASSETS} asset IDs")
+    if len(set(assets)) != len(assets):
+        raise ValueError("VaR correlation assets must be unique")
+    
+    kinds = [kind for kind in ('matrix', 'covariance', 'loadings') if kind in correlation]
+    if len(kinds) != 1:
+        raise ValueError("VaR correlation needs exactly one of 'matrix', 'covariance' or 'loadings'")
+    kind = kinds[0]
+    
+    rows = correlation[kind]
+    if not isinstance(rows, list) or len(rows) != len(assets):
+        raise ValueError(f"VaR correlation {kind} must have one row per asset")
+    width = len(assets) if kind != 'loadings' else (len(rows[0]) if isinstance(rows[0], list) else 0)
+    if width == 0:
+        raise ValueError("VaR correlation loadings need at least one factor")
+    for row in rows:
+        if (not isinstance(row, list) or len(row) != width or
+                not all(isinstance(x, (int, float)) and not isinstance(x, bool) for x in row)):
+            raise ValueError(f"VaR correlation {kind} rows must be lists of {width} numbers")
+    
+    return {'assets': assets, 'kind': kind, 'rows': [[float(x) for x in row] for row in rows]}
+
+def get_correlation_model(correlation: Dict[str, Any]) -> Any:
+    key = (correlation['kind'], tuple(correlation['assets']),
+           tuple(tuple(row) for row in correlation['rows']))
+    with correlation_models_lock:
+        model = correlation_models.get(key)
+        if model is not None:
+            correlation_models.move_to_end(key)
+            return model
+    
+    # Invalid matrices raise ValueError from the engine.
+    if correlation['kind'] == 'loadings':
+        model = quant_risk_engine.CorrelationModel.from_factor_loadings(
+            correlation['assets'], correlation['rows'])
+    else:
+        matrix_type = (quant_risk_engine.CorrelationModel.MatrixType.Covariance
+                       if correlation['kind'] == 'covariance'
+                       else quant_risk_engine.CorrelationModel.MatrixType.Correlation)
+        model = quant_risk_engine.CorrelationModel(correlation['assets'], correlation['rows'], matrix_type)
+    
+    with correlation_models_lock:
+        correlation_models[key] = model
+        correlation_models.move_to_end(key)
+        while len(correlation_models) > CORRELATION_MODEL_CACHE_SIZE:
+            correlation_models.popitem(last=False)
+    return model
+
 def auto_fetch_missing_market_data(portfolio_assets: set, provided_market_data: Dict[str, Any]) -> Dict[str, Any]:
     """
     Automatically fetch market data for assets that aren't provided
@@ -166,6 +387,7 @@ def create_option(item: Dict[str, Any]) -> Any:
             item['asset_id'].strip(),
             binomial_steps
         )
+        option.set_lattice_scheme(LATTICE_SCHEMES[item.get('lattice_scheme', 'crr').lower()])
     else:
         pricing_model_str = item.get('pricing_model', 'blackscholes').lower()
         
@@ -187,6 +409,7 @@ def create_option(item: Dict[str, Any]) -> Any:
         if pricing_model_str == 'binomial':
             binomial_steps = item.get('binomial_steps', 100)
             option.set_binomial_steps(binomial_steps)
+            option.set_lattice_scheme(LATTICE_SCHEMES[item.get('lattice_scheme', 'crr').lower()])
         
         if pricing_model_str == 'jumpdiffusion':
             jump_params = item.get('jump_parameters', {})
@@ -200,6 +423,332 @@ def create_option(item: Dict[str, Any]) -> Any:
 BASE_DIR = os.path.dirname(os.path.abspath(__file__))
 DASHBOARD_DIR = os.path.join(BASE_DIR, "..", "js_dashboard")
 
+def to_cpp_market_data(market_data: Dict[str, Any]) -> Dict[str, Any]:
+    market_data_map_cpp = {}
+    for asset_id, md_py in market_data.items():
+        dividend = md_py.get('dividend', 0.0)
+        market_data_map_cpp[asset_id] = quant_risk_engine.MarketData(
+            asset_id,
+            float(md_py['spot']),
+            float(md_py['rate']),
+            float(md_py['vol']),
+            float(dividend)
+        )
+    return market_data_map_cpp
+
+def from_cpp_market_data(md_cpp: Any) -> Dict[str, Any]:
+    return {
+        'spot': md_cpp.spot_price,
+        'rate': md_cpp.risk_free_rate,
+        'vol': md_cpp.volatility,
+        'dividend': md_cpp.dividend_yield
+    }
+
+def build_portfolio(portfolio_data: List[Dict[str, Any]]) -> Any:
+    portfolio = quant_risk_engine.Portfolio()
+    portfolio.reserve(len(portfolio_data))
+    for item in portfolio_data:
+        option = create_option(item)
+        portfolio.add_instrument(option, item['quantity'])
+    return portfolio
+
+def resolve_portfolio_request(data: Dict[str, Any]) -> tuple:
+    """
+    Validate a request's 'portfolio' and 'market_data' fields and fill in
+    missing market data. Returns (portfolio_data, complete_market_data,
+    auto_fetched_assets).
+    """
+    if 'portfolio' not in data:
+        raise ValueError("Missing required field 'portfolio'")
+
+    portfolio_data = data['portfolio']
+    market_data_map_py = data.get('market_data', {})  # Default to empty dict
+
+    if not isinstance(portfolio_data, list):
+        raise ValueError("Field 'portfolio' must be an array")
+
+    if not isinstance(market_data_map_py, dict):
+        raise ValueError("Field 'market_data' must be an object")
+
+    if len(portfolio_data) == 0:
+        raise ValueError('Portfolio cannot be empty')
+
+    for idx, item in enumerate(portfolio_data):
+        validate_portfolio_item(item, idx)
+
+    portfolio_assets = set(item['asset_id'] for item in portfolio_data)
+    complete_market_data, auto_fetched = resolve_market_data(portfolio_assets, market_data_map_py)
+    return portfolio_data, complete_market_data, auto_fetched
+
+def resolve_batch_request(data: Dict[str, Any]) -> tuple:
+    """
+    Validate a batch request's 'books' and 'market_data' fields and fill in
+    missing market data for every book. Returns (books, complete_market_data,
+    auto_fetched_assets).
+    """
+    if 'books' not in data:
+        raise ValueError("Missing required field 'books'")
+
+    books = data['books']
+    market_data_map_py = data.get('market_data', {})
+
+    if not isinstance(books, list) or len(books) == 0 or len(books) > MAX_BATCH_BOOKS:
+        raise ValueError(f"Field 'books' must be an array of 1 to {MAX_BATCH_BOOKS} portfolios")
+
+    if not isinstance(market_data_map_py, dict):
+        raise ValueError("Field 'market_data' must be an object")
+
+    for book_index, book in enumerate(books):
+        if not isinstance(book, list) or len(book) == 0:
+            raise ValueError(f"Book {book_index} must be a non-empty array")
+        try:
+            for idx, item in enumerate(book):
+                validate_portfolio_item(item, idx)
+        except ValueError as e:
+            raise ValueError(f"Book {book_index}: {e}")
+
+    portfolio_assets = set(item['asset_id'] for book in books for item in book)
+    complete_market_data, auto_fetched = resolve_market_data(portfolio_assets, market_data_map_py)
+    return books, complete_market_data, auto_fetched
+
+def resolve_market_data(portfolio_assets: set, market_data_map_py: Dict[str, Any]) -> tuple:
+    """
+    Fill in and validate market data for portfolio_assets. Returns
+    (complete_market_data, auto_fetched_assets).
+    """
+    # AUTO-FETCH: Get complete market data (provided + auto-fetched)
+    complete_market_data = auto_fetch_missing_market_data(
+        portfolio_assets,
+        market_data_map_py
+    )
+
+    # Track which assets were auto-fetched for response
+    auto_fetched = [asset for asset in portfolio_assets
+                    if asset not in market_data_map_py or not market_data_map_py[asset]]
+
+    for asset_id, md in complete_market_data.items():
+        validate_market_data(asset_id, md)
+
+    return complete_market_data, auto_fetched
+
+def create_risk_engine(var_config: Dict[str, Any]) -> Any:
+    engine = quant_risk_engine.RiskEngine()
+    engine.set_pricing_cache(pricing_cache)
+    engine.set_var_simulations(var_config['simulations'])
+    engine.set_var_time_horizon_days(var_config['time_horizon'])
+    engine.set_num_threads(var_config['threads'])
+    engine.set_var_method(VAR_METHODS[var_config['method']])
+    engine.set_vol_of_vol(var_config['vol_of_vol'])
+    engine.set_sampling_method(SAMPLING_METHODS[var_config['sampling_method']])
+    engine.set_use_control_variate(var_config['control_variate'])
+    engine.set_compute_contributions(var_config['contributions'])
+    engine.set_collect_run_stats(COLLECT_RUN_STATS)
+    if 'correlation' in var_config:
+        engine.set_correlation_model(get_correlation_model(var_config['correlation']))
+    if 'historical' in var_config:
+        engine.set_historical_returns(get_returns_store(), var_config['historical']['lookback_days'])
+    engine.set_confidence_levels(var_config['confidence_levels'])
+
+    if var_config['seed'] is not None:
+        engine.set_random_seed(var_config['seed'])
+        engine.set_use_fixed_seed(True)
+
+    return engine
+
+def risk_figures_to_json(result_cpp: Any) -> Dict[str, Any]:
+    return {
+        'total_pv': result_cpp.total_pv,
+        'total_delta': result_cpp.total_delta,
+        'total_gamma': result_cpp.total_gamma,
+        'total_vega': result_cpp.total_vega,
+        'total_theta': result_cpp.total_theta,
+        'value_at_risk_95': result_cpp.value_at_risk_95,
+        'tail_measures': [
+            {
+                'confidence': measure.confidence,
+                'value_at_risk': measure.value_at_risk,
+                'expected_shortfall': measure.expected_shortfall
+            }
+            for measure in result_cpp.tail_measures
+        ]
+    }
+
+def run_stats_to_json(stats: Any) -> Dict[str, Any]:
+    stats_py = {'paths': stats.paths}
+    stats_py.update({key: getattr(stats, key) for key in RUN_STATS_PHASES})
+    stats_py['arena_bytes'] = stats.arena_bytes
+    stats_py['arena_heap_blocks'] = stats.arena_heap_blocks
+    stats_py['counters'] = {key: getattr(stats.counters, key) for key in RUN_STATS_COUNTERS}
+    return stats_py
+
+def record_run_stats(stats_py: Dict[str, Any]) -> None:
+    global run_stats_last
+    with run_stats_lock:
+        run_stats_totals['runs'] += 1
+        run_stats_totals['paths'] += stats_py['paths']
+        for key in RUN_STATS_PHASES:
+            run_stats_totals[key] += stats_py[key]
+        for key in RUN_STATS_COUNTERS:
+            run_stats_totals[key] += stats_py['counters'][key]
+        run_stats_last = stats_py
+
+def run_stats_summary() -> Dict[str, Any]:
+    with run_stats_lock:
+        totals = dict(run_stats_totals)
+        last = run_stats_last
+    runs = totals['runs']
+    return {
+        'compiled': quant_risk_engine.run_stats_compiled,
+        'collecting': COLLECT_RUN_STATS,
+        'runs': runs,
+        'paths': totals['paths'],
+        'mean_ms': {key: totals[key] / runs if runs else 0.0 for key in RUN_STATS_PHASES},
+        'counters': {key: totals[key] for key in RUN_STATS_COUNTERS},
+        'last_run': last
+    }
+
+def risk_result_to_json(result_cpp: Any, engine: Any, var_config: Dict[str, Any],
+                        portfolio_size: int) -> Dict[str, Any]:
+    result_py = risk_figures_to_json(result_cpp)
+    result_py.update({
+        'portfolio_size': portfolio_size,
+        'var_parameters': {
+            'simulations': var_config['simulations'],
+            'confidence_level': var_config['confidence'],
+            'confidence_levels': var_config['confidence_levels'],
+            'time_horizon_days': var_config['time_horizon'],
+            'threads': var_config['threads'],
+            'method': var_config['method'],
+            'vol_of_vol': var_config['vol_of_vol'],
+            'sampling_method': var_config['sampling_method'],
+            'control_variate': var_config['control_variate'],
+            'contributions': var_config['contributions'],
+            'correlation': var_config['correlation']['kind'] if 'correlation' in var_config else None,
+            'historical': var_config.get('historical')
+        }
+    })
+
+    report = engine.get_last_approximation_report()
+    if report.computed:
+        result_py['approximation_report'] = {
+            'validation_paths': report.validation_paths,
+            'max_abs_pnl_error': report.max_abs_pnl_error,
+            'rms_pnl_error': report.rms_pnl_error,
+            'relative_rms_error': report.relative_rms_error,
+            'full_var_95': report.full_var_95,
+            'approx_var_95': report.approx_var_95,
+            'full_var_99': report.full_var_99,
+            'approx_var_99': report.approx_var_99
+        }
+
+    sampling = engine.get_last_sampling_report()
+    if sampling.computed:
+        result_py['sampling_report'] = {
+            'batches': sampling.batches,
+            'control_variate': sampling.control_variate,
+            'historical': sampling.historical,
+            'var_95_standard_error': sampling.var_95_standard_error,
+            'var_99_standard_error': sampling.var_99_standard_error,
+            'es_95_standard_error': sampling.es_95_standard_error,
+            'es_99_standard_error': sampling.es_99_standard_error,
+            'standard_errors': [
+                {
+                    'confidence': measure.confidence,
+                    'value_at_risk': measure.value_at_risk,
+                    'expected_shortfall': measure.expected_shortfall
+                }
+                for measure in sampling.standard_errors
+            ]
+        }
+
+    contributions = engine.get_last_contribution_report()
+    if contributions.computed:
+        result_py['risk_contributions'] = [
+            {
+                'confidence': level.confidence,
+                'value_at_risk': level.value_at_risk,
+                'expected_shortfall': level.expected_shortfall,
+                'var_window_paths': level.var_window_paths,
+                'lines': [
+                    {
+                        'index': index,
+                        'component_var': level.component_var[index],
+                        'component_es': level.component_es[index],
+                        'marginal_var': level.marginal_var[index],
+                        'marginal_es': level.marginal_es[index]
+                    }
+                    for index in range(len(level.component_var))
+                ]
+            }
+            for level in contributions.levels
+        ]
+
+    stats = engine.get_last_run_stats()
+    if stats.collected:
+        result_py['run_stats'] = run_stats_to_json(stats)
+        record_run_stats(result_py['run_stats'])
+    return result_py
+
+def unknown_portfolio(portfolio_id: int):
+    return jsonify({'error': f'Unknown portfolio ID: {portfolio_id}'}), 404
+
+def unknown_job(job_id: int):
+    return jsonify({'error': f'Unknown job ID: {job_id}'}), 404
+
+def job_result_to_json(job: Any) -> Dict[str, Any]:
+    """Response body of a completed job, built on first request."""
+    with job_requests_lock:
+        job_request = job_requests[job.id()]
+        if job_request['result'] is None:
+            result_cpp = job.wait()
+            if not result_cpp.is_valid():
+                raise RuntimeError('Risk calculation produced invalid results')
+            result_py = risk_result_to_json(result_cpp, job.engine(), job_request['var_config'],
+                                            job_request['portfolio_size'])
+            result_py['market_data_info'] = job_request['market_data_info']
+            job_request['result'] = result_py
+        return job_request['result']
+
+def job_to_json(job: Any, detail: bool = True) -> Dict[str, Any]:
+    """
+    Status and progress of a job. With detail, also its running VaR and ES
+    estimates with their intervals, and its result or error once finished.
+    """
+    progress = job.progress()
+    status = JOB_STATUSES[progress.status]
+    job_py = {
+        'job_id': job.id(),
+        'priority': job.priority(),
+        'status': status,
+        'progress': {
+            'paths_done': progress.paths_done,
+            'paths_total': progress.paths_total,
+            'fraction': progress.paths_done / progress.paths_total if progress.paths_total else 0.0
+        }
+    }
+    if not detail:
+        return job_py
+
+    job_py['estimates'] = [
+        {
+            'confidence': estimate.confidence,
+            'value_at_risk': estimate.value_at_risk,
+            'var_interval': [estimate.var_lower, estimate.var_upper],
+            'expected_shortfall': estimate.expected_shortfall,
+            'es_interval': [estimate.es_lower, estimate.es_upper]
+        }
+        for estimate in progress.estimates
+    ]
+    if status == 'completed':
+        try:
+            job_py['result'] = job_result_to_json(job)
+        except RuntimeError as e:
+            job_py['status'] = 'failed'
+            job_py['error'] = str(e)
+    elif status == 'failed':
+        job_py['error'] = job.error()
+    return job_py
+
 @app.route("/")
 def serve_dashboard():
     return send_from_directory(DASHBOARD_DIR, "index.html")
@@ -303,6 +852,7 @@ def health_check():
     try:
         fetcher = get_market_data_fetcher()
         cached_assets = len(fetcher.cache.get_all())
+        pricing_stats = pricing_cache.stats()
         
         return jsonify({
             'status': 'healthy',
@@ -321,6 +871,18 @@ def health_check():
             'cache_info': {
                 'cached_assets': cached_assets,
                 'cache_location': fetcher.cache.db_path
+            },
+            'pricing_cache': {
+                'capacity': pricing_cache.capacity(),
+                'size': pricing_stats.size,
+                'hits': pricing_stats.hits,
+                'misses': pricing_stats.misses,
+                'evictions': pricing_stats.evictions
+            },
+            'run_stats': run_stats_summary(),
+            'risk_jobs': {
+                'workers': job_queue.worker_count(),
+                'queued': job_queue.queued_count()
             }
         }), 200
     except Exception as e:
@@ -349,105 +911,298 @@ def calculate_risk():
         if not data:
             return jsonify({'error': 'Request body must be valid JSON'}), 400
         
-        if 'portfolio' not in data:
-            return jsonify({'error': "Missing required field 'portfolio'"}), 400
-        
-        portfolio_data = data['portfolio']
-        market_data_map_py = data.get('market_data', {})  # Default to empty dict
         var_params = data.get('var_parameters', None)
-        
-        if not isinstance(portfolio_data, list):
-            return jsonify({'error': "Field 'portfolio' must be an array"}), 400
-        
-        if not isinstance(market_data_map_py, dict):
-            return jsonify({'error': "Field 'market_data' must be an object"}), 400
-        
-        if len(portfolio_data) == 0:
-            return jsonify({'error': 'Portfolio cannot be empty'}), 400
 
-        # Validate portfolio items
-        for idx, item in enumerate(portfolio_data):
-            validate_portfolio_item(item, idx)
-        
-        # Get all unique assets in portfolio
-        portfolio_assets = set(item['asset_id'] for item in portfolio_data)
-        
-        # AUTO-FETCH: Get complete market data (provided + auto-fetched)
-        try:
-            complete_market_data = auto_fetch_missing_market_data(
-                portfolio_assets, 
-                market_data_map_py
-            )
-            
-            # Track which assets were auto-fetched for response
-            auto_fetched = [asset for asset in portfolio_assets 
-                          if asset not in market_data_map_py or not market_data_map_py[asset]]
-            
-        except ValueError as e:
-            return jsonify({'error': str(e)}), 400
-        
-        # Validate the complete market data
-        for asset_id, md in complete_market_data.items():
-            validate_market_data(asset_id, md)
-        
-        var_config = validate_var_parameters(var_params)
+        portfolio_data, complete_market_data, auto_fetched = resolve_portfolio_request(data)
 
-        # Build portfolio
-        portfolio = quant_risk_engine.Portfolio()
-        portfolio.reserve(len(portfolio_data))
-        
-        for item in portfolio_data:
-            option = create_option(item)
-            portfolio.add_instrument(option, item['quantity'])
+        var_config = validate_var_parameters(var_params)
 
-        # Convert market data to C++ format
-        market_data_map_cpp = {}
-        for asset_id, md_py in complete_market_data.items():
-            dividend = md_py.get('dividend', 0.0)
-            md_cpp = quant_risk_engine.MarketData(
-                asset_id,
-                float(md_py['spot']),
-                float(md_py['rate']),
-                float(md_py['vol']),
-                float(dividend)
-            )
-            market_data_map_cpp[asset_id] = md_cpp
+        portfolio = build_portfolio(portfolio_data)
+        market_data_map_cpp = to_cpp_market_data(complete_market_data)
 
         # Calculate risk
-        engine = quant_risk_engine.RiskEngine()
-        engine.set_var_simulations(var_config['simulations'])
-        engine.set_var_time_horizon_days(var_config['time_horizon'])
-        
-        if var_config['seed'] is not None:
-            engine.set_random_seed(var_config['seed'])
-            engine.set_use_fixed_seed(True)
-        
+        engine = create_risk_engine(var_config)
         result_cpp = engine.calculate_portfolio_risk(portfolio, market_data_map_cpp)
         
         if not result_cpp.is_valid():
             return jsonify({'error': 'Risk calculation produced invalid results'}), 500
 
         # Prepare response with market data info
-        result_py = {
-            'total_pv': result_cpp.total_pv,
-            'total_delta': result_cpp.total_delta,
-            'total_gamma': result_cpp.total_gamma,
-            'total_vega': result_cpp.total_vega,
-            'total_theta': result_cpp.total_theta,
-            'value_at_risk_95': result_cpp.value_at_risk_95,
-            'portfolio_size': len(portfolio),
-            'var_parameters': {
-                'simulations': var_config['simulations'],
-                'confidence_level': var_config['confidence'],
-                'time_horizon_days': var_config['time_horizon']
-            },
+        result_py = risk_result_to_json(result_cpp, engine, var_config, len(portfolio))
+        result_py['market_data_info'] = {
+            'auto_fetched_assets': auto_fetched if auto_fetched else [],
+            'market_data_used': complete_market_data
+        }
+        return jsonify(result_py), 200
+
+    except ValueError as e:
+        return jsonify({'error': f'Validation error: {str(e)}'}), 400
+    except RuntimeError as e:
+        return jsonify({'error': f'Runtime error: {str(e)}'}), 500
+    except Exception as e:
+        app.logger.error(f"Unexpected error: {traceback.format_exc()}")
+        return jsonify({'error': f'Internal server error: {str(e)}'}), 500
+
+@app.route('/calculate_batch_risk', methods=['POST'])
+def calculate_batch_risk():
+    """
+    Calculate risk for several books on one set of scenarios, pricing
+    contracts shared between books once. Takes 'books' (portfolios in the
+    /calculate_risk format), one 'market_data' for all of them and
+    'var_parameters'.
+    """
+    try:
+        data = request.get_json()
+
+        if not data:
+            return jsonify({'error': 'Request body must be valid JSON'}), 400
+
+        books_data, complete_market_data, auto_fetched = resolve_batch_request(data)
+        var_config = validate_var_parameters(data.get('var_parameters', None))
+
+        books = [build_portfolio(book) for book in books_data]
+        engine = create_risk_engine(var_config)
+        batch_cpp = engine.calculate_batch_risk(books, to_cpp_market_data(complete_market_data))
+
+        if not batch_cpp.total.is_valid() or not all(book.is_valid() for book in batch_cpp.books):
+            return jsonify({'error': 'Risk calculation produced invalid results'}), 500
+
+        result_py = risk_result_to_json(batch_cpp.total, engine, var_config,
+                                        sum(len(book) for book in books))
+        result_py['books'] = [risk_figures_to_json(book) for book in batch_cpp.books]
+        result_py['distinct_lines'] = batch_cpp.distinct_lines
+        result_py['market_data_info'] = {
+            'auto_fetched_assets': auto_fetched if auto_fetched else [],
+            'market_data_used': complete_market_data
+        }
+        return jsonify(result_py), 200
+
+    except ValueError as e:
+        return jsonify({'error': f'Validation error: {str(e)}'}), 400
+    except RuntimeError as e:
+        return jsonify({'error': f'Runtime error: {str(e)}'}), 500
+    except Exception as e:
+        app.logger.error(f"Unexpected error: {traceback.format_exc()}")
+        return jsonify({'error': f'Internal server error: {str(e)}'}), 500
+
+@app.route('/portfolios', methods=['POST'])
+def register_portfolio():
+    """
+    Register a portfolio and its market data with the engine. Market data
+    is completed the same way as in /calculate_risk. Returns the ID used
+    by the /portfolios/<id> endpoints.
+    """
+    try:
+        data = request.get_json()
+
+        if not data:
+            return jsonify({'error': 'Request body must be valid JSON'}), 400
+
+        portfolio_data, complete_market_data, auto_fetched = resolve_portfolio_request(data)
+
+        portfolio = build_portfolio(portfolio_data)
+        portfolio_id = portfolio_registry.register(portfolio, to_cpp_market_data(complete_market_data))
+
+        return jsonify({
+            'portfolio_id': portfolio_id,
+            'portfolio_size': len(portfolio_data),
             'market_data_info': {
                 'auto_fetched_assets': auto_fetched if auto_fetched else [],
                 'market_data_used': complete_market_data
             }
+        }), 201
+
+    except ValueError as e:
+        return jsonify({'error': f'Validation error: {str(e)}'}), 400
+    except RuntimeError as e:
+        return jsonify({'error': f'Runtime error: {str(e)}'}), 500
+    except Exception as e:
+        app.logger.error(f"Unexpected error: {traceback.format_exc()}")
+        return jsonify({'error': f'Internal server error: {str(e)}'}), 500
+
+@app.route('/portfolios/<int:portfolio_id>', methods=['DELETE'])
+def remove_portfolio(portfolio_id):
+    try:
+        portfolio_registry.remove(portfolio_id)
+        return jsonify({'message': f'Portfolio {portfolio_id} removed'}), 200
+    except IndexError:
+        return unknown_portfolio(portfolio_id)
+
+@app.route('/portfolios/<int:portfolio_id>/quantities', methods=['POST'])
+def update_portfolio_quantities(portfolio_id):
+    """
+    Apply quantity changes to a registered portfolio. Each update names a
+    line by its index in the registered portfolio and gives either a
+    'delta' to add or a new 'quantity'. Updates are checked before any is
+    applied.
+    """
+    try:
+        data = request.get_json()
+
+        if not data or 'updates' not in data:
+            return jsonify({'error': "Missing required field 'updates'"}), 400
+
+        updates = data['updates']
+        if not isinstance(updates, list) or len(updates) == 0:
+            return jsonify({'error': "Field 'updates' must be a non-empty array"}), 400
+
+        if not portfolio_registry.contains(portfolio_id):
+            return unknown_portfolio(portfolio_id)
+        line_count = portfolio_registry.line_count(portfolio_id)
+
+        for idx, update in enumerate(updates):
+            if not isinstance(update, dict):
+                raise ValueError(f"Update {idx}: must be an object")
+            index = update.get('index')
+            if not isinstance(index, int) or isinstance(index, bool) or not 0 <= index < line_count:
+                raise ValueError(f"Update {idx}: index must be an integer in [0, {line_count})")
+            if ('delta' in update) == ('quantity' in update):
+                raise ValueError(f"Update {idx}: provide exactly one of 'delta' or 'quantity'")
+            value = update.get('delta', update.get('quantity'))
+            if not isinstance(value, int) or isinstance(value, bool):
+                raise ValueError(f"Update {idx}: delta and quantity must be integers")
+            if not INT32_MIN <= value <= INT32_MAX:
+                raise ValueError(f"Update {idx}: delta and quantity must fit in 32 bits")
+
+        # Applied in one call, which checks the resulting quantities for
+        # overflow before changing any line.
+        portfolio_registry.update_quantities(portfolio_id, [
+            quant_risk_engine.QuantityUpdate(update['index'], update.get('delta', update.get('quantity')),
+                                             'delta' in update)
+            for update in updates
+        ])
+
+        return jsonify({'portfolio_id': portfolio_id, 'updated': len(updates)}), 200
+
+    except IndexError:
+        return unknown_portfolio(portfolio_id)
+    except OverflowError as e:
+        return jsonify({'error': f'Validation error: {str(e)}'}), 400
+    except ValueError as e:
+        return jsonify({'error': f'Validation error: {str(e)}'}), 400
+    except RuntimeError as e:
+        return jsonify({'error': f'Runtime error: {str(e)}'}), 500
+    except Exception as e:
+        app.logger.error(f"Unexpected error: {traceback.format_exc()}")
+        return jsonify({'error': f'Internal server error: {str(e)}'}), 500
+
+@app.route('/portfolios/<int:portfolio_id>/market_data', methods=['POST'])
+def update_portfolio_market_data(portfolio_id):
+    """
+    Add or replace market data for a registered portfolio's assets.
+    """
+    try:
+        data = request.get_json()
+
+        if not data or 'market_data' not in data:
+            return jsonify({'error': "Missing required field 'market_data'"}), 400
+
+        market_data = data['market_data']
+        if not isinstance(market_data, dict) or len(market_data) == 0:
+            return jsonify({'error': "Field 'market_data' must be a non-empty object"}), 400
+
+        for asset_id, md in market_data.items():
+            if not isinstance(md, dict):
+                raise ValueError(f"Market data for '{asset_id}' must be an object")
+            validate_market_data(asset_id, md)
+
+        if not portfolio_registry.contains(portfolio_id):
+            return unknown_portfolio(portfolio_id)
+
+        for md_cpp in to_cpp_market_data(market_data).values():
+            portfolio_registry.update_market_data(portfolio_id, md_cpp)
+
+        return jsonify({'portfolio_id': portfolio_id, 'updated_assets': sorted(market_data.keys())}), 200
+
+    except IndexError:
+        return unknown_portfolio(portfolio_id)
+    except ValueError as e:
+        return jsonify({'error': f'Validation error: {str(e)}'}), 400
+    except RuntimeError as e:
+        return jsonify({'error': f'Runtime error: {str(e)}'}), 500
+    except Exception as e:
+        app.logger.error(f"Unexpected error: {traceback.format_exc()}")
+        return jsonify({'error': f'Internal server error: {str(e)}'}), 500
+
+@app.route('/portfolios/<int:portfolio_id>/risk', methods=['POST'])
+def calculate_registered_portfolio_risk(portfolio_id):
+    """
+    Calculate risk for a registered portfolio with its current quantities
+    and market data. Takes the same 'var_parameters' as /calculate_risk.
+    """
+    try:
+        data = request.get_json(silent=True) or {}
+        var_config = validate_var_parameters(data.get('var_parameters', None))
+
+        # Engines are cheap to configure and hold per-run state, so each
+        # request gets its own rather than sharing one across threads.
+        engine = create_risk_engine(var_config)
+        result_cpp = portfolio_registry.calculate_risk(portfolio_id, engine)
+
+        if not result_cpp.is_valid():
+            return jsonify({'error': 'Risk calculation produced invalid results'}), 500
+
+        result_py = risk_result_to_json(result_cpp, engine, var_config,
+                                        portfolio_registry.line_count(portfolio_id))
+        result_py['portfolio_id'] = portfolio_id
+        result_py['market_data_info'] = {
+            'auto_fetched_assets': [],
+            'market_data_used': {
+                asset_id: from_cpp_market_data(md)
+                for asset_id, md in portfolio_registry.get_market_data(portfolio_id).items()
+            }
         }
         return jsonify(result_py), 200
 
+    except IndexError:
+        return unknown_portfolio(portfolio_id)
+    except ValueError as e:
+        return jsonify({'error': f'Validation error: {str(e)}'}), 400
+    except RuntimeError as e:
+        return jsonify({'error': f'Runtime error: {str(e)}'}), 500
+    except Exception as e:
+        app.logger.error(f"Unexpected error: {traceback.format_exc()}")
+        return jsonify({'error': f'Internal server error: {str(e)}'}), 500
+
+@app.route('/jobs', methods=['POST'])
+def submit_risk_job():
+    """
+    Queue a risk calculation to run in the background. Takes the same body
+    as /calculate_risk plus an optional integer 'priority' (higher starts
+    first, default 0), and returns the job's ID straight away.
+    """
+    try:
+        data = request.get_json()
+
+        if not data:
+            return jsonify({'error': 'Request body must be valid JSON'}), 400
+
+        priority = data.get('priority', 0)
+        if isinstance(priority, bool) or not isinstance(priority, int):
+            raise ValueError("Field 'priority' must be an integer")
+
+        portfolio_data, complete_market_data, auto_fetched = resolve_portfolio_request(data)
+        var_config = validate_var_parameters(data.get('var_parameters', None))
+
+        portfolio = build_portfolio(portfolio_data)
+        engine = create_risk_engine(var_config)
+        # Held across the submit so a job never finishes before its entry exists.
+        with job_requests_lock:
+            try:
+                job = job_queue.submit(engine, portfolio, to_cpp_market_data(complete_market_data), priority)
+            except RuntimeError as e:
+                return jsonify({'error': str(e)}), 503
+            job_requests[job.id()] = {
+                'var_config': var_config,
+                'portfolio_size': len(portfolio_data),
+                'market_data_info': {
+                    'auto_fetched_assets': auto_fetched if auto_fetched else [],
+                    'market_data_used': complete_market_data
+                },
+                'result': None
+            }
+        return jsonify(job_to_json(job, detail=False)), 202
+
     except ValueError as e:
         return jsonify({'error': f'Validation error: {str(e)}'}), 400
     except RuntimeError as e:
@@ -456,6 +1211,56 @@ def calculate_risk():
         app.logger.error(f"Unexpected error: {traceback.format_exc()}")
         return jsonify({'error': f'Internal server error: {str(e)}'}), 500
 
+@app.route('/jobs', methods=['GET'])
+def list_risk_jobs():
+    return jsonify({
+        'workers': job_queue.worker_count(),
+        'queued': job_queue.queued_count(),
+        'jobs': [job_to_json(job, detail=False) for job in job_queue.jobs()]
+    }), 200
+
+@app.route('/jobs/<int:job_id>', methods=['GET'])
+def get_risk_job(job_id):
+    """
+    Progress of a job and its VaR and ES estimates so far, each with an
+    interval that narrows as paths come in. Completed jobs also carry the
+    same result /calculate_risk returns.
+    """
+    try:
+        job = job_queue.job(job_id)
+    except IndexError:
+        return unknown_job(job_id)
+    try:
+        return jsonify(job_to_json(job)), 200
+    except Exception as e:
+        app.logger.error(f"Unexpected error: {traceback.format_exc()}")
+        return jsonify({'error': f'Internal server error: {str(e)}'}), 500
+
+@app.route('/jobs/<int:job_id>/cancel', methods=['POST'])
+def cancel_risk_job(job_id):
+    """
+    Cancel a job. A queued job never starts; a running one stops after the
+    block of paths it is on, so its status may read 'running' for a moment.
+    """
+    try:
+        job = job_queue.job(job_id)
+    except IndexError:
+        return unknown_job(job_id)
+    if not job.cancel():
+        return jsonify({'error': f'Job {job_id} has already finished'}), 409
+    return jsonify(job_to_json(job, detail=False)), 202
+
+@app.route('/jobs/<int:job_id>', methods=['DELETE'])
+def remove_risk_job(job_id):
+    try:
+        if not job_queue.release(job_id):
+            return jsonify({'error': f'Job {job_id} has not finished; cancel it first'}), 409
+    except IndexError:
+        return unknown_job(job_id)
+    with job_requests_lock:
+        job_requests.pop(job_id, None)
+    return jsonify({'message': f'Job {job_id} removed'}), 200
+
 @app.route('/price_option', methods=['POST'])
 def price_option():
     """
@@ -516,6 +1321,7 @@ def price_option():
             'style': data.get('style', 'european'),
             'pricing_model': data.get('pricing_model', 'blackscholes'),
             'binomial_steps': data.get('binomial_steps', 100),
+            'lattice_scheme': data.get('lattice_scheme', 'crr'),
             'jump_parameters': data.get('jump_parameters', {}),
             'quantity': 1
         })
@@ -528,12 +1334,13 @@ def price_option():
             float(md_data.get('dividend', 0.0))
         )
         
+        greeks = option.compute_all(md)
         result = {
-            'price': option.price(md),
-            'delta': option.delta(md),
-            'gamma': option.gamma(md),
-            'vega': option.vega(md),
-            'theta': option.theta(md),
+            'price': greeks.price,
+            'delta': greeks.delta,
+            'gamma': greeks.gamma,
+            'vega': greeks.vega,
+            'theta': greeks.theta,
             'instrument_type': option.get_instrument_type(),
             'market_data_auto_fetched': auto_fetched,
             'market_data_used': md_data
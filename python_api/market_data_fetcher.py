@@ -279,6 +279,64 @@ class MarketDataFetcher:
         
         return successful, failed
     
+    def build_returns_store(self, path: str, tickers: List[str],
+                            period: str = '10y') -> Tuple[List[str], List]:
+        """
+        Write a returns file for historical VaR from daily closes
+        
+        Every ticker gets one log return per trading day of the combined
+        calendar. Days a ticker has no close are NaN, and its next return
+        spans the gap, so no move is lost.
+        
+        Args:
+            path: File to write (see ReturnsStore)
+            tickers: List of ticker symbols
+            period: YFinance history period
+            
+        Returns:
+            Tuple of (written_tickers_list, failed_tickers_list)
+        """
+        import math
+        import quant_risk_engine
+        
+        closes = {}
+        failed = []
+        for ticker in tickers:
+            ticker = ticker.upper().strip()
+            try:
+                hist = yf.Ticker(ticker).history(period=period)
+                if hist.empty or len(hist) < 2:
+                    raise ValueError("No price history available")
+                closes[ticker] = {int(day.strftime('%Y%m%d')): float(close)
+                                  for day, close in hist['Close'].items() if close > 0.0}
+            except Exception as e:
+                logger.warning(f"Failed to fetch history for {ticker}: {str(e)}")
+                failed.append({'ticker': ticker, 'error': str(e)})
+        
+        if not closes:
+            raise ValueError("No price history available for any ticker")
+        
+        dates = sorted(set(day for series in closes.values() for day in series))
+        assets = list(closes)
+        returns = []
+        for ticker in assets:
+            series = closes[ticker]
+            previous = None
+            row = []
+            for day in dates:
+                close = series.get(day)
+                if close is None or previous is None:
+                    row.append(math.nan)
+                else:
+                    row.append(math.log(close / previous))
+                if close is not None:
+                    previous = close
+            returns.append(row)
+        
+        quant_risk_engine.ReturnsStore.write(path, assets, dates, returns)
+        logger.info(f"Wrote {len(dates)} days of returns for {len(assets)} tickers to {path}")
+        return assets, failed
+    
     def _calculate_volatility(self, stock: yf.Ticker, 
                              window_days: int = 252) -> float:
         """
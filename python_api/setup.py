@@ -1,7 +1,7 @@
 from setuptools import setup, Extension
 import pybind11
 
-cpp_args = ['-std=c++17', '-Wall', '-pedantic']
+cpp_args = ['-std=c++17', '-Wall', '-pedantic', '-fno-math-errno', '-fno-trapping-math']
 
 ext_modules = [
     Extension(
@@ -10,12 +10,28 @@ ext_modules = [
             '../cpp_engine/apps/main.cpp',
             '../cpp_engine/libraries/python_interface/src/pybind_wrapper.cpp',
             '../cpp_engine/libraries/qe_risk_engine/src/Portfolio.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/AssetSymbolTable.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/PortfolioColumns.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/PortfolioRegistry.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/PricingCache.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/QuasiRandom.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/ReturnsStore.cpp',
             '../cpp_engine/libraries/qe_risk_engine/src/RiskEngine.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/RiskJobQueue.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/RunArena.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/RunControl.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/RunStats.cpp',
             '../cpp_engine/libraries/qe_risk_engine/src/BlackScholes.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/BlackScholesBatch.cpp',
             '../cpp_engine/libraries/qe_risk_engine/src/BinomialTree.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/CorrelationModel.cpp',
             '../cpp_engine/libraries/qe_risk_engine/src/JumpDiffusion.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/ImpliedVolatilityBatch.cpp',
             '../cpp_engine/libraries/qe_risk_engine/src/ImpliedVolatilitySurface.cpp',
             '../cpp_engine/libraries/qe_risk_engine/src/MarketData.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/Parallel.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/PnLSink.cpp',
+            '../cpp_engine/libraries/qe_risk_engine/src/TailStatistics.cpp',
             "../cpp_engine/libraries/qe_risk_engine/src/Instrument.cpp"
         ],
         include_dirs=[
@@ -27,6 +43,7 @@ ext_modules = [
             '../cpp_engine/libraries/qe_risk_engine/includes'
         ],
         language='c++',
+        define_macros=[('QE_RUN_STATS', None)],
         extra_compile_args=cpp_args,
     ),
 ]
@@ -39,6 +56,7 @@ setup(
     ext_modules=ext_modules,
     install_requires=[
         'pybind11>=2.6.0',
+        'numpy>=1.20',
     ],
     zip_safe=False,
 )
\ No newline at end of file